@@ -0,0 +1,270 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "aes.h"
+
+#include <prtypes.h>
+
+#include <cstring>
+#include <string>
+
+#include "securemem.h"
+
+static const unsigned char kSBOX[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+  0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+  0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+  0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+  0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+  0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+  0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+  0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+  0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+  0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+  0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+  0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+  0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+  0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+  0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+  0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+  0xb0, 0x54, 0xbb, 0x16,
+};
+
+static const unsigned char kINVERSE_SBOX[256] = {
+  0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e,
+  0x81, 0xf3, 0xd7, 0xfb, 0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87,
+  0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb, 0x54, 0x7b, 0x94, 0x32,
+  0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+  0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49,
+  0x6d, 0x8b, 0xd1, 0x25, 0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16,
+  0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92, 0x6c, 0x70, 0x48, 0x50,
+  0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+  0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05,
+  0xb8, 0xb3, 0x45, 0x06, 0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02,
+  0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b, 0x3a, 0x91, 0x11, 0x41,
+  0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+  0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8,
+  0x1c, 0x75, 0xdf, 0x6e, 0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89,
+  0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b, 0xfc, 0x56, 0x3e, 0x4b,
+  0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+  0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59,
+  0x27, 0x80, 0xec, 0x5f, 0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d,
+  0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef, 0xa0, 0xe0, 0x3b, 0x4d,
+  0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+  0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63,
+  0x55, 0x21, 0x0c, 0x7d,
+};
+
+static const unsigned char kROUND_CONSTANTS[10] = {
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36,
+};
+
+/* The initial value that RFC 3394 unwrapping has to end up with. */
+static const unsigned char kWRAP_IV[8] = {
+  0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6,
+};
+
+const size_t Aes::kBlockSize;
+
+/* Multiplication by x in GF(2^8). */
+static inline unsigned char Double(unsigned char a) {
+  return static_cast<unsigned char>((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+}
+
+static unsigned char Multiply(unsigned char a, unsigned char b) {
+  unsigned char product = 0;
+  while (b != 0) {
+    if (b & 1) {
+      product ^= a;
+    }
+    a = Double(a);
+    b >>= 1;
+  }
+  return product;
+}
+
+static inline PRUint32 SubWord(PRUint32 word) {
+  return (static_cast<PRUint32>(kSBOX[word >> 24]) << 24) |
+         (static_cast<PRUint32>(kSBOX[(word >> 16) & 0xff]) << 16) |
+         (static_cast<PRUint32>(kSBOX[(word >> 8) & 0xff]) << 8) |
+         static_cast<PRUint32>(kSBOX[word & 0xff]);
+}
+
+/* The state is kept by columns, as the block's bytes are. */
+static void AddRoundKey(const PRUint32 *round_key, unsigned char *state) {
+  for (int column = 0; column < 4; column++) {
+    state[column * 4] ^= static_cast<unsigned char>(round_key[column] >> 24);
+    state[column * 4 + 1] ^=
+        static_cast<unsigned char>(round_key[column] >> 16);
+    state[column * 4 + 2] ^=
+        static_cast<unsigned char>(round_key[column] >> 8);
+    state[column * 4 + 3] ^= static_cast<unsigned char>(round_key[column]);
+  }
+}
+
+/*
+ * SubBytes and ShiftRows in one, or their inverses: row r of column c comes
+ * from column c + r, or c - r.
+ */
+static void Substitute(const unsigned char *box, int direction,
+                       unsigned char *state) {
+  unsigned char in[16];
+  std::memcpy(in, state, sizeof in);
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      int from = (column + direction * row + 4) % 4;
+      state[column * 4 + row] = box[in[from * 4 + row]];
+    }
+  }
+  SecureZero(in, sizeof in);
+}
+
+static void MixColumns(unsigned char *state) {
+  for (int column = 0; column < 4; column++) {
+    unsigned char *c = state + column * 4;
+    unsigned char all = c[0] ^ c[1] ^ c[2] ^ c[3];
+    unsigned char first = c[0];
+    c[0] ^= all ^ Double(c[0] ^ c[1]);
+    c[1] ^= all ^ Double(c[1] ^ c[2]);
+    c[2] ^= all ^ Double(c[2] ^ c[3]);
+    c[3] ^= all ^ Double(c[3] ^ first);
+  }
+}
+
+static void InverseMixColumns(unsigned char *state) {
+  for (int column = 0; column < 4; column++) {
+    unsigned char *c = state + column * 4;
+    unsigned char a[4] = { c[0], c[1], c[2], c[3] };
+    for (int row = 0; row < 4; row++) {
+      c[row] = Multiply(a[row], 0x0e) ^ Multiply(a[(row + 1) % 4], 0x0b) ^
+               Multiply(a[(row + 2) % 4], 0x0d) ^
+               Multiply(a[(row + 3) % 4], 0x09);
+    }
+  }
+}
+
+Aes::Aes(const void *key, size_t size)
+    : rounds_(0) {
+  std::memset(round_keys_, 0, sizeof round_keys_);
+  if (size != 16 && size != 24 && size != 32) {
+    return;
+  }
+
+  const unsigned char *k = static_cast<const unsigned char *>(key);
+  int key_words = static_cast<int>(size / 4);
+  rounds_ = key_words + 6;
+  int i;
+  for (i = 0; i < key_words; i++) {
+    round_keys_[i] = (static_cast<PRUint32>(k[i * 4]) << 24) |
+                     (static_cast<PRUint32>(k[i * 4 + 1]) << 16) |
+                     (static_cast<PRUint32>(k[i * 4 + 2]) << 8) |
+                     static_cast<PRUint32>(k[i * 4 + 3]);
+  }
+  for (; i < 4 * (rounds_ + 1); i++) {
+    PRUint32 word = round_keys_[i - 1];
+    if (i % key_words == 0) {
+      word = SubWord((word << 8) | (word >> 24)) ^
+             (static_cast<PRUint32>(kROUND_CONSTANTS[i / key_words - 1])
+              << 24);
+    } else if (key_words > 6 && i % key_words == 4) {
+      word = SubWord(word);
+    }
+    round_keys_[i] = round_keys_[i - key_words] ^ word;
+  }
+}
+
+Aes::~Aes() {
+  SecureZero(round_keys_, sizeof round_keys_);
+}
+
+void Aes::EncryptBlock(const unsigned char *in, unsigned char *out) const {
+  unsigned char state[16];
+  std::memcpy(state, in, sizeof state);
+
+  AddRoundKey(round_keys_, state);
+  for (int round = 1; round < rounds_; round++) {
+    Substitute(kSBOX, 1, state);
+    MixColumns(state);
+    AddRoundKey(round_keys_ + round * 4, state);
+  }
+  Substitute(kSBOX, 1, state);
+  AddRoundKey(round_keys_ + rounds_ * 4, state);
+
+  std::memcpy(out, state, sizeof state);
+  SecureZero(state, sizeof state);
+}
+
+void Aes::DecryptBlock(const unsigned char *in, unsigned char *out) const {
+  unsigned char state[16];
+  std::memcpy(state, in, sizeof state);
+
+  AddRoundKey(round_keys_ + rounds_ * 4, state);
+  for (int round = rounds_ - 1; round > 0; round--) {
+    Substitute(kINVERSE_SBOX, -1, state);
+    AddRoundKey(round_keys_ + round * 4, state);
+    InverseMixColumns(state);
+  }
+  Substitute(kINVERSE_SBOX, -1, state);
+  AddRoundKey(round_keys_, state);
+
+  std::memcpy(out, state, sizeof state);
+  SecureZero(state, sizeof state);
+}
+
+bool Aes::Unwrap(const std::string &wrapped, SecureString *key) const {
+  if (!valid() || wrapped.size() < 24 || wrapped.size() % 8 != 0) {
+    return false;
+  }
+
+  size_t n = wrapped.size() / 8 - 1;
+  unsigned char block[16];
+  std::memcpy(block, wrapped.data(), 8);
+  key->assign(wrapped.data() + 8, wrapped.size() - 8);
+  for (int j = 5; j >= 0; j--) {
+    for (size_t i = n; i >= 1; i--) {
+      PRUint64 t = static_cast<PRUint64>(n) * j + i;
+      for (int b = 0; b < 8; b++) {
+        block[7 - b] ^= static_cast<unsigned char>(t >> (b * 8));
+      }
+      std::memcpy(block + 8, &(*key)[(i - 1) * 8], 8);
+      DecryptBlock(block, block);
+      std::memcpy(&(*key)[(i - 1) * 8], block + 8, 8);
+    }
+  }
+
+  bool ok = std::memcmp(block, kWRAP_IV, sizeof kWRAP_IV) == 0;
+  SecureZero(block, sizeof block);
+  if (!ok) {
+    SecureZero(&(*key)[0], key->size());
+    key->clear();
+  }
+  return ok;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifndef _GPGPLUGIN_AES_H_
+#define _GPGPLUGIN_AES_H_
+
+#include <prtypes.h>
+
+#include <cstddef>
+#include <string>
+
+#include "securemem.h"
+
+/*
+ * AES (FIPS 197), for the session keys of messages that the plugin decrypts
+ * itself (see openpgp.h). NSPR has no ciphers. This is a plain table-based
+ * implementation, which leaks through cache timing what a local attacker
+ * could use against a long-lived key; session keys only ever decrypt the one
+ * message they came with.
+ */
+class Aes {
+ public:
+  static const size_t kBlockSize = 16;
+
+  /* |size| has to be 16, 24 or 32, see valid(). */
+  Aes(const void *key, size_t size);
+  ~Aes();
+
+  bool valid() const { return rounds_ != 0; }
+
+  void EncryptBlock(const unsigned char *in, unsigned char *out) const;
+  void DecryptBlock(const unsigned char *in, unsigned char *out) const;
+
+  /*
+   * Unwrap |wrapped| with this key as the key encryption key (RFC 3394).
+   * Returns false if |wrapped| fails the integrity check.
+   */
+  bool Unwrap(const std::string &wrapped, SecureString *key) const;
+
+ private:
+  /* Round keys, four words per round and one more round's worth. */
+  PRUint32 round_keys_[60];
+  int rounds_;
+};
+
+#endif  // _GPGPLUGIN_AES_H_
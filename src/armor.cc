@@ -0,0 +1,373 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "armor.h"
+
+#include <prinit.h>
+#include <prtypes.h>
+
+#include <cstring>
+#include <string>
+
+static const PRUint32 kCRC24_INIT = 0xb704ce;
+static const PRUint32 kCRC24_POLY = 0x1864cfb;
+static const size_t kARMOR_COLUMNS = 64;
+static const char kRADIX64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char *kBEGIN_PREFIX = "-----BEGIN PGP ";
+static const char *kEND_PREFIX = "-----END PGP ";
+static const char *kDASHES = "-----";
+
+/*
+ * The CRC is computed four bytes at a time with a table for each of them,
+ * with the 24 bits of the CRC kept in the top of a 32-bit word so that the
+ * bytes line up with it. kCRC24_TABLES[0] alone is the byte-wise table.
+ */
+static PRUint32 kCRC24_TABLES[4][256];
+static PRCallOnceType crc24_once;
+
+static PRStatus PR_CALLBACK InitCrc24Tables() {
+  const PRUint32 poly = (kCRC24_POLY & 0xffffff) << 8;
+  for (PRUint32 i = 0; i < 256; i++) {
+    PRUint32 crc = i << 24;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ poly : crc << 1;
+    }
+    kCRC24_TABLES[0][i] = crc;
+  }
+  for (int t = 1; t < 4; t++) {
+    for (PRUint32 i = 0; i < 256; i++) {
+      PRUint32 prev = kCRC24_TABLES[t - 1][i];
+      kCRC24_TABLES[t][i] = (prev << 8) ^ kCRC24_TABLES[0][prev >> 24];
+    }
+  }
+  return PR_SUCCESS;
+}
+
+PRUint32 Crc24(const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  PRUint32 crc = kCRC24_INIT << 8;
+
+  PR_CallOnce(&crc24_once, InitCrc24Tables);
+  for (; size >= 4; size -= 4, p += 4) {
+    crc ^= static_cast<PRUint32>(p[0]) << 24 |
+        static_cast<PRUint32>(p[1]) << 16 |
+        static_cast<PRUint32>(p[2]) << 8 | p[3];
+    crc = kCRC24_TABLES[3][crc >> 24] ^
+        kCRC24_TABLES[2][(crc >> 16) & 0xff] ^
+        kCRC24_TABLES[1][(crc >> 8) & 0xff] ^
+        kCRC24_TABLES[0][crc & 0xff];
+  }
+  while (size-- > 0) {
+    crc = (crc << 8) ^ kCRC24_TABLES[0][(crc >> 24) ^ *p++];
+  }
+  return crc >> 8;
+}
+
+/* Encode |size| bytes at |data| to |out|, which is advanced past them. */
+static void Radix64(const unsigned char *data, size_t size, char **out) {
+  char *p = *out;
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    PRUint32 group = static_cast<PRUint32>(data[i]) << 16 |
+        static_cast<PRUint32>(data[i + 1]) << 8 | data[i + 2];
+    p[0] = kRADIX64[group >> 18];
+    p[1] = kRADIX64[(group >> 12) & 0x3f];
+    p[2] = kRADIX64[(group >> 6) & 0x3f];
+    p[3] = kRADIX64[group & 0x3f];
+    p += 4;
+  }
+  if (i < size) {
+    PRUint32 group = static_cast<PRUint32>(data[i]) << 16;
+    if (i + 1 < size) {
+      group |= static_cast<PRUint32>(data[i + 1]) << 8;
+    }
+    p[0] = kRADIX64[group >> 18];
+    p[1] = kRADIX64[(group >> 12) & 0x3f];
+    p[2] = i + 1 < size ? kRADIX64[(group >> 6) & 0x3f] : '=';
+    p[3] = '=';
+    p += 4;
+  }
+  *out = p;
+}
+
+/*
+ * The whole armor is sized up front and written in place, rather than being
+ * appended to a line at a time.
+ */
+std::string Armor(const std::string &type, const StringPiece &packets) {
+  const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(packets.data());
+  /* 48 bytes of input make one line of 64 characters. */
+  const size_t line = kARMOR_COLUMNS / 4 * 3;
+  size_t lines = (packets.size() + line - 1) / line;
+  size_t begin_size = strlen(kBEGIN_PREFIX) + type.size() + strlen(kDASHES);
+  size_t end_size = strlen(kEND_PREFIX) + type.size() + strlen(kDASHES);
+  size_t armored_size = begin_size + 2 +
+      (packets.size() + 2) / 3 * 4 + lines +
+      1 + 4 + 1 +
+      end_size + 1;
+
+  std::string armored(armored_size, '\0');
+  char *out = &armored[0];
+  char *start = out;
+
+  memcpy(out, kBEGIN_PREFIX, strlen(kBEGIN_PREFIX));
+  out += strlen(kBEGIN_PREFIX);
+  memcpy(out, type.data(), type.size());
+  out += type.size();
+  memcpy(out, kDASHES, strlen(kDASHES));
+  out += strlen(kDASHES);
+  *out++ = '\n';
+  *out++ = '\n';
+
+  for (size_t i = 0; i < packets.size(); i += line) {
+    size_t n = packets.size() - i < line ? packets.size() - i : line;
+    Radix64(data + i, n, &out);
+    *out++ = '\n';
+  }
+
+  PRUint32 crc = Crc24(packets.data(), packets.size());
+  unsigned char crc_bytes[3];
+  crc_bytes[0] = static_cast<unsigned char>(crc >> 16);
+  crc_bytes[1] = static_cast<unsigned char>(crc >> 8);
+  crc_bytes[2] = static_cast<unsigned char>(crc);
+  *out++ = '=';
+  Radix64(crc_bytes, sizeof crc_bytes, &out);
+  *out++ = '\n';
+
+  memcpy(out, kEND_PREFIX, strlen(kEND_PREFIX));
+  out += strlen(kEND_PREFIX);
+  memcpy(out, type.data(), type.size());
+  out += type.size();
+  memcpy(out, kDASHES, strlen(kDASHES));
+  out += strlen(kDASHES);
+  *out++ = '\n';
+
+  armored.resize(out - start);
+  return armored;
+}
+
+/*
+ * Values of radix-64 characters by character, with kSPACE for the white
+ * space that may be in the armor and kINVALID for anything else.
+ */
+static const unsigned char kSPACE = 0x40;
+static const unsigned char kINVALID = 0x80;
+static unsigned char kRADIX64_VALUES[256];
+static PRCallOnceType radix64_once;
+
+static PRStatus PR_CALLBACK InitRadix64Values() {
+  memset(kRADIX64_VALUES, kINVALID, sizeof kRADIX64_VALUES);
+  for (int i = 0; i < 64; i++) {
+    kRADIX64_VALUES[static_cast<unsigned char>(kRADIX64[i])] =
+        static_cast<unsigned char>(i);
+  }
+  kRADIX64_VALUES[static_cast<unsigned char>(' ')] = kSPACE;
+  kRADIX64_VALUES[static_cast<unsigned char>('\t')] = kSPACE;
+  kRADIX64_VALUES[static_cast<unsigned char>('\r')] = kSPACE;
+  kRADIX64_VALUES[static_cast<unsigned char>('\n')] = kSPACE;
+  return PR_SUCCESS;
+}
+
+/*
+ * Decode the radix-64 in [|p|, |end|) to |out|, skipping white space.
+ * Returns false if there's anything else in it, or if it doesn't end at a
+ * whole group of four characters (the last of which may be padded).
+ */
+static bool DecodeRadix64(const char *p, const char *end, std::string *out) {
+  const unsigned char *in = reinterpret_cast<const unsigned char *>(p);
+  const unsigned char *in_end = reinterpret_cast<const unsigned char *>(end);
+  size_t start = out->size();
+  out->resize(start + (end - p) / 4 * 3 + 3);
+  unsigned char *o = reinterpret_cast<unsigned char *>(&(*out)[start]);
+  unsigned char *o_start = o;
+  PRUint32 group = 0;
+  int count = 0;
+  int padding = 0;
+
+  while (in < in_end) {
+    /* Lines are made of whole groups, which are decoded in one go. */
+    if (count == 0 && in_end - in >= 4) {
+      unsigned char a = kRADIX64_VALUES[in[0]];
+      unsigned char b = kRADIX64_VALUES[in[1]];
+      unsigned char c = kRADIX64_VALUES[in[2]];
+      unsigned char d = kRADIX64_VALUES[in[3]];
+      if (((a | b | c | d) & (kSPACE | kINVALID)) == 0) {
+        PRUint32 g = static_cast<PRUint32>(a) << 18 |
+            static_cast<PRUint32>(b) << 12 |
+            static_cast<PRUint32>(c) << 6 | d;
+        o[0] = static_cast<unsigned char>(g >> 16);
+        o[1] = static_cast<unsigned char>(g >> 8);
+        o[2] = static_cast<unsigned char>(g);
+        o += 3;
+        in += 4;
+        continue;
+      }
+    }
+    unsigned char ch = *in++;
+    if (ch == '=') {
+      /* Padding may only end the last group. */
+      if (count < 2) {
+        return false;
+      }
+      padding++;
+      group <<= 6;
+      count++;
+    } else {
+      unsigned char value = kRADIX64_VALUES[ch];
+      if (value == kSPACE) {
+        continue;
+      }
+      if (value == kINVALID || padding > 0) {
+        return false;
+      }
+      group = group << 6 | value;
+      count++;
+    }
+    if (count == 4) {
+      o[0] = static_cast<unsigned char>(group >> 16);
+      o[1] = static_cast<unsigned char>(group >> 8);
+      o[2] = static_cast<unsigned char>(group);
+      o += 3 - padding;
+      group = 0;
+      count = 0;
+      if (padding > 0) {
+        break;
+      }
+    }
+  }
+  /* Only white space may follow the padding. */
+  for (; in < in_end; in++) {
+    if (kRADIX64_VALUES[*in] != kSPACE) {
+      return false;
+    }
+  }
+  if (count != 0) {
+    return false;
+  }
+  out->resize(start + (o - o_start));
+  return true;
+}
+
+/* The end of the line at |pos| in |text|, before any "\r\n" or "\n". */
+static size_t LineEnd(const std::string &text, size_t pos, size_t *next) {
+  size_t end = text.find('\n', pos);
+  if (end == std::string::npos) {
+    *next = end = text.size();
+  } else {
+    *next = end + 1;
+  }
+  while (end > pos && (text[end - 1] == '\r' || text[end - 1] == ' ' ||
+                       text[end - 1] == '\t')) {
+    end--;
+  }
+  return end;
+}
+
+bool Dearmor(const std::string &armored, const std::string &type,
+             std::string *packets) {
+  std::string begin = kBEGIN_PREFIX + type + kDASHES;
+  std::string end = kEND_PREFIX + type + kDASHES;
+
+  /* The header line starts a line of its own. */
+  size_t pos = 0;
+  while (true) {
+    pos = armored.find(begin, pos);
+    if (pos == std::string::npos) {
+      return false;
+    }
+    if (pos == 0 || armored[pos - 1] == '\n') {
+      break;
+    }
+    pos++;
+  }
+  size_t next;
+  if (LineEnd(armored, pos, &next) != pos + begin.size()) {
+    return false;
+  }
+
+  /* Armor headers ("Key: Value") go up to an empty line. */
+  pos = next;
+  while (pos < armored.size()) {
+    size_t line_end = LineEnd(armored, pos, &next);
+    if (line_end == pos) {
+      pos = next;
+      break;
+    }
+    if (armored.find(": ", pos) >= line_end) {
+      /* gpg takes a missing empty line, so do we. */
+      break;
+    }
+    pos = next;
+  }
+
+  /* Then the radix-64, up to the checksum or the tail line. */
+  size_t data_start = pos;
+  size_t data_end = std::string::npos;
+  size_t checksum = std::string::npos;
+  while (pos < armored.size()) {
+    size_t line_end = LineEnd(armored, pos, &next);
+    if (armored[pos] == '=' && checksum == std::string::npos &&
+        line_end - pos == 5) {
+      data_end = pos;
+      checksum = pos + 1;
+    } else if (armored.compare(pos, line_end - pos, end) == 0) {
+      if (data_end == std::string::npos) {
+        data_end = pos;
+      }
+      break;
+    } else if (checksum != std::string::npos) {
+      return false;
+    }
+    pos = next;
+  }
+  if (pos >= armored.size()) {
+    return false;
+  }
+
+  PR_CallOnce(&radix64_once, InitRadix64Values);
+  packets->clear();
+  if (!DecodeRadix64(armored.data() + data_start, armored.data() + data_end,
+                     packets)) {
+    return false;
+  }
+  if (checksum != std::string::npos) {
+    std::string crc_bytes;
+    if (!DecodeRadix64(armored.data() + checksum, armored.data() + checksum + 4,
+                       &crc_bytes) || crc_bytes.size() != 3) {
+      return false;
+    }
+    PRUint32 crc = static_cast<PRUint32>(
+        static_cast<unsigned char>(crc_bytes[0])) << 16 |
+        static_cast<PRUint32>(static_cast<unsigned char>(crc_bytes[1])) << 8 |
+        static_cast<unsigned char>(crc_bytes[2]);
+    if (crc != Crc24(packets->data(), packets->size())) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * OpenPGP ASCII armor (RFC 4880, section 6), for the packets the plugin
+ * builds itself and for gpg's binary output when the plugin armors it.
+ */
+
+#ifndef _GPGPLUGIN_ARMOR_H_
+#define _GPGPLUGIN_ARMOR_H_
+
+#include <prtypes.h>
+
+#include <cstddef>
+#include <string>
+
+#include "stringpiece.h"
+
+/*
+ * The CRC-24 of |size| bytes at |data|, as used by the armor checksum.
+ */
+PRUint32 Crc24(const void *data, size_t size);
+
+/*
+ * Armor |packets| between "-----BEGIN PGP <type>-----" and
+ * "-----END PGP <type>-----" lines, the way gpg does: no armor headers,
+ * 64 columns of radix-64 and the CRC-24 checksum line.
+ */
+std::string Armor(const std::string &type, const StringPiece &packets);
+
+/*
+ * Take the packets of the first "PGP <type>" armor block in |armored| (which
+ * may have text around it) to |packets|. Returns false if there's no such
+ * block, if it isn't valid radix-64, or if its checksum doesn't match (a
+ * missing checksum is allowed, as in RFC 4880).
+ */
+bool Dearmor(const std::string &armored, const std::string &type,
+             std::string *packets);
+
+#endif  // _GPGPLUGIN_ARMOR_H_
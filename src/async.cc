@@ -0,0 +1,222 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "async.h"
+
+#include <pratom.h>
+#include <prcvar.h>
+#include <prerror.h>
+#include <prinit.h>
+#include <prinrval.h>
+#include <prlock.h>
+#include <prthread.h>
+
+#include <deque>
+#include <vector>
+
+#include "logging.h"
+
+static const int kMAX_THREADS = 4;
+static const PRUint32 kIDLE_SECONDS = 60;
+
+GpgAsyncTask::GpgAsyncTask() {
+  link_.elem.prstk_elem_next = NULL;
+  link_.task = this;
+}
+
+GpgCompletionQueue::GpgCompletionQueue()
+    : stack_(PR_CreateStack("gpg completions")),
+      posted_(0),
+      refs_(1) {
+}
+
+GpgCompletionQueue::~GpgCompletionQueue() {
+  if (stack_ != NULL) {
+    PR_DestroyStack(stack_);
+  }
+}
+
+void GpgCompletionQueue::Ref() {
+  PR_AtomicIncrement(&refs_);
+}
+
+void GpgCompletionQueue::Unref() {
+  if (PR_AtomicDecrement(&refs_) == 0) {
+    delete this;
+  }
+}
+
+void GpgCompletionQueue::Push(GpgAsyncTask *task) {
+  PR_StackPush(stack_, &task->link_.elem);
+  if (PR_AtomicSet(&posted_, 1) == 0) {
+    Ref();
+    PostDrain();
+  }
+}
+
+void GpgCompletionQueue::DrainAndUnref(void *queue) {
+  GpgCompletionQueue *self = static_cast<GpgCompletionQueue *>(queue);
+  self->Drain();
+  self->Unref();
+}
+
+/*
+ * A task pushed once we've started asks for a drain of its own, even if we
+ * get to pop it as well, so we never have to wait on a push in progress.
+ * The drain it asked for then finds nothing to do.
+ */
+void GpgCompletionQueue::Drain() {
+  std::vector<GpgAsyncTask *> tasks;
+  PRStackElem *elem;
+
+  PR_AtomicSet(&posted_, 0);
+  while ((elem = PR_StackPop(stack_)) != NULL) {
+    tasks.push_back(reinterpret_cast<GpgAsyncTask::Link *>(elem)->task);
+  }
+  /* The stack hands them out newest first. */
+  for (std::vector<GpgAsyncTask *>::reverse_iterator it = tasks.rbegin();
+       it != tasks.rend(); ++it) {
+    (*it)->Complete();
+    delete *it;
+  }
+}
+
+static GpgWorkerPool *pool_instance = NULL;
+
+PRStatus GpgWorkerPool::CreateInstance() {
+  pool_instance = new GpgWorkerPool();
+  return PR_SUCCESS;
+}
+
+GpgWorkerPool *GpgWorkerPool::Instance() {
+  static PRCallOnceType once;
+  if (PR_CallOnce(&once, CreateInstance) == PR_FAILURE) {
+    return NULL;
+  }
+  return pool_instance;
+}
+
+GpgWorkerPool::GpgWorkerPool()
+    : lock_(PR_NewLock()),
+      work_available_(PR_NewCondVar(lock_)),
+      thread_exited_(PR_NewCondVar(lock_)),
+      threads_(0),
+      idle_threads_(0),
+      stopping_(false) {
+}
+
+bool GpgWorkerPool::Submit(GpgAsyncTask *task, GpgCompletionQueue *queue) {
+  Job job;
+  job.task = task;
+  job.queue = queue;
+  std::vector<PRThread *> exited;
+
+  PR_Lock(lock_);
+  exited.swap(exited_);
+  jobs_.push_back(job);
+  if (static_cast<size_t>(idle_threads_) < jobs_.size() &&
+      threads_ < kMAX_THREADS) {
+    PRThread *thread = PR_CreateThread(PR_SYSTEM_THREAD, Work, this,
+                                       PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD,
+                                       PR_JOINABLE_THREAD, 0);
+    if (thread != NULL) {
+      threads_++;
+    } else {
+      LOG("GPG: PR_CreateThread failed: %d\n", PR_GetError());
+      if (threads_ == 0) {
+        jobs_.pop_back();
+        PR_Unlock(lock_);
+        JoinExited(&exited);
+        return false;
+      }
+    }
+  }
+  queue->Ref();
+  PR_NotifyCondVar(work_available_);
+  PR_Unlock(lock_);
+  JoinExited(&exited);
+  return true;
+}
+
+void GpgWorkerPool::Shutdown() {
+  std::vector<PRThread *> exited;
+
+  PR_Lock(lock_);
+  stopping_ = true;
+  PR_NotifyAllCondVar(work_available_);
+  while (threads_ > 0) {
+    PR_WaitCondVar(thread_exited_, PR_INTERVAL_NO_TIMEOUT);
+  }
+  stopping_ = false;
+  exited.swap(exited_);
+  PR_Unlock(lock_);
+  JoinExited(&exited);
+}
+
+/* The threads have already left WorkLoop(), so this doesn't take long. */
+void GpgWorkerPool::JoinExited(std::vector<PRThread *> *exited) {
+  for (size_t i = 0; i < exited->size(); i++) {
+    PR_JoinThread((*exited)[i]);
+  }
+  exited->clear();
+}
+
+void GpgWorkerPool::Work(void *pool) {
+  static_cast<GpgWorkerPool *>(pool)->WorkLoop();
+}
+
+void GpgWorkerPool::WorkLoop() {
+  PRIntervalTime idle_timeout = PR_SecondsToInterval(kIDLE_SECONDS);
+
+  PR_Lock(lock_);
+  for (;;) {
+    PRIntervalTime idle_since = PR_IntervalNow();
+    while (jobs_.empty()) {
+      if (stopping_ ||
+          static_cast<PRIntervalTime>(PR_IntervalNow() - idle_since) >=
+          idle_timeout) {
+        threads_--;
+        exited_.push_back(PR_GetCurrentThread());
+        PR_NotifyAllCondVar(thread_exited_);
+        PR_Unlock(lock_);
+        return;
+      }
+      idle_threads_++;
+      PR_WaitCondVar(work_available_, idle_timeout);
+      idle_threads_--;
+    }
+
+    Job job = jobs_.front();
+    jobs_.pop_front();
+    PR_Unlock(lock_);
+
+    job.task->Run();
+    job.queue->Push(job.task);
+    job.queue->Unref();
+
+    PR_Lock(lock_);
+  }
+}
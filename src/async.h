@@ -0,0 +1,167 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Running plugin calls on worker threads, so that JavaScript doesn't have to
+ * wait on the browser's main thread while gpg runs.
+ *
+ * A GpgAsyncTask is submitted to the GpgWorkerPool together with the
+ * GpgCompletionQueue of the object it was started from. The task runs on a
+ * worker thread, is pushed onto the completion queue and then completes on
+ * the main thread, where the queue is drained in batches.
+ */
+
+#ifndef _GPGPLUGIN_ASYNC_H_
+#define _GPGPLUGIN_ASYNC_H_
+
+#include <pratom.h>
+#include <prtypes.h>
+
+#include <deque>
+#include <vector>
+
+class GpgCompletionQueue;
+struct PRCondVar;
+struct PRLock;
+struct PRThread;
+
+class GpgAsyncTask {
+ public:
+  GpgAsyncTask();
+  virtual ~GpgAsyncTask() {}
+
+  /* Do the work. Called on a worker thread. */
+  virtual void Run() = 0;
+
+  /*
+   * Deliver the result. Called on the main thread after Run(), and then the
+   * task is deleted.
+   */
+  virtual void Complete() = 0;
+
+ private:
+  friend class GpgCompletionQueue;
+
+  /* The completion queue is a PRStack, whose elements must come first. */
+  struct Link {
+    PRStackElem elem;
+    GpgAsyncTask *task;
+  };
+
+  Link link_;
+};
+
+/*
+ * Finished tasks are pushed by the worker threads onto a lock-free PRStack.
+ * The first push after a drain has started has the subclass schedule another
+ * drain on the main thread; later pushes ride along with that one.
+ *
+ * The queue is reference counted, so that it stays around until the last
+ * task submitted to it has completed even if its owner is gone.
+ */
+class GpgCompletionQueue {
+ public:
+  GpgCompletionQueue();
+
+  void Ref();
+  void Unref();
+
+  /* Called on a worker thread when |task| has run. */
+  void Push(GpgAsyncTask *task);
+
+  /*
+   * For PostDrain() to have called on the main thread, with the queue as the
+   * argument. Releases the reference taken for it.
+   */
+  static void DrainAndUnref(void *queue);
+
+ protected:
+  virtual ~GpgCompletionQueue();
+
+  /*
+   * Arrange for DrainAndUnref(this) to be called on the main thread. A
+   * reference has been taken for the call, so if it can't be arranged, the
+   * subclass must make the call itself later.
+   */
+  virtual void PostDrain() = 0;
+
+ private:
+  void Drain();
+
+  PRStack *stack_;
+  /* Whether a drain has been asked for that hasn't started yet. */
+  PRInt32 posted_;
+  PRInt32 refs_;
+};
+
+class GpgWorkerPool {
+ public:
+  /*
+   * Returns the pool shared by all plugin instances. Threads are started when
+   * there's work for them and exit again after being idle for a while.
+   */
+  static GpgWorkerPool *Instance();
+
+  /*
+   * Run |task| on a worker thread and then push it onto |queue|, which is
+   * referenced until then. Returns false if there's no thread to run it, in
+   * which case the caller still owns |task|.
+   */
+  bool Submit(GpgAsyncTask *task, GpgCompletionQueue *queue);
+
+  /*
+   * Have the threads finish the tasks submitted so far and wait for them to
+   * exit, idle ones included. Threads are started again by the next
+   * Submit().
+   */
+  void Shutdown();
+
+ private:
+  struct Job {
+    GpgAsyncTask *task;
+    GpgCompletionQueue *queue;
+  };
+
+  GpgWorkerPool();
+
+  static PRStatus CreateInstance();
+  static void PR_CALLBACK Work(void *pool);
+  void WorkLoop();
+  void JoinExited(std::vector<PRThread *> *exited);
+
+  /* Everything below is protected by lock_. */
+  PRLock *lock_;
+  PRCondVar *work_available_;
+  PRCondVar *thread_exited_;
+  std::deque<Job> jobs_;
+  int threads_;
+  int idle_threads_;
+  bool stopping_;
+  /* Threads that have left WorkLoop() but haven't been joined. */
+  std::vector<PRThread *> exited_;
+};
+
+#endif  // _GPGPLUGIN_ASYNC_H_
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+#include <pratom.h>
+#include <prcvar.h>
+#include <prinrval.h>
+#include <prlock.h>
+#include <prthread.h>
+
+#include <vector>
+
+#include "async.h"
+
+namespace {
+
+const int kTASKS = 50;
+
+/*
+ * Stands in for the browser: a drain that the queue asks for is done by the
+ * test, which plays the main thread.
+ */
+class TestQueue : public GpgCompletionQueue {
+ public:
+  explicit TestQueue(PRInt32 *destroyed)
+      : lock_(PR_NewLock()),
+        posted_(PR_NewCondVar(lock_)),
+        drains_(0),
+        destroyed_(destroyed) {
+  }
+
+  /* Wait for a drain to be asked for and do it. */
+  bool WaitAndDrain() {
+    PR_Lock(lock_);
+    PRIntervalTime timeout = PR_SecondsToInterval(10);
+    PRIntervalTime start = PR_IntervalNow();
+    while (drains_ == 0) {
+      if (static_cast<PRIntervalTime>(PR_IntervalNow() - start) > timeout) {
+        PR_Unlock(lock_);
+        return false;
+      }
+      PR_WaitCondVar(posted_, timeout);
+    }
+    drains_--;
+    PR_Unlock(lock_);
+    DrainAndUnref(this);
+    return true;
+  }
+
+  int drains() {
+    PR_Lock(lock_);
+    int drains = drains_;
+    PR_Unlock(lock_);
+    return drains;
+  }
+
+ protected:
+  ~TestQueue() {
+    PR_AtomicSet(destroyed_, 1);
+    PR_DestroyCondVar(posted_);
+    PR_DestroyLock(lock_);
+  }
+
+  void PostDrain() {
+    PR_Lock(lock_);
+    drains_++;
+    PR_NotifyCondVar(posted_);
+    PR_Unlock(lock_);
+  }
+
+ private:
+  PRLock *lock_;
+  PRCondVar *posted_;
+  int drains_;
+  PRInt32 *destroyed_;
+};
+
+/* Records which threads it ran and completed on. */
+class TestTask : public GpgAsyncTask {
+ public:
+  TestTask(int id, std::vector<int> *completed)
+      : id_(id),
+        ran_on_(NULL),
+        completed_(completed) {
+  }
+
+  void Run() {
+    ran_on_ = PR_GetCurrentThread();
+  }
+
+  void Complete() {
+    EXPECT_NE(PR_GetCurrentThread(), ran_on_);
+    completed_->push_back(id_);
+  }
+
+ private:
+  int id_;
+  PRThread *ran_on_;
+  std::vector<int> *completed_;
+};
+
+TEST(GpgCompletionQueueTest, DrainsInOrder) {
+  PRInt32 destroyed = 0;
+  TestQueue *queue = new TestQueue(&destroyed);
+  std::vector<int> completed;
+
+  for (int i = 0; i < 3; i++) {
+    queue->Push(new TestTask(i, &completed));
+  }
+  /* Only the first push asks for a drain. */
+  EXPECT_EQ(1, queue->drains());
+  ASSERT_TRUE(queue->WaitAndDrain());
+  EXPECT_EQ(3U, completed.size());
+  EXPECT_EQ(0, completed[0]);
+  EXPECT_EQ(1, completed[1]);
+  EXPECT_EQ(2, completed[2]);
+
+  /* And the first one after that asks again. */
+  queue->Push(new TestTask(3, &completed));
+  EXPECT_EQ(1, queue->drains());
+  ASSERT_TRUE(queue->WaitAndDrain());
+  EXPECT_EQ(4U, completed.size());
+
+  EXPECT_EQ(0, destroyed);
+  queue->Unref();
+  EXPECT_EQ(1, destroyed);
+}
+
+/* Pushes another task onto its queue as it completes. */
+class PushingTask : public GpgAsyncTask {
+ public:
+  PushingTask(GpgCompletionQueue *queue, GpgAsyncTask *next)
+      : queue_(queue),
+        next_(next) {
+  }
+
+  void Run() {
+  }
+
+  void Complete() {
+    queue_->Push(next_);
+  }
+
+ private:
+  GpgCompletionQueue *queue_;
+  GpgAsyncTask *next_;
+};
+
+TEST(GpgCompletionQueueTest, AsksAgainForPushDuringDrain) {
+  PRInt32 destroyed = 0;
+  TestQueue *queue = new TestQueue(&destroyed);
+  std::vector<int> completed;
+
+  queue->Push(new PushingTask(queue, new TestTask(0, &completed)));
+  ASSERT_TRUE(queue->WaitAndDrain());
+  EXPECT_EQ(0U, completed.size());
+  EXPECT_EQ(1, queue->drains());
+  ASSERT_TRUE(queue->WaitAndDrain());
+  EXPECT_EQ(1U, completed.size());
+
+  queue->Unref();
+  EXPECT_EQ(1, destroyed);
+}
+
+TEST(GpgWorkerPoolTest, CompletesOnDrainingThread) {
+  PRInt32 destroyed = 0;
+  TestQueue *queue = new TestQueue(&destroyed);
+  std::vector<int> completed;
+
+  GpgWorkerPool *pool = GpgWorkerPool::Instance();
+  ASSERT_TRUE(pool != NULL);
+  for (int i = 0; i < kTASKS; i++) {
+    ASSERT_TRUE(pool->Submit(new TestTask(i, &completed), queue));
+  }
+  /* The tasks keep the queue around. */
+  queue->Unref();
+
+  while (completed.size() < static_cast<size_t>(kTASKS)) {
+    ASSERT_TRUE(queue->WaitAndDrain());
+  }
+  for (int i = 0; i < 1000 && PR_AtomicAdd(&destroyed, 0) == 0; i++) {
+    PR_Sleep(PR_MillisecondsToInterval(10));
+  }
+  EXPECT_EQ(1, PR_AtomicAdd(&destroyed, 0));
+}
+
+TEST(GpgWorkerPoolTest, ShutdownRunsSubmittedTasks) {
+  PRInt32 destroyed = 0;
+  TestQueue *queue = new TestQueue(&destroyed);
+  std::vector<int> completed;
+
+  GpgWorkerPool *pool = GpgWorkerPool::Instance();
+  ASSERT_TRUE(pool != NULL);
+  for (int i = 0; i < kTASKS; i++) {
+    ASSERT_TRUE(pool->Submit(new TestTask(i, &completed), queue));
+  }
+  pool->Shutdown();
+  /* Every task has been pushed, so one drain completes them all. */
+  ASSERT_TRUE(queue->WaitAndDrain());
+  EXPECT_EQ(static_cast<size_t>(kTASKS), completed.size());
+  EXPECT_EQ(0, queue->drains());
+
+  /* And the pool can be used again. */
+  ASSERT_TRUE(pool->Submit(new TestTask(kTASKS, &completed), queue));
+  queue->Unref();
+  ASSERT_TRUE(queue->WaitAndDrain());
+  EXPECT_EQ(static_cast<size_t>(kTASKS + 1), completed.size());
+  pool->Shutdown();
+  EXPECT_EQ(1, destroyed);
+}
+
+}  /* namespace */
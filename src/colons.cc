@@ -0,0 +1,109 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "colons.h"
+
+#include <cstring>
+#include <string>
+
+#include "stringpiece.h"
+
+struct ColonTypeName {
+  const char *name;
+  GpgColonType type;
+};
+
+static const ColonTypeName kCOLON_TYPES[] = {
+  { "pub", kCOLON_PUB },
+  { "sub", kCOLON_SUB },
+  { "sec", kCOLON_SEC },
+  { "ssb", kCOLON_SSB },
+  { "uid", kCOLON_UID },
+  { "fpr", kCOLON_FPR },
+  { "grp", kCOLON_GRP },
+  { "sig", kCOLON_SIG },
+};
+
+static GpgColonType LookupColonType(const StringPiece &name) {
+  if (name.size() != 3) {
+    return kCOLON_OTHER;
+  }
+  for (size_t i = 0; i < sizeof(kCOLON_TYPES) / sizeof(kCOLON_TYPES[0]);
+       i++) {
+    if (memcmp(name.data(), kCOLON_TYPES[i].name, 3) == 0) {
+      return kCOLON_TYPES[i].type;
+    }
+  }
+  return kCOLON_OTHER;
+}
+
+void ParseColonRecord(const StringPiece &line, GpgColonRecord *record) {
+  const char *next = line.data();
+  const char *end = line.data() + line.size();
+  record->count = 0;
+  while (record->count < kCOLON_FIELDS - 1) {
+    const char *colon = static_cast<const char *>(
+        memchr(next, ':', end - next));
+    if (colon == NULL) {
+      break;
+    }
+    record->fields[record->count++] = StringPiece(next, colon - next);
+    next = colon + 1;
+  }
+  record->fields[record->count++] = StringPiece(next, end - next);
+  record->type = LookupColonType(record->fields[kCOLON_FIELD_TYPE]);
+}
+
+GpgColonScanner::GpgColonScanner() : scanned_(0) {
+}
+
+GpgColonScanner::~GpgColonScanner() {
+}
+
+void GpgColonScanner::Grew(const std::string &output) {
+  const char *end = output.data() + output.size();
+  const char *next = output.data() + scanned_;
+  const char *newline;
+  while ((newline = static_cast<const char *>(
+              memchr(next, '\n', end - next))) != NULL) {
+    GpgColonRecord record;
+    ParseColonRecord(StringPiece(next, newline - next), &record);
+    Take(record);
+    next = newline + 1;
+  }
+  scanned_ = next - output.data();
+}
+
+void GpgColonScanner::Finish(const std::string &output) {
+  Grew(output);
+  if (scanned_ < output.size()) {
+    GpgColonRecord record;
+    ParseColonRecord(StringPiece(output.data() + scanned_,
+                                 output.size() - scanned_), &record);
+    Take(record);
+    scanned_ = output.size();
+  }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Parsing the listings gpg writes with --with-colons in place: each line is a
+ * record whose fields are StringPieces into the listing, found with memchr()
+ * rather than split off into strings of their own. A GpgColonScanner takes
+ * the records as the listing is read from gpg.
+ */
+
+#ifndef _GPGPLUGIN_COLONS_H_
+#define _GPGPLUGIN_COLONS_H_
+
+#include <cstddef>
+#include <string>
+
+#include "outputwatcher.h"
+#include "stringpiece.h"
+
+/* The kinds of record, by their first field, and kCOLON_OTHER for others. */
+enum GpgColonType {
+  kCOLON_OTHER,
+  kCOLON_PUB,
+  kCOLON_SUB,
+  kCOLON_SEC,
+  kCOLON_SSB,
+  kCOLON_UID,
+  kCOLON_FPR,
+  kCOLON_GRP,
+  kCOLON_SIG
+};
+
+/* The fields that are used, numbered from 0 rather than doc/DETAILS' 1. */
+enum GpgColonField {
+  kCOLON_FIELD_TYPE = 0,
+  kCOLON_FIELD_VALIDITY = 1,
+  kCOLON_FIELD_ALGO = 3,
+  kCOLON_FIELD_KEYID = 4,
+  kCOLON_FIELD_CREATED = 5,
+  /* The user ID of uid records, the fingerprint of fpr, the keygrip of grp. */
+  kCOLON_FIELD_USER_ID = 9,
+  kCOLON_FIELD_CAPABILITIES = 11,
+  kCOLON_FIELD_CURVE = 16,
+  /* gpg 2.2 writes 21 fields, any more are left in the last one. */
+  kCOLON_FIELDS = 21
+};
+
+struct GpgColonRecord {
+  GpgColonType type;
+  StringPiece fields[kCOLON_FIELDS];
+  size_t count;
+
+  /* The field numbered |field|, or an empty one if the record is shorter. */
+  StringPiece Field(size_t field) const {
+    return field < count ? fields[field] : StringPiece();
+  }
+};
+
+/* Split |line|, without its newline, into |record|. */
+void ParseColonRecord(const StringPiece &line, GpgColonRecord *record);
+
+/*
+ * Takes the records of a listing, as a GpgOutputWatcher on the pipe it's read
+ * from (see BaseGnupg::CallReadAndWaitOnGpg()) or all at once. Lines that
+ * aren't records, such as gpg's status lines, come as kCOLON_OTHER.
+ */
+class GpgColonScanner : public GpgOutputWatcher {
+ public:
+  GpgColonScanner();
+  virtual ~GpgColonScanner();
+
+  /* Take each whole line of |output| that hasn't been taken yet. */
+  virtual void Grew(const std::string &output);
+
+  /* Take the rest of |output|, which is all of it, whole line or not. */
+  void Finish(const std::string &output);
+
+ protected:
+  virtual void Take(const GpgColonRecord &record) = 0;
+
+ private:
+  /* How much of the output has been taken, up to a whole line. */
+  size_t scanned_;
+};
+
+#endif  // _GPGPLUGIN_COLONS_H_
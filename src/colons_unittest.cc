@@ -0,0 +1,157 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "colons.h"
+#include "stringpiece.h"
+
+namespace {
+
+/* What gpg 2.2 lists for a key with --with-colons --fingerprint. */
+const char kLISTING[] =
+    "tru::1:1600000000:0:3:1:5\n"
+    "pub:u:3072:1:2C157CF124CB0839:1600000000:::u:::scESC::::::23::0:\n"
+    "fpr:::::::::0123456789ABCDEF0123456789ABCDEF01234567:\n"
+    "uid:u::::1600000000::ABCDEF::Some One <rsa@example.com>::::::::::0:\n"
+    "sub:u:3072:1:8E2A3B4C5D6E7F80:1600000000::::::e::::::23:\n"
+    "fpr:::::::::89ABCDEF0123456789ABCDEF0123456789ABCDEF:\n";
+
+/* Keeps the type and first fields of each record as strings. */
+class RecordingScanner : public GpgColonScanner {
+ public:
+  std::vector<GpgColonType> types;
+  std::vector<std::string> keyids;
+  std::vector<std::string> user_ids;
+
+ protected:
+  virtual void Take(const GpgColonRecord &record) {
+    types.push_back(record.type);
+    keyids.push_back(record.Field(kCOLON_FIELD_KEYID).as_string());
+    user_ids.push_back(record.Field(kCOLON_FIELD_USER_ID).as_string());
+  }
+};
+
+TEST(ParseColonRecordTest, SplitsFields) {
+  GpgColonRecord record;
+  ParseColonRecord(
+      "pub:u:3072:1:2C157CF124CB0839:1600000000:::u:::scESC::::::23::0:",
+      &record);
+  EXPECT_EQ(kCOLON_PUB, record.type);
+  EXPECT_EQ(21U, record.count);
+  EXPECT_EQ("u", record.Field(kCOLON_FIELD_VALIDITY).as_string());
+  EXPECT_EQ("1", record.Field(kCOLON_FIELD_ALGO).as_string());
+  EXPECT_EQ("2C157CF124CB0839",
+            record.Field(kCOLON_FIELD_KEYID).as_string());
+  EXPECT_EQ("scESC", record.Field(kCOLON_FIELD_CAPABILITIES).as_string());
+  EXPECT_EQ("", record.Field(20).as_string());
+}
+
+TEST(ParseColonRecordTest, ShortRecordsHaveEmptyFields) {
+  GpgColonRecord record;
+  ParseColonRecord("uid:u", &record);
+  EXPECT_EQ(kCOLON_UID, record.type);
+  EXPECT_EQ(2U, record.count);
+  EXPECT_TRUE(record.Field(kCOLON_FIELD_USER_ID).empty());
+}
+
+/* Fields past the last one gpg documents stay in the last one. */
+TEST(ParseColonRecordTest, KeepsExtraFieldsInLast) {
+  std::string line = "sig";
+  for (int i = 1; i < kCOLON_FIELDS + 2; i++) {
+    line += ":";
+  }
+  line += "end";
+  GpgColonRecord record;
+  ParseColonRecord(line, &record);
+  EXPECT_EQ(kCOLON_SIG, record.type);
+  EXPECT_EQ(static_cast<size_t>(kCOLON_FIELDS), record.count);
+  EXPECT_EQ("::end", record.Field(kCOLON_FIELDS - 1).as_string());
+}
+
+TEST(ParseColonRecordTest, OtherLinesAreOther) {
+  GpgColonRecord record;
+  ParseColonRecord("[GNUPG:] KEY_CONSIDERED 0123 0", &record);
+  EXPECT_EQ(kCOLON_OTHER, record.type);
+  ParseColonRecord("", &record);
+  EXPECT_EQ(kCOLON_OTHER, record.type);
+  EXPECT_EQ(1U, record.count);
+}
+
+TEST(GpgColonScannerTest, TakesEachRecord) {
+  RecordingScanner scanner;
+  scanner.Finish(kLISTING);
+  ASSERT_EQ(6U, scanner.types.size());
+  EXPECT_EQ(kCOLON_OTHER, scanner.types[0]);
+  EXPECT_EQ(kCOLON_PUB, scanner.types[1]);
+  EXPECT_EQ(kCOLON_FPR, scanner.types[2]);
+  EXPECT_EQ(kCOLON_UID, scanner.types[3]);
+  EXPECT_EQ(kCOLON_SUB, scanner.types[4]);
+  EXPECT_EQ(kCOLON_FPR, scanner.types[5]);
+  EXPECT_EQ("2C157CF124CB0839", scanner.keyids[1]);
+  EXPECT_EQ("Some One <rsa@example.com>", scanner.user_ids[3]);
+  EXPECT_EQ("8E2A3B4C5D6E7F80", scanner.keyids[4]);
+}
+
+/*
+ * Fed a byte at a time, the way it might come from a pipe, each record is
+ * taken once, as soon as its line is whole.
+ */
+TEST(GpgColonScannerTest, TakesWholeLinesAsTheyCome) {
+  RecordingScanner scanner;
+  std::string listing(kLISTING);
+  std::string output;
+  size_t taken_at_first_newline = 0;
+  for (size_t i = 0; i < listing.size(); i++) {
+    output += listing[i];
+    scanner.Grew(output);
+    if (listing[i] == '\n' && taken_at_first_newline == 0) {
+      taken_at_first_newline = scanner.types.size();
+    }
+  }
+  EXPECT_EQ(1U, taken_at_first_newline);
+  scanner.Finish(output);
+  ASSERT_EQ(6U, scanner.types.size());
+  EXPECT_EQ("Some One <rsa@example.com>", scanner.user_ids[3]);
+}
+
+/* Finish() takes a last line that has no newline. */
+TEST(GpgColonScannerTest, FinishTakesUnterminatedLine) {
+  RecordingScanner scanner;
+  std::string output = "pub:f:\nuid:f::::::::Someone";
+  scanner.Grew(output);
+  EXPECT_EQ(1U, scanner.types.size());
+  scanner.Finish(output);
+  ASSERT_EQ(2U, scanner.types.size());
+  EXPECT_EQ("Someone", scanner.user_ids[1]);
+  scanner.Finish(output);
+  EXPECT_EQ(2U, scanner.types.size());
+}
+
+}  /* namespace */
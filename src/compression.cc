@@ -0,0 +1,117 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "compression.h"
+
+#include <prtypes.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+/* Sampled texts are counted in this many blocks of equal size. */
+static const size_t kSAMPLE_BLOCKS = 16;
+
+/*
+ * Texts shorter than this are left to gpg: compressing them costs little,
+ * and there are too few bytes for the entropy to say much.
+ */
+static const size_t kMIN_CHOOSE_SIZE = 1024;
+
+/*
+ * Above kNONE_ENTROPY bits per byte zlib gains (next to) nothing, as with
+ * JPEG, PNG, ZIP or gpg's own output. From kFAST_ENTROPY up, as with base64
+ * of binary data, the fastest level gets most of what there is to get.
+ */
+static const double kNONE_ENTROPY = 7.5;
+static const double kFAST_ENTROPY = 5.5;
+
+/*
+ * Count the bytes at |data| in four histograms, one for each byte of every
+ * four, so that runs of equal bytes don't have each increment wait on the
+ * one before. |counts| is 4 x 256 and must be zeroed by the caller.
+ */
+static void CountBytes(const unsigned char *data, size_t size,
+                       PRUint32 counts[4][256]) {
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    counts[0][data[i]]++;
+    counts[1][data[i + 1]]++;
+    counts[2][data[i + 2]]++;
+    counts[3][data[i + 3]]++;
+  }
+  for (; i < size; i++) {
+    counts[0][data[i]]++;
+  }
+}
+
+double SampledEntropy(const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  PRUint32 counts[4][256];
+  memset(counts, 0, sizeof counts);
+
+  size_t counted;
+  if (size <= kENTROPY_SAMPLE) {
+    CountBytes(bytes, size, counts);
+    counted = size;
+  } else {
+    const size_t block = kENTROPY_SAMPLE / kSAMPLE_BLOCKS;
+    const size_t stride = (size - block) / (kSAMPLE_BLOCKS - 1);
+    for (size_t i = 0; i < kSAMPLE_BLOCKS; i++) {
+      CountBytes(bytes + i * stride, block, counts);
+    }
+    counted = block * kSAMPLE_BLOCKS;
+  }
+  if (counted == 0) {
+    return 0;
+  }
+
+  /* H = log2(n) - sum(c * log2(c)) / n, over the counts c of n bytes. */
+  double sum = 0;
+  for (int value = 0; value < 256; value++) {
+    PRUint32 count = counts[0][value] + counts[1][value] +
+        counts[2][value] + counts[3][value];
+    if (count > 1) {
+      sum += count * log(static_cast<double>(count));
+    }
+  }
+  double n = static_cast<double>(counted);
+  return (log(n) - sum / n) / log(2.0);
+}
+
+int ChooseCompressLevel(const void *data, size_t size) {
+  if (size < kMIN_CHOOSE_SIZE) {
+    return kCOMPRESS_DEFAULT;
+  }
+  double entropy = SampledEntropy(data, size);
+  if (entropy >= kNONE_ENTROPY) {
+    return kCOMPRESS_NONE;
+  }
+  if (entropy >= kFAST_ENTROPY) {
+    return kCOMPRESS_FAST;
+  }
+  return kCOMPRESS_DEFAULT;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Deciding how hard gpg should try to compress a text before encrypting it,
+ * from how random its bytes look. gpg compresses everything with zlib by
+ * default, which is wasted work on images, archives and other texts that are
+ * compressed already.
+ */
+
+#ifndef _GPGPLUGIN_COMPRESSION_H_
+#define _GPGPLUGIN_COMPRESSION_H_
+
+#include <cstddef>
+
+/* What ChooseCompressLevel() returns, besides zlib levels. */
+static const int kCOMPRESS_DEFAULT = -1;
+static const int kCOMPRESS_NONE = 0;
+static const int kCOMPRESS_FAST = 1;
+
+/*
+ * The Shannon entropy of the bytes of |size| bytes at |data|, in bits per
+ * byte (0 to 8). Large texts are sampled: only up to kENTROPY_SAMPLE bytes,
+ * taken from blocks spread evenly over the text, are counted.
+ */
+double SampledEntropy(const void *data, size_t size);
+static const size_t kENTROPY_SAMPLE = 64 * 1024;
+
+/*
+ * The zlib level to have gpg compress |size| bytes at |data| with:
+ * kCOMPRESS_NONE if they look compressed (or encrypted) already,
+ * kCOMPRESS_FAST if they would only shrink a little, and kCOMPRESS_DEFAULT,
+ * leaving it to gpg, for everything else and for texts too short to tell.
+ */
+int ChooseCompressLevel(const void *data, size_t size);
+
+#endif  // _GPGPLUGIN_COMPRESSION_H_
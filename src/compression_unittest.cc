@@ -0,0 +1,112 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "compression.h"
+
+namespace {
+
+/* Bytes that look random, from a linear congruential generator. */
+std::string RandomBytes(size_t size) {
+  std::string bytes(size, '\0');
+  unsigned int x = 1;
+  for (size_t i = 0; i < size; i++) {
+    x = x * 1103515245 + 12345;
+    bytes[i] = static_cast<char>(x >> 16);
+  }
+  return bytes;
+}
+
+std::string Base64Like(size_t size) {
+  static const char kALPHABET[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string random = RandomBytes(size);
+  for (size_t i = 0; i < size; i++) {
+    random[i] = kALPHABET[static_cast<unsigned char>(random[i]) % 64];
+  }
+  return random;
+}
+
+std::string Prose(size_t size) {
+  static const char kSENTENCE[] =
+      "The quick brown fox jumps over the lazy dog, and then it sleeps. ";
+  std::string text;
+  while (text.size() < size) {
+    text.append(kSENTENCE);
+  }
+  text.resize(size);
+  return text;
+}
+
+TEST(SampledEntropyTest, MeasuresBitsPerByte) {
+  EXPECT_DOUBLE_EQ(0, SampledEntropy("", 0));
+  EXPECT_DOUBLE_EQ(0, SampledEntropy("aaaaaaaa", 8));
+  EXPECT_DOUBLE_EQ(1, SampledEntropy("abababab", 8));
+
+  std::string all;
+  for (int i = 0; i < 4 * 256; i++) {
+    all.push_back(static_cast<char>(i));
+  }
+  EXPECT_DOUBLE_EQ(8, SampledEntropy(all.data(), all.size()));
+}
+
+/*
+ * Large texts are sampled from one end to the other, so that random bytes
+ * at the end of zeros are noticed.
+ */
+TEST(SampledEntropyTest, SamplesAllOfLargeTexts) {
+  std::string text(10 * kENTROPY_SAMPLE, '\0');
+  std::string tail = RandomBytes(kENTROPY_SAMPLE);
+  text.replace(text.size() - tail.size(), tail.size(), tail);
+  double entropy = SampledEntropy(text.data(), text.size());
+  EXPECT_GT(entropy, 1.0);
+  EXPECT_LT(entropy, 2.0);
+
+  std::string random = RandomBytes(10 * kENTROPY_SAMPLE);
+  EXPECT_GT(SampledEntropy(random.data(), random.size()), 7.9);
+}
+
+TEST(ChooseCompressLevelTest, SkipsWhatWontCompress) {
+  std::string random = RandomBytes(1024 * 1024);
+  EXPECT_EQ(kCOMPRESS_NONE, ChooseCompressLevel(random.data(), random.size()));
+
+  std::string base64 = Base64Like(100 * 1024);
+  EXPECT_EQ(kCOMPRESS_FAST, ChooseCompressLevel(base64.data(), base64.size()));
+
+  std::string prose = Prose(100 * 1024);
+  EXPECT_EQ(kCOMPRESS_DEFAULT, ChooseCompressLevel(prose.data(), prose.size()));
+}
+
+TEST(ChooseCompressLevelTest, LeavesShortTextsToGpg) {
+  std::string random = RandomBytes(100);
+  EXPECT_EQ(kCOMPRESS_DEFAULT,
+            ChooseCompressLevel(random.data(), random.size()));
+}
+
+}  /* namespace */
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * The NPAPI entry points of the plugin. These are those of the static glue's
+ * main.cc, except that the stream functions pass the data of the URLs that
+ * the plugin fetches on to their GpgUrlFetch (the notifyData of the stream).
+ * Other streams are left alone, as before.
+ */
+
+#include <npapi.h>
+
+#include "globals_glue.h"
+#include "gnupg.h"
+#include "npn_api.h"
+#include "urlfetch.h"
+#include "watchdog.h"
+
+#ifndef OS_WINDOWS
+#include "posix/launcher.h"
+#endif
+
+namespace glue {
+namespace globals {
+
+void SetLastError(NPP npp, const char *error) {
+}
+
+}
+}
+
+/* The fetch that |stream| is for, or NULL. */
+static GpgUrlFetch *FetchOf(NPStream *stream) {
+  return static_cast<GpgUrlFetch *>(stream->notifyData);
+}
+
+extern "C" {
+  NPError OSCALL NP_GetEntryPoints(NPPluginFuncs *pluginFuncs) {
+    pluginFuncs->version = 11;
+    pluginFuncs->size = sizeof(*pluginFuncs);
+    pluginFuncs->newp = NPP_New;
+    pluginFuncs->destroy = NPP_Destroy;
+    pluginFuncs->setwindow = NPP_SetWindow;
+    pluginFuncs->newstream = NPP_NewStream;
+    pluginFuncs->destroystream = NPP_DestroyStream;
+    pluginFuncs->asfile = NPP_StreamAsFile;
+    pluginFuncs->writeready = NPP_WriteReady;
+    pluginFuncs->write = NPP_Write;
+    pluginFuncs->print = NPP_Print;
+    pluginFuncs->event = NPP_HandleEvent;
+    pluginFuncs->urlnotify = NPP_URLNotify;
+    pluginFuncs->getvalue = NPP_GetValue;
+    pluginFuncs->setvalue = NPP_SetValue;
+
+    return NPERR_NO_ERROR;
+  }
+
+#if defined(OS_WINDOWS) || defined(OS_MACOSX)
+  NPError OSCALL NP_Initialize(NPNetscapeFuncs *browserFuncs) {
+    return InitializeNPNApi(browserFuncs);
+  }
+#else
+  NPError OSCALL NP_Initialize(NPNetscapeFuncs *browserFuncs,
+                               NPPluginFuncs *pluginFuncs) {
+    NPError retval = InitializeNPNApi(browserFuncs);
+    if (retval != NPERR_NO_ERROR) return retval;
+    NP_GetEntryPoints(pluginFuncs);
+    return NPERR_NO_ERROR;
+  }
+#endif
+
+  NPError OSCALL NP_Shutdown(void) {
+    /*
+     * No thread of ours may run on once the plugin is unloaded. The workers
+     * go first, as the watchdog may still have to interrupt the calls they
+     * run, which are all canceled by now.
+     */
+    Gnupg::ShutdownAsync();
+    GpgWatchdog *watchdog = GpgWatchdog::Instance();
+    if (watchdog != NULL) {
+      watchdog->Stop();
+    }
+#ifndef OS_WINDOWS
+    /* Don't leave gpg-launcher behind once the plugin is unloaded. */
+    GpgLauncher *launcher = GpgLauncher::Instance();
+    if (launcher != NULL) {
+      launcher->Stop();
+    }
+#endif
+    return NPERR_NO_ERROR;
+  }
+
+  NPError NPP_New(NPMIMEType pluginType, NPP instance, uint16_t mode,
+                  int16_t argc, char *argn[], char *argv[],
+                  NPSavedData *saved) {
+    glue::InitializeGlue(instance);
+    NPObject *object = glue::CreateStaticNPObject(instance);
+    instance->pdata = object;
+    return NPERR_NO_ERROR;
+  }
+
+  NPError NPP_Destroy(NPP instance, NPSavedData **save) {
+    NPObject *object = static_cast<NPObject*>(instance->pdata);
+    if (object) {
+      NPN_ReleaseObject(object);
+      instance->pdata = NULL;
+    }
+    Gnupg::InstanceDestroyed(instance);
+    return NPERR_NO_ERROR;
+  }
+
+  NPError NPP_GetValue(NPP instance, NPPVariable variable, void *value) {
+    switch (variable) {
+      case NPPVpluginScriptableNPObject: {
+        void **v = static_cast<void **>(value);
+        NPObject *obj = static_cast<NPObject *>(instance->pdata);
+        NPN_RetainObject(obj);
+        *v = obj;
+        break;
+      }
+      case NPPVpluginNeedsXEmbed:
+        *static_cast<NPBool *>(value) = true;
+        break;
+      default:
+        return NPERR_INVALID_PARAM;
+        break;
+    }
+    return NPERR_NO_ERROR;
+  }
+
+  NPError NPP_SetValue(NPP instance, NPNVariable variable, void *value) {
+    return NPERR_GENERIC_ERROR;
+  }
+
+  NPError NPP_SetWindow(NPP instance, NPWindow *window) {
+    return NPERR_NO_ERROR;
+  }
+
+  void NPP_StreamAsFile(NPP instance, NPStream *stream, const char *fname) {
+  }
+
+  int16_t NPP_HandleEvent(NPP instance, void *event) {
+    return 0;
+  }
+
+  /*
+   * Browsers older than NPVERS_HAS_RESPONSE_HEADERS don't have the headers
+   * in the stream.
+   */
+  NPError NPP_NewStream(NPP instance, NPMIMEType type, NPStream *stream,
+                        NPBool seekable, uint16_t *stype) {
+    GpgUrlFetch *fetch = FetchOf(stream);
+    if (fetch == NULL) {
+      return NPERR_NO_ERROR;
+    }
+    int plugin_major, plugin_minor, browser_major, browser_minor;
+    NPN_Version(&plugin_major, &plugin_minor, &browser_major, &browser_minor);
+    const char *headers = NULL;
+    if (browser_minor >= NPVERS_HAS_RESPONSE_HEADERS) {
+      headers = stream->headers;
+    }
+    if (!fetch->Begin(headers)) {
+      return NPERR_GENERIC_ERROR;
+    }
+    *stype = NP_NORMAL;
+    return NPERR_NO_ERROR;
+  }
+
+  NPError NPP_DestroyStream(NPP instance, NPStream *stream, NPReason reason) {
+    return NPERR_NO_ERROR;
+  }
+
+  int32_t NPP_WriteReady(NPP instance, NPStream *stream) {
+    GpgUrlFetch *fetch = FetchOf(stream);
+    return fetch == NULL ? 0 : fetch->WriteReady();
+  }
+
+  int32_t NPP_Write(NPP instance, NPStream *stream, int32_t offset, int32_t len,
+                    void *buffer) {
+    GpgUrlFetch *fetch = FetchOf(stream);
+    return fetch == NULL ? 0 : fetch->Write(buffer, len);
+  }
+
+  void NPP_Print(NPP instance, NPPrint *platformPrint) {
+  }
+
+  /* Called once for every URL fetched with NPN_GetURLNotify(). */
+  void NPP_URLNotify(NPP instance, const char *url, NPReason reason,
+                     void *notifyData) {
+    GpgUrlFetch *fetch = static_cast<GpgUrlFetch *>(notifyData);
+    if (fetch != NULL) {
+      fetch->Finish(reason == NPRES_DONE);
+      fetch->Release();
+    }
+  }
+}  // extern "C"
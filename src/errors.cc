@@ -0,0 +1,51 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "errors.h"
+
+const char *const kERR_INTERNAL = "Internal error";
+const char *const kERR_NO_SECRET_KEY = "Secret key not available";
+const char *const kERR_NO_PUBLIC_KEY = "Public key not available";
+const char *const kERR_UNKNOWN_GPG_ERR = "Unknown gpg error";
+const char *const kERR_BAD_SIGNATURE = "Bad signature";
+const char *const kERR_SIGNATURE_ERR = "Signature not found or unreadable";
+const char *const kERR_UNEXPECTED_GPG_OUTPUT = "Unexpected gpg output";
+const char *const kERR_ALREADY_HAVE_KEY = "Already have key";
+const char *const kERR_PUBLIC_KEY_NOT_TRUSTED = "Key not trusted";
+const char *const kERR_BAD_PUBLIC_KEY = "Key expired or revoked";
+const char *const kERR_ALREADY_SIGNED = "Key/Uid already signed";
+const char *const kERR_BAD_PASSPHRASE =
+    "Bad passphrase or couldn't talk to gpg-agent";
+const char *const kERR_UNTRUSTED_ORIGIN = "Not allowed from this origin";
+const char *const kERR_TIMEOUT = "Timed out waiting for gpg";
+const char *const kERR_CANCELED = "Canceled";
+const char *const kERR_NO_STREAM = "No such stream";
+const char *const kERR_NO_RESULT = "No such result";
+const char *const kERR_BAD_FILE = "Can't read the file, or no file given";
+const char *const kERR_BAD_OUTPUT = "The output path has to be absolute";
+const char *const kERR_OUTPUT_EXISTS = "The output file already exists";
+const char *const kERR_URL = "Couldn't fetch the URL";
+const char *const kERR_BAD_ARMOR = "Bad ASCII armor";
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * The error strings returned to JavaScript in GpgRetBase::error_str(). They are
+ * shared by every engine, so that the extension sees the same errors no matter
+ * how gpg is being run. See the EXCEPTION INFORMATION in gnupg.h for what each
+ * of them means.
+ */
+
+#ifndef _GPGPLUGIN_ERRORS_H_
+#define _GPGPLUGIN_ERRORS_H_
+
+extern const char *const kERR_INTERNAL;
+extern const char *const kERR_NO_SECRET_KEY;
+extern const char *const kERR_NO_PUBLIC_KEY;
+extern const char *const kERR_UNKNOWN_GPG_ERR;
+extern const char *const kERR_BAD_SIGNATURE;
+extern const char *const kERR_SIGNATURE_ERR;
+extern const char *const kERR_UNEXPECTED_GPG_OUTPUT;
+extern const char *const kERR_ALREADY_HAVE_KEY;
+extern const char *const kERR_PUBLIC_KEY_NOT_TRUSTED;
+extern const char *const kERR_BAD_PUBLIC_KEY;
+extern const char *const kERR_ALREADY_SIGNED;
+extern const char *const kERR_BAD_PASSPHRASE;
+extern const char *const kERR_UNTRUSTED_ORIGIN;
+extern const char *const kERR_TIMEOUT;
+extern const char *const kERR_CANCELED;
+extern const char *const kERR_NO_STREAM;
+extern const char *const kERR_NO_RESULT;
+extern const char *const kERR_BAD_FILE;
+extern const char *const kERR_BAD_OUTPUT;
+extern const char *const kERR_OUTPUT_EXISTS;
+extern const char *const kERR_URL;
+extern const char *const kERR_BAD_ARMOR;
+
+#endif  // _GPGPLUGIN_ERRORS_H_
@@ -48,30 +48,65 @@
 
 #include "gnupg.h"
 
+#include <ctype.h>
 #include <npapi.h>
 #include <npfunctions.h>
 #include <prerror.h>
+#include <prinit.h>
 #include <prio.h>
+#include <pratom.h>
+#include <prcvar.h>
+#include <prlock.h>
 #include <prproces.h>
+#include <prthread.h>
+#include <prtime.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <cstring>
-#include <fstream>
 #include <set>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "armor.h"
+#include "async.h"
+#include "colons.h"
+#include "compression.h"
+#include "errors.h"
+#include "gpgprocess.h"
+#include "gpgsession.h"
 #include "logging.h"
-#include "prstrms.h"
+#include "npn_api.h"
+#include "openpgp.h"
+#include "outputwatcher.h"
 #include "static_object.h"
+#include "status.h"
+#include "statusmachine.h"
+#include "statuswatch.h"
+#include "stringpiece.h"
 #include "tmpwrapper.h"
 #include "types.h"
+#include "urlfetch.h"
+#include "watchdog.h"
+
+#ifdef HAVE_GPGME
+#include "gpgme_engine.h"
+#endif
 
 #ifdef OS_WINDOWS
 #include "windows/createprocess.h"
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <private/pprio.h>
+
+#include "posix/agent.h"
+#include "posix/launcher.h"
+#include "posix/pump.h"
+#include "posix/spawn.h"
 #endif
 
 static const char *kTMP_SIGNED_TEXT = "gpgst";
@@ -86,119 +121,450 @@ static const char *kTMP_SIGNATURE = "gpgsg";
 #endif
 
 /*
- * Various GPG responses
- */
-static const char *kGPG_INV_RECP = "INV_RECP";
-/* BEING: Sub-reasons for kGPG_INV_RECP */
-static const char *kGPG_INV_NOT_TRUSTED = "10";
-/* It's supposed to be "1", but is often "0"... */
-static const char *kGPG_INV_NOT_FOUND1 = "0";
-static const char *kGPG_INV_NOT_FOUND2 = "1";
-/* END: Sub-reasons for kGPG_INV_RECP */
-static const char *kGPG_END_ENCRYPTION = "END_ENCRYPTION";
-static const char *kGPG_BADSIG = "BADSIG";
-static const char *kGPG_NODATA = "NODATA";
-static const char *kGPG_SIG_ID = "SIG_ID";
-static const char *kGPG_GOODSIG = "GOODSIG";
-static const char *kGPG_VALIDSIG = "VALIDSIG";
-static const char *kGPG_USERID_HINT = "USERID_HINT";
-static const char *kGPG_NEED_PASSPHRASE = "NEED_PASSPHRASE";
-static const char *kGPG_GOOD_PASSPHRASE = "GOOD_PASSPHRASE";
-static const char *kGPG_BAD_PASSPHRASE = "BAD_PASSPHRASE";
-static const char *kGPG_BEGIN_SIGNING = "BEGIN_SIGNING";
-static const char *kGPG_SIG_CREATED = "SIG_CREATED";
-static const char *kGPG_ENC_TO = "ENC_TO";
-static const char *kGPG_PLAINTEXT = "PLAINTEXT";
-static const char *kGPG_PLAINTEXT_LENGTH = "PLAINTEXT_LENGTH";
-static const char *kGPG_DECRYPTION_OKAY = "DECRYPTION_OKAY";
-static const char *kGPG_END_DECRYPTION = "END_DECRYPTION";
-static const char *kGPG_DECRYPTION_FAILED = "DECRYPTION_FAILED";
-static const char *kGPG_IMPORT_OK = "IMPORT_OK";
-static const char *kGPG_IMPORTED = "IMPORTED";
-static const char *kGPG_PROMPT = "GET_LINE";
-static const char *kGPG_ACK = "GOT_IT";
-static const char *kGPG_CONFIRM = "GET_BOOL";
-static const char *kGPG_ALREADY_SIGNED = "ALREADY_SIGNED";
-
-/*
- * Exceptions we raise
- */
-static const char *kERR_INTERNAL = "Internal error";
-static const char *kERR_NO_SECRET_KEY = "Secret key not available";
-static const char *kERR_NO_PUBLIC_KEY = "Public key not available";
-static const char *kERR_UNKNOWN_GPG_ERR = "Unknown gpg error";
-static const char *kERR_BAD_SIGNATURE = "Bad signature";
-static const char *kERR_SIGNATURE_ERR = "Signature not found or unreadable";
-static const char *kERR_UNEXPECTED_GPG_OUTPUT = "Unexpected gpg output";
-static const char *kERR_ALREADY_HAVE_KEY = "Already have key";
-static const char *kERR_PUBLIC_KEY_NOT_TRUSTED = "Key not trusted";
-static const char *kERR_BAD_PUBLIC_KEY = "Key expired or revoked";
-static const char *kERR_ALREADY_SIGNED = "Key/Uid already signed";
-static const char *kERR_BAD_PASSPHRASE =
-    "Bad passphrase or couldn't talk to gpg-agent";
+ * How much of gpg's output is read at a time, and how much room is left after
+ * the end of a file so that reading it doesn't have to grow the buffer.
+ */
+static const PRInt32 kREAD_BLOCK = 64 * 1024;
+
+/*
+ * Values for GpgPreferences::GpgSpawnStrategy
+ */
+static const char *kSPAWN_NSPR = "nspr";
+static const char *kSPAWN_LAUNCHER = "launcher";
+static const char *kSPAWN_POSIX_SPAWN = "posix_spawn";
+
+/*
+ * Values for GpgPreferences::GpgEngine
+ */
+static const char *kENGINE_GPGME = "gpgme";
+static const char *kENGINE_AGENT = "agent";
+
+/*
+ * Values for GpgPreferences::GpgReader
+ */
+static const char *kREADER_EXIT = "exit";
+
+/*
+ * Values for GpgPreferences::GpgDataPath
+ */
+static const char *kDATA_PATH_PIPES = "pipes";
+
+/*
+ * Values for GpgPreferences::GpgTempFiles
+ */
+static const char *kTEMP_FILES_MEMORY = "memory";
+
+/*
+ * Values for GpgPreferences::GpgArmor
+ */
+static const char *kARMOR_IN_PLUGIN = "plugin";
+
+/*
+ * Values for GpgPreferences::GpgCompression, besides the zlib levels
+ */
+static const char *kCOMPRESSION_AUTO = "auto";
+static const char *kCOMPRESSION_NONE = "none";
+
+/* The zlib levels as gpg arguments. */
+static const char *const kCOMPRESS_LEVELS[] = {
+  "0", "1", "2", "3", "4", "5", "6", "7", "8", "9"
+};
 
+const char *const BaseGnupg::kGPG_EXTRA_INPUT = "-&";
+
+static const char *kARMOR_SIGNATURE = "SIGNATURE";
+static const char *kARMOR_MESSAGE = "MESSAGE";
 
 /*
  * *** BEGIN HELPER FUNCTIONS ***
  */
 
+BaseGnupg::BaseGnupg()
+    : lock_(PR_NewLock()),
+      streams_idle_(PR_NewCondVar(lock_)),
+      agent_lock_(PR_NewLock()),
+      agent_(NULL) {
+}
+
+/*
+ * Copies have the preferences, counters and keys of |other|, but locks and an
+ * agent connection of their own.
+ */
+BaseGnupg::BaseGnupg(const BaseGnupg &other)
+    : preferences_(other.preferences_),
+      lock_(PR_NewLock()),
+      streams_idle_(PR_NewCondVar(lock_)),
+      agent_lock_(PR_NewLock()),
+      agent_(NULL) {
+  PR_Lock(other.lock_);
+  stats_ = other.stats_;
+  signing_keys_ = other.signing_keys_;
+  decryption_keys_ = other.decryption_keys_;
+  PR_Unlock(other.lock_);
+}
+
+BaseGnupg::~BaseGnupg() {
+  AbortStreams();
+#ifndef OS_WINDOWS
+  delete agent_;
+#endif
+  PR_DestroyLock(agent_lock_);
+  PR_DestroyCondVar(streams_idle_);
+  PR_DestroyLock(lock_);
+}
+
+BaseGnupg &BaseGnupg::operator=(const BaseGnupg &other) {
+  if (this == &other) {
+    return *this;
+  }
+  preferences_ = other.preferences_;
+
+  PR_Lock(other.lock_);
+  GpgStats stats = other.stats_;
+  std::map<std::string, openpgp::SigningKey> signing_keys =
+      other.signing_keys_;
+  std::map<std::string, openpgp::DecryptionKey> decryption_keys =
+      other.decryption_keys_;
+  PR_Unlock(other.lock_);
+
+  PR_Lock(lock_);
+  stats_ = stats;
+  signing_keys_.swap(signing_keys);
+  decryption_keys_.swap(decryption_keys);
+  PR_Unlock(lock_);
+  return *this;
+}
+
+void BaseGnupg::RecordSpawn(const std::string &strategy, PRInt64 elapsed,
+                            bool ok) {
+  PR_Lock(lock_);
+  stats_.RecordSpawn(strategy, elapsed, ok);
+  PR_Unlock(lock_);
+}
+
+void BaseGnupg::MergeStats(const GpgStats &stats) {
+  PR_Lock(lock_);
+  stats_.Merge(stats);
+  PR_Unlock(lock_);
+}
+
+void BaseGnupg::RecordInterruption(const std::string &target, bool canceled) {
+  PR_Lock(lock_);
+  stats_.RecordInterruption(target, canceled);
+  PR_Unlock(lock_);
+}
+
+void BaseGnupg::RecordFallback(const std::string &strategy,
+                               GpgStats::Fallback reason) {
+  PR_Lock(lock_);
+  stats_.RecordFallback(strategy, reason);
+  PR_Unlock(lock_);
+}
+
+PRIntervalTime BaseGnupg::Timeout() const {
+  int seconds = preferences_.IntPreference(GpgPreferences::GpgTimeout);
+  if (seconds == 0) {
+    return PR_INTERVAL_NO_TIMEOUT;
+  }
+  return PR_SecondsToInterval(seconds);
+}
+
+bool BaseGnupg::UseDataPipes() const {
+#ifdef OS_WINDOWS
+  return false;
+#else
+  return preferences_.StringPreference(GpgPreferences::GpgDataPath) ==
+      kDATA_PATH_PIPES;
+#endif
+}
+
+bool BaseGnupg::UseMemoryFiles() const {
+  return preferences_.StringPreference(GpgPreferences::GpgTempFiles) ==
+      kTEMP_FILES_MEMORY;
+}
+
+bool BaseGnupg::ArmorInPlugin() const {
+  return preferences_.StringPreference(GpgPreferences::GpgArmor) ==
+      kARMOR_IN_PLUGIN;
+}
+
+/*
+ * What gpg_fail_fast terminates gpg for. gpg writes nothing after these but
+ * the reasons for giving up. NO_SECKEY isn't one of them, as gpg writes it
+ * for each recipient that it has no key for, even when it has the key of
+ * another one.
+ */
+static GpgStatusSet FailFastStatuses() {
+  GpgStatusSet statuses;
+  statuses.set(kSTATUS_INV_RECP);
+  statuses.set(kSTATUS_DECRYPTION_FAILED);
+  statuses.set(kSTATUS_BADSIG);
+  return statuses;
+}
+
+static const GpgStatusSet kFAIL_FAST = FailFastStatuses();
+
+const GpgStatusSet *BaseGnupg::FailFast() const {
+  return preferences_.BoolPreference(GpgPreferences::GpgFailFast) ?
+      &kFAIL_FAST : NULL;
+}
+
+int BaseGnupg::CompressLevel(const std::string &compression,
+                             const std::string *rawtext) {
+  const std::string &choice = compression.empty() ?
+      preferences_.StringPreference(GpgPreferences::GpgCompression) :
+      compression;
+  if (choice == kCOMPRESSION_NONE) {
+    return kCOMPRESS_NONE;
+  }
+  if (choice.size() == 1 && choice[0] >= '0' && choice[0] <= '9') {
+    return choice[0] - '0';
+  }
+  if (choice != kCOMPRESSION_AUTO || rawtext == NULL) {
+    return kCOMPRESS_DEFAULT;
+  }
+
+  int level = ChooseCompressLevel(rawtext->data(), rawtext->size());
+  LOG("GPG: Compression level for %u bytes: %d\n",
+      static_cast<unsigned>(rawtext->size()), level);
+  PR_Lock(lock_);
+  stats_.RecordCompression(level == kCOMPRESS_NONE ? "none" :
+                           level == kCOMPRESS_FAST ? "fast" : "gpg",
+                           rawtext->size());
+  PR_Unlock(lock_);
+  return level;
+}
+
+/*
+ * Create the file that gpg writes its output to in |wrapper|, and add the
+ * arguments that name it to |args|. |filename| is set to its name.
+ */
+static bool CreateOutputFile(TmpWrapper *wrapper, std::string *filename,
+                             std::vector<const char *> *args) {
+  *filename = kTMP_RAW_TEXT;
+  if (!wrapper->CreateOutputFile(filename)) {
+    return false;
+  }
+  if (wrapper->IsInMemory()) {
+    args->push_back("--yes");
+  }
+  args->push_back("--output");
+  args->push_back(filename->c_str());
+  return true;
+}
+
+/*
+ * Whether WaitOnGpg() returned |ret| instead of an exit code that gpg's
+ * output can be judged by, so that the call fails with CallFailure(ret).
+ */
+static bool CallAbandoned(int ret) {
+  return ret == BaseGnupg::kGPG_TIMED_OUT ||
+      ret == BaseGnupg::kGPG_CANCELED ||
+      ret == BaseGnupg::kGPG_LOST;
+}
+
+/*
+ * The error for a failed CallReadAndWaitOnGpg() that set |retval| to |ret|.
+ */
+static const char *CallFailure(int ret) {
+  switch (ret) {
+    case BaseGnupg::kGPG_TIMED_OUT:
+      return kERR_TIMEOUT;
+    case BaseGnupg::kGPG_CANCELED:
+      return kERR_CANCELED;
+    default:
+      return kERR_INTERNAL;
+  }
+}
+
+/*
+ * The pipes to a gpg process, see Gnupg::StartGpg(). The command pipe and the
+ * status pipe are always there, the others only for data pipes.
+ */
+enum GpgPipe {
+  kPIPE_COMMAND,
+  kPIPE_STATUS,
+  kPIPE_INPUT,
+  kPIPE_OUTPUT,
+  kPIPE_EXTRA,
+  kPIPE_COUNT
+};
+
+/* Which end of each pipe gpg gets: 0 for those it reads, 1 for the others. */
+static const int kGPG_END[kPIPE_COUNT] = { 0, 1, 0, 1, 0 };
+
+/*
+ * Held by StartGpg() from creating the pipes for a gpg process until it has
+ * closed the ends that the process inherits, so that processes started by
+ * other threads in the meantime don't inherit them as well.
+ */
+static PRCallOnceType spawn_once;
+static PRLock *spawn_lock = NULL;
+
+static PRStatus InitSpawnLock() {
+  spawn_lock = PR_NewLock();
+  return spawn_lock == NULL ? PR_FAILURE : PR_SUCCESS;
+}
+
+#ifndef OS_WINDOWS
+/*
+ * Once PR_CreateProcess() has been used, NSPR reaps every child of the
+ * browser with waitpid(-1) on a thread of its own, so a gpg started by
+ * posix_spawn() could be reaped before it's waited on, and its pid reused by
+ * the time it's signaled. posix_spawn() isn't used from then on, and
+ * PR_CreateProcess() is only used when the spawn strategy fails to start gpg,
+ * and not while a gpg that posix_spawn() started is still to be waited on
+ * (see PosixSpawnChildren()); such a call fails instead. Should NSPR reap a
+ * gpg anyway, WaitOnGpg() fails since its exit code is lost. Falling back is
+ * counted in the stats. Protected by spawn_lock.
+ */
+static bool spawned_with_nspr = false;
+#endif
+
+#ifndef OS_WINDOWS
+/*
+ * NSPR makes both ends of its pipes non-blocking, which gpg doesn't expect of
+ * its own ends: it would fail to read its input or to write its output when
+ * it got ahead of us.
+ */
+static bool SetBlocking(PRFileDesc *pipe) {
+  int fd = PR_FileDesc2NativeHandle(pipe);
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+    LOG("GPG: fcntl failed: %s\n", std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+/*
+ * |prefix| followed by the number of |fd|, which a child process inherits
+ * under the same number.
+ */
+static std::string FdArgument(const char *prefix, PRFileDesc *fd) {
+  std::ostringstream argument;
+  argument << prefix << PR_FileDesc2NativeHandle(fd);
+  return argument.str();
+}
+#endif
+
+GpgSession *Gnupg::CallGpg(const std::vector<const char*> &args) {
+  return StartGpg(args, NULL, false);
+}
+
 /*
  * This is a function to handle the execution of gpg as well as setup the
  * pipes appropriately.
  *
- * It will set up two pipes so that command_pipe_[1] can be used to write to
- * the gpg process and status_pipe_[0] can be used to read from it.
+ * It will set up two pipes, which the GpgSession returned uses to write to the
+ * gpg process and to read from it.
  *
  * The passphrase must always be written to the command pipe first before gpg
  * will do anything. If no passphrase will be needed an newline may be written.
+ *
+ * If |data| isn't NULL, gpg gets two more pipes as its standard input and
+ * output, and one more if |extra| is true, which replaces each of |args|
+ * that's kGPG_EXTRA_INPUT. Their other ends are put in |data|. The command
+ * and status pipes are then passed under the numbers they have here.
+ *
+ * Depending on GpgPreferences::GpgSpawnStrategy, gpg is created by NSPR, by
+ * posix_spawn() or by gpg-launcher. If the chosen strategy fails or
+ * isn't available on this platform, we fall back to NSPR, unless
+ * posix_spawn() has been used before. How long each attempt took is recorded
+ * in |stats_|.
  */
-PRProcess *Gnupg::CallGpg(const std::vector<const char*> &args) {
+GpgSession *Gnupg::StartGpg(const std::vector<const char*> &args,
+                            DataPipes *data, bool extra) {
+  PRFileDesc *pipes[kPIPE_COUNT][2];
+  int npipes = 0;
+  int wanted;
+  PRFileDesc *in;
+  PRFileDesc *out;
+  std::vector<PRFileDesc *> inherit;
+  std::string command_fd = "0";
+  std::string status_fd = "1";
+  std::string extra_arg;
   PRProcessAttr *attr;
   PRFileDesc *null;
-  PRProcess *process;
+  GpgProcess *process = NULL;
+  PRProcess *nspr_process;
+  GpgSession *session;
+  GpgWatchdog *watchdog;
+  PRTime start;
   std::vector<const char*> command;
   char *const *argv;
   const char *gpg_path = preferences_.StringPreference(
       GpgPreferences::GpgBinaryPath).c_str();
+  const std::string &spawn_strategy = preferences_.StringPreference(
+      GpgPreferences::GpgSpawnStrategy);
+
+  LOG("GPG: In StartGpg\n");
+
+#ifdef OS_WINDOWS
+  if (data != NULL) {
+    LOG("GPG: Data pipes aren't supported on Windows\n");
+    return NULL;
+  }
+#endif
 
-  LOG("GPG: In CallGpg\n");
+  if (PR_CallOnce(&spawn_once, InitSpawnLock) == PR_FAILURE) {
+    return NULL;
+  }
+  PR_Lock(spawn_lock);
 
-  if (PR_CreatePipe(&command_pipe_[0], &command_pipe_[1]) == PR_FAILURE) {
-    LOG("GPG: PR_CreatePipe failed: %d\n", PR_GetError());
-    goto error_return;
+  if (data == NULL) {
+    wanted = kPIPE_STATUS + 1;
+  } else {
+    wanted = extra ? kPIPE_EXTRA + 1 : kPIPE_OUTPUT + 1;
   }
-  if (PR_CreatePipe(&status_pipe_[0], &status_pipe_[1]) == PR_FAILURE) {
-    LOG("GPG: PR_CreatePipe failed: %d\n", PR_GetError());
-    goto error_cleanup_from_command_pipe;
+  for (npipes = 0; npipes < wanted; npipes++) {
+    if (PR_CreatePipe(&pipes[npipes][0], &pipes[npipes][1]) == PR_FAILURE) {
+      LOG("GPG: PR_CreatePipe failed: %d\n", PR_GetError());
+      goto error_cleanup_from_pipes;
+    }
   }
 
   /*
-   * Set reading end of the command pipe and the writing end of the status pipe
-   * to be inheritable by a child process, and set the other ends to be not
-   * inheritable, so that the process that's created later inherits the file
-   * descriptors it needs (and no others).
+   * Set the ends of the pipes that gpg uses to be inheritable by a child
+   * process, and set the other ends to be not inheritable, so that the
+   * process that's created later inherits the file descriptors it needs (and
+   * no others).
    */
-  if (PR_SetFDInheritable(command_pipe_[0], PR_TRUE) == PR_FAILURE) {
-    LOG("GPG: PR_SetFDInheritable failed: %d\n", PR_GetError());
-    goto error_cleanup_from_status_pipe;
-  }
-  if (PR_SetFDInheritable(command_pipe_[1], PR_FALSE) == PR_FAILURE) {
-    LOG("GPG: PR_SetFDInheritable failed: %d\n", PR_GetError());
-    goto error_cleanup_from_status_pipe;
+  for (int i = 0; i < npipes; i++) {
+    if (PR_SetFDInheritable(pipes[i][kGPG_END[i]], PR_TRUE) == PR_FAILURE ||
+        PR_SetFDInheritable(pipes[i][1 - kGPG_END[i]], PR_FALSE) ==
+            PR_FAILURE) {
+      LOG("GPG: PR_SetFDInheritable failed: %d\n", PR_GetError());
+      goto error_cleanup_from_pipes;
+    }
   }
-  if (PR_SetFDInheritable(status_pipe_[0], PR_FALSE) == PR_FAILURE) {
-    LOG("GPG: PR_SetFDInheritable failed: %d\n", PR_GetError());
-    goto error_cleanup_from_status_pipe;
+
+  in = pipes[kPIPE_COMMAND][0];
+  out = pipes[kPIPE_STATUS][1];
+#ifndef OS_WINDOWS
+  for (int i = 0; i < npipes; i++) {
+    if (!SetBlocking(pipes[i][kGPG_END[i]])) {
+      goto error_cleanup_from_pipes;
+    }
   }
-  if (PR_SetFDInheritable(status_pipe_[1], PR_TRUE) == PR_FAILURE) {
-    LOG("GPG: PR_SetFDInheritable failed: %d\n", PR_GetError());
-    goto error_cleanup_from_status_pipe;
+  if (data != NULL) {
+    in = pipes[kPIPE_INPUT][0];
+    out = pipes[kPIPE_OUTPUT][1];
+    command_fd = FdArgument("", pipes[kPIPE_COMMAND][0]);
+    status_fd = FdArgument("", pipes[kPIPE_STATUS][1]);
+    inherit.push_back(pipes[kPIPE_COMMAND][0]);
+    inherit.push_back(pipes[kPIPE_STATUS][1]);
+    if (extra) {
+      extra_arg = FdArgument("-&", pipes[kPIPE_EXTRA][0]);
+      inherit.push_back(pipes[kPIPE_EXTRA][0]);
+    }
   }
+#endif
 
   attr = PR_NewProcessAttr();
   if (attr == NULL) {
     LOG("GPG: PR_NewProcessAttr failed: %d\n", PR_GetError());
-    goto error_cleanup_from_status_pipe;
+    goto error_cleanup_from_pipes;
   }
 
   if (PR_ProcessAttrSetCurrentDirectory(attr, "/") == PR_FAILURE) {
@@ -215,38 +581,85 @@ PRProcess *Gnupg::CallGpg(const std::vector<const char*> &args) {
     goto error_cleanup_from_attr;
   }
 
-  PR_ProcessAttrSetStdioRedirect(attr, PR_StandardInput, command_pipe_[0]);
-  PR_ProcessAttrSetStdioRedirect(attr, PR_StandardOutput, status_pipe_[1]);
+  PR_ProcessAttrSetStdioRedirect(attr, PR_StandardInput, in);
+  PR_ProcessAttrSetStdioRedirect(attr, PR_StandardOutput, out);
   PR_ProcessAttrSetStdioRedirect(attr, PR_StandardError, null);
 
   command.push_back(gpg_path);
   command.push_back("--use-agent");
   command.push_back("--command-fd");
-  command.push_back("0");
+  command.push_back(command_fd.c_str());
   command.push_back("--status-fd");
-  command.push_back("1");
+  command.push_back(status_fd.c_str());
   command.push_back("--quiet");
   command.push_back("--batch");
   command.push_back("--no-tty");
-  command.insert(command.end(), args.begin(), args.end());
+  for (size_t i = 0; i < args.size(); i++) {
+    if (extra && std::strcmp(args[i], kGPG_EXTRA_INPUT) == 0) {
+      command.push_back(extra_arg.c_str());
+    } else {
+      command.push_back(args[i]);
+    }
+  }
   command.push_back(NULL);
   argv = const_cast<char *const *>(&(command[0]));
 
-  LOG("GPG: PR_CreateProcess pgp\n");
+#ifndef OS_WINDOWS
+  if (spawn_strategy == kSPAWN_POSIX_SPAWN && spawned_with_nspr) {
+    LOG("GPG: NSPR reaps the children, not using posix_spawn\n");
+    RecordFallback(kSPAWN_POSIX_SPAWN, GpgStats::kFALLBACK_DISABLED);
+  } else if (spawn_strategy == kSPAWN_POSIX_SPAWN) {
+    LOG("GPG: posix_spawn pgp\n");
+    start = PR_Now();
+    process = CreateProcessPosixSpawn(gpg_path, argv, in, out, null);
+    RecordSpawn(kSPAWN_POSIX_SPAWN, PR_Now() - start, process != NULL);
+    if (process == NULL) {
+      LOG("GPG: posix_spawn failed, using NSPR from now on\n");
+      RecordFallback(kSPAWN_POSIX_SPAWN, GpgStats::kFALLBACK_FAILED);
+    }
+  } else if (spawn_strategy == kSPAWN_LAUNCHER) {
+    LOG("GPG: Launching pgp\n");
+    start = PR_Now();
+    GpgLauncher *launcher = GpgLauncher::Instance();
+    if (launcher != NULL) {
+      process = launcher->Launch(
+          preferences_.StringPreference(GpgPreferences::GpgLauncherPath),
+          gpg_path, argv, in, out, null, inherit);
+    }
+    RecordSpawn(kSPAWN_LAUNCHER, PR_Now() - start, process != NULL);
+    if (process == NULL) {
+      RecordFallback(kSPAWN_LAUNCHER, GpgStats::kFALLBACK_FAILED);
+    }
+  }
+#endif
+
+  if (process == NULL) {
+#ifndef OS_WINDOWS
+    if (!spawned_with_nspr && PosixSpawnChildren() > 0) {
+      LOG("GPG: posix_spawn's children still run, not using NSPR\n");
+      goto error_cleanup_from_null;
+    }
+    spawned_with_nspr = true;
+#endif
+    LOG("GPG: PR_CreateProcess pgp\n");
+    start = PR_Now();
 #ifdef OS_WINDOWS
-  /*
-   * Use a workaround until NSPR has been updated to allow execution of Windows
-   * Console Applications without opening an empty window.
-   *
-   * TODO(roubert): Delete this when NSPR has been updated.
-   */
-  process = CreateProcessNoWindow(gpg_path, argv, NULL, attr);
+    /*
+     * Use a workaround until NSPR has been updated to allow execution of
+     * Windows Console Applications without opening an empty window.
+     *
+     * TODO(roubert): Delete this when NSPR has been updated.
+     */
+    nspr_process = CreateProcessNoWindow(gpg_path, argv, NULL, attr);
 #else
-  process = PR_CreateProcess(gpg_path, argv, NULL, attr);
+    nspr_process = PR_CreateProcess(gpg_path, argv, NULL, attr);
 #endif
-  if (process == NULL) {
-    LOG("GPG: PR_CreateProcess failed: %d\n", PR_GetError());
-    goto error_cleanup_from_null;
+    RecordSpawn(kSPAWN_NSPR, PR_Now() - start, nspr_process != NULL);
+    if (nspr_process == NULL) {
+      LOG("GPG: PR_CreateProcess failed: %d\n", PR_GetError());
+      goto error_cleanup_from_null;
+    }
+    process = new NsprProcess(nspr_process);
   }
 
   PR_DestroyProcessAttr(attr);
@@ -254,29 +667,46 @@ PRProcess *Gnupg::CallGpg(const std::vector<const char*> &args) {
   /*
    * We close the file descriptors we don't need.
    */
-  if (PR_Close(command_pipe_[0]) == PR_FAILURE) {
-    LOG("GPG: PR_Close failed: %d\n", PR_GetError());
-  }
-  if (PR_Close(status_pipe_[1]) == PR_FAILURE) {
-    LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+  for (int i = 0; i < npipes; i++) {
+    if (PR_Close(pipes[i][kGPG_END[i]]) == PR_FAILURE) {
+      LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+    }
   }
   if (PR_Close(null) == PR_FAILURE) {
     LOG("GPG: PR_Close failed: %d\n", PR_GetError());
   }
+  PR_Unlock(spawn_lock);
+
+  if (data != NULL) {
+    data->input = pipes[kPIPE_INPUT][1];
+    data->output = pipes[kPIPE_OUTPUT][0];
+    data->extra = extra ? pipes[kPIPE_EXTRA][1] : NULL;
+  }
 
   /*
-   * Here we wrap the pipes in streams. This is so we can use C++
+   * The session wraps the pipes in streams. This is so we can use C++
    * functions to do string reading and parsing which is far less
    * error_return prone than doing it manually...
    *
    * In particular this is useful for the interactive cases where
    * we'd rather be calling std::getline() then reading one char
    * at a time looking for newlines, ourselves.
+   *
+   * It's watched until WaitOnGpg(), so that a gpg that hangs, or whose
+   * operation is canceled, is terminated and the reads come to an end. Its
+   * status is watched as well while the operation asks for it.
    */
-  outstream_ = new PRofstream(command_pipe_[1]);
-  instream_ = new PRifstream(status_pipe_[0]);
-
-  return process;
+  session = new GpgSession(process, pipes[kPIPE_COMMAND][1],
+                           pipes[kPIPE_STATUS][0]);
+  if (GpgStatusWatch::Current() != NULL) {
+    session->WatchStatus(new GpgStatusWatch(*GpgStatusWatch::Current(),
+                                            session));
+  }
+  watchdog = GpgWatchdog::Instance();
+  if (watchdog != NULL) {
+    watchdog->Watch(session, GpgWatchdog::CurrentOperation(), Timeout());
+  }
+  return session;
 
 error_cleanup_from_null:
   PR_Close(null);
@@ -284,155 +714,418 @@ error_cleanup_from_null:
 error_cleanup_from_attr:
   PR_DestroyProcessAttr(attr);
 
-error_cleanup_from_status_pipe:
-  PR_Close(status_pipe_[1]);
-  PR_Close(status_pipe_[0]);
-
-error_cleanup_from_command_pipe:
-  PR_Close(command_pipe_[1]);
-  PR_Close(command_pipe_[0]);
+error_cleanup_from_pipes:
+  for (int i = 0; i < npipes; i++) {
+    PR_Close(pipes[i][1]);
+    PR_Close(pipes[i][0]);
+  }
 
-error_return:
+  PR_Unlock(spawn_lock);
   return NULL;
 }
 
-/*
- * Reads the output stream of gpg and returns a string.
- *
- * |out| must point to a valid string object.
- */
-bool Gnupg::ReadAllGpgOutput(std::string *out) {
-  LOG("GPG: Reading pgp\n");
-  if (!out) {
-    LOG("GPG: out is NULL!\n");
-    return false;
-  }
-  std::string line;
-  while (std::getline(*instream_, line)) {
-    out->append(line + "\n");
-  }
-  if (instream_->bad()) {
-    LOG("GPG: Failed to read from gpg\n");
-    return false;
+int Gnupg::ExitFdToWatch(GpgSession *session) {
+  if (preferences_.StringPreference(GpgPreferences::GpgReader) !=
+      kREADER_EXIT) {
+    return -1;
   }
-  LOG("GPG: Read %u bytes\n", static_cast<unsigned int>(out->size()));
-  LOG("GPG: Read: \"%s\"\n", out->c_str());
-  return true;
+  return session->ExitFd();
 }
 
 /*
- * This is for functions that require interaction with gpg. After a
- * command, this function looks for the expected response. If multiple
- * responses are expect, it is suggested you call ExpectString() on each
- * one.
+ * Runs gpg with data pipes, see BaseGnupg::CallGpgWithData(). Everything is
+ * moved through the pipes at once, so that gpg can't get stuck writing its
+ * output while we're still writing its input.
  */
-bool BaseGnupg::ExpectString(const std::string &response) {
-  LOG("GPG: ExpectString\n");
+bool Gnupg::CallGpgWithData(const std::vector<const char*> &args,
+                            const std::string &input,
+                            const std::string *extra,
+                            int *retval, std::string *output,
+                            SecureString *data) {
+  LOG("GPG: In CallGpgWithData\n");
+  *retval = -1;
 
-  LOG("GPG:   looking for %s\n", response.c_str());
-  std::string line;
-  std::getline(*instream_, line);
-  if (instream_->fail()) {
-    LOG("GPG:   reading from stream failed\n");
+  if (!preferences_.BoolPreference(GpgPreferences::GpgPluginInitialized)) {
+    LOG("GPG: plugin not initialized\n");
     return false;
   }
-  std::vector<std::string> parsed_line;
-  if (!ParseGpgLine(line, &parsed_line)) {
-    LOG("GPG:   failed to parse line\n");
+
+#ifdef OS_WINDOWS
+  LOG("GPG: Data pipes aren't supported on Windows\n");
+  return false;
+#else
+  DataPipes pipes;
+  GpgSession *session = StartGpg(args, &pipes, extra != NULL);
+  if (session == NULL) {
+    LOG("GPG: Failed to execute\n");
     return false;
   }
-  LOG("GPG:   got %s\n", parsed_line[0].c_str());
-  if (parsed_line[0] == response) {
-    return true;
-  }
-  return false;
-}
 
-/*
- * Helper function for the ParseGpgOutput() function below.
- *
- * This parses GPG standardized-output lines that look like this:
- *
- *    [GNUPG:] <RESPONSE> <EXTRA_INFO>
- *
- * It does this by ignoring the "[GNUPG:] ", and returns a vector
- * of two strings. The first is <RESPONSE> and the second is <EXTRA_INFO>
- */
-bool BaseGnupg::ParseGpgLine(const std::string &line,
-                             std::vector<std::string> *output) {
-  LOG("GPG: Parsing line %s\n", line.c_str());
-
-  std::stringstream line_stream(line);
+  bool pumped;
+  {
+    GpgPipePump pump;
+    pump.AddInput(pipes.input, input);
+    if (extra != NULL) {
+      pump.AddInput(pipes.extra, *extra);
+    }
+    pump.AddOutput(session->StatusPipe(), output, session->StatusWatcher());
+    pump.AddOutput(pipes.output, data);
+    pump.SetExitFd(ExitFdToWatch(session));
+    pumped = pump.Run();
+  }
+  if (PR_Close(pipes.output) == PR_FAILURE) {
+    LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+  }
+  LOG("GPG: Read %u bytes of status and %u bytes of data\n",
+      static_cast<unsigned int>(output->size()),
+      static_cast<unsigned int>(data->size()));
 
-  std::string token;
-  /* drop "[GNUPG:]" */
-  if (!std::getline(line_stream, token, ' ')) {
-    LOG("GPG: Failed nuke lame token\n");
+  LOG("GPG: Waiting on gpg\n");
+  int ret = WaitOnGpg(session);
+  if (CallAbandoned(ret)) {
+    *retval = ret;
     return false;
   }
-  /* get the right token */
-  if (!std::getline(line_stream, token, ' ')) {
-    LOG("GPG: Failed grab good token\n");
+  if (!pumped) {
+    LOG("GPG: Failed to talk to gpg\n");
     return false;
   }
-
-  LOG("GPG: resp: \"%s\"\n", token.c_str());
-  std::string rest;
-  /*
-   * Get the rest of the line - note we don't error check
-   * because there may be nothing left, and that's OK.
-   */
-  std::getline(line_stream, rest);
-  LOG("GPG: rest: \"%s\"\n", rest.c_str());
-
-  output->push_back(token);
-  output->push_back(rest);
-
+  *retval = ret;
   return true;
+#endif
 }
 
+#ifndef OS_WINDOWS
 /*
- * A function to parse GPG output. Lines are parsed by the above ParseGpgLine()
- * function, and this returns a vector of vectors. Each outer vector is a line
- * and each inner vector is the output of the above parsing function on that
- * line.
+ * The GpgInputStream of Gnupg::OpenGpgWithData(). A thread of its own reads
+ * what gpg writes while its input is being written, so that gpg can't get
+ * stuck writing its output. It also writes the extra input, if any.
  */
-bool BaseGnupg::ParseGpgOutput(const std::string &input,
-                               std::vector< std::vector<std::string> > *lines) {
-  LOG("GPG: ParseGpgOutput\n");
-  std::istringstream gpgout(input);
-  std::string line;
+class GpgDataStream : public GpgInputStream {
+ public:
+  /*
+   * Takes ownership of |session| and of the pipes. |extra| is NULL if there's
+   * no extra input. Reading stops once |exit_fd| is readable, unless it's -1
+   * (see GpgPipePump::SetExitFd()).
+   */
+  GpgDataStream(Gnupg *gnupg, GpgSession *session, PRFileDesc *input,
+                PRFileDesc *output, PRFileDesc *extra,
+                const std::string &extra_text, int exit_fd)
+      : gnupg_(gnupg),
+        session_(session),
+        input_(input),
+        output_(output),
+        extra_(extra),
+        extra_text_(extra_text),
+        exit_fd_(exit_fd),
+        reader_(NULL),
+        read_(false) {
+  }
 
-  while (getline(gpgout, line)) {
-    LOG("GPG: Got line \"%s\"\n", line.c_str());
-    std::vector<std::string> lineparts;
-    if (!ParseGpgLine(line, &lineparts)) {
-      LOG("GPG: Failing parse, line parse failed on %s\n", line.c_str());
+  ~GpgDataStream() {
+    if (session_ != NULL) {
+      session_->Kill();
+      int retval;
+      std::string output;
+      SecureString data;
+      Close(&retval, &output, &data);
+    }
+  }
+
+  bool Start() {
+    reader_ = PR_CreateThread(PR_USER_THREAD, Read, this, PR_PRIORITY_NORMAL,
+                              PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+    if (reader_ == NULL) {
+      LOG("GPG: PR_CreateThread failed: %d\n", PR_GetError());
+      if (extra_ != NULL && PR_Close(extra_) == PR_FAILURE) {
+        LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+      }
+      extra_ = NULL;
       return false;
     }
-    lines->push_back(lineparts);
+    return true;
   }
-  return true;
-}
 
-/*
- * A wrapper on wait to do the logging and return the status.
- */
-int Gnupg::WaitOnGpg(PRProcess *process) {
-  delete instream_;
-  delete outstream_;
-  instream_ = NULL;
-  outstream_ = NULL;
+  bool Write(const std::string &chunk) {
+    if (input_ == NULL) {
+      return false;
+    }
+    size_t written = 0;
+    while (written < chunk.size()) {
+      size_t left = chunk.size() - written;
+      if (left > static_cast<size_t>(kREAD_BLOCK)) {
+        left = kREAD_BLOCK;
+      }
+      PRInt32 count = PR_Write(input_, chunk.data() + written, left);
+      if (count <= 0) {
+        LOG("GPG: Failed to write to gpg: %d\n", PR_GetError());
+        return false;
+      }
+      written += count;
+    }
+    return true;
+  }
 
-  LOG("GPG: Waiting on pgp...");
-  PRInt32 ret;
-  if (PR_WaitProcess(process, &ret) == PR_FAILURE) {
-    LOG("GPG: Failed to PR_WaitProcess: %d\n", PR_GetError());
-    return -1;
+  bool Close(int *retval, std::string *output, SecureString *data) {
+    *retval = -1;
+    if (session_ == NULL) {
+      return false;
+    }
+    if (input_ != NULL && PR_Close(input_) == PR_FAILURE) {
+      LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+    }
+    input_ = NULL;
+    if (reader_ != NULL) {
+      PR_JoinThread(reader_);
+    }
+    if (PR_Close(output_) == PR_FAILURE) {
+      LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+    }
+    output->swap(output_text_);
+    data->swap(data_);
+    LOG("GPG: Read %u bytes of status and %u bytes of data\n",
+        static_cast<unsigned int>(output->size()),
+        static_cast<unsigned int>(data->size()));
+
+    int ret = gnupg_->WaitOnGpg(session_);
+    session_ = NULL;
+    if (CallAbandoned(ret)) {
+      *retval = ret;
+      return false;
+    }
+    if (!read_) {
+      LOG("GPG: Failed to read from gpg\n");
+      return false;
+    }
+    *retval = ret;
+    return true;
   }
-  LOG(" done\n");
-  return ret;
-}
+
+ private:
+  static void PR_CALLBACK Read(void *arg) {
+    GpgDataStream *stream = static_cast<GpgDataStream *>(arg);
+    GpgPipePump pump;
+    if (stream->extra_ != NULL) {
+      pump.AddInput(stream->extra_, stream->extra_text_);
+    }
+    pump.AddOutput(stream->session_->StatusPipe(), &stream->output_text_,
+                   stream->session_->StatusWatcher());
+    pump.AddOutput(stream->output_, &stream->data_);
+    pump.SetExitFd(stream->exit_fd_);
+    stream->read_ = pump.Run();
+  }
+
+  Gnupg *gnupg_;
+  GpgSession *session_;
+  PRFileDesc *input_;
+  PRFileDesc *output_;
+  /* Closed by the reader thread once it's written. */
+  PRFileDesc *extra_;
+  const std::string extra_text_;
+  int exit_fd_;
+  PRThread *reader_;
+  /* Written by the reader thread until it's joined. */
+  std::string output_text_;
+  SecureString data_;
+  bool read_;
+
+  GpgDataStream(const GpgDataStream &);
+  GpgDataStream &operator=(const GpgDataStream &);
+};
+#endif
+
+GpgInputStream *Gnupg::OpenGpgWithData(const std::vector<const char*> &args,
+                                       const std::string *extra) {
+  LOG("GPG: In OpenGpgWithData\n");
+
+  if (!preferences_.BoolPreference(GpgPreferences::GpgPluginInitialized)) {
+    LOG("GPG: plugin not initialized\n");
+    return NULL;
+  }
+
+#ifdef OS_WINDOWS
+  LOG("GPG: Data pipes aren't supported on Windows\n");
+  return NULL;
+#else
+  DataPipes pipes;
+  GpgSession *session = StartGpg(args, &pipes, extra != NULL);
+  if (session == NULL) {
+    LOG("GPG: Failed to execute\n");
+    return NULL;
+  }
+
+  GpgDataStream *stream = new GpgDataStream(
+      this, session, pipes.input, pipes.output,
+      extra != NULL ? pipes.extra : NULL,
+      extra != NULL ? *extra : std::string(), ExitFdToWatch(session));
+  if (!stream->Start()) {
+    delete stream;
+    return NULL;
+  }
+  return stream;
+#endif
+}
+
+/*
+ * Reads the output stream of gpg and returns a string.
+ *
+ * |out| must point to a valid string object. |watcher|, or the session's
+ * status watcher if it's NULL, is told about the output as it's read.
+ */
+bool Gnupg::ReadAllGpgOutput(GpgSession *session, std::string *out,
+                             GpgOutputWatcher *watcher) {
+  LOG("GPG: Reading pgp\n");
+  if (!out) {
+    LOG("GPG: out is NULL!\n");
+    return false;
+  }
+  if (watcher == NULL) {
+    watcher = session->StatusWatcher();
+  }
+#ifndef OS_WINDOWS
+  PRFileDesc *pipe = session->StatusPipe();
+  if (preferences_.StringPreference(GpgPreferences::GpgReader) ==
+      kREADER_EXIT && pipe != NULL) {
+    GpgPipePump pump;
+    pump.AddOutput(pipe, out, watcher);
+    pump.SetExitFd(session->ExitFd());
+    if (!pump.Run()) {
+      LOG("GPG: Failed to read from gpg\n");
+      return false;
+    }
+    LOG("GPG: Read %u bytes\n", static_cast<unsigned int>(out->size()));
+    return true;
+  }
+#endif
+  std::istream &in = session->in();
+  std::vector<char> buffer(kREAD_BLOCK);
+  if (watcher != NULL) {
+    /* A watched gpg's output is passed on as it comes, not a block at once. */
+    char first;
+    while (in.get(first)) {
+      out->push_back(first);
+      std::streamsize n;
+      while ((n = in.readsome(&buffer[0], buffer.size())) > 0) {
+        out->append(&buffer[0], n);
+      }
+      watcher->Grew(*out);
+    }
+  } else {
+    while (in.read(&buffer[0], buffer.size()) || in.gcount() > 0) {
+      out->append(&buffer[0], in.gcount());
+    }
+  }
+  if (in.bad()) {
+    LOG("GPG: Failed to read from gpg\n");
+    return false;
+  }
+  LOG("GPG: Read %u bytes\n", static_cast<unsigned int>(out->size()));
+  LOG("GPG: Read: \"%s\"\n", out->c_str());
+  return true;
+}
+
+/*
+ * This is for functions that require interaction with gpg. After a
+ * command, this function looks for the expected response. If multiple
+ * responses are expect, it is suggested you call ExpectString() on each
+ * one.
+ */
+bool BaseGnupg::ExpectString(GpgSession *session, GpgStatus response) {
+  LOG("GPG: ExpectString\n");
+
+  LOG("GPG:   looking for %s\n", StatusName(response));
+  std::string line;
+  std::getline(session->in(), line);
+  if (session->in().fail()) {
+    LOG("GPG:   reading from stream failed\n");
+    return false;
+  }
+  GpgStatusLine parsed_line;
+  if (!ParseGpgLine(line, &parsed_line)) {
+    LOG("GPG:   failed to parse line\n");
+    return false;
+  }
+  LOG("GPG:   got %.*s\n", static_cast<int>(parsed_line.keyword.size()),
+      parsed_line.keyword.data());
+  if (parsed_line.status == response) {
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Parse a GPG standardized-output line that looks like this:
+ *
+ *    [GNUPG:] <RESPONSE> <EXTRA_INFO>
+ *
+ * into |output|, whose keyword is <RESPONSE> and whose args are <EXTRA_INFO>.
+ * Both point into |line|, see ParseStatusLine().
+ */
+bool BaseGnupg::ParseGpgLine(const std::string &line, GpgStatusLine *output) {
+  if (!ParseStatusLine(line, output)) {
+    LOG("GPG: Failed to parse line %s\n", line.c_str());
+    return false;
+  }
+  return true;
+}
+
+/*
+ * A function to parse GPG output, a line at a time as ParseGpgLine() does,
+ * into |lines|, which point into |input|.
+ */
+bool BaseGnupg::ParseGpgOutput(const std::string &input,
+                               GpgStatusLines *lines) {
+  LOG("GPG: ParseGpgOutput\n");
+  if (!ParseStatusOutput(input, lines)) {
+    LOG("GPG: Failing parse after %u lines\n",
+        static_cast<unsigned>(lines->size()));
+    return false;
+  }
+  return true;
+}
+
+/*
+ * A wrapper on wait to do the logging and return the status.
+ */
+int Gnupg::WaitOnGpg(GpgSession *session) {
+  GpgWatchdog::Interruption interruption = GpgWatchdog::kNOT_INTERRUPTED;
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  if (watchdog != NULL) {
+    interruption = watchdog->Unwatch(session);
+  }
+
+  LOG("GPG: Waiting on pgp...");
+  int ret;
+  bool waited = session->Wait(&ret);
+  delete session;
+  switch (interruption) {
+    case GpgWatchdog::kTIMED_OUT:
+      LOG(" timed out\n");
+      RecordInterruption("gpg", false);
+      return kGPG_TIMED_OUT;
+    case GpgWatchdog::kCANCELED:
+      LOG(" canceled\n");
+      RecordInterruption("gpg", true);
+      return kGPG_CANCELED;
+    default:
+      break;
+  }
+  if (!waited) {
+    return -1;
+  }
+  if (ret == GpgProcess::kEXIT_UNKNOWN) {
+    /*
+     * NSPR reaped a gpg that posix_spawn() started (see spawned_with_nspr).
+     * Its status can't stand in for its exit code: a message with a good and
+     * a bad signature, say, is only told apart by the latter.
+     */
+    LOG(" reaped by NSPR\n");
+    RecordFallback(kSPAWN_POSIX_SPAWN, GpgStats::kFALLBACK_REAPED);
+    return kGPG_LOST;
+  }
+  LOG(" done\n");
+  return ret;
+}
 
 /*
  * A convenience wrapper to call CallGpg, ReadAllGpgOutput, WaitOnGpg.
@@ -440,48 +1133,146 @@ int Gnupg::WaitOnGpg(PRProcess *process) {
  * For our non-interactive calls this works well, we only do it manually
  * in interactive calls.
  *
- * |output| must point to a valid string object.
+ * |output| must point to a valid string object. On failure |retval| is
+ * kGPG_TIMED_OUT, kGPG_CANCELED or kGPG_LOST if gpg was given up on or its
+ * exit code was lost, and -1 otherwise.
+ *
+ * |watcher|, unless it's NULL, is told about the output as it's read, in
+ * place of any status watch (see GpgStatusWatch), so that it can be taken
+ * apart while gpg is still writing it.
  */
 bool BaseGnupg::CallReadAndWaitOnGpg(const std::vector<const char*> &args,
-                                     int *retval, std::string *output) {
+                                     int *retval, std::string *output,
+                                     GpgOutputWatcher *watcher) {
   LOG("GPG: In CallReadAndWaitOnGpg\n");
+  *retval = -1;
 
   if (!preferences_.BoolPreference(GpgPreferences::GpgPluginInitialized)) {
     LOG("GPG: plugin not initialized\n");
     return false;
   }
 
-  PRProcess *process = CallGpg(args);
+  GpgSession *session = CallGpg(args);
 
-  if (process == NULL) {
+  if (session == NULL) {
     LOG("GPG: Failed to execute\n");
     return false;
   }
 
   LOG("GPG: Reading GPG Output\n");
-  if (!ReadAllGpgOutput(output)) {
+  if (!ReadAllGpgOutput(session, output, watcher)) {
+    int ret = WaitOnGpg(session);
+    if (CallAbandoned(ret)) {
+      *retval = ret;
+    }
     return false;
   }
 
   LOG("GPG: Waiting on gpg\n");
-  *retval = WaitOnGpg(process);
+  *retval = WaitOnGpg(session);
+
+  return !CallAbandoned(*retval);
+}
+
+/*
+ * With --multifile, gpg goes on with the next file after failing on one, and
+ * exits with the worst exit code of all the files. A file that gpg got to the
+ * end of without any of these is taken to have worked.
+ */
+static const GpgStatus kGPG_FILE_FAILURES[] = {
+  kSTATUS_INV_RECP,
+  kSTATUS_BADSIG,
+  kSTATUS_ERRSIG,
+  kSTATUS_NODATA,
+  kSTATUS_DECRYPTION_FAILED,
+};
+
+bool BaseGnupg::CallGpgMultifile(const std::vector<const char*> &args,
+                                 const std::vector<std::string> &files,
+                                 int *retval,
+                                 std::vector<int> *retvals,
+                                 std::vector<std::string> *outputs) {
+  LOG("GPG: In CallGpgMultifile\n");
+
+  std::vector<const char*> command(args);
+  command.push_back("--multifile");
+  std::map<std::string, size_t> indexes;
+  for (size_t i = 0; i < files.size(); i++) {
+    command.push_back(files[i].c_str());
+    indexes[files[i]] = i;
+  }
+
+  std::string ret_text;
+  if (!CallReadAndWaitOnGpg(command, retval, &ret_text)) {
+    return false;
+  }
+
+  outputs->assign(files.size(), std::string());
+  retvals->assign(files.size(), *retval);
+  std::vector<bool> done(files.size(), false);
+  std::vector<bool> failed(files.size(), false);
+
+  StringPiece rest(ret_text);
+  size_t current = files.size();
+  while (!rest.empty()) {
+    size_t newline = rest.find('\n');
+    StringPiece line = rest.substr(0, newline);
+    rest = rest.substr(newline == StringPiece::npos ? rest.size()
+                                                    : newline + 1);
+    GpgStatusLine lineparts;
+    if (!ParseStatusLine(line, &lineparts)) {
+      continue;
+    }
+    if (lineparts.status == kSTATUS_FILE_START) {
+      /* FILE_START <what> <filename> */
+      size_t space = lineparts.args.find(' ');
+      std::map<std::string, size_t>::const_iterator it = indexes.end();
+      if (space != StringPiece::npos) {
+        it = indexes.find(lineparts.args.substr(space + 1).as_string());
+      }
+      current = it == indexes.end() ? files.size() : it->second;
+    } else if (lineparts.status == kSTATUS_FILE_DONE) {
+      if (current < files.size()) {
+        done[current] = true;
+      }
+      current = files.size();
+    } else if (current < files.size()) {
+      (*outputs)[current].append(line.data(), line.size());
+      (*outputs)[current].append("\n");
+      for (size_t i = 0;
+           i < sizeof kGPG_FILE_FAILURES / sizeof kGPG_FILE_FAILURES[0];
+           i++) {
+        if (lineparts.status == kGPG_FILE_FAILURES[i]) {
+          failed[current] = true;
+        }
+      }
+    }
+  }
 
+  for (size_t i = 0; i < files.size(); i++) {
+    if (done[i] && !failed[i]) {
+      (*retvals)[i] = 0;
+    }
+  }
   return true;
 }
 
 /*
- * Given an ordered series of responses we expect, make sure that happened.
+ * Given an ordered series of |count| responses we expect, make sure that
+ * happened.
  */
 bool BaseGnupg::CheckForOrderedOutput(
-    const std::vector<std::string> &expected,
-    const std::vector< std::vector<std::string> > &output) {
-  if (expected.size() > output.size()) {
+    const GpgStatus *expected,
+    size_t count,
+    const GpgStatusLines &output) {
+  if (count > output.size()) {
     return false;
   }
-  for (size_t i = 0; i < expected.size(); i++) {
-    if (expected[i] != output[i][0]) {
-      LOG("GPG: Was expecting \"%s\" but got \"%s\"\n", expected[i].c_str(),
-           output[i][0].c_str());
+  for (size_t i = 0; i < count; i++) {
+    if (output[i].status != expected[i]) {
+      LOG("GPG: Was expecting \"%s\" but got \"%.*s\"\n",
+          StatusName(expected[i]), static_cast<int>(output[i].keyword.size()),
+          output[i].keyword.data());
       return false;
     }
   }
@@ -489,941 +1280,3428 @@ bool BaseGnupg::CheckForOrderedOutput(
 }
 
 /*
- * An alternative to the CheckForOrderedOutput approach - we get a list
+ * An alternative to the CheckForOrderedOutput approach - we get a set
  * of required responses and make sure they're there.
  *
  * The difference between this and the above is that this one does
  * not enforce order.
  */
 bool BaseGnupg::CheckForUnorderedOutput(
-    const std::vector<std::string> &expected,
-    const std::vector< std::vector<std::string> > &output) {
-  std::set<std::string> output_set;
-  for (size_t i = 0; i < output.size(); i++)
-    output_set.insert(output[i][0]);
-
-  for (size_t i = 0; i < expected.size(); i++) {
-    if (output_set.find(expected[i]) == output_set.end()) {
-      return false;
-    }
-  }
-
-  return true;
+    const GpgStatusSet &expected,
+    const GpgStatusLines &output) {
+  return (expected & ~output.statuses()).none();
 }
 
 /*
- * Wrapper around the above to make the vector for you.
+ * Whether the output has a line with the status |expected|.
  */
-bool BaseGnupg::CheckForSingleOutput(
-    const char *expected,
-    const std::vector< std::vector<std::string> > &output) {
-  std::vector<std::string> expected_outputs;
-  expected_outputs.push_back(expected);
-  return CheckForUnorderedOutput(expected_outputs, output);
+bool BaseGnupg::CheckForSingleOutput(GpgStatus expected,
+                                     const GpgStatusLines &output) {
+  return output.statuses().test(expected);
 }
 
 /*
- * Split on a character, nuf said.
+ * Read all of |file| into |text|. The size of the file is only taken as a
+ * hint, so that |text| is allocated once and the file is read into it with
+ * one PR_Read(), and read on until the end.
  */
-bool BaseGnupg::SplitOnChar(const std::string &line,
-                            char schar,
-                            std::vector<std::string> *output) {
-  LOG("GPG: SplitOnChar: \"%c\"\n", schar);
-
-  std::stringstream line_stream(line);
-  std::string token;
-
-  while (getline(line_stream, token, schar)) {
-    output->push_back(token);
+static bool ReadOpenFile(PRFileDesc *file, SecureString *text) {
+  PRFileInfo64 info;
+  PRInt64 size = 0;
+  if (PR_GetOpenFileInfo64(file, &info) == PR_SUCCESS) {
+    size = info.size;
   }
 
+  size_t length = 0;
+  text->resize(static_cast<size_t>(size) + kREAD_BLOCK);
+  for (;;) {
+    if (text->size() - length < static_cast<size_t>(kREAD_BLOCK)) {
+      text->resize(text->size() * 2);
+    }
+    size_t room = std::min(text->size() - length,
+                           static_cast<size_t>(PR_INT32_MAX));
+    PRInt32 read = PR_Read(file, &(*text)[length],
+                           static_cast<PRInt32>(room));
+    if (read < 0) {
+      LOG("GPG: PR_Read failed: %d\n", PR_GetError());
+      text->clear();
+      return false;
+    }
+    if (read == 0) {
+      break;
+    }
+    length += read;
+  }
+  text->resize(length);
   return true;
 }
 
-/*
- * Wrapper on the above.
- */
-bool BaseGnupg::SplitOnSpaces(const std::string &line,
-                              std::vector<std::string> *output) {
-  LOG("GPG: SplitOnSpaces\n");
-  return SplitOnChar(line, ' ', output);
-}
-
 /*
  * Read all of the data from a file - generally an output file from GPG.
  */
-bool Gnupg::ReadFileToString(const char *filename, std::string *text) {
+bool Gnupg::ReadFileToString(const char *filename, SecureString *text) {
   LOG("GPG: Reading tempfile %s\n", filename);
 
   if (!text || !filename) {
     return false;
   }
 
-  std::ifstream file(filename);
-  if (!file.is_open()) {
+  PRFileDesc *file = PR_Open(filename, PR_RDONLY, 0);
+  if (file == NULL) {
     LOG("GPG: Failed to open file: %s\n", filename);
     return false;
   }
-  std::string line;
-  std::string data;
-  while (getline(file, line)) {
-    data.append(line);
-    data.append("\n");
-  }
-  file.close();
-  LOG("GPG: Read %u bytes\n", static_cast<unsigned int>(data.size()));
-  LOG("GPG: Read: \"%s\"\n", data.c_str());
-  *text = data;
-  return true;
+  bool ok = ReadOpenFile(file, text);
+  if (PR_Close(file) == PR_FAILURE) {
+    LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+  }
+  if (ok) {
+    LOG("GPG: Read %u bytes\n", static_cast<unsigned int>(text->size()));
+  }
+  return ok;
 }
 
-
 /*
- * *** BEGIN API FUNCTIONS ***
- */
-
-/*
- * A base test to make sure that we can find the gpg binary.
- * Returns true if we can, false otherwise.
+ * Whether the API functions below that GPGME can do should use it.
  */
-GpgRetBool BaseGnupg::IsGpgInstalled() {
-  struct stat file_info;
-  GpgRetBool retobj;
-  if (stat(preferences_.StringPreference(
-      GpgPreferences::GpgBinaryPath).c_str(), &file_info)) {
-    retobj.set_retbool(false);
-    return retobj;
+GpgmeEngine *BaseGnupg::Gpgme() {
+  if (preferences_.StringPreference(GpgPreferences::GpgEngine) !=
+      kENGINE_GPGME) {
+    return NULL;
   }
-  retobj.set_retbool(true);
-  return retobj;
+#ifdef HAVE_GPGME
+  GpgmeEngine *engine = GpgmeEngine::ForCurrentThread(
+      preferences_.StringPreference(GpgPreferences::GpgBinaryPath));
+  if (engine == NULL) {
+    LOG("GPG: GPGME unavailable, running gpg instead\n");
+  }
+  return engine;
+#else
+  LOG("GPG: Built without GPGME, running gpg instead\n");
+  return NULL;
+#endif
 }
 
-/*
- * Returns the version output of GPG as a JS string.
- */
-GpgRetString BaseGnupg::GetGnupgVersion() {
-  GpgRetString retobj;
-
-  std::vector<const char*> args;
-  args.push_back("--version");
-
-  int ret;
-  std::string version;
-  if (!CallReadAndWaitOnGpg(args, &ret, &version)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+#ifdef HAVE_GPGME
+void BaseGnupg::WatchGpgme(GpgmeEngine *gpgme) {
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  if (watchdog != NULL) {
+    watchdog->Watch(gpgme, GpgWatchdog::CurrentOperation(), Timeout());
   }
+}
 
-  if (ret) {
-    LOG("GPG: GPG failed with status: %d\n", ret);
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+const char *BaseGnupg::UnwatchGpgme(GpgmeEngine *gpgme) {
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  if (watchdog == NULL) {
+    return NULL;
   }
-
-  retobj.set_retstring(version);
-  return retobj;
+  GpgWatchdog::Interruption interruption = watchdog->Unwatch(gpgme);
+  if (interruption == GpgWatchdog::kNOT_INTERRUPTED) {
+    return NULL;
+  }
+  /* The operation may have ended before GPGME saw it canceled. */
+  GpgmeEngine::ResetForCurrentThread();
+  bool canceled = interruption == GpgWatchdog::kCANCELED;
+  RecordInterruption("gpgme", canceled);
+  return canceled ? kERR_CANCELED : kERR_TIMEOUT;
 }
 
 /*
- * Verify signature for signed_text.
- *
- * Note there are two ways to call this function:
- *   - with "signature" - this is for detached signatures
- *   - without "signature" - this is for clearsigned text and the
- *     signature is assumed to be in signed_text
+ * Replace |retobj| with |error|, if GPGME was interrupted, so that the call
+ * returns the same thing as when gpg is interrupted.
  */
-GpgRetSignerInfo BaseGnupg::VerifySignedText(const std::string &signed_text,
-                                             const std::string &signature) {
-  GpgRetSignerInfo retobj;
+template <class Ret>
+static void SetInterrupted(const char *error, Ret *retobj) {
+  if (error != NULL) {
+    *retobj = Ret();
+    retobj->set_error_str(error);
+  }
+}
+#endif
 
-  LOG("GPG: In VerifySignedText\n");
 
-  std::string signed_file = kTMP_SIGNED_TEXT;
-  TmpWrapper signed_wrapper;
-  if (!signed_wrapper.CreateAndWriteTmpFile(signed_text, &signed_file)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+#ifndef OS_WINDOWS
+/* A request to gpg-agent, see BaseGnupg::CallAgent(). */
+class AgentRequest {
+ public:
+  virtual ~AgentRequest() {}
+
+  /* Make the request, as GpgAgent::PkSign() does. */
+  virtual bool Run(GpgAgent *agent, std::string *result,
+                   unsigned int *error) = 0;
+};
+
+class AgentSignRequest : public AgentRequest {
+ public:
+  AgentSignRequest(const std::string &keygrip, const std::string &description,
+                   const std::string &digest)
+      : keygrip_(keygrip),
+        description_(description),
+        digest_(digest) {
   }
 
-  std::string sig_file = kTMP_SIGNATURE;
-  TmpWrapper sig_wrapper;
-  if (signature.size()) {
-    if (!sig_wrapper.CreateAndWriteTmpFile(signature, &sig_file)) {
-      retobj.set_error_str(kERR_INTERNAL);
-      return retobj;
-    }
+  bool Run(GpgAgent *agent, std::string *result, unsigned int *error) {
+    return agent->PkSign(keygrip_, description_, openpgp::kHASH_SHA256,
+                         digest_, result, error);
   }
 
-  std::vector<const char *> args;
-  args.push_back("--verify");
-  if (signature.size()) {
-    args.push_back(sig_file.c_str());
+ private:
+  const std::string &keygrip_;
+  const std::string &description_;
+  const std::string &digest_;
+};
+
+class AgentDecryptRequest : public AgentRequest {
+ public:
+  AgentDecryptRequest(const std::string &keygrip,
+                      const std::string &description,
+                      const std::string &enc_val)
+      : keygrip_(keygrip),
+        description_(description),
+        enc_val_(enc_val) {
   }
-  args.push_back(signed_file.c_str());
 
-  int ret;
-  std::string ret_text;
-  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+  bool Run(GpgAgent *agent, std::string *result, unsigned int *error) {
+    return agent->PkDecrypt(keygrip_, description_, enc_val_, result, error);
   }
 
-  std::vector< std::vector<std::string> > parsed_output;
-  ParseGpgOutput(ret_text, &parsed_output);
+ private:
+  const std::string &keygrip_;
+  const std::string &description_;
+  const std::string &enc_val_;
+};
 
-  if (ret) {
-    LOG("GPG: Gnupg retval is %d, returning\n", ret);
-    if (parsed_output.size() == 0) {
-      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    } else if (parsed_output[0][0] == kGPG_BADSIG) {
-      retobj.set_error_str(kERR_BAD_SIGNATURE);
-    } else if (parsed_output[0][0] == kGPG_NODATA) {
-      retobj.set_error_str(kERR_SIGNATURE_ERR);
-    } else {
-      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    }
-    return retobj;
+/*
+ * An agent connection that has gone bad (because the agent has been
+ * restarted, say) is replaced once before giving up.
+ */
+bool BaseGnupg::CallAgent(AgentRequest *request, std::string *result,
+                          unsigned int *error, const char **interrupted) {
+  /* The preference can change between calls. */
+  std::string socket_path = preferences_.StringPreference(
+      GpgPreferences::GpgAgentSocket);
+  if (socket_path.empty()) {
+    socket_path = GpgAgent::DefaultSocketPath();
   }
 
-  std::vector<std::string> expected;
-  expected.push_back(kGPG_SIG_ID);
-  expected.push_back(kGPG_GOODSIG);
-  expected.push_back(kGPG_VALIDSIG);
-
-  LOG("GPG: Checking output\n");
-  if (!CheckForOrderedOutput(expected, parsed_output)) {
-    retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
-    return retobj;
+  bool answered = false;
+  bool reconnected = false;
+  GpgWatchdog::Interruption interruption = GpgWatchdog::kNOT_INTERRUPTED;
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  *error = 0;
+  *interrupted = NULL;
+  PR_Lock(agent_lock_);
+  if (agent_ != NULL && agent_socket_ != socket_path) {
+    delete agent_;
+    agent_ = NULL;
   }
-
-  LOG("GPG: Parsing signer\n");
-  std::vector<std::string> line_parts;
-  SplitOnSpaces(parsed_output[1][1], &line_parts);
-
-  /* Everything after the first part is the signer. */
-  std::string signer;
-  for (size_t i = 1; i < line_parts.size(); i++) {
-    if (i > 1) {
-      signer += " ";
+  while (true) {
+    if (agent_ == NULL) {
+      agent_ = GpgAgent::Connect(socket_path);
+      if (agent_ == NULL) {
+        break;
+      }
+      agent_socket_ = socket_path;
+      reconnected = true;
+    }
+    if (watchdog != NULL) {
+      watchdog->Watch(agent_, GpgWatchdog::CurrentOperation(), Timeout());
+    }
+    bool ok = request->Run(agent_, result, error);
+    if (watchdog != NULL) {
+      interruption = watchdog->Unwatch(agent_);
+    }
+    if (interruption != GpgWatchdog::kNOT_INTERRUPTED) {
+      /* The connection has been shut down, but the agent may still be busy. */
+      delete agent_;
+      agent_ = NULL;
+      break;
+    }
+    if (ok) {
+      answered = true;
+      break;
+    }
+    if (agent_->connected()) {
+      answered = true;
+      break;
+    }
+    delete agent_;
+    agent_ = NULL;
+    if (reconnected) {
+      break;
     }
-    signer += line_parts[i];
   }
+  PR_Unlock(agent_lock_);
+  if (interruption != GpgWatchdog::kNOT_INTERRUPTED) {
+    bool canceled = interruption == GpgWatchdog::kCANCELED;
+    RecordInterruption("agent", canceled);
+    *interrupted = canceled ? kERR_CANCELED : kERR_TIMEOUT;
+    return false;
+  }
+  return answered;
+}
 
-  retobj.set_signer(signer);
-  retobj.set_trust_level(parsed_output[3][0]);
-  retobj.set_debug(ret_text);
+/*
+ * gpg's listing of the secret key |keyid|, with everything that the agent
+ * engine needs to know about it.
+ */
+bool BaseGnupg::ListSecretKey(const std::string &keyid, std::string *listing,
+                              const char **interrupted) {
+  std::vector<const char *> args;
+  args.push_back("--with-colons");
+  args.push_back("--with-keygrip");
+  args.push_back("--with-key-data");
+  args.push_back("--list-secret-keys");
+  args.push_back(keyid.c_str());
 
-  return retobj;
+  int ret;
+  *interrupted = NULL;
+  if (!CallReadAndWaitOnGpg(args, &ret, listing) || ret) {
+    LOG("GPG: Can't list secret key %s\n", keyid.c_str());
+    /* Running gpg again won't make it any faster. */
+    if (ret == kGPG_TIMED_OUT || ret == kGPG_CANCELED) {
+      *interrupted = CallFailure(ret);
+    }
+    return false;
+  }
+  return true;
 }
+#endif
 
 /*
- * Encrypt rawtext to keyid.
+ * gpg only runs the first time a keyid is signed with, to find out which key
+ * that is.
  */
-GpgRetEncryptInfo BaseGnupg::EncryptText(
-    const std::string &rawtext,
-    const std::vector<std::string> &keyids,
-    const std::vector<std::string> &hidden_keyids,
-    bool always_trust,
-    const std::string &sign) {
-  GpgRetEncryptInfo retobj;
-
-  LOG("GPG: In EncryptText\n");
-
-  LOG("GPG: Opening tmp file\n");
-  std::string raw_file = kTMP_RAW_TEXT;
-  TmpWrapper raw_wrapper;
-  if (!raw_wrapper.CreateAndWriteTmpFile(rawtext, &raw_file)) {
-    retobj.set_error_str(kERR_INTERNAL);
+bool BaseGnupg::AgentSignText(const std::string &rawtext,
+                              const std::string &keyid,
+                              GpgRetString *retobj) {
+#ifdef OS_WINDOWS
+  return false;
+#else
+  if (preferences_.StringPreference(GpgPreferences::GpgEngine) !=
+      kENGINE_AGENT) {
+    return false;
   }
 
-  std::string res_filename;
-  res_filename.append(raw_file);
-  res_filename.append(".asc");
-  /* Make sure gpg isn't going to write to an existing file */
-  TmpWrapper res_wrapper;
-  res_wrapper.UnlinkAndTrackFile(res_filename);
-
-  std::vector<const char *> args;
-  args.push_back("--encrypt");
-  args.push_back("--armor");
-  if (sign.size()) {
-    args.push_back("--sign");
-    args.push_back("--local-user");
-    args.push_back(sign.c_str());
+  openpgp::SigningKey key;
+  PR_Lock(lock_);
+  std::map<std::string, openpgp::SigningKey>::const_iterator known =
+      signing_keys_.find(keyid);
+  bool found = known != signing_keys_.end();
+  if (found) {
+    key = known->second;
   }
-  if (always_trust)
-    args.push_back("--always-trust");
-  for (size_t i = 0; i < keyids.size(); i++) {
-    LOG("GPG: RECP: %s\n", keyids[i].c_str());
-    args.push_back("--recipient");
-    args.push_back(keyids[i].c_str());
+  PR_Unlock(lock_);
+
+  const char *interrupted;
+  if (!found) {
+    std::string listing;
+    if (!ListSecretKey(keyid, &listing, &interrupted)) {
+      if (interrupted != NULL) {
+        retobj->set_error_str(interrupted);
+        return true;
+      }
+      return false;
+    }
+    /* Remember keys the agent can't sign with too, so we don't ask again. */
+    if (!openpgp::ParseSigningKey(listing, &key)) {
+      key = openpgp::SigningKey();
+    }
+    PR_Lock(lock_);
+    signing_keys_[keyid] = key;
+    PR_Unlock(lock_);
   }
-  for (size_t i = 0; i < hidden_keyids.size(); i++) {
-    args.push_back("--hidden-recipient");
-    LOG("GPG: HIDRECP: %s\n", hidden_keyids[i].c_str());
-    args.push_back(hidden_keyids[i].c_str());
+  if (key.keygrip.empty()) {
+    LOG("GPG: Agent can't sign with %s, running gpg instead\n",
+        keyid.c_str());
+    return false;
   }
-  args.push_back(raw_file.c_str());
 
-  int ret;
-  std::string ret_text;
-  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+  openpgp::SignatureBuilder builder(
+      key, static_cast<PRUint32>(PR_Now() / PR_USEC_PER_SEC));
+  std::string digest = builder.Digest(rawtext);
+  std::string description("Please enter the passphrase to sign with key ");
+  description.append(key.keyid);
+
+  AgentSignRequest request(key.keygrip, description, digest);
+  std::string sig_val;
+  unsigned int error;
+  if (!CallAgent(&request, &sig_val, &error, &interrupted)) {
+    if (interrupted != NULL) {
+      retobj->set_error_str(interrupted);
+      return true;
+    }
+    return false;
   }
 
-  std::vector< std::vector<std::string> > parsed_output;
-  ParseGpgOutput(ret_text, &parsed_output);
+  if (error) {
+    switch (GpgAgent::ErrorCode(error)) {
+      case GpgAgent::kERR_BAD_PASSPHRASE:
+      case GpgAgent::kERR_CANCELED:
+        retobj->set_error_str(kERR_BAD_PASSPHRASE);
+        return true;
+      default:
+        return false;
+    }
+  }
 
-  LOG("GPG: Removing tmpfile\n");
+  std::string packet;
+  if (!builder.Packet(sig_val, &packet)) {
+    return false;
+  }
+  retobj->set_retstring(Armor(kARMOR_SIGNATURE, packet));
+  return true;
+#endif
+}
 
-  retobj.set_debug(ret_text);
+/*
+ * Like for signing, gpg only runs the first time a session key is encrypted
+ * to a keyid, to find out about the key. The first session key whose secret
+ * key is here is used, which is what gpg does too unless it's been told to
+ * try them all.
+ */
+bool BaseGnupg::AgentDecryptText(const std::string &cipher_text,
+                                 GpgRetDecryptInfo *retobj) {
+#ifdef OS_WINDOWS
+  return false;
+#else
+  if (preferences_.StringPreference(GpgPreferences::GpgEngine) !=
+      kENGINE_AGENT) {
+    return false;
+  }
 
-  LOG("GPG: Error checking gpg run\n");
-  if (ret) {
-    LOG("GPG: Gnupg retval is %d, returning\n", ret);
-    int line = 0;
-    if (sign.size())
-      line = 3;
-    if (parsed_output.size() == 0) {
-      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    } else if (parsed_output[line][0] == kGPG_INV_RECP) {
-      /*
-       * If the key isn't trusted we get
-       *   kGPG_INV_RECP kGPG_INV_NOT_TRUSTED
-       * If the key is not found we'll get either
-       *   kGPG_INV_RECP kGPG_INV_NOT_FOUND1
-       * or:
-       *   kGPG_INV_RECP kGPG_INV_NOT_FOUND2
-       *
-       * The second "word" is a number and is a code for
-       * why the recipient is invalid. For any other code
-       * we report a generic error as it's unexpected.
-       */
-      std::vector<std::string> line_parts;
-      SplitOnSpaces(parsed_output[line][1], &line_parts);
-      if (line_parts[0] == kGPG_INV_NOT_TRUSTED) {
-        LOG("GPG: Key not trusted\n");
-        retobj.set_error_str(kERR_PUBLIC_KEY_NOT_TRUSTED);
-      } else if (line_parts[0] == kGPG_INV_NOT_FOUND1 ||
-                 line_parts[0] == kGPG_INV_NOT_FOUND2) {
-        LOG("GPG: Key not found\n");
-        retobj.set_error_str(kERR_NO_PUBLIC_KEY);
-      } else {
-        LOG("GPG: Key bad\n");
-        retobj.set_error_str(kERR_BAD_PUBLIC_KEY);
+  std::string packets;
+  openpgp::EncryptedMessage message;
+  if (!Dearmor(cipher_text, kARMOR_MESSAGE, &packets) ||
+      !message.Parse(packets)) {
+    return false;
+  }
+
+  const char *interrupted;
+  const openpgp::EncryptedSessionKey *session_key = NULL;
+  openpgp::DecryptionKey key;
+  for (size_t i = 0; i < message.session_keys().size(); i++) {
+    const std::string &keyid = message.session_keys()[i].keyid;
+    PR_Lock(lock_);
+    std::map<std::string, openpgp::DecryptionKey>::const_iterator known =
+        decryption_keys_.find(keyid);
+    bool found = known != decryption_keys_.end();
+    if (found) {
+      key = known->second;
+    }
+    PR_Unlock(lock_);
+
+    if (!found) {
+      std::string listing;
+      if (!ListSecretKey(keyid, &listing, &interrupted)) {
+        if (interrupted != NULL) {
+          retobj->set_error_str(interrupted);
+          return true;
+        }
+        continue;
       }
-    } else {
-      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-      LOG("GPG: Unexpected GPG failure output: %s %s\n",
-          parsed_output[0][0].c_str(),
-          parsed_output[0][1].c_str());
+      /* Remember keys the agent can't decrypt with too. */
+      if (!openpgp::ParseDecryptionKey(listing, keyid, &key)) {
+        key = openpgp::DecryptionKey();
+      }
+      PR_Lock(lock_);
+      decryption_keys_[keyid] = key;
+      PR_Unlock(lock_);
     }
-    return retobj;
+    if (!key.keygrip.empty()) {
+      session_key = &message.session_keys()[i];
+      break;
+    }
+  }
+  std::string enc_val;
+  if (session_key != NULL) {
+    enc_val = openpgp::EncryptedMessage::EncVal(*session_key);
+  }
+  if (enc_val.empty()) {
+    LOG("GPG: Agent can't decrypt the message, running gpg instead\n");
+    return false;
   }
 
-  if (parsed_output.size() == 0) {
-    retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    return retobj;
+  std::string description(
+      "Please enter the passphrase to decrypt with key ");
+  description.append(key.keyid);
+
+  AgentDecryptRequest request(key.keygrip, description, enc_val);
+  std::string value;
+  unsigned int error;
+  if (!CallAgent(&request, &value, &error, &interrupted)) {
+    WipeString(&value);
+    if (interrupted != NULL) {
+      retobj->set_error_str(interrupted);
+      return true;
+    }
+    return false;
   }
 
-  LOG("GPG: Output checking gpg run\n");
-  if (sign.size()) {
-    LOG("GPG: Checking output for signing confirmation\n");
-    if (parsed_output[4][0] != kGPG_SIG_CREATED) {
-      retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
-      LOG("GPG: Unexpected GPG output: %s %s\n", parsed_output[0][0].c_str(),
-             parsed_output[0][1].c_str());
-      return retobj;
+  if (error) {
+    switch (GpgAgent::ErrorCode(error)) {
+      case GpgAgent::kERR_BAD_PASSPHRASE:
+      case GpgAgent::kERR_CANCELED:
+        retobj->set_error_str(kERR_BAD_PASSPHRASE);
+        return true;
+      default:
+        return false;
     }
   }
 
-  LOG("GPG: Checking output for encryption confirmation\n");
-  if (parsed_output[parsed_output.size()-1][0] != kGPG_END_ENCRYPTION) {
-      retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
-      LOG("GPG: Unexpected GPG output: %s %s\n", parsed_output[0][0].c_str(),
-             parsed_output[0][1].c_str());
-      return retobj;
+  int cipher_algo;
+  SecureString symmetric_key;
+  SecureString plain_text;
+  bool decrypted = openpgp::EncryptedMessage::SessionKey(
+      key, *session_key, value, &cipher_algo, &symmetric_key) &&
+      message.Decrypt(cipher_algo, symmetric_key, &plain_text);
+  WipeString(&value);
+  if (!decrypted) {
+    /* gpg can say what's wrong with it. */
+    LOG("GPG: Couldn't decrypt with the agent's session key\n");
+    return false;
   }
+  SetResultText(&plain_text, retobj);
+  return true;
+#endif
+}
 
-  std::string data;
-  if (!ReadFileToString(res_filename.c_str(), &data)) {
-    retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
+
+/*
+ * *** BEGIN API FUNCTIONS ***
+ */
+
+/*
+ * A base test to make sure that we can find the gpg binary.
+ * Returns true if we can, false otherwise.
+ */
+GpgRetBool BaseGnupg::IsGpgInstalled() {
+  struct stat file_info;
+  GpgRetBool retobj;
+  if (stat(preferences_.StringPreference(
+      GpgPreferences::GpgBinaryPath).c_str(), &file_info)) {
+    retobj.set_retbool(false);
     return retobj;
   }
-
-  retobj.set_cipher_text(data);
+  retobj.set_retbool(true);
   return retobj;
 }
 
 /*
- * Signs rawtext with keyid and returns the detached signature.
+ * Returns the version output of GPG as a JS string.
  */
-GpgRetString BaseGnupg::SignText(const std::string &rawtext,
-                                 const std::string &keyid,
-                                 bool clearsign) {
+GpgRetString BaseGnupg::GetGnupgVersion() {
   GpgRetString retobj;
 
-  LOG("GPG: In SignText\n");
+  std::vector<const char*> args;
+  args.push_back("--version");
 
-  LOG("GPG: Opening tmp files\n");
-  std::string raw_file = kTMP_RAW_TEXT;
-  TmpWrapper raw_wrapper;
-  if (!raw_wrapper.CreateAndWriteTmpFile(rawtext, &raw_file)) {
+  int ret;
+  std::string version;
+  if (!CallReadAndWaitOnGpg(args, &ret, &version)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  if (ret) {
+    LOG("GPG: GPG failed with status: %d\n", ret);
     retobj.set_error_str(kERR_INTERNAL);
+    return retobj;
   }
 
-  std::vector<const char *> args;
-  args.push_back("--armor");
-  if (clearsign)
-    args.push_back("--clearsign");
-  else
-    args.push_back("--detach-sign");
-  args.push_back("--local-user");
-  args.push_back(keyid.c_str());
-  args.push_back(raw_file.c_str());
+  retobj.set_retstring(version);
+  return retobj;
+}
 
-  /* Prep the output file before calling gpg. */
-  std::string res_file;
-  res_file.append(raw_file.c_str());
-  res_file.append(".asc");
-  TmpWrapper res_wrapper;
-  res_wrapper.UnlinkAndTrackFile(res_file);
+/*
+ * Verify signature for signed_text.
+ *
+ * Note there are two ways to call this function:
+ *   - with "signature" - this is for detached signatures
+ *   - without "signature" - this is for clearsigned text and the
+ *     signature is assumed to be in signed_text
+ */
+GpgRetSignerInfo BaseGnupg::VerifySignedText(const std::string &signed_text,
+                                             const std::string &signature) {
+  GpgRetSignerInfo retobj;
+
+  LOG("GPG: In VerifySignedText\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+#ifdef HAVE_GPGME
+  GpgmeEngine *gpgme = Gpgme();
+  if (gpgme != NULL) {
+    WatchGpgme(gpgme);
+    GpgRetSignerInfo retobj = gpgme->VerifySignedText(signed_text, signature);
+    SetInterrupted(UnwatchGpgme(gpgme), &retobj);
+    return retobj;
+  }
+#endif
+
+  /* A detached signature is checked and passed on like a cipher text. */
+  const std::string *sig = &signature;
+  std::string packets;
+  if (signature.size() && ArmorInPlugin()) {
+    if (!Dearmor(signature, kARMOR_SIGNATURE, &packets)) {
+      LOG("GPG: Bad armor, not running gpg\n");
+      retobj.set_error_str(kERR_BAD_ARMOR);
+      return retobj;
+    }
+    sig = &packets;
+  }
 
+  std::vector<const char *> args;
   int ret;
   std::string ret_text;
-  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+
+  if (UseDataPipes()) {
+    /* The signed text goes to gpg's stdin, the signature to another pipe. */
+    if (signature.size()) {
+      args.push_back("--enable-special-filenames");
+    }
+    args.push_back("--verify");
+    /* Otherwise "-&N" is taken for an option. */
+    args.push_back("--");
+    if (signature.size()) {
+      args.push_back(kGPG_EXTRA_INPUT);
+    }
+    args.push_back("-");
+
+    SecureString data;
+    if (!CallGpgWithData(args, signed_text,
+                         signature.size() ? sig : NULL,
+                         &ret, &ret_text, &data)) {
+      retobj.set_error_str(CallFailure(ret));
+      return retobj;
+    }
+    return VerifyResult(ret, ret_text);
+  }
+
+  std::string signed_file = kTMP_SIGNED_TEXT;
+  TmpWrapper signed_wrapper(UseMemoryFiles());
+  if (!signed_wrapper.CreateAndWriteTmpFile(signed_text, &signed_file)) {
     retobj.set_error_str(kERR_INTERNAL);
     return retobj;
   }
 
-  if (ret) {
-    /*
-     * If the key we're supposed to use is not available, we'll get *NO*
-     * output (bad form, gpg). So if we get output, that's some unknown
-     * error.
-     */
-    if (!ret_text.size()) {
-      LOG("GPG: Signing failed (%d) - no output\n", ret);
-      retobj.set_error_str(kERR_NO_SECRET_KEY);
-    } else {
-      std::vector< std::vector<std::string> > parsed_output;
-      ParseGpgOutput(ret_text, &parsed_output);
-      if (CheckForSingleOutput(kGPG_BAD_PASSPHRASE, parsed_output)) {
-        LOG("GPG: Bad passphrase or couldn't talk to agent\n");
-        retobj.set_error_str(kERR_BAD_PASSPHRASE);
-      } else {
-        LOG("GPG: Signing failed (%d): \"%s\"\n", ret, ret_text.c_str());
-        retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-      }
+  std::string sig_file = kTMP_SIGNATURE;
+  TmpWrapper sig_wrapper(UseMemoryFiles());
+  if (signature.size()) {
+    if (!sig_wrapper.CreateAndWriteTmpFile(*sig, &sig_file)) {
+      retobj.set_error_str(kERR_INTERNAL);
+      return retobj;
     }
+  }
+
+  args.push_back("--verify");
+  if (signature.size()) {
+    args.push_back(sig_file.c_str());
+  }
+  args.push_back(signed_file.c_str());
+
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  return VerifyResult(ret, ret_text);
+}
+
+/*
+ * What the output |ret_text| of gpg --verify, which exited with |ret|, says
+ * about the signature.
+ */
+GpgRetSignerInfo BaseGnupg::VerifyResult(int ret,
+                                         const std::string &ret_text) {
+  GpgRetSignerInfo retobj;
+
+  GpgVerifyMachine status;
+  status.FeedOutput(ret_text);
+
+  LOG("GPG: Checking output\n");
+  if (!status.Finish(ret, &retobj)) {
     return retobj;
   }
+  retobj.set_debug(ret_text);
+
+  return retobj;
+}
+
+/*
+ * The arguments for gpg to compress with zlib level |level|, none for
+ * kCOMPRESS_DEFAULT.
+ */
+static void AddCompressArgs(int level, std::vector<const char *> *args) {
+  if (level == kCOMPRESS_NONE) {
+    args->push_back("--compress-algo");
+    args->push_back("none");
+  } else if (level > 0 && level <= 9) {
+    args->push_back("--compress-level");
+    args->push_back(kCOMPRESS_LEVELS[level]);
+  }
+}
+
+/*
+ * The arguments for gpg to encrypt like EncryptText() does, except for where
+ * the input comes from and the output goes to. gpg is asked to |armor| the
+ * cipher text, and to compress it with |compress_level|.
+ */
+static void AddEncryptArgs(const std::vector<std::string> &keyids,
+                           const std::vector<std::string> &hidden_keyids,
+                           bool always_trust, const std::string &sign,
+                           bool armor, int compress_level,
+                           std::vector<const char *> *args) {
+  args->push_back("--encrypt");
+  if (armor)
+    args->push_back("--armor");
+  AddCompressArgs(compress_level, args);
+  if (sign.size()) {
+    args->push_back("--sign");
+    args->push_back("--local-user");
+    args->push_back(sign.c_str());
+  }
+  if (always_trust)
+    args->push_back("--always-trust");
+  for (size_t i = 0; i < keyids.size(); i++) {
+    LOG("GPG: RECP: %s\n", keyids[i].c_str());
+    args->push_back("--recipient");
+    args->push_back(keyids[i].c_str());
+  }
+  for (size_t i = 0; i < hidden_keyids.size(); i++) {
+    args->push_back("--hidden-recipient");
+    LOG("GPG: HIDRECP: %s\n", hidden_keyids[i].c_str());
+    args->push_back(hidden_keyids[i].c_str());
+  }
+}
+
+/*
+ * Encrypt rawtext to keyid.
+ */
+GpgRetEncryptInfo BaseGnupg::EncryptText(
+    const std::string &rawtext,
+    const std::vector<std::string> &keyids,
+    const std::vector<std::string> &hidden_keyids,
+    bool always_trust,
+    const std::string &sign) {
+  return EncryptTextCompressed(rawtext, keyids, hidden_keyids, always_trust,
+                               sign, "");
+}
+
+GpgRetEncryptInfo BaseGnupg::EncryptTextCompressed(
+    const std::string &rawtext,
+    const std::vector<std::string> &keyids,
+    const std::vector<std::string> &hidden_keyids,
+    bool always_trust,
+    const std::string &sign,
+    const std::string &compression) {
+  GpgRetEncryptInfo retobj;
+
+  LOG("GPG: In EncryptText\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+  int level = CompressLevel(compression, &rawtext);
+
+#ifdef HAVE_GPGME
+  /* GPGME can't set the compression, so anything but gpg's own runs gpg. */
+  GpgmeEngine *gpgme = level == kCOMPRESS_DEFAULT ? Gpgme() : NULL;
+  if (gpgme != NULL) {
+    WatchGpgme(gpgme);
+    retobj = gpgme->EncryptText(rawtext, keyids, hidden_keyids,
+                                always_trust, sign);
+    SetInterrupted(UnwatchGpgme(gpgme), &retobj);
+    KeepLargeResult(&retobj);
+    return retobj;
+  }
+#endif
+
+  bool pipes = UseDataPipes();
+  std::string raw_file = kTMP_RAW_TEXT;
+  TmpWrapper raw_wrapper(UseMemoryFiles());
+  std::string res_filename;
+  TmpWrapper res_wrapper(UseMemoryFiles());
+  if (!pipes) {
+    LOG("GPG: Opening tmp file\n");
+    if (!raw_wrapper.CreateAndWriteTmpFile(rawtext, &raw_file)) {
+      retobj.set_error_str(kERR_INTERNAL);
+    }
+  }
+
+  bool armor = ArmorInPlugin();
+  std::vector<const char *> args;
+  AddEncryptArgs(keyids, hidden_keyids, always_trust, sign, !armor, level,
+                 &args);
+
+  int ret;
+  std::string ret_text;
+  SecureString data;
+  bool called;
+  if (pipes) {
+    args.push_back("--output");
+    args.push_back("-");
+    called = CallGpgWithData(args, rawtext, NULL, &ret, &ret_text, &data);
+  } else if (CreateOutputFile(&res_wrapper, &res_filename, &args)) {
+    args.push_back(raw_file.c_str());
+    called = CallReadAndWaitOnGpg(args, &ret, &ret_text);
+  } else {
+    retobj.set_error_str(kERR_INTERNAL);
+    return retobj;
+  }
+  if (!called) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  SecureString *cipher_text = pipes ? &data : NULL;
+  if (armor && ret == 0 &&
+      (pipes || ReadFileToString(res_filename.c_str(), &data))) {
+    std::string armored = Armor(kARMOR_MESSAGE,
+                                StringPiece(data.data(), data.size()));
+    data.assign(armored.data(), armored.size());
+    cipher_text = &data;
+  }
+  return EncryptResult(ret, ret_text, !sign.empty(), res_filename,
+                       cipher_text);
+}
+
+/*
+ * What the output |ret_text| of gpg --encrypt, which exited with |ret|, says
+ * about the encryption, and the cipher text from |data| (or |res_filename|).
+ * |signed_too| is whether gpg was asked to --sign as well.
+ */
+GpgRetEncryptInfo BaseGnupg::EncryptResult(int ret,
+                                           const std::string &ret_text,
+                                           bool signed_too,
+                                           const std::string &res_filename,
+                                           SecureString *data) {
+  GpgRetEncryptInfo retobj;
+
+  GpgEncryptMachine status(signed_too);
+  status.FeedOutput(ret_text);
+
+  retobj.set_debug(ret_text);
+
+  LOG("GPG: Checking output for encryption confirmation\n");
+  if (!status.Finish(ret, &retobj)) {
+    LOG("GPG: Unexpected GPG output: %s\n", ret_text.c_str());
+    return retobj;
+  }
+
+  if (data != NULL) {
+    SetResultText(data, &retobj);
+    return retobj;
+  }
+
+  SecureString cipher_text;
+  if (!ReadFileToString(res_filename.c_str(), &cipher_text)) {
+    retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
+    return retobj;
+  }
+
+  SetResultText(&cipher_text, &retobj);
+  return retobj;
+}
+
+/*
+ * Signs rawtext with keyid and returns the detached signature.
+ */
+GpgRetString BaseGnupg::SignText(const std::string &rawtext,
+                                 const std::string &keyid,
+                                 bool clearsign) {
+  GpgRetString retobj;
+
+  LOG("GPG: In SignText\n");
+
+#ifdef HAVE_GPGME
+  GpgmeEngine *gpgme = Gpgme();
+  if (gpgme != NULL) {
+    WatchGpgme(gpgme);
+    retobj = gpgme->SignText(rawtext, keyid, clearsign);
+    SetInterrupted(UnwatchGpgme(gpgme), &retobj);
+    return retobj;
+  }
+#endif
+
+  if (!clearsign && AgentSignText(rawtext, keyid, &retobj)) {
+    return retobj;
+  }
+
+  bool pipes = UseDataPipes();
+  std::string raw_file = kTMP_RAW_TEXT;
+  TmpWrapper raw_wrapper(UseMemoryFiles());
+  if (!pipes) {
+    LOG("GPG: Opening tmp files\n");
+    if (!raw_wrapper.CreateAndWriteTmpFile(rawtext, &raw_file)) {
+      retobj.set_error_str(kERR_INTERNAL);
+    }
+  }
+
+  /* Clear signed text is always armored by gpg. */
+  bool armor = !clearsign && ArmorInPlugin();
+  std::vector<const char *> args;
+  if (!armor)
+    args.push_back("--armor");
+  if (clearsign)
+    args.push_back("--clearsign");
+  else
+    args.push_back("--detach-sign");
+  args.push_back("--local-user");
+  args.push_back(keyid.c_str());
+
+  /* Prep the output file before calling gpg. */
+  std::string res_file;
+  TmpWrapper res_wrapper(UseMemoryFiles());
+  if (!pipes) {
+    if (!CreateOutputFile(&res_wrapper, &res_file, &args)) {
+      retobj.set_error_str(kERR_INTERNAL);
+      return retobj;
+    }
+    args.push_back(raw_file.c_str());
+  } else {
+    args.push_back("--output");
+    args.push_back("-");
+  }
+
+  int ret;
+  std::string ret_text;
+  SecureString data;
+  bool called;
+  if (pipes) {
+    called = CallGpgWithData(args, rawtext, NULL, &ret, &ret_text, &data);
+  } else {
+    called = CallReadAndWaitOnGpg(args, &ret, &ret_text);
+  }
+  if (!called) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  const SecureString *signature = pipes ? &data : NULL;
+  if (armor && ret == 0 &&
+      (pipes || ReadFileToString(res_file.c_str(), &data))) {
+    std::string armored = Armor(kARMOR_SIGNATURE,
+                                StringPiece(data.data(), data.size()));
+    data.assign(armored.data(), armored.size());
+    signature = &data;
+  }
+  return SignResult(ret, ret_text, res_file, signature);
+}
+
+/*
+ * What the output |ret_text| of gpg --detach-sign or --clearsign, which
+ * exited with |ret|, says about the signing, and the signature or signed text
+ * from |data| (or |res_file|).
+ */
+/* What gpg reports once it has made a signature. */
+static GpgStatusSet SignedStatuses() {
+  GpgStatusSet statuses;
+  statuses.set(kSTATUS_BEGIN_SIGNING);
+  statuses.set(kSTATUS_SIG_CREATED);
+  return statuses;
+}
+
+GpgRetString BaseGnupg::SignResult(int ret, const std::string &ret_text,
+                                   const std::string &res_file,
+                                   const SecureString *data) {
+  GpgRetString retobj;
+
+  if (ret) {
+    /*
+     * If the key we're supposed to use is not available, we'll get *NO*
+     * output (bad form, gpg). So if we get output, that's some unknown
+     * error.
+     */
+    if (!ret_text.size()) {
+      LOG("GPG: Signing failed (%d) - no output\n", ret);
+      retobj.set_error_str(kERR_NO_SECRET_KEY);
+    } else {
+      GpgStatusLines parsed_output;
+      ParseGpgOutput(ret_text, &parsed_output);
+      if (CheckForSingleOutput(kSTATUS_BAD_PASSPHRASE, parsed_output)) {
+        LOG("GPG: Bad passphrase or couldn't talk to agent\n");
+        retobj.set_error_str(kERR_BAD_PASSPHRASE);
+      } else {
+        LOG("GPG: Signing failed (%d): \"%s\"\n", ret, ret_text.c_str());
+        retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
+      }
+    }
+    return retobj;
+  }
+
+  GpgStatusLines parsed_output;
+  ParseGpgOutput(ret_text, &parsed_output);
+
+  /*
+   * gpg only reports asking for a passphrase (USERID_HINT, NEED_PASSPHRASE,
+   * GOOD_PASSPHRASE) for a key that has one, and GnuPG 2 reports
+   * KEY_CONSIDERED before anything else, so only the signing is looked for.
+   */
+  static const GpgStatusSet kSIGNED = SignedStatuses();
+
+  if (!CheckForUnorderedOutput(kSIGNED, parsed_output)) {
+    LOG("GPG: CheckForUnorderedOutput returned false\n");
+    retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+    return retobj;
+  }
+
+  if (data != NULL) {
+    retobj.set_retstring(std::string(data->data(), data->size()));
+    return retobj;
+  }
+
+  LOG("GPG: Reading output files\n");
+  SecureString signed_text;
+  if (!ReadFileToString(res_file.c_str(), &signed_text)) {
+    retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
+    return retobj;
+  }
+
+  retobj.set_retstring(std::string(signed_text.data(), signed_text.size()));
+
+  return retobj;
+}
+
+/*
+ * Given cipher text, decrypt it.
+ *
+ * If the ciphertext has a signature in it, we will verify it
+ * and set the same entries in the return object that we would
+ * in VerifySignedText()
+ */
+GpgRetDecryptInfo BaseGnupg::DecryptText(const std::string &cipher_text) {
+  GpgRetDecryptInfo retobj;
+
+  LOG("GPG: In DecryptText\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+#ifdef HAVE_GPGME
+  GpgmeEngine *gpgme = Gpgme();
+  if (gpgme != NULL) {
+    SecureString plain_text;
+    WatchGpgme(gpgme);
+    GpgRetDecryptInfo retobj = gpgme->DecryptText(cipher_text, &plain_text);
+    SetInterrupted(UnwatchGpgme(gpgme), &retobj);
+    if (!retobj.is_error()) {
+      SetResultText(&plain_text, &retobj);
+    }
+    return retobj;
+  }
+#endif
+
+  if (AgentDecryptText(cipher_text, &retobj)) {
+    return retobj;
+  }
+
+  /* gpg gets the packets once their armor has been checked. */
+  const std::string *input = &cipher_text;
+  std::string packets;
+  if (ArmorInPlugin()) {
+    if (!Dearmor(cipher_text, kARMOR_MESSAGE, &packets)) {
+      LOG("GPG: Bad armor, not running gpg\n");
+      retobj.set_error_str(kERR_BAD_ARMOR);
+      return retobj;
+    }
+    input = &packets;
+  }
+
+  std::vector<const char *> args;
+  int ret;
+  std::string ret_text;
+
+  if (UseDataPipes()) {
+    args.push_back("--output");
+    args.push_back("-");
+    args.push_back("--decrypt");
+
+    SecureString data;
+    if (!CallGpgWithData(args, *input, NULL, &ret, &ret_text, &data)) {
+      retobj.set_error_str(CallFailure(ret));
+      return retobj;
+    }
+    return DecryptResult(ret, ret_text, "", &data);
+  }
+
+  LOG("GPG: Opening tmp files\n");
+
+  std::string cipher_file = kTMP_RAW_TEXT;
+  TmpWrapper cipher_wrapper(UseMemoryFiles());
+  if (!cipher_wrapper.CreateAndWriteTmpFile(*input, &cipher_file)) {
+    retobj.set_error_str(kERR_INTERNAL);
+  }
+
+  std::string raw_file;
+  TmpWrapper raw_wrapper(UseMemoryFiles());
+  if (!CreateOutputFile(&raw_wrapper, &raw_file, &args)) {
+    retobj.set_error_str(kERR_INTERNAL);
+    return retobj;
+  }
+  args.push_back("--decrypt");
+  args.push_back(cipher_file.c_str());
+
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  return DecryptResult(ret, ret_text, raw_file, NULL);
+}
+
+/*
+ * What the output |ret_text| of gpg --decrypt, which exited with |ret|, says
+ * about the decryption (and the signature, if any), and the plain text from
+ * |data| (or |raw_file|).
+ */
+GpgRetDecryptInfo BaseGnupg::DecryptResult(int ret,
+                                           const std::string &ret_text,
+                                           const std::string &raw_file,
+                                           SecureString *data) {
+  GpgRetDecryptInfo retobj;
+
+  GpgDecryptMachine status;
+  status.FeedOutput(ret_text);
+
+  if (!status.Finish(ret, &retobj)) {
+    return retobj;
+  }
+
+  retobj.set_debug(ret_text);
+
+  if (data != NULL) {
+    SetResultText(data, &retobj);
+    return retobj;
+  }
+
+  SecureString text;
+  if (!ReadFileToString(raw_file.c_str(), &text)) {
+    retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
+    return retobj;
+  }
+
+  SetResultText(&text, &retobj);
+  return retobj;
+}
+
+/*
+ * *** BATCH FUNCTIONS ***
+ *
+ * A batch is done in chunks of at most kBATCH_CHUNK inputs, each by a single
+ * run of gpg with --multifile. Batches of more than one chunk are split into
+ * at most kBATCH_SHARDS shards, which run on threads of their own so that
+ * their gpg processes run side by side.
+ */
+static const size_t kBATCH_CHUNK = 64;
+static const size_t kBATCH_SHARDS = 4;
+
+/*
+ * The part of a batch function that's the same for all of them. Subclasses
+ * say what gpg should do with the inputs and keep the results.
+ */
+class BatchJob {
+ public:
+  explicit BatchJob(BaseGnupg *gnupg)
+      : gnupg_(gnupg),
+        singly_(false) {
+  }
+
+  virtual ~BatchJob() {}
+
+  /* Do all inputs with the single call, for when gpg isn't run for them. */
+  void RunSingly() {
+    singly_ = true;
+  }
+
+  /* Do inputs [begin, end) with one gpg, and put their results in place. */
+  void RunChunk(size_t begin, size_t end) {
+    std::vector<size_t> items;
+    for (size_t i = begin; i < end; i++) {
+      if (singly_ || NeedsSingle(i)) {
+        RunSingle(i);
+      } else {
+        items.push_back(i);
+      }
+    }
+    if (items.size() == 1) {
+      RunSingle(items[0]);
+      return;
+    }
+    if (items.empty()) {
+      return;
+    }
+
+    /* Two for each input: what gpg reads, and what it writes, if anything. */
+    TmpWrapper *wrappers = new TmpWrapper[2 * items.size()];
+    std::vector<std::string> files(items.size());
+    bool written = true;
+    for (size_t j = 0; written && j < items.size(); j++) {
+      written = WriteInput(items[j], &wrappers[2 * j], &wrappers[2 * j + 1],
+                           &files[j]);
+    }
+
+    int ret = -1;
+    std::vector<const char*> args;
+    MultifileArgs(&args);
+    std::vector<int> rets;
+    std::vector<std::string> outputs;
+    if (written &&
+        gnupg_->CallGpgMultifile(args, files, &ret, &rets, &outputs)) {
+      for (size_t j = 0; j < items.size(); j++) {
+        SetResult(items[j], rets[j], outputs[j], files[j]);
+      }
+    } else {
+      for (size_t j = 0; j < items.size(); j++) {
+        SetError(items[j], CallFailure(ret));
+      }
+    }
+    delete[] wrappers;
+  }
+
+ protected:
+  /* Whether input |i| can't go to gpg with other inputs. */
+  virtual bool NeedsSingle(size_t i) const = 0;
+  /* Do input |i| with the single call. */
+  virtual void RunSingle(size_t i) = 0;
+  /* The arguments for gpg that go before --multifile. */
+  virtual void MultifileArgs(std::vector<const char*> *args) const = 0;
+  /*
+   * Write input |i| to a new file for gpg, tracked by |input|, and put its
+   * name in |file|. |output| tracks what gpg writes, if anything.
+   */
+  virtual bool WriteInput(size_t i, TmpWrapper *input, TmpWrapper *output,
+                          std::string *file) = 0;
+  /* Keep the result of input |i|, which gpg read from |file|. */
+  virtual void SetResult(size_t i, int ret, const std::string &output,
+                         const std::string &file) = 0;
+  virtual void SetError(size_t i, const char *error) = 0;
+
+  BaseGnupg *gnupg_;
+
+ private:
+  bool singly_;
+};
+
+/*
+ * Consecutive inputs of a batch that are done on one thread, which takes on
+ * the GpgWatchdog operation of the caller so that canceling it stops all of
+ * the batch.
+ */
+struct BatchShard {
+  BatchJob *job;
+  size_t begin;
+  size_t end;
+  PRInt32 operation;
+};
+
+static void RunBatchShard(const BatchShard &shard) {
+  for (size_t begin = shard.begin; begin < shard.end; begin += kBATCH_CHUNK) {
+    size_t end = begin + kBATCH_CHUNK;
+    shard.job->RunChunk(begin, end < shard.end ? end : shard.end);
+  }
+}
+
+static void PR_CALLBACK RunBatchShardThread(void *arg) {
+  BatchShard *shard = static_cast<BatchShard *>(arg);
+  GpgWatchdog::SetCurrentOperation(shard->operation);
+  RunBatchShard(*shard);
+}
+
+static void RunBatch(BatchJob *job, size_t count) {
+  size_t chunks = (count + kBATCH_CHUNK - 1) / kBATCH_CHUNK;
+  size_t shards = chunks < kBATCH_SHARDS ? chunks : kBATCH_SHARDS;
+  if (shards <= 1) {
+    BatchShard shard = { job, 0, count, 0 };
+    RunBatchShard(shard);
+    return;
+  }
+
+  size_t per_shard = (count + shards - 1) / shards;
+  std::vector<BatchShard> plan(shards);
+  for (size_t i = 0; i < shards; i++) {
+    plan[i].job = job;
+    plan[i].begin = i * per_shard;
+    plan[i].end = plan[i].begin + per_shard < count ?
+        plan[i].begin + per_shard : count;
+    plan[i].operation = GpgWatchdog::CurrentOperation();
+  }
+
+  /* The first shard runs on the calling thread. */
+  std::vector<PRThread *> threads(shards, static_cast<PRThread *>(NULL));
+  for (size_t i = 1; i < shards; i++) {
+    threads[i] = PR_CreateThread(PR_USER_THREAD, RunBatchShardThread,
+                                 &plan[i], PR_PRIORITY_NORMAL,
+                                 PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+    if (threads[i] == NULL) {
+      LOG("GPG: PR_CreateThread failed: %d\n", PR_GetError());
+    }
+  }
+  RunBatchShard(plan[0]);
+  for (size_t i = 1; i < shards; i++) {
+    if (threads[i] == NULL) {
+      RunBatchShard(plan[i]);
+    } else if (PR_JoinThread(threads[i]) == PR_FAILURE) {
+      LOG("GPG: PR_JoinThread failed: %d\n", PR_GetError());
+    }
+  }
+}
+
+class VerifyBatchJob : public BatchJob {
+ public:
+  VerifyBatchJob(BaseGnupg *gnupg,
+                 const std::vector<std::string> &signed_texts,
+                 const std::vector<std::string> &signatures,
+                 std::vector<GpgRetSignerInfo> *results)
+      : BatchJob(gnupg),
+        signed_texts_(signed_texts),
+        signatures_(signatures),
+        results_(results) {
+  }
+
+ protected:
+  /* --multifile only does inline signatures. */
+  bool NeedsSingle(size_t i) const {
+    return i < signatures_.size() && !signatures_[i].empty();
+  }
+
+  void RunSingle(size_t i) {
+    (*results_)[i] = gnupg_->VerifySignedText(
+        signed_texts_[i], i < signatures_.size() ? signatures_[i] : "");
+  }
+
+  void MultifileArgs(std::vector<const char*> *args) const {
+    args->push_back("--verify");
+  }
+
+  bool WriteInput(size_t i, TmpWrapper *input, TmpWrapper * /* output */,
+                  std::string *file) {
+    *file = kTMP_SIGNED_TEXT;
+    return input->CreateAndWriteTmpFile(signed_texts_[i], file);
+  }
+
+  void SetResult(size_t i, int ret, const std::string &output,
+                 const std::string & /* file */) {
+    (*results_)[i] = gnupg_->VerifyResult(ret, output);
+  }
+
+  void SetError(size_t i, const char *error) {
+    (*results_)[i].set_error_str(error);
+  }
+
+ private:
+  const std::vector<std::string> &signed_texts_;
+  const std::vector<std::string> &signatures_;
+  std::vector<GpgRetSignerInfo> *results_;
+};
+
+class EncryptBatchJob : public BatchJob {
+ public:
+  EncryptBatchJob(BaseGnupg *gnupg, const std::vector<std::string> &rawtexts,
+                  const std::vector<std::string> &keyids,
+                  const std::vector<std::string> &hidden_keyids,
+                  bool always_trust, const std::string &sign,
+                  int compress_level,
+                  std::vector<GpgRetEncryptInfo> *results)
+      : BatchJob(gnupg),
+        rawtexts_(rawtexts),
+        keyids_(keyids),
+        hidden_keyids_(hidden_keyids),
+        always_trust_(always_trust),
+        sign_(sign),
+        compress_level_(compress_level),
+        results_(results) {
+  }
+
+ protected:
+  /* --multifile doesn't do --sign. */
+  bool NeedsSingle(size_t /* i */) const {
+    return !sign_.empty();
+  }
+
+  void RunSingle(size_t i) {
+    (*results_)[i] = gnupg_->EncryptText(rawtexts_[i], keyids_,
+                                         hidden_keyids_, always_trust_,
+                                         sign_);
+  }
+
+  void MultifileArgs(std::vector<const char*> *args) const {
+    args->push_back("--encrypt");
+    args->push_back("--armor");
+    AddCompressArgs(compress_level_, args);
+    if (always_trust_)
+      args->push_back("--always-trust");
+    for (size_t i = 0; i < keyids_.size(); i++) {
+      args->push_back("--recipient");
+      args->push_back(keyids_[i].c_str());
+    }
+    for (size_t i = 0; i < hidden_keyids_.size(); i++) {
+      args->push_back("--hidden-recipient");
+      args->push_back(hidden_keyids_[i].c_str());
+    }
+  }
+
+  bool WriteInput(size_t i, TmpWrapper *input, TmpWrapper *output,
+                  std::string *file) {
+    *file = kTMP_RAW_TEXT;
+    if (!input->CreateAndWriteTmpFile(rawtexts_[i], file)) {
+      return false;
+    }
+    /* Make sure gpg isn't going to write to an existing file */
+    output->UnlinkAndTrackFile(*file + ".asc");
+    return true;
+  }
+
+  void SetResult(size_t i, int ret, const std::string &output,
+                 const std::string &file) {
+    (*results_)[i] = gnupg_->EncryptResult(ret, output, false,
+                                           file + ".asc", NULL);
+  }
+
+  void SetError(size_t i, const char *error) {
+    (*results_)[i].set_error_str(error);
+  }
+
+ private:
+  const std::vector<std::string> &rawtexts_;
+  const std::vector<std::string> &keyids_;
+  const std::vector<std::string> &hidden_keyids_;
+  bool always_trust_;
+  const std::string &sign_;
+  /* For the texts encrypted together, see BaseGnupg::CompressLevel(). */
+  int compress_level_;
+  std::vector<GpgRetEncryptInfo> *results_;
+};
+
+class DecryptBatchJob : public BatchJob {
+ public:
+  DecryptBatchJob(BaseGnupg *gnupg,
+                  const std::vector<std::string> &cipher_texts,
+                  std::vector<GpgRetDecryptInfo> *results)
+      : BatchJob(gnupg),
+        cipher_texts_(cipher_texts),
+        results_(results) {
+  }
+
+ protected:
+  bool NeedsSingle(size_t /* i */) const {
+    return false;
+  }
+
+  void RunSingle(size_t i) {
+    (*results_)[i] = gnupg_->DecryptText(cipher_texts_[i]);
+  }
+
+  void MultifileArgs(std::vector<const char*> *args) const {
+    args->push_back("--decrypt");
+  }
+
+  /*
+   * --multifile can't be given --output, gpg writes the plain text to the
+   * name of the file without its suffix.
+   */
+  bool WriteInput(size_t i, TmpWrapper *input, TmpWrapper *output,
+                  std::string *file) {
+    std::string raw_file = TmpWrapper::MkTmpFileName(kTMP_RAW_TEXT);
+    if (raw_file.empty()) {
+      return false;
+    }
+    output->UnlinkAndTrackFile(raw_file);
+    *file = raw_file + ".asc";
+    return input->CreateAndWriteFile(cipher_texts_[i], *file);
+  }
+
+  void SetResult(size_t i, int ret, const std::string &output,
+                 const std::string &file) {
+    (*results_)[i] = gnupg_->DecryptResult(
+        ret, output, file.substr(0, file.size() - strlen(".asc")), NULL);
+  }
+
+  void SetError(size_t i, const char *error) {
+    (*results_)[i].set_error_str(error);
+  }
+
+ private:
+  const std::vector<std::string> &cipher_texts_;
+  std::vector<GpgRetDecryptInfo> *results_;
+};
+
+std::vector<GpgRetSignerInfo> BaseGnupg::VerifySignedTextBatch(
+    const std::vector<std::string> &signed_texts,
+    const std::vector<std::string> &signatures) {
+  LOG("GPG: In VerifySignedTextBatch\n");
+
+  std::vector<GpgRetSignerInfo> results(signed_texts.size());
+  VerifyBatchJob job(this, signed_texts, signatures, &results);
+#ifdef HAVE_GPGME
+  if (Gpgme() != NULL) {
+    job.RunSingly();
+  }
+#endif
+  RunBatch(&job, signed_texts.size());
+  return results;
+}
+
+std::vector<GpgRetEncryptInfo> BaseGnupg::EncryptTextBatch(
+    const std::vector<std::string> &rawtexts,
+    const std::vector<std::string> &keyids,
+    const std::vector<std::string> &hidden_keyids,
+    bool always_trust,
+    const std::string &sign) {
+  LOG("GPG: In EncryptTextBatch\n");
+
+  std::vector<GpgRetEncryptInfo> results(rawtexts.size());
+  EncryptBatchJob job(this, rawtexts, keyids, hidden_keyids, always_trust,
+                      sign, CompressLevel("", NULL), &results);
+#ifdef HAVE_GPGME
+  if (Gpgme() != NULL) {
+    job.RunSingly();
+  }
+#endif
+  RunBatch(&job, rawtexts.size());
+  return results;
+}
+
+std::vector<GpgRetDecryptInfo> BaseGnupg::DecryptTextBatch(
+    const std::vector<std::string> &cipher_texts) {
+  LOG("GPG: In DecryptTextBatch\n");
+
+  std::vector<GpgRetDecryptInfo> results(cipher_texts.size());
+  DecryptBatchJob job(this, cipher_texts, &results);
+#ifdef HAVE_GPGME
+  if (Gpgme() != NULL) {
+    job.RunSingly();
+  }
+#endif
+  /* Each goes to the agent, and only what it can't decrypt runs gpg. */
+  if (preferences_.StringPreference(GpgPreferences::GpgEngine) ==
+      kENGINE_AGENT) {
+    job.RunSingly();
+  }
+  RunBatch(&job, cipher_texts.size());
+  return results;
+}
+
+/*
+ * The handle of a stream is the GpgWatchdog operation that gpg is watched
+ * for, so that it can be canceled like an asynchronous call.
+ */
+int BaseGnupg::OpenStream(const std::vector<const char*> &args, bool encrypt,
+                          bool signed_too, const void *owner) {
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  if (watchdog == NULL) {
+    return 0;
+  }
+  PRInt32 handle = watchdog->NewOperation(owner);
+  PRInt32 current = GpgWatchdog::CurrentOperation();
+  GpgWatchdog::SetCurrentOperation(handle);
+  GpgInputStream *input = OpenGpgWithData(args, NULL);
+  GpgWatchdog::SetCurrentOperation(current);
+  if (input == NULL) {
+    LOG("GPG: Failed to open stream\n");
+    watchdog->EndOperation(handle);
+    return 0;
+  }
+
+  PR_Lock(lock_);
+  Stream &stream = streams_[handle];
+  stream.input = input;
+  stream.encrypt = encrypt;
+  stream.signed_too = signed_too;
+  stream.writers = 0;
+  stream.closing = false;
+  PR_Unlock(lock_);
+  return handle;
+}
+
+int BaseGnupg::OpenEncryptStream(
+    const std::vector<std::string> &keyids,
+    const std::vector<std::string> &hidden_keyids,
+    bool always_trust,
+    const std::string &sign,
+    const void *owner) {
+  LOG("GPG: In OpenEncryptStream\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+  std::vector<const char *> args;
+  AddEncryptArgs(keyids, hidden_keyids, always_trust, sign, true,
+                 CompressLevel("", NULL), &args);
+  args.push_back("--output");
+  args.push_back("-");
+  return OpenStream(args, true, !sign.empty(), owner);
+}
+
+int BaseGnupg::OpenSignStream(const std::string &keyid, bool clearsign,
+                              const void *owner) {
+  LOG("GPG: In OpenSignStream\n");
+
+  std::vector<const char *> args;
+  args.push_back("--armor");
+  args.push_back(clearsign ? "--clearsign" : "--detach-sign");
+  args.push_back("--local-user");
+  args.push_back(keyid.c_str());
+  args.push_back("--output");
+  args.push_back("-");
+  return OpenStream(args, false, false, owner);
+}
+
+GpgRetBool BaseGnupg::WriteStream(int handle, const std::string &chunk) {
+  GpgRetBool retobj;
+
+  /*
+   * Written to without the lock, as gpg may take its time reading, but
+   * counted as a writer so that it isn't closed meanwhile.
+   */
+  PR_Lock(lock_);
+  std::map<int, Stream>::iterator it = streams_.find(handle);
+  if (it == streams_.end() || it->second.closing) {
+    PR_Unlock(lock_);
+    retobj.set_error_str(kERR_NO_STREAM);
+    return retobj;
+  }
+  it->second.writers++;
+  GpgInputStream *input = it->second.input;
+  PR_Unlock(lock_);
+
+  bool written = input->Write(chunk);
+
+  PR_Lock(lock_);
+  /* The stream stays in streams_ while it has writers. */
+  it = streams_.find(handle);
+  if (--it->second.writers == 0) {
+    PR_NotifyAllCondVar(streams_idle_);
+  }
+  PR_Unlock(lock_);
+  retobj.set_retbool(written);
+  return retobj;
+}
+
+const char *BaseGnupg::CloseStream(int handle, bool encrypt, bool *signed_too,
+                                   int *retval, std::string *output,
+                                   SecureString *data) {
+  PR_Lock(lock_);
+  std::map<int, Stream>::iterator it = streams_.find(handle);
+  if (it == streams_.end() || it->second.encrypt != encrypt) {
+    PR_Unlock(lock_);
+    return kERR_NO_STREAM;
+  }
+  Stream stream;
+  bool taken = TakeStreamLocked(handle, &stream);
+  PR_Unlock(lock_);
+  if (!taken) {
+    return kERR_NO_STREAM;
+  }
+
+  bool closed = stream.input->Close(retval, output, data);
+  delete stream.input;
+  GpgWatchdog::Instance()->EndOperation(handle);
+  *signed_too = stream.signed_too;
+  return closed ? NULL : CallFailure(*retval);
+}
+
+GpgRetEncryptInfo BaseGnupg::CloseEncryptStream(int handle) {
+  GpgRetEncryptInfo retobj;
+
+  LOG("GPG: In CloseEncryptStream\n");
+
+  bool signed_too;
+  int ret;
+  std::string ret_text;
+  SecureString data;
+  const char *error = CloseStream(handle, true, &signed_too, &ret, &ret_text,
+                                  &data);
+  if (error != NULL) {
+    retobj.set_error_str(error);
+    return retobj;
+  }
+
+  return EncryptResult(ret, ret_text, signed_too, "", &data);
+}
+
+GpgRetString BaseGnupg::CloseSignStream(int handle) {
+  GpgRetString retobj;
+
+  LOG("GPG: In CloseSignStream\n");
+
+  bool signed_too;
+  int ret;
+  std::string ret_text;
+  SecureString data;
+  const char *error = CloseStream(handle, false, &signed_too, &ret, &ret_text,
+                                  &data);
+  if (error != NULL) {
+    retobj.set_error_str(error);
+    return retobj;
+  }
+
+  return SignResult(ret, ret_text, "", &data);
+}
+
+bool BaseGnupg::TakeStreamLocked(int handle, Stream *stream) {
+  std::map<int, Stream>::iterator it = streams_.find(handle);
+  if (it == streams_.end() || it->second.closing) {
+    return false;
+  }
+  it->second.closing = true;
+  while (it->second.writers > 0) {
+    PR_WaitCondVar(streams_idle_, PR_INTERVAL_NO_TIMEOUT);
+  }
+  *stream = it->second;
+  streams_.erase(it);
+  return true;
+}
+
+void BaseGnupg::AbortStreams() {
+  std::map<int, Stream> streams;
+  PR_Lock(lock_);
+  std::vector<int> handles;
+  for (std::map<int, Stream>::iterator it = streams_.begin();
+       it != streams_.end(); ++it) {
+    handles.push_back(it->first);
+  }
+  for (size_t i = 0; i < handles.size(); i++) {
+    Stream stream;
+    if (TakeStreamLocked(handles[i], &stream)) {
+      streams[handles[i]] = stream;
+    }
+  }
+  PR_Unlock(lock_);
+  for (std::map<int, Stream>::iterator it = streams.begin();
+       it != streams.end(); ++it) {
+    delete it->second.input;
+    GpgWatchdog::Instance()->EndOperation(it->first);
+  }
+}
+
+/*
+ * *** BEGIN LARGE RESULTS ***
+ *
+ * Results are made on the threads of asynchronous calls as well, and are
+ * then handed to the object the call was made on, so their handles are
+ * unique among all objects.
+ */
+static PRInt32 last_result = 0;
+
+/* Whether |c| is a byte in the middle of a UTF-8 character. */
+static bool IsUtf8Continuation(char c) {
+  return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+/*
+ * The offset at or after |offset| in |text| where a UTF-8 character starts,
+ * not moving by more than a character so that texts that aren't UTF-8 are
+ * read whole as well.
+ */
+static size_t Utf8Start(const SecureString &text, size_t offset) {
+  for (int i = 0; i < 3 && offset < text.size() &&
+       IsUtf8Continuation(text[offset]); i++) {
+    offset++;
+  }
+  return offset;
+}
+
+bool BaseGnupg::IsLargeResult(size_t size) {
+  int kb = preferences_.IntPreference(GpgPreferences::GpgLargeResultKb);
+  return kb != 0 && size > static_cast<size_t>(kb) * 1024 &&
+      size <= static_cast<size_t>(PR_INT32_MAX);
+}
+
+int BaseGnupg::KeepLargeResult(SecureString *text) {
+  if (!IsLargeResult(text->size())) {
+    return 0;
+  }
+  int handle = PR_ATOMIC_INCREMENT(&last_result);
+  size_t size = text->size();
+  PR_Lock(lock_);
+  results_[handle].swap(*text);
+  PR_Unlock(lock_);
+  LOG("GPG: Keeping %u bytes as result %d\n", static_cast<unsigned>(size),
+      handle);
+  return handle;
+}
+
+void BaseGnupg::SetResultText(SecureString *text, GpgRetEncryptInfo *retobj) {
+  int size = static_cast<int>(text->size());
+  int handle = KeepLargeResult(text);
+  if (handle != 0) {
+    retobj->set_result(handle, size);
+    return;
+  }
+  retobj->set_cipher_text(std::string(text->data(), text->size()));
+  text->clear();
+}
+
+void BaseGnupg::SetResultText(SecureString *text, GpgRetDecryptInfo *retobj) {
+  int size = static_cast<int>(text->size());
+  int handle = KeepLargeResult(text);
+  if (handle != 0) {
+    retobj->set_result(handle, size);
+    return;
+  }
+  retobj->set_data(std::string(text->data(), text->size()));
+  text->clear();
+}
+
+/*
+ * GPGME hands a cipher text over in a std::string, so a large one is copied
+ * into secure memory here, and then wiped.
+ */
+void BaseGnupg::KeepLargeResult(GpgRetEncryptInfo *retobj) {
+  std::string *cipher_text = retobj->mutable_cipher_text();
+  if (!IsLargeResult(cipher_text->size())) {
+    return;
+  }
+  SecureString text(cipher_text->data(), cipher_text->size());
+  WipeString(cipher_text);
+  SetResultText(&text, retobj);
+}
+
+void BaseGnupg::AdoptResults(std::map<int, SecureString> *results) {
+  PR_Lock(lock_);
+  for (std::map<int, SecureString>::iterator it = results->begin();
+       it != results->end(); ++it) {
+    results_[it->first].swap(it->second);
+  }
+  PR_Unlock(lock_);
+  results->clear();
+}
+
+GpgRetChunk BaseGnupg::ReadChunk(int handle, int offset, int length) {
+  GpgRetChunk retobj;
+
+  /* Held while reading, so that the text isn't released from under it. */
+  PR_Lock(lock_);
+  std::map<int, SecureString>::const_iterator it = results_.find(handle);
+  if (it == results_.end()) {
+    PR_Unlock(lock_);
+    retobj.set_error_str(kERR_NO_RESULT);
+    return retobj;
+  }
+  const SecureString &text = it->second;
+
+  size_t begin = Utf8Start(text, std::min(
+      static_cast<size_t>(std::max(offset, 0)), text.size()));
+  size_t end = begin + std::min(static_cast<size_t>(std::max(length, 0)),
+                                text.size() - begin);
+  if (end < text.size()) {
+    /*
+     * End before the character that |end| is in the middle of, or after it if
+     * that's all there is to the chunk.
+     */
+    size_t cut = end;
+    for (int i = 0; i < 3 && cut > begin && IsUtf8Continuation(text[cut]);
+         i++) {
+      cut--;
+    }
+    if (cut > begin && !IsUtf8Continuation(text[cut])) {
+      end = cut;
+    } else {
+      end = Utf8Start(text, end);
+    }
+  }
+
+  retobj.set_data(std::string(text.data() + begin, end - begin));
+  PR_Unlock(lock_);
+  retobj.set_next_offset(static_cast<int>(end));
+  return retobj;
+}
+
+GpgRetBool BaseGnupg::ReleaseResult(int handle) {
+  GpgRetBool retobj;
+
+  /* Released outside of the lock, where its memory is zeroed. */
+  SecureString text;
+  PR_Lock(lock_);
+  std::map<int, SecureString>::iterator it = results_.find(handle);
+  if (it == results_.end()) {
+    PR_Unlock(lock_);
+    retobj.set_error_str(kERR_NO_RESULT);
+    return retobj;
+  }
+  text.swap(it->second);
+  results_.erase(it);
+  PR_Unlock(lock_);
+  retobj.set_retbool(true);
+  return retobj;
+}
+
+/*
+ * *** BEGIN FILE FUNCTIONS ***
+ *
+ * The paths are handed to gpg as they are, after "--" so that they aren't
+ * taken for options. The output path can't be, so only absolute ones are
+ * taken: they can't be "-" (standard output, which gpg's status is read
+ * from) or start with a dash.
+ */
+
+/* Whether |path| names a file that can be read. */
+static bool IsReadableFile(const std::string &path) {
+  return !path.empty() &&
+      PR_Access(path.c_str(), PR_ACCESS_READ_OK) == PR_SUCCESS;
+}
+
+/* Whether |path| is absolute. */
+static bool IsAbsolutePath(const std::string &path) {
+#ifdef OS_WINDOWS
+  /* "C:\..." or "\\server\...". */
+  if (path.size() >= 3 && isalpha(static_cast<unsigned char>(path[0])) &&
+      path[1] == ':' && (path[2] == '\\' || path[2] == '/')) {
+    return true;
+  }
+  return path.size() >= 2 && path[0] == '\\' && path[1] == '\\';
+#else
+  return !path.empty() && path[0] == '/';
+#endif
+}
+
+const char *BaseGnupg::OutputPathError(const std::string &output_path) const {
+  if (!IsAbsolutePath(output_path)) {
+    return kERR_BAD_OUTPUT;
+  }
+  if (!preferences_.BoolPreference(GpgPreferences::GpgOverwriteFiles) &&
+      PR_Access(output_path.c_str(), PR_ACCESS_EXISTS) == PR_SUCCESS) {
+    return kERR_OUTPUT_EXISTS;
+  }
+  return NULL;
+}
+
+void BaseGnupg::AddOutputArgs(const std::string &output_path,
+                              std::vector<const char *> *args) const {
+  /*
+   * Without --yes, gpg in batch mode refuses to overwrite a file that was
+   * created after OutputPathError() looked.
+   */
+  if (preferences_.BoolPreference(GpgPreferences::GpgOverwriteFiles)) {
+    args->push_back("--yes");
+  }
+  args->push_back("--output");
+  args->push_back(output_path.c_str());
+}
+
+GpgRetEncryptInfo BaseGnupg::EncryptFile(
+    const std::string &path,
+    const std::string &output_path,
+    const std::vector<std::string> &keyids,
+    const std::vector<std::string> &hidden_keyids,
+    bool always_trust,
+    const std::string &sign) {
+  GpgRetEncryptInfo retobj;
+
+  LOG("GPG: In EncryptFile\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+  if (!IsReadableFile(path)) {
+    retobj.set_error_str(kERR_BAD_FILE);
+    return retobj;
+  }
+  const char *output_error = OutputPathError(output_path);
+  if (output_error != NULL) {
+    retobj.set_error_str(output_error);
+    return retobj;
+  }
+
+  std::vector<const char *> args;
+  AddEncryptArgs(keyids, hidden_keyids, always_trust, sign, true,
+                 CompressLevel("", NULL), &args);
+  AddOutputArgs(output_path, &args);
+  args.push_back("--");
+  args.push_back(path.c_str());
+
+  int ret;
+  std::string ret_text;
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  SecureString none;
+  return EncryptResult(ret, ret_text, !sign.empty(), output_path, &none);
+}
+
+GpgRetDecryptInfo BaseGnupg::DecryptFile(const std::string &path,
+                                         const std::string &output_path) {
+  GpgRetDecryptInfo retobj;
+
+  LOG("GPG: In DecryptFile\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+  if (!IsReadableFile(path)) {
+    retobj.set_error_str(kERR_BAD_FILE);
+    return retobj;
+  }
+  const char *output_error = OutputPathError(output_path);
+  if (output_error != NULL) {
+    retobj.set_error_str(output_error);
+    return retobj;
+  }
+
+  std::vector<const char *> args;
+  AddOutputArgs(output_path, &args);
+  args.push_back("--decrypt");
+  args.push_back("--");
+  args.push_back(path.c_str());
+
+  int ret;
+  std::string ret_text;
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  SecureString none;
+  return DecryptResult(ret, ret_text, output_path, &none);
+}
+
+GpgRetString BaseGnupg::SignFile(const std::string &path,
+                                 const std::string &output_path,
+                                 const std::string &keyid,
+                                 bool clearsign) {
+  GpgRetString retobj;
+
+  LOG("GPG: In SignFile\n");
+
+  if (!IsReadableFile(path)) {
+    retobj.set_error_str(kERR_BAD_FILE);
+    return retobj;
+  }
+  const char *output_error = OutputPathError(output_path);
+  if (output_error != NULL) {
+    retobj.set_error_str(output_error);
+    return retobj;
+  }
+
+  std::vector<const char *> args;
+  args.push_back("--armor");
+  args.push_back(clearsign ? "--clearsign" : "--detach-sign");
+  args.push_back("--local-user");
+  args.push_back(keyid.c_str());
+  AddOutputArgs(output_path, &args);
+  args.push_back("--");
+  args.push_back(path.c_str());
+
+  int ret;
+  std::string ret_text;
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  SecureString none;
+  return SignResult(ret, ret_text, output_path, &none);
+}
+
+GpgRetSignerInfo BaseGnupg::VerifyFile(const std::string &path,
+                                       const std::string &signature_path) {
+  GpgRetSignerInfo retobj;
+
+  LOG("GPG: In VerifyFile\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+  if (!IsReadableFile(path) ||
+      (!signature_path.empty() && !IsReadableFile(signature_path))) {
+    retobj.set_error_str(kERR_BAD_FILE);
+    return retobj;
+  }
+
+  std::vector<const char *> args;
+  args.push_back("--verify");
+  args.push_back("--");
+  if (!signature_path.empty()) {
+    args.push_back(signature_path.c_str());
+  }
+  args.push_back(path.c_str());
+
+  int ret;
+  std::string ret_text;
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  return VerifyResult(ret, ret_text);
+}
+
+/*
+ * *** BEGIN URL FUNCTIONS ***
+ *
+ * The fetch is watched like gpg while we wait for its data, so that the call
+ * can be canceled or time out before the browser is done.
+ */
+
+const char *BaseGnupg::CallGpgWithFetch(const std::vector<const char*> &args,
+                                        const std::string *extra,
+                                        GpgUrlFetch *fetch,
+                                        int *retval, std::string *output,
+                                        SecureString *data) {
+  *retval = -1;
+  GpgInputStream *input = OpenGpgWithData(args, extra);
+  if (input == NULL) {
+    LOG("GPG: Failed to start gpg for the URL\n");
+    fetch->Abandon();
+    return kERR_INTERNAL;
+  }
+
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  if (watchdog != NULL) {
+    watchdog->Watch(fetch, GpgWatchdog::CurrentOperation(), Timeout());
+  }
+  /* gpg may stop reading early, e.g. if the data isn't encrypted. */
+  bool written = true;
+  std::string chunk;
+  while (written && fetch->NextChunk(&chunk)) {
+    written = input->Write(chunk);
+  }
+  GpgWatchdog::Interruption interruption = GpgWatchdog::kNOT_INTERRUPTED;
+  if (watchdog != NULL) {
+    interruption = watchdog->Unwatch(fetch);
+  }
+  bool complete = fetch->Abandon();
+
+  if (interruption != GpgWatchdog::kNOT_INTERRUPTED) {
+    bool canceled = interruption == GpgWatchdog::kCANCELED;
+    RecordInterruption("url", canceled);
+    delete input;
+    return canceled ? kERR_CANCELED : kERR_TIMEOUT;
+  }
+  if (written && !complete) {
+    LOG("GPG: The browser didn't fetch all of the URL\n");
+    delete input;
+    return kERR_URL;
+  }
+
+  bool closed = input->Close(retval, output, data);
+  delete input;
+  return closed ? NULL : CallFailure(*retval);
+}
+
+GpgRetDecryptInfo BaseGnupg::DecryptFetch(GpgUrlFetch *fetch) {
+  GpgRetDecryptInfo retobj;
+
+  LOG("GPG: In DecryptFetch\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+  std::vector<const char *> args;
+  args.push_back("--output");
+  args.push_back("-");
+  args.push_back("--decrypt");
+
+  int ret;
+  std::string ret_text;
+  SecureString data;
+  const char *error = CallGpgWithFetch(args, NULL, fetch, &ret, &ret_text,
+                                       &data);
+  if (error != NULL) {
+    retobj.set_error_str(error);
+    return retobj;
+  }
+
+  return DecryptResult(ret, ret_text, "", &data);
+}
+
+GpgRetSignerInfo BaseGnupg::VerifyFetch(GpgUrlFetch *fetch,
+                                        const std::string &signature) {
+  GpgRetSignerInfo retobj;
+
+  LOG("GPG: In VerifyFetch\n");
+
+  GpgStatusWatch::Scope fail_fast(FailFast());
+
+  /* As in VerifySignedText() with data pipes. */
+  std::vector<const char *> args;
+  if (signature.size()) {
+    args.push_back("--enable-special-filenames");
+  }
+  args.push_back("--verify");
+  args.push_back("--");
+  if (signature.size()) {
+    args.push_back(kGPG_EXTRA_INPUT);
+  }
+  args.push_back("-");
+
+  int ret;
+  std::string ret_text;
+  SecureString data;
+  const char *error = CallGpgWithFetch(args,
+                                       signature.size() ? &signature : NULL,
+                                       fetch, &ret, &ret_text, &data);
+  if (error != NULL) {
+    retobj.set_error_str(error);
+    return retobj;
+  }
+
+  return VerifyResult(ret, ret_text);
+}
+
+/*
+ * Fetch keyid (optionally from keyserver) onto the local keyring.
+ */
+GpgRetBool BaseGnupg::GetKey(const std::string &keyid,
+                          const std::string &keyserver) {
+  GpgRetBool retobj;
+
+  LOG("GPG: In GetKey\n");
+
+  std::vector<const char *> args;
+  if (keyserver.size()) {
+    args.push_back("--keyserver");
+    args.push_back(keyserver.c_str());
+  }
+  args.push_back("--recv-key");
+  args.push_back(keyid.c_str());
+
+  int ret;
+  std::string ret_text;
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  GpgStatusLines parsed_output;
+  ParseGpgOutput(ret_text, &parsed_output);
+
+  if (ret) {
+    if (parsed_output.size() == 0) {
+      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
+    } else if (parsed_output[0].status == kSTATUS_NODATA) {
+      LOG("GPG: Key not found\n");
+      retobj.set_error_str(kERR_NO_PUBLIC_KEY);
+    } else {
+      LOG("GPG: Unknown error in output\n");
+      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
+    }
+    return retobj;
+  }
+
+  if (parsed_output[0].status == kSTATUS_IMPORT_OK) {
+    LOG("GPG: Key already on keyring\n");
+    retobj.set_error_str(kERR_ALREADY_HAVE_KEY);
+  } else if (parsed_output[0].status == kSTATUS_IMPORTED) {
+    retobj.set_retbool(true);
+  } else {
+    retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+  }
+  return retobj;
+}
+
+/*
+ * The user IDs of a key listing. They're copied, as the listing they're in
+ * may be moved while it's still being read.
+ */
+class UidScanner : public GpgColonScanner {
+ public:
+  const std::vector<std::string> &uids() const { return uids_; }
+
+ protected:
+  virtual void Take(const GpgColonRecord &record) {
+    if (record.type == kCOLON_UID) {
+      uids_.push_back(record.Field(kCOLON_FIELD_USER_ID).as_string());
+      LOG("GPG: Got UID %s\n", uids_.back().c_str());
+    }
+  }
+
+ private:
+  std::vector<std::string> uids_;
+};
+
+/* The trust in the first primary key of a key listing. */
+class TrustScanner : public GpgColonScanner {
+ public:
+  TrustScanner() : found_(false), trust_("") {}
+
+  bool found() const { return found_; }
+  const char *trust() const { return trust_; }
+
+ protected:
+  virtual void Take(const GpgColonRecord &record) {
+    if (found_ || record.type != kCOLON_PUB) {
+      return;
+    }
+    found_ = true;
+    StringPiece validity = record.Field(kCOLON_FIELD_VALIDITY);
+    LOG("GPG: Got trust %s\n", validity.as_string().c_str());
+    switch (validity.empty() ? '\0' : validity[0]) {
+      case 'f': trust_ = "TRUST_FULL"; break;
+      case 'u': trust_ = "TRUST_ULTIMATE"; break;
+      case 'i': trust_ = "TRUST_INVALID"; break;
+      case 'r': trust_ = "TRUST_REVOKED"; break;
+      case 'e': trust_ = "TRUST_EXPIRED"; break;
+      case '-':
+      case 'q': trust_ = "TRUST_UNKNOWN"; break;
+      case 'n': trust_ = "TRUST_UNTRUSTED"; break;
+      case 'm': trust_ = "TRUST_MARGINAL"; break;
+    }
+  }
+
+ private:
+  bool found_;
+  const char *trust_;
+};
+
+/*
+ * Return an array of uids on keyid
+ */
+GpgRetUidsInfo BaseGnupg::GetUids(const std::string &keyid) {
+  GpgRetUidsInfo retobj;
+
+  LOG("GPG: In GetUids\n");
+
+#ifdef HAVE_GPGME
+  GpgmeEngine *gpgme = Gpgme();
+  if (gpgme != NULL) {
+    WatchGpgme(gpgme);
+    retobj = gpgme->GetUids(keyid);
+    SetInterrupted(UnwatchGpgme(gpgme), &retobj);
+    return retobj;
+  }
+#endif
+
+  std::vector<const char *> args;
+  args.push_back("--with-colons");
+  args.push_back("--fixed-list-mode");
+  args.push_back("--fingerprint");
+  args.push_back(keyid.c_str());
+
+  int ret;
+  std::string ret_text;
+  UidScanner uids;
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text, &uids)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  /*
+   * For --fingerprint, gpg will never output the "standard" output
+   * however, if we fail here it's almost certainly because we don't
+   * have the key.
+   */
+  if (ret) {
+    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
+    return retobj;
+  }
+
+  LOG("GPG: Processing this: \"%s\"\n", ret_text.c_str());
+  uids.Finish(ret_text);
+  for (size_t i = 0; i < uids.uids().size(); i++) {
+    retobj.add_uid(uids.uids()[i]);
+  }
+
+  for (size_t i = 0; i < retobj.uids().size(); i++) {
+    LOG("GPG: DEBUG: UID: %s\n", retobj.uids()[i].c_str());
+  }
+
+  return retobj;
+}
+
+/*
+ * For verification: returns the fingerprint of keyid
+ */
+GpgRetString BaseGnupg::GetFingerprint(const std::string &keyid) {
+  GpgRetString retobj;
+
+  LOG("GPG: In GetFingerprint\n");
+
+#ifdef HAVE_GPGME
+  GpgmeEngine *gpgme = Gpgme();
+  if (gpgme != NULL) {
+    WatchGpgme(gpgme);
+    retobj = gpgme->GetFingerprint(keyid);
+    SetInterrupted(UnwatchGpgme(gpgme), &retobj);
+    return retobj;
+  }
+#endif
+
+  std::vector<const char *> args;
+  args.push_back("--fingerprint");
+  args.push_back(keyid.c_str());
+
+  int ret;
+  std::string ret_text;
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  /*
+   * for --fingerprint, gpg will never output the "standard" output
+   * however, if we fail here it's almost certainly because we don't
+   * have the key.
+   */
+  if (ret) {
+    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
+    return retobj;
+  }
+
+  retobj.set_retstring(ret_text);
+
+  return retobj;
+}
+
+/*
+ * Returns the trust value of keyid
+ */
+GpgRetString BaseGnupg::GetTrust(const std::string &keyid) {
+  GpgRetString retobj;
+
+  LOG("GPG: In GetFingerprint\n");
+
+#ifdef HAVE_GPGME
+  GpgmeEngine *gpgme = Gpgme();
+  if (gpgme != NULL) {
+    WatchGpgme(gpgme);
+    retobj = gpgme->GetTrust(keyid);
+    SetInterrupted(UnwatchGpgme(gpgme), &retobj);
+    return retobj;
+  }
+#endif
+
+  std::vector<const char *> args;
+  args.push_back("--fixed-list-mode");
+  args.push_back("--with-colons");
+  args.push_back("--list-keys");
+  args.push_back(keyid.c_str());
+
+  int ret;
+  std::string ret_text;
+  TrustScanner trust;
+  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text, &trust)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+
+  /*
+   * for --list-keys, gpg will never output the "standard" output
+   * however, if we fail here it's almost certainly because we don't
+   * have the key.
+   */
+  if (ret) {
+    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
+    return retobj;
+  }
+
+  LOG("GPG: Processing this: \"%s\"\n", ret_text.c_str());
+  trust.Finish(ret_text);
+  if (trust.found()) {
+    retobj.set_retstring(trust.trust());
+  }
+
+  return retobj;
+}
+
+/*
+ * This will sign uid <uid> on key <keyid> at level <level>.
+ * It uses the --edit-key functionality for interactive conversation
+ * with gpg.
+ */
+GpgRetBool BaseGnupg::SignUid(const std::string &keyid, const std::string &uid,
+                              const std::string &level) {
+  GpgRetBool retobj;
+  /*
+   * We use a goto below, which means all initialization has to be up-top.
+   */
+  std::string line;
+  GpgStatusLine parsed_line;
+  int ret;
+
+  LOG("GPG: In SignUid\n");
+
+  std::vector<const char *>args;
+  args.push_back("--default-cert-level");
+  args.push_back(level.c_str());
+  args.push_back("--edit-key");
+  args.push_back(keyid.c_str());
+
+  GpgSession *session = CallGpg(args);
+
+  if (session == NULL) {
+    LOG("GPG: Failed to execute\n");
+    retobj.set_error_str(kERR_INTERNAL);
+    return retobj;
+  }
+
+  if (!ExpectString(session, kSTATUS_GET_LINE)) {
+    goto unexpected;
+  }
+
+  /*
+   * FIXME: Why doesn't writing with streams work?
+   */
+  LOG("GPG: Choosing uid %s\n", uid.c_str());
+  session->out() << uid << std::endl;
+
+  if (!ExpectString(session, kSTATUS_GOT_IT)) {
+    goto unexpected;
+  }
+  if (!ExpectString(session, kSTATUS_GET_LINE)) {
+    goto unexpected;
+  }
+
+  LOG("GPG: Issueing sign command\n");
+  session->out() << "sign" << std::endl;
+
+  if (!ExpectString(session, kSTATUS_GOT_IT)) {
+    goto unexpected;
+  }
+
+  if (!std::getline(session->in(), line)) {
+    goto unexpected;
+  }
+  if (!ParseGpgLine(line, &parsed_line)) {
+    goto unexpected;
+  }
+
+  if (parsed_line.status == kSTATUS_ALREADY_SIGNED) {
+    retobj.set_error_str(kERR_ALREADY_SIGNED);
+    session->out() << "exit" << std::endl;
+    WaitOnGpg(session);
+    return retobj;
+  } else if (parsed_line.status != kSTATUS_GET_BOOL) {
+    LOG("GPG: Expected %s, got %.*s\n", StatusName(kSTATUS_GET_BOOL),
+        static_cast<int>(parsed_line.keyword.size()),
+        parsed_line.keyword.data());
+    goto unexpected;
+  }
+
+  LOG("GPG: Confirming sign\n");
+  session->out() << "Y" << std::endl;
+
+  if (!ExpectString(session, kSTATUS_GOT_IT)) {
+    goto unexpected;
+  }
+  if (!ExpectString(session, kSTATUS_USERID_HINT)) {
+    goto unexpected;
+  }
+  if (!ExpectString(session, kSTATUS_NEED_PASSPHRASE)) {
+    goto unexpected;
+  }
+
+  /*
+   * NOTE:
+   * In the current version of gpg/gpg-agent, the agent will prompt
+   * 3 times *BUT* will return "BAD_PASSPHRASE" after the first one.
+   *
+   * To make matters worse, if a good passphrase is specified, no further
+   * feedback is given, so all we can do is report back to the user it
+   * didn't work.
+   *
+   * This is made slightly better , since once the agent has the right
+   * passphrase, it won't prompt on the next try it'll "just work"
+   *
+   * If they fix this in the future, we'll loop on this until
+   * we get an exit condition.
+   */
+  if (!std::getline(session->in(), line)) {
+    goto unexpected;
+  }
+  if (!ParseGpgLine(line, &parsed_line)) {
+    goto unexpected;
+  }
+  if (parsed_line.status == kSTATUS_BAD_PASSPHRASE) {
+    retobj.set_error_str(kERR_BAD_PASSPHRASE);
+    session->out() << "exit" << std::endl;
+    WaitOnGpg(session);
+    return retobj;
+  } else if (parsed_line.status != kSTATUS_GOOD_PASSPHRASE) {
+    LOG("GPG: Expected %s, got %.*s\n", StatusName(kSTATUS_GOOD_PASSPHRASE),
+        static_cast<int>(parsed_line.keyword.size()),
+        parsed_line.keyword.data());
+    goto unexpected;
+  }
+
+  if (!ExpectString(session, kSTATUS_GET_LINE)) {
+    goto unexpected;
+  }
+
+  LOG("GPG: Saving key\n");
+  session->out() << "save" << std::endl;
+
+  /*
+   * No need to check return values here, GPG gave us feedback the whole way,
+   * unless it was given up on while saving.
+   */
+  ret = WaitOnGpg(session);
+  if (CallAbandoned(ret)) {
+    retobj.set_error_str(CallFailure(ret));
+    return retobj;
+  }
+  retobj.set_retbool(true);
+  return retobj;
+
+ unexpected:
+    /* Output stops early when gpg has been terminated by the watchdog. */
+    session->Kill();
+    ret = WaitOnGpg(session);
+    if (ret == kGPG_TIMED_OUT || ret == kGPG_CANCELED) {
+      retobj.set_error_str(CallFailure(ret));
+    } else {
+      retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+    }
+    return retobj;
+}
 
-  std::vector< std::vector<std::string> > parsed_output;
-  ParseGpgOutput(ret_text, &parsed_output);
+GpgRetBool BaseGnupg::SetConfigValue(const std::string &key,
+                                     const std::string &value) {
+  GpgRetBool retobj;
 
-  std::vector<std::string> expected;
-  expected.push_back(kGPG_USERID_HINT);
-  expected.push_back(kGPG_NEED_PASSPHRASE);
-  expected.push_back(kGPG_GOOD_PASSPHRASE);
-  expected.push_back(kGPG_BEGIN_SIGNING);
-  expected.push_back(kGPG_SIG_CREATED);
+  retobj.set_retbool(preferences_.SetDirective(key, value));
 
-  if (!CheckForOrderedOutput(expected, parsed_output)) {
-    LOG("GPG: CheckForOrderedOutput returned false\n");
-    retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
-    return retobj;
-  }
+  return retobj;
+}
 
-  std::string data;
-  LOG("GPG: Reading output files\n");
-  if (!ReadFileToString(res_file.c_str(), &data)) {
-    retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    return retobj;
-  }
+GpgRetString BaseGnupg::GetStats() {
+  GpgRetString retobj;
 
-  retobj.set_retstring(data);
+  PR_Lock(lock_);
+  retobj.set_retstring(stats_.ToString());
+  PR_Unlock(lock_);
 
   return retobj;
 }
 
 /*
- * Given cipher text, decrypt it.
+ * *** BEGIN ASYNCHRONOUS CALLS ***
  *
- * If the ciphertext has a signature in it, we will verify it
- * and set the same entries in the return object that we would
- * in VerifySignedText()
+ * The asynchronous methods run the synchronous ones on a GpgWorkerPool
+ * thread, on the object that Gnupg::ForCurrentThread() returns there, and
+ * then pass what they returned to a JavaScript callback on the main thread.
  */
-GpgRetDecryptInfo BaseGnupg::DecryptText(const std::string &cipher_text) {
-  GpgRetDecryptInfo retobj;
 
-  LOG("GPG: In DecryptText\n");
+class GnupgCompletionQueue;
 
-  LOG("GPG: Opening tmp files\n");
+/*
+ * Every GnupgCompletionQueue there is, including those whose object or plugin
+ * instance is gone, so that their drains can be posted to another instance or
+ * done when the plugin shuts down. Protected by queues_lock, as are the
+ * members of the queues that say where they stand.
+ */
+static PRCallOnceType queues_once;
+static PRLock *queues_lock = NULL;
+static std::set<GnupgCompletionQueue *> *queues = NULL;
+
+static PRStatus InitQueues() {
+  queues_lock = PR_NewLock();
+  queues = new std::set<GnupgCompletionQueue *>();
+  return queues_lock == NULL ? PR_FAILURE : PR_SUCCESS;
+}
 
-  std::string cipher_file = kTMP_RAW_TEXT;
-  TmpWrapper cipher_wrapper;
-  if (!cipher_wrapper.CreateAndWriteTmpFile(cipher_text, &cipher_file)) {
-    retobj.set_error_str(kERR_INTERNAL);
+/* Returns queues_lock, or NULL if it couldn't be created. */
+static PRLock *QueuesLock() {
+  if (PR_CallOnce(&queues_once, InitQueues) == PR_FAILURE) {
+    return NULL;
   }
+  return queues_lock;
+}
 
-  std::string raw_file = cipher_file;
-  raw_file.append(".plain");
-
-  /* Make sure gpg doesn't write to an existing file. */
-  TmpWrapper raw_wrapper;
-  raw_wrapper.UnlinkAndTrackFile(raw_file);
+/*
+ * Completes the calls made on a Gnupg object by having the browser drain it on
+ * the main thread. Outlives the object if calls are still running when it goes
+ * away, and then throws away the counters and results they collected.
+ *
+ * The browser drops the calls posted to a plugin instance that it destroys,
+ * so once the instance is gone, drains are posted to another one. If there's
+ * none, the queue is drained by whichever instance is destroyed next, or when
+ * the plugin shuts down.
+ */
+class GnupgCompletionQueue : public GpgCompletionQueue {
+ public:
+  GnupgCompletionQueue(NPP npp, Gnupg *origin)
+      : npp_(npp),
+        origin_(origin),
+        instance_gone_(false),
+        posted_to_(NULL),
+        parked_(false) {
+    PRLock *lock = QueuesLock();
+    if (lock != NULL) {
+      PR_Lock(lock);
+      queues->insert(this);
+      PR_Unlock(lock);
+    }
+  }
 
-  std::vector<const char *> args;
-  args.push_back("--output");
-  args.push_back(raw_file.c_str());
-  args.push_back("--decrypt");
-  args.push_back(cipher_file.c_str());
+  /* The plugin instance the calls were made in, or NULL if it's gone. */
+  NPP npp() const {
+    return npp_;
+  }
 
-  int ret;
-  std::string ret_text;
-  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+  /* The object the calls were made on, or NULL if it's gone. */
+  Gnupg *origin() const {
+    return origin_;
   }
 
-  std::vector< std::vector<std::string> > parsed_output;
-  ParseGpgOutput(ret_text, &parsed_output);
+  /*
+   * Whether the object or plugin instance that the calls were made on is
+   * gone, so that nobody is waiting for their results any more.
+   */
+  bool orphaned() const {
+    return origin_ == NULL || instance_gone_;
+  }
 
-  bool is_signed = false;
-  if (CheckForSingleOutput(kGPG_SIG_ID, parsed_output)) {
-    is_signed = true;
+  /*
+   * Forget the object, which is going away, and cancel the calls made on it
+   * that are still queued or running.
+   */
+  void Orphan() {
+    origin_ = NULL;
+    GpgWatchdog *watchdog = GpgWatchdog::Instance();
+    if (watchdog != NULL) {
+      watchdog->CancelAll(this);
+    }
   }
 
-  if (ret) {
-    if (parsed_output.size() == 0) {
-      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    } else if (CheckForSingleOutput(kGPG_DECRYPTION_FAILED, parsed_output)) {
-      LOG(("GPG: Private key not available\n"));
-      retobj.set_error_str(kERR_NO_SECRET_KEY);
-    } else if (is_signed) {
-      if (CheckForSingleOutput(kGPG_BADSIG, parsed_output)) {
-        retobj.set_error_str(kERR_BAD_SIGNATURE);
-      } else if (CheckForSingleOutput(kGPG_NODATA, parsed_output)) {
-        retobj.set_error_str(kERR_SIGNATURE_ERR);
+  /*
+   * Called on the main thread when plugin instance |npp| is being destroyed,
+   * or with NULL when the plugin shuts down. Drains the queues whose drain is
+   * never going to be called: those posted to |npp|, and those that had
+   * nowhere to be posted to.
+   */
+  static void InstanceDestroyed(NPP npp) {
+    PRLock *lock = QueuesLock();
+    if (lock == NULL) {
+      return;
+    }
+    std::vector<GnupgCompletionQueue *> undrained;
+    PR_Lock(lock);
+    for (std::set<GnupgCompletionQueue *>::iterator it = queues->begin();
+         it != queues->end(); ++it) {
+      GnupgCompletionQueue *queue = *it;
+      if (npp != NULL && queue->npp_ == npp) {
+        queue->npp_ = NULL;
+        queue->instance_gone_ = true;
+      }
+      if ((npp != NULL && queue->posted_to_ == npp) || queue->parked_) {
+        queue->posted_to_ = NULL;
+        queue->parked_ = false;
+        undrained.push_back(queue);
       }
-    } else {
-      LOG("GPG: Decryption failed for unknown reasons, is_signed: %d\n",
-          is_signed);
-      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
     }
-    return retobj;
+    PR_Unlock(lock);
+    for (size_t i = 0; i < undrained.size(); i++) {
+      DrainAndUnref(undrained[i]);
+    }
   }
 
-  std::vector<std::string> expected;
-  expected.push_back(kGPG_ENC_TO);
-  expected.push_back(kGPG_USERID_HINT);
-  expected.push_back(kGPG_PLAINTEXT);
-  expected.push_back(kGPG_PLAINTEXT_LENGTH);
-  expected.push_back(kGPG_DECRYPTION_OKAY);
-  expected.push_back(kGPG_END_DECRYPTION);
-
-  if (!CheckForUnorderedOutput(expected, parsed_output)) {
-    LOG(("GPG: CheckRequiredOutput failed for decryption check\n"));
-    retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
-    return retobj;
+ protected:
+  ~GnupgCompletionQueue() {
+    PRLock *lock = QueuesLock();
+    if (lock != NULL) {
+      PR_Lock(lock);
+      queues->erase(this);
+      PR_Unlock(lock);
+    }
   }
 
-  if (is_signed) {
-    expected.clear();
-    expected.push_back(kGPG_GOODSIG);
-    expected.push_back(kGPG_VALIDSIG);
-    if (!CheckForUnorderedOutput(expected, parsed_output)) {
-      LOG(("GPG: CheckRequiredOutput failed for signing check (in decrypt)\n"));
-      retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
-      return retobj;
+  void PostDrain() {
+    PRLock *lock = QueuesLock();
+    if (lock == NULL) {
+      NPN_PluginThreadAsyncCall(npp_, DrainAndUnref, this);
+      return;
+    }
+    PR_Lock(lock);
+    NPP npp = npp_;
+    for (std::set<GnupgCompletionQueue *>::iterator it = queues->begin();
+         npp == NULL && it != queues->end(); ++it) {
+      npp = (*it)->npp_;
     }
+    if (npp != NULL) {
+      posted_to_ = npp;
+      NPN_PluginThreadAsyncCall(npp, Posted, this);
+    } else {
+      parked_ = true;
+    }
+    PR_Unlock(lock);
+  }
 
-    std::vector<std::string> line_parts;
-    SplitOnSpaces(parsed_output[8][1], &line_parts);
+ private:
+  static void Posted(void *queue) {
+    GnupgCompletionQueue *self = static_cast<GnupgCompletionQueue *>(queue);
+    PR_Lock(queues_lock);
+    self->posted_to_ = NULL;
+    PR_Unlock(queues_lock);
+    DrainAndUnref(self);
+  }
 
-    /* Everything after the first part is the signer. */
-    std::string signer = "";
-    for (size_t i = 1; i < line_parts.size(); i++) {
-      if (i > 1) {
-        signer += " ";
-      }
-      signer += line_parts[i];
-    }
+  NPP npp_;
+  Gnupg *origin_;
+  bool instance_gone_;
+  /* The instance a drain has been posted to and not yet called in. */
+  NPP posted_to_;
+  /* Whether a drain is due that there was no instance to post to. */
+  bool parked_;
+};
 
-    retobj.set_signer(signer);
+/*
+ * A call made on |origin|, which runs with the preferences that |origin| had
+ * at the time.
+ */
+class GnupgTask : public GpgAsyncTask {
+ public:
+  /*
+   * The call is an operation of |queue| for the GpgWatchdog, so that it can
+   * be canceled through the object it was made on.
+   */
+  GnupgTask(Gnupg *origin, GnupgCompletionQueue *queue)
+      : preferences_(origin->preferences_),
+        queue_(queue),
+        watchdog_(GpgWatchdog::Instance()),
+        operation_(watchdog_ == NULL ? 0 : watchdog_->NewOperation(queue)) {
+  }
 
-    retobj.set_trust_level(parsed_output[10][0]);
+  /* The handle of the operation, for Cancel(). */
+  PRInt32 operation() const {
+    return operation_;
   }
 
-  retobj.set_debug(ret_text);
+  void Run() {
+    if (watchdog_ != NULL && watchdog_->IsCanceled(operation_)) {
+      stats_.RecordInterruption("queued", true);
+      Fail(kERR_CANCELED);
+      return;
+    }
+    Gnupg *gnupg = Gnupg::ForCurrentThread();
+    if (gnupg == NULL) {
+      Fail(kERR_INTERNAL);
+      return;
+    }
+    gnupg->preferences_ = preferences_;
+    gnupg->stats_ = GpgStats();
+    GpgWatchdog::SetCurrentOperation(operation_);
+    Call(gnupg);
+    GpgWatchdog::SetCurrentOperation(0);
+    stats_ = gnupg->stats_;
+    PR_Lock(gnupg->lock_);
+    results_.swap(gnupg->results_);
+    gnupg->results_.clear();
+    PR_Unlock(gnupg->lock_);
+  }
 
-  std::string data;
-  if (!ReadFileToString(raw_file.c_str(), &data)) {
-    retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    return retobj;
+  void Complete() {
+    if (watchdog_ != NULL) {
+      watchdog_->EndOperation(operation_);
+    }
+    Gnupg *origin = queue_->origin();
+    if (origin != NULL) {
+      origin->MergeStats(stats_);
+      origin->AdoptResults(&results_);
+    }
+    results_.clear();
+    /* The callback of an orphaned call is released without being run. */
+    if (!queue_->orphaned()) {
+      Deliver();
+    }
   }
 
-  retobj.set_data(data);
-  return retobj;
+ protected:
+  /* Make the call on |gnupg| and keep what it returns. */
+  virtual void Call(Gnupg *gnupg) = 0;
+  /* Have the call return |error| instead. */
+  virtual void Fail(const char *error) = 0;
+  virtual void Deliver() = 0;
+
+ private:
+  GpgPreferences preferences_;
+  GpgStats stats_;
+  /* The results that the call kept, see BaseGnupg::KeepLargeResult(). */
+  std::map<int, SecureString> results_;
+  GnupgCompletionQueue *queue_;
+  GpgWatchdog *watchdog_;
+  PRInt32 operation_;
+};
+
+/* Have |ret| say |error|, or all of the results of a batch. */
+template <class Ret>
+static void SetCallError(Ret *ret, const char *error) {
+  ret->set_error_str(error);
 }
 
-/*
- * Fetch keyid (optionally from keyserver) onto the local keyring.
- */
-GpgRetBool BaseGnupg::GetKey(const std::string &keyid,
-                          const std::string &keyserver) {
-  GpgRetBool retobj;
-
-  LOG("GPG: In GetKey\n");
-
-  std::vector<const char *> args;
-  if (keyserver.size()) {
-    args.push_back("--keyserver");
-    args.push_back(keyserver.c_str());
+template <class Ret>
+static void SetCallError(std::vector<Ret> *ret, const char *error) {
+  for (size_t i = 0; i < ret->size(); i++) {
+    (*ret)[i].set_error_str(error);
   }
-  args.push_back("--recv-key");
-  args.push_back(keyid.c_str());
+}
 
-  int ret;
-  std::string ret_text;
-  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+template <class Ret>
+class GnupgCall : public GnupgTask {
+ public:
+  GnupgCall(Gnupg *origin, GnupgCompletionQueue *queue,
+            GpgCallback<Ret> *on_done)
+      : GnupgTask(origin, queue),
+        on_done_(on_done) {
   }
 
-  std::vector< std::vector<std::string> > parsed_output;
-  ParseGpgOutput(ret_text, &parsed_output);
+  ~GnupgCall() {
+    delete on_done_;
+  }
 
-  if (ret) {
-    if (parsed_output.size() == 0) {
-      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    } else if (parsed_output[0][0] == kGPG_NODATA) {
-      LOG("GPG: Key not found\n");
-      retobj.set_error_str(kERR_NO_PUBLIC_KEY);
-    } else {
-      LOG("GPG: Unknown error in output\n");
-      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
-    }
-    return retobj;
+ protected:
+  void Fail(const char *error) {
+    SetCallError(&ret_, error);
   }
 
-  if (parsed_output[0][0] == kGPG_IMPORT_OK) {
-    LOG("GPG: Key already on keyring\n");
-    retobj.set_error_str(kERR_ALREADY_HAVE_KEY);
-  } else if (parsed_output[0][0] == kGPG_IMPORTED) {
-    retobj.set_retbool(true);
-  } else {
-    retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+  void Deliver() {
+    if (on_done_ != NULL) {
+      on_done_->Run(ret_);
+    }
   }
-  return retobj;
-}
 
-/*
- * Return an array of uids on keyid
- */
-GpgRetUidsInfo BaseGnupg::GetUids(const std::string &keyid) {
-  GpgRetUidsInfo retobj;
+  Ret ret_;
 
-  LOG("GPG: In GetUids\n");
+ private:
+  GpgCallback<Ret> *on_done_;
+};
 
-  std::vector<const char *> args;
-  args.push_back("--with-colons");
-  args.push_back("--fixed-list-mode");
-  args.push_back("--fingerprint");
-  args.push_back(keyid.c_str());
+class GetGnupgVersionCall : public GnupgCall<GpgRetString> {
+ public:
+  GetGnupgVersionCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                      GpgRetStringCallback *on_done)
+      : GnupgCall<GpgRetString>(origin, queue, on_done) {
+  }
 
-  int ret;
-  std::string ret_text;
-  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->GetGnupgVersion();
+  }
+};
+
+class SignTextCall : public GnupgCall<GpgRetString> {
+ public:
+  SignTextCall(Gnupg *origin, GnupgCompletionQueue *queue,
+               GpgRetStringCallback *on_done, const std::string &rawtext,
+               const std::string &keyid, bool clearsign)
+      : GnupgCall<GpgRetString>(origin, queue, on_done),
+        rawtext_(rawtext),
+        keyid_(keyid),
+        clearsign_(clearsign) {
   }
 
-  /*
-   * For --fingerprint, gpg will never output the "standard" output
-   * however, if we fail here it's almost certainly because we don't
-   * have the key.
-   */
-  if (ret) {
-    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
-    return retobj;
+  /* The calls' copies of plain texts are wiped before they're freed. */
+  ~SignTextCall() {
+    WipeString(&rawtext_);
   }
 
-  LOG("GPG: Processing this: \"%s\"\n", ret_text.c_str());
-  std::vector<std::string> lines;
-  SplitOnChar(ret_text, '\n', &lines);
-  for (size_t i = 0; i < lines.size(); i++) {
-    std::vector<std::string> parts;
-    SplitOnChar(lines[i], ':', &parts);
-    if (parts[0] == "uid") {
-      LOG("GPG: Got UID %s\n", parts[9].c_str());
-      retobj.add_uid(parts[9]);
-    } else {
-      LOG("GPG: skipping non-uid line\n");
-    }
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->SignText(rawtext_, keyid_, clearsign_);
   }
 
-  for (size_t i = 0; i < retobj.uids().size(); i++) {
-    LOG("GPG: DEBUG: UID: %s\n", retobj.uids()[i].c_str());
+ private:
+  std::string rawtext_;
+  std::string keyid_;
+  bool clearsign_;
+};
+
+class VerifySignedTextCall : public GnupgCall<GpgRetSignerInfo> {
+ public:
+  VerifySignedTextCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                       GpgRetSignerInfoCallback *on_done,
+                       const std::string &signed_text,
+                       const std::string &signature)
+      : GnupgCall<GpgRetSignerInfo>(origin, queue, on_done),
+        signed_text_(signed_text),
+        signature_(signature) {
   }
 
-  return retobj;
-}
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->VerifySignedText(signed_text_, signature_);
+  }
 
-/*
- * For verification: returns the fingerprint of keyid
- */
-GpgRetString BaseGnupg::GetFingerprint(const std::string &keyid) {
-  GpgRetString retobj;
+ private:
+  std::string signed_text_;
+  std::string signature_;
+};
+
+class EncryptTextCall : public GnupgCall<GpgRetEncryptInfo> {
+ public:
+  EncryptTextCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                  GpgRetEncryptInfoCallback *on_done,
+                  const std::string &rawtext,
+                  const std::vector<std::string> &keyids,
+                  const std::vector<std::string> &hidden_keyids,
+                  bool always_trust, const std::string &sign,
+                  const std::string &compression)
+      : GnupgCall<GpgRetEncryptInfo>(origin, queue, on_done),
+        rawtext_(rawtext),
+        keyids_(keyids),
+        hidden_keyids_(hidden_keyids),
+        always_trust_(always_trust),
+        sign_(sign),
+        compression_(compression) {
+  }
 
-  LOG("GPG: In GetFingerprint\n");
+  ~EncryptTextCall() {
+    WipeString(&rawtext_);
+  }
 
-  std::vector<const char *> args;
-  args.push_back("--fingerprint");
-  args.push_back(keyid.c_str());
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->EncryptTextCompressed(rawtext_, keyids_, hidden_keyids_,
+                                        always_trust_, sign_, compression_);
+  }
 
-  int ret;
-  std::string ret_text;
-  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+ private:
+  std::string rawtext_;
+  std::vector<std::string> keyids_;
+  std::vector<std::string> hidden_keyids_;
+  bool always_trust_;
+  std::string sign_;
+  std::string compression_;
+};
+
+class DecryptTextCall : public GnupgCall<GpgRetDecryptInfo> {
+ public:
+  DecryptTextCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                  GpgRetDecryptInfoCallback *on_done,
+                  const std::string &cipher_text)
+      : GnupgCall<GpgRetDecryptInfo>(origin, queue, on_done),
+        cipher_text_(cipher_text) {
   }
 
-  /*
-   * for --fingerprint, gpg will never output the "standard" output
-   * however, if we fail here it's almost certainly because we don't
-   * have the key.
-   */
-  if (ret) {
-    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
-    return retobj;
+  ~DecryptTextCall() {
+    WipeString(ret_.mutable_data());
   }
 
-  retobj.set_retstring(ret_text);
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->DecryptText(cipher_text_);
+  }
 
-  return retobj;
-}
+ private:
+  std::string cipher_text_;
+};
 
 /*
- * Returns the trust value of keyid
+ * The batch calls start out with a result for each input, so that they have
+ * one to fail if they don't get to run.
  */
-GpgRetString BaseGnupg::GetTrust(const std::string &keyid) {
-  GpgRetString retobj;
+class VerifySignedTextBatchCall
+    : public GnupgCall<std::vector<GpgRetSignerInfo> > {
+ public:
+  VerifySignedTextBatchCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                            GpgRetSignerInfoBatchCallback *on_done,
+                            const std::vector<std::string> &signed_texts,
+                            const std::vector<std::string> &signatures)
+      : GnupgCall<std::vector<GpgRetSignerInfo> >(origin, queue, on_done),
+        signed_texts_(signed_texts),
+        signatures_(signatures) {
+    ret_.resize(signed_texts.size());
+  }
 
-  LOG("GPG: In GetFingerprint\n");
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->VerifySignedTextBatch(signed_texts_, signatures_);
+  }
 
-  std::vector<const char *> args;
-  args.push_back("--fixed-list-mode");
-  args.push_back("--with-colons");
-  args.push_back("--list-keys");
-  args.push_back(keyid.c_str());
+ private:
+  std::vector<std::string> signed_texts_;
+  std::vector<std::string> signatures_;
+};
+
+class EncryptTextBatchCall
+    : public GnupgCall<std::vector<GpgRetEncryptInfo> > {
+ public:
+  EncryptTextBatchCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                       GpgRetEncryptInfoBatchCallback *on_done,
+                       const std::vector<std::string> &rawtexts,
+                       const std::vector<std::string> &keyids,
+                       const std::vector<std::string> &hidden_keyids,
+                       bool always_trust, const std::string &sign)
+      : GnupgCall<std::vector<GpgRetEncryptInfo> >(origin, queue, on_done),
+        rawtexts_(rawtexts),
+        keyids_(keyids),
+        hidden_keyids_(hidden_keyids),
+        always_trust_(always_trust),
+        sign_(sign) {
+    ret_.resize(rawtexts.size());
+  }
 
-  int ret;
-  std::string ret_text;
-  if (!CallReadAndWaitOnGpg(args, &ret, &ret_text)) {
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+  ~EncryptTextBatchCall() {
+    for (size_t i = 0; i < rawtexts_.size(); i++) {
+      WipeString(&rawtexts_[i]);
+    }
   }
 
-  /*
-   * for --list-keys, gpg will never output the "standard" output
-   * however, if we fail here it's almost certainly because we don't
-   * have the key.
-   */
-  if (ret) {
-    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
-    return retobj;
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->EncryptTextBatch(rawtexts_, keyids_, hidden_keyids_,
+                                   always_trust_, sign_);
   }
 
-  LOG("GPG: Processing this: \"%s\"\n", ret_text.c_str());
-  std::vector<std::string> lines;
-  SplitOnChar(ret_text, '\n', &lines);
-  for (size_t i = 0; i < lines.size(); i++) {
-    std::vector<std::string> parts;
-    SplitOnChar(lines[i], ':', &parts);
-    if (parts[0] == "pub") {
-      LOG("GPG: Got trust %s\n", parts[1].c_str());
-      std::string trust;
-      switch (parts[1].c_str()[0]) {
-        case 'f': trust = "TRUST_FULL"; break;
-        case 'u': trust = "TRUST_ULTIMATE"; break;
-        case 'i': trust = "TRUST_INVALID"; break;
-        case 'r': trust = "TRUST_REVOKED"; break;
-        case 'e': trust = "TRUST_EXPIRED"; break;
-        case '-':
-        case 'q': trust = "TRUST_UNKNOWN"; break;
-        case 'n': trust = "TRUST_UNTRUSTED"; break;
-        case 'm': trust = "TRUST_MARGINAL"; break;
-      }
-      retobj.set_retstring(trust);
-      break;
-    } else {
-      LOG("GPG: skipping non-pub line\n");
+ private:
+  std::vector<std::string> rawtexts_;
+  std::vector<std::string> keyids_;
+  std::vector<std::string> hidden_keyids_;
+  bool always_trust_;
+  std::string sign_;
+};
+
+class DecryptTextBatchCall
+    : public GnupgCall<std::vector<GpgRetDecryptInfo> > {
+ public:
+  DecryptTextBatchCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                       GpgRetDecryptInfoBatchCallback *on_done,
+                       const std::vector<std::string> &cipher_texts)
+      : GnupgCall<std::vector<GpgRetDecryptInfo> >(origin, queue, on_done),
+        cipher_texts_(cipher_texts) {
+    ret_.resize(cipher_texts.size());
+  }
+
+  ~DecryptTextBatchCall() {
+    for (size_t i = 0; i < ret_.size(); i++) {
+      WipeString(ret_[i].mutable_data());
     }
   }
 
-  return retobj;
-}
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->DecryptTextBatch(cipher_texts_);
+  }
 
-/*
- * This will sign uid <uid> on key <keyid> at level <level>.
- * It uses the --edit-key functionality for interactive conversation
- * with gpg.
- */
-GpgRetBool BaseGnupg::SignUid(const std::string &keyid, const std::string &uid,
-                              const std::string &level) {
-  GpgRetBool retobj;
-  /*
-   * We use a goto below, which means all initialization has to be up-top.
-   */
-  std::string line;
-  std::vector<std::string> parsed_line;
+ private:
+  std::vector<std::string> cipher_texts_;
+};
+
+class GetKeyCall : public GnupgCall<GpgRetBool> {
+ public:
+  GetKeyCall(Gnupg *origin, GnupgCompletionQueue *queue,
+             GpgRetBoolCallback *on_done, const std::string &keyid,
+             const std::string &keyserver)
+      : GnupgCall<GpgRetBool>(origin, queue, on_done),
+        keyid_(keyid),
+        keyserver_(keyserver) {
+  }
 
-  LOG("GPG: In SignUid\n");
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->GetKey(keyid_, keyserver_);
+  }
 
-  std::vector<const char *>args;
-  args.push_back("--default-cert-level");
-  args.push_back(level.c_str());
-  args.push_back("--edit-key");
-  args.push_back(keyid.c_str());
+ private:
+  std::string keyid_;
+  std::string keyserver_;
+};
+
+class GetUidsCall : public GnupgCall<GpgRetUidsInfo> {
+ public:
+  GetUidsCall(Gnupg *origin, GnupgCompletionQueue *queue,
+              GpgRetUidsInfoCallback *on_done, const std::string &keyid)
+      : GnupgCall<GpgRetUidsInfo>(origin, queue, on_done),
+        keyid_(keyid) {
+  }
+
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->GetUids(keyid_);
+  }
+
+ private:
+  std::string keyid_;
+};
 
-  PRProcess *process = CallGpg(args);
+class GetFingerprintCall : public GnupgCall<GpgRetString> {
+ public:
+  GetFingerprintCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                     GpgRetStringCallback *on_done, const std::string &keyid)
+      : GnupgCall<GpgRetString>(origin, queue, on_done),
+        keyid_(keyid) {
+  }
 
-  if (process == NULL) {
-    LOG("GPG: Failed to execute\n");
-    retobj.set_error_str(kERR_INTERNAL);
-    return retobj;
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->GetFingerprint(keyid_);
   }
 
-  if (!ExpectString(kGPG_PROMPT)) {
-    goto unexpected;
+ private:
+  std::string keyid_;
+};
+
+class GetTrustCall : public GnupgCall<GpgRetString> {
+ public:
+  GetTrustCall(Gnupg *origin, GnupgCompletionQueue *queue,
+               GpgRetStringCallback *on_done, const std::string &keyid)
+      : GnupgCall<GpgRetString>(origin, queue, on_done),
+        keyid_(keyid) {
   }
 
-  /*
-   * FIXME: Why doesn't writing with streams work?
-   */
-  LOG("GPG: Choosing uid %s\n", uid.c_str());
-  *outstream_ << uid << std::endl;
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->GetTrust(keyid_);
+  }
 
-  if (!ExpectString(kGPG_ACK)) {
-    goto unexpected;
+ private:
+  std::string keyid_;
+};
+
+class SignUidCall : public GnupgCall<GpgRetBool> {
+ public:
+  SignUidCall(Gnupg *origin, GnupgCompletionQueue *queue,
+              GpgRetBoolCallback *on_done, const std::string &keyid,
+              const std::string &uid, const std::string &level)
+      : GnupgCall<GpgRetBool>(origin, queue, on_done),
+        keyid_(keyid),
+        uid_(uid),
+        level_(level) {
   }
-  if (!ExpectString(kGPG_PROMPT)) {
-    goto unexpected;
+
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->SignUid(keyid_, uid_, level_);
   }
 
-  LOG("GPG: Issueing sign command\n");
-  *outstream_ << "sign" << std::endl;
+ private:
+  std::string keyid_;
+  std::string uid_;
+  std::string level_;
+};
+
+class EncryptFileCall : public GnupgCall<GpgRetEncryptInfo> {
+ public:
+  EncryptFileCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                  GpgRetEncryptInfoCallback *on_done,
+                  const std::string &path, const std::string &output_path,
+                  const std::vector<std::string> &keyids,
+                  const std::vector<std::string> &hidden_keyids,
+                  bool always_trust, const std::string &sign)
+      : GnupgCall<GpgRetEncryptInfo>(origin, queue, on_done),
+        path_(path),
+        output_path_(output_path),
+        keyids_(keyids),
+        hidden_keyids_(hidden_keyids),
+        always_trust_(always_trust),
+        sign_(sign) {
+  }
 
-  if (!ExpectString(kGPG_ACK)) {
-    goto unexpected;
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->EncryptFile(path_, output_path_, keyids_, hidden_keyids_,
+                              always_trust_, sign_);
   }
 
-  if (!std::getline(*instream_, line)) {
-    goto unexpected;
+ private:
+  std::string path_;
+  std::string output_path_;
+  std::vector<std::string> keyids_;
+  std::vector<std::string> hidden_keyids_;
+  bool always_trust_;
+  std::string sign_;
+};
+
+class DecryptFileCall : public GnupgCall<GpgRetDecryptInfo> {
+ public:
+  DecryptFileCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                  GpgRetDecryptInfoCallback *on_done,
+                  const std::string &path, const std::string &output_path)
+      : GnupgCall<GpgRetDecryptInfo>(origin, queue, on_done),
+        path_(path),
+        output_path_(output_path) {
   }
-  if (!ParseGpgLine(line, &parsed_line)) {
-    goto unexpected;
+
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->DecryptFile(path_, output_path_);
   }
 
-  if (parsed_line[0] == kGPG_ALREADY_SIGNED) {
-    retobj.set_error_str(kERR_ALREADY_SIGNED);
-    *outstream_ << "exit" << std::endl;
-    WaitOnGpg(process);
-    return retobj;
-  } else if (parsed_line[0] != kGPG_CONFIRM) {
-    LOG("GPG: Expected %s, got %s\n", kGPG_CONFIRM, parsed_line[0].c_str());
-    goto unexpected;
+ private:
+  std::string path_;
+  std::string output_path_;
+};
+
+class SignFileCall : public GnupgCall<GpgRetString> {
+ public:
+  SignFileCall(Gnupg *origin, GnupgCompletionQueue *queue,
+               GpgRetStringCallback *on_done, const std::string &path,
+               const std::string &output_path, const std::string &keyid,
+               bool clearsign)
+      : GnupgCall<GpgRetString>(origin, queue, on_done),
+        path_(path),
+        output_path_(output_path),
+        keyid_(keyid),
+        clearsign_(clearsign) {
   }
 
-  LOG("GPG: Confirming sign\n");
-  *outstream_ << "Y" << std::endl;
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->SignFile(path_, output_path_, keyid_, clearsign_);
+  }
 
-  if (!ExpectString(kGPG_ACK)) {
-    goto unexpected;
+ private:
+  std::string path_;
+  std::string output_path_;
+  std::string keyid_;
+  bool clearsign_;
+};
+
+class VerifyFileCall : public GnupgCall<GpgRetSignerInfo> {
+ public:
+  VerifyFileCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                 GpgRetSignerInfoCallback *on_done, const std::string &path,
+                 const std::string &signature_path)
+      : GnupgCall<GpgRetSignerInfo>(origin, queue, on_done),
+        path_(path),
+        signature_path_(signature_path) {
   }
-  if (!ExpectString(kGPG_USERID_HINT)) {
-    goto unexpected;
+
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->VerifyFile(path_, signature_path_);
   }
-  if (!ExpectString(kGPG_NEED_PASSPHRASE)) {
-    goto unexpected;
+
+ private:
+  std::string path_;
+  std::string signature_path_;
+};
+
+/*
+ * The calls hold a reference to their fetch, and refuse the rest of its data
+ * once they're done with it.
+ */
+class DecryptUrlCall : public GnupgCall<GpgRetDecryptInfo> {
+ public:
+  DecryptUrlCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                 GpgRetDecryptInfoCallback *on_done, GpgUrlFetch *fetch)
+      : GnupgCall<GpgRetDecryptInfo>(origin, queue, on_done),
+        fetch_(fetch) {
+    fetch_->AddRef();
   }
 
-  /*
-   * NOTE:
-   * In the current version of gpg/gpg-agent, the agent will prompt
-   * 3 times *BUT* will return "BAD_PASSPHRASE" after the first one.
-   *
-   * To make matters worse, if a good passphrase is specified, no further
-   * feedback is given, so all we can do is report back to the user it
-   * didn't work.
-   *
-   * This is made slightly better , since once the agent has the right
-   * passphrase, it won't prompt on the next try it'll "just work"
-   *
-   * If they fix this in the future, we'll loop on this until
-   * we get an exit condition.
-   */
-  if (!std::getline(*instream_, line)) {
-    goto unexpected;
+  ~DecryptUrlCall() {
+    fetch_->Abandon();
+    fetch_->Release();
+    WipeString(ret_.mutable_data());
   }
-  parsed_line.clear();
-  if (!ParseGpgLine(line, &parsed_line)) {
-    goto unexpected;
+
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->DecryptFetch(fetch_);
   }
-  if (parsed_line[0] == kGPG_BAD_PASSPHRASE) {
-    retobj.set_error_str(kERR_BAD_PASSPHRASE);
-    *outstream_ << "exit" << std::endl;
-    WaitOnGpg(process);
-    return retobj;
-  } else if (parsed_line[0] != kGPG_GOOD_PASSPHRASE) {
-    LOG("GPG: Expected %s, got %s\n", kGPG_GOOD_PASSPHRASE,
-        parsed_line[0].c_str());
-    goto unexpected;
+
+ private:
+  GpgUrlFetch *fetch_;
+};
+
+class VerifyUrlCall : public GnupgCall<GpgRetSignerInfo> {
+ public:
+  VerifyUrlCall(Gnupg *origin, GnupgCompletionQueue *queue,
+                GpgRetSignerInfoCallback *on_done, GpgUrlFetch *fetch,
+                const std::string &signature)
+      : GnupgCall<GpgRetSignerInfo>(origin, queue, on_done),
+        fetch_(fetch),
+        signature_(signature) {
+    fetch_->AddRef();
   }
 
-  if (!ExpectString(kGPG_PROMPT)) {
-    goto unexpected;
+  ~VerifyUrlCall() {
+    fetch_->Abandon();
+    fetch_->Release();
   }
 
-  LOG("GPG: Saving key\n");
-  *outstream_ << "save" << std::endl;
+ protected:
+  void Call(Gnupg *gnupg) {
+    ret_ = gnupg->VerifyFetch(fetch_, signature_);
+  }
 
-  WaitOnGpg(process);
+ private:
+  GpgUrlFetch *fetch_;
+  std::string signature_;
+};
 
-  /* No need to check return values here, GPG gave us feedback the whole way */
-  retobj.set_retbool(true);
-  return retobj;
+static PRCallOnceType worker_once;
+static PRUintn worker_index;
 
- unexpected:
-    retobj.set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
-    PR_KillProcess(process);
-    WaitOnGpg(process);
-    return retobj;
+static void PR_CALLBACK DestroyWorker(void *gnupg) {
+  delete static_cast<Gnupg *>(gnupg);
 }
 
-GpgRetBool BaseGnupg::SetConfigValue(const std::string &key,
-                                     const std::string &value) {
-  GpgRetBool retobj;
+static PRStatus InitWorkers() {
+  return PR_NewThreadPrivateIndex(&worker_index, DestroyWorker);
+}
 
-  retobj.set_retbool(preferences_.SetDirective(key, value));
+Gnupg::Gnupg()
+    : completion_queue_(NULL) {
+}
 
-  return retobj;
+Gnupg::Gnupg(const Gnupg &other)
+    : BaseGnupg(other),
+      completion_queue_(NULL) {
+}
+
+Gnupg &Gnupg::operator=(const Gnupg &other) {
+  BaseGnupg::operator=(other);
+  return *this;
+}
+
+/* The streams wait on gpg through this object, so they go first. */
+Gnupg::~Gnupg() {
+  AbortStreams();
+  if (completion_queue_ != NULL) {
+    completion_queue_->Orphan();
+    completion_queue_->Unref();
+  }
+}
+
+Gnupg *Gnupg::ForCurrentThread() {
+  if (PR_CallOnce(&worker_once, InitWorkers) == PR_FAILURE) {
+    return NULL;
+  }
+
+  Gnupg *gnupg = static_cast<Gnupg *>(PR_GetThreadPrivate(worker_index));
+  if (gnupg == NULL) {
+    gnupg = new Gnupg();
+    if (PR_SetThreadPrivate(worker_index, gnupg) == PR_FAILURE) {
+      delete gnupg;
+      return NULL;
+    }
+  }
+  return gnupg;
+}
+
+GnupgCompletionQueue *Gnupg::CompletionQueue(NPP npp) {
+  if (completion_queue_ == NULL) {
+    completion_queue_ = new GnupgCompletionQueue(npp, this);
+  }
+  return completion_queue_;
+}
+
+void Gnupg::InstanceDestroyed(NPP npp) {
+  GnupgCompletionQueue::InstanceDestroyed(npp);
+}
+
+void Gnupg::ShutdownAsync() {
+  GpgWorkerPool *pool = GpgWorkerPool::Instance();
+  if (pool != NULL) {
+    pool->Shutdown();
+  }
+  GnupgCompletionQueue::InstanceDestroyed(NULL);
+}
+
+/*
+ * Browsers that can't call back to the main thread (Safari) get the result
+ * before the call returns, like from the synchronous methods.
+ *
+ * Returns the handle of the call for Cancel().
+ */
+static int RunAsync(GnupgCompletionQueue *queue, GnupgTask *task) {
+  PRInt32 operation = task->operation();
+  if (queue->npp() != NULL && IsPluginThreadAsyncCallSupported(queue->npp())) {
+    GpgWorkerPool *pool = GpgWorkerPool::Instance();
+    if (pool != NULL && pool->Submit(task, queue)) {
+      return operation;
+    }
+  }
+  task->Run();
+  task->Complete();
+  delete task;
+  return operation;
 }
 
 namespace glue {
 namespace class_Gnupg {
-bool IsTrustedOrigin(void *pdata) {
-  globals::NPAPIObject *static_object;
-  NPIdentifier identifier;
-  NPObject *window;
-  NPP npp = NULL;
-  NPVariant window_location, window_location_href;
+/* Whether |location| is that of a page of one of our extensions. */
+static bool IsTrustedLocation(const char *location) {
   std::vector<std::string> trusted_origins;
-  std::string origin;
-  bool rv = false;
+  size_t location_length = strlen(location);
 
   /*
    * This origin is for Firefox (ex: chrome://content/browser/overlay.xul).
@@ -1445,6 +4723,36 @@ bool IsTrustedOrigin(void *pdata) {
    */
   trusted_origins.push_back("safari-extension://");
 
+  /*
+   * This block iterates over all trusted_origins and attempts to match
+   * the scheme of the origin the plugin resides in (origin is a value
+   * such as 'http://example.com/foo.html', scheme is 'http://') with
+   * the scheme defined in trusted_origin (e.g. chrome://).  If a match
+   * is found, the origin is considered trusted and can set
+   * configuration values.
+   */
+  for (std::vector<std::string>::const_iterator it =
+      trusted_origins.begin(); it != trusted_origins.end(); ++it) {
+    if (location_length < it->length())
+      continue;
+    if (it->compare(0, it->length(), location, it->length()) == 0)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Put the location of the page the plugin is on in |location|. Returns
+ * false if the browser doesn't tell.
+ */
+static bool PageLocation(void *pdata, std::string *location) {
+  globals::NPAPIObject *static_object;
+  NPIdentifier identifier;
+  NPObject *window;
+  NPP npp = NULL;
+  NPVariant window_location, window_location_href;
+  bool rv = false;
+
   static_object = static_cast<globals::NPAPIObject*>(pdata);
   if(!static_object || !(npp = static_object->npp()))
     return rv;
@@ -1457,28 +4765,8 @@ bool IsTrustedOrigin(void *pdata) {
       if (NPN_GetProperty(npp, window_location.value.objectValue,
                           identifier, &window_location_href)) {
         if (NPVARIANT_IS_STRING(window_location_href)) {
-          const NPUTF8 *origin =
-              NPVARIANT_TO_STRING(window_location_href).UTF8Characters;
-          size_t origin_length = strlen(origin);
-          /*
-           * This block iterates over all trusted_origins and attempts to match
-           * the scheme of the origin the plugin resides in (origin is a value
-           * such as 'http://example.com/foo.html', scheme is 'http://') with
-           * the scheme defined in trusted_origin (e.g. chrome://).  If a match
-           * is found, the origin is considered trusted and can set
-           * configuration values.
-           */
-          for (std::vector<std::string>::const_iterator it =
-              trusted_origins.begin(); it != trusted_origins.end(); ++it) {
-            if (origin_length < it->length())
-              continue;
-            if (it->compare(0, it->length(), origin, it->length()) == 0) {
-              rv = true;
-              break;
-            }
-          }
-          if (rv == false)
-            LOG("GPG: origin validation failed for %s\n", origin);
+          *location = NPVARIANT_TO_STRING(window_location_href).UTF8Characters;
+          rv = true;
         }
         NPN_ReleaseVariantValue(&window_location_href);
       }
@@ -1489,6 +4777,44 @@ bool IsTrustedOrigin(void *pdata) {
   return rv;
 }
 
+bool IsTrustedOrigin(void *pdata) {
+  std::string location;
+  if (!PageLocation(pdata, &location))
+    return false;
+  if (IsTrustedLocation(location.c_str()))
+    return true;
+  LOG("GPG: origin validation failed for %s\n", location.c_str());
+  return false;
+}
+
+/*
+ * The scheme and host (and port) of |url| in lower case, e.g.
+ * "http://example.com:8080", or "" if it has none. That of a file: URL is
+ * "file://".
+ */
+static std::string UrlOrigin(const std::string &url) {
+  size_t scheme_end = url.find("://");
+  if (scheme_end == std::string::npos)
+    return "";
+  std::string origin = url.substr(0, url.find_first_of("/?#", scheme_end + 3));
+  for (size_t i = 0; i < origin.size(); ++i)
+    origin[i] = tolower(static_cast<unsigned char>(origin[i]));
+  return origin;
+}
+
+bool MayFetchUrl(void *pdata, const std::string &url) {
+  std::string location;
+  if (!PageLocation(pdata, &location))
+    return false;
+  if (IsTrustedLocation(location.c_str()))
+    return true;
+  std::string origin = UrlOrigin(url);
+  if (!origin.empty() && origin == UrlOrigin(location))
+    return true;
+  LOG("GPG: %s may not fetch %s\n", location.c_str(), url.c_str());
+  return false;
+}
+
 GpgRetBool userglue_method_SetConfigValue(void *pdata, Gnupg *object,
                                           const std::string &param_key,
                                           const std::string &param_val) {
@@ -1505,5 +4831,395 @@ GpgRetBool userglue_method_SetConfigValue(void *pdata, Gnupg *object,
 
   return retobj;
 }
+
+GpgRetString userglue_method_GetStats(void *pdata, Gnupg *object) {
+  GpgRetString retobj;
+
+  if (object && IsTrustedOrigin(pdata)) {
+    retobj = object->GetStats();
+  } else {
+    retobj.set_error_str(kERR_UNTRUSTED_ORIGIN);
+  }
+
+  return retobj;
+}
+
+static NPP PluginInstance(void *pdata) {
+  globals::NPAPIObject *static_object =
+      static_cast<globals::NPAPIObject*>(pdata);
+  return static_object == NULL ? NULL : static_object->npp();
+}
+
+int userglue_method_GetGnupgVersionAsync(void *pdata, Gnupg *object,
+                                         GpgRetStringCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new GetGnupgVersionCall(object, queue, param_on_done));
+}
+
+int userglue_method_SignTextAsync(void *pdata, Gnupg *object,
+                                  const std::string &param_rawtext,
+                                  const std::string &param_keyid,
+                                  bool param_clearsign,
+                                  GpgRetStringCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new SignTextCall(object, queue, param_on_done,
+                                          param_rawtext, param_keyid,
+                                          param_clearsign));
+}
+
+int userglue_method_VerifySignedTextAsync(
+    void *pdata, Gnupg *object, const std::string &param_signed_text,
+    const std::string &param_signature,
+    GpgRetSignerInfoCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new VerifySignedTextCall(object, queue, param_on_done,
+                                                  param_signed_text,
+                                                  param_signature));
+}
+
+int userglue_method_EncryptTextAsync(
+    void *pdata, Gnupg *object, const std::string &param_rawtext,
+    const std::vector<std::string> &param_keyids,
+    const std::vector<std::string> &param_hidden_keyids,
+    bool param_always_trust, const std::string &param_sign,
+    GpgRetEncryptInfoCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new EncryptTextCall(object, queue, param_on_done,
+                                             param_rawtext, param_keyids,
+                                             param_hidden_keyids,
+                                             param_always_trust, param_sign,
+                                             ""));
+}
+
+int userglue_method_EncryptTextCompressedAsync(
+    void *pdata, Gnupg *object, const std::string &param_rawtext,
+    const std::vector<std::string> &param_keyids,
+    const std::vector<std::string> &param_hidden_keyids,
+    bool param_always_trust, const std::string &param_sign,
+    const std::string &param_compression,
+    GpgRetEncryptInfoCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new EncryptTextCall(object, queue, param_on_done,
+                                             param_rawtext, param_keyids,
+                                             param_hidden_keyids,
+                                             param_always_trust, param_sign,
+                                             param_compression));
+}
+
+int userglue_method_DecryptTextAsync(
+    void *pdata, Gnupg *object, const std::string &param_cipher_text,
+    GpgRetDecryptInfoCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new DecryptTextCall(object, queue, param_on_done,
+                                             param_cipher_text));
+}
+
+int userglue_method_VerifySignedTextBatchAsync(
+    void *pdata, Gnupg *object,
+    const std::vector<std::string> &param_signed_texts,
+    const std::vector<std::string> &param_signatures,
+    GpgRetSignerInfoBatchCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new VerifySignedTextBatchCall(object, queue,
+                                                       param_on_done,
+                                                       param_signed_texts,
+                                                       param_signatures));
+}
+
+int userglue_method_EncryptTextBatchAsync(
+    void *pdata, Gnupg *object, const std::vector<std::string> &param_rawtexts,
+    const std::vector<std::string> &param_keyids,
+    const std::vector<std::string> &param_hidden_keyids,
+    bool param_always_trust, const std::string &param_sign,
+    GpgRetEncryptInfoBatchCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new EncryptTextBatchCall(object, queue, param_on_done,
+                                                  param_rawtexts, param_keyids,
+                                                  param_hidden_keyids,
+                                                  param_always_trust,
+                                                  param_sign));
+}
+
+int userglue_method_DecryptTextBatchAsync(
+    void *pdata, Gnupg *object,
+    const std::vector<std::string> &param_cipher_texts,
+    GpgRetDecryptInfoBatchCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new DecryptTextBatchCall(object, queue, param_on_done,
+                                                  param_cipher_texts));
+}
+
+int userglue_method_GetKeyAsync(void *pdata, Gnupg *object,
+                                const std::string &param_keyid,
+                                const std::string &param_keyserver,
+                                GpgRetBoolCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new GetKeyCall(object, queue, param_on_done,
+                                        param_keyid, param_keyserver));
+}
+
+int userglue_method_GetUidsAsync(void *pdata, Gnupg *object,
+                                 const std::string &param_keyid,
+                                 GpgRetUidsInfoCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new GetUidsCall(object, queue, param_on_done,
+                                         param_keyid));
+}
+
+int userglue_method_GetFingerprintAsync(void *pdata, Gnupg *object,
+                                        const std::string &param_keyid,
+                                        GpgRetStringCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new GetFingerprintCall(object, queue, param_on_done,
+                                                param_keyid));
+}
+
+int userglue_method_GetTrustAsync(void *pdata, Gnupg *object,
+                                  const std::string &param_keyid,
+                                  GpgRetStringCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new GetTrustCall(object, queue, param_on_done,
+                                          param_keyid));
+}
+
+int userglue_method_SignUidAsync(void *pdata, Gnupg *object,
+                                 const std::string &param_keyid,
+                                 const std::string &param_uid,
+                                 const std::string &param_level,
+                                 GpgRetBoolCallback *param_on_done) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new SignUidCall(object, queue, param_on_done,
+                                         param_keyid, param_uid, param_level));
+}
+
+/*
+ * The file functions name files on the user's disk, so web pages may not use
+ * them.
+ */
+GpgRetEncryptInfo userglue_method_EncryptFile(
+    void *pdata, Gnupg *object, const std::string &param_path,
+    const std::string &param_output_path,
+    const std::vector<std::string> &param_keyids,
+    const std::vector<std::string> &param_hidden_keyids,
+    bool param_always_trust, const std::string &param_sign) {
+  GpgRetEncryptInfo retobj;
+
+  if (object && IsTrustedOrigin(pdata)) {
+    retobj = object->EncryptFile(param_path, param_output_path, param_keyids,
+                                 param_hidden_keyids, param_always_trust,
+                                 param_sign);
+  } else {
+    retobj.set_error_str(kERR_UNTRUSTED_ORIGIN);
+  }
+
+  return retobj;
+}
+
+GpgRetDecryptInfo userglue_method_DecryptFile(
+    void *pdata, Gnupg *object, const std::string &param_path,
+    const std::string &param_output_path) {
+  GpgRetDecryptInfo retobj;
+
+  if (object && IsTrustedOrigin(pdata)) {
+    retobj = object->DecryptFile(param_path, param_output_path);
+  } else {
+    retobj.set_error_str(kERR_UNTRUSTED_ORIGIN);
+  }
+
+  return retobj;
+}
+
+GpgRetString userglue_method_SignFile(void *pdata, Gnupg *object,
+                                      const std::string &param_path,
+                                      const std::string &param_output_path,
+                                      const std::string &param_keyid,
+                                      bool param_clearsign) {
+  GpgRetString retobj;
+
+  if (object && IsTrustedOrigin(pdata)) {
+    retobj = object->SignFile(param_path, param_output_path, param_keyid,
+                              param_clearsign);
+  } else {
+    retobj.set_error_str(kERR_UNTRUSTED_ORIGIN);
+  }
+
+  return retobj;
+}
+
+GpgRetSignerInfo userglue_method_VerifyFile(
+    void *pdata, Gnupg *object, const std::string &param_path,
+    const std::string &param_signature_path) {
+  GpgRetSignerInfo retobj;
+
+  if (object && IsTrustedOrigin(pdata)) {
+    retobj = object->VerifyFile(param_path, param_signature_path);
+  } else {
+    retobj.set_error_str(kERR_UNTRUSTED_ORIGIN);
+  }
+
+  return retobj;
+}
+
+/*
+ * Hand |on_done| the |error| of an asynchronous call that can't be made, and
+ * return the handle of no call.
+ */
+template <class Ret>
+static int FailCall(GpgCallback<Ret> *on_done, const char *error) {
+  Ret retobj;
+  retobj.set_error_str(error);
+  if (on_done != NULL) {
+    on_done->Run(retobj);
+    delete on_done;
+  }
+  return 0;
+}
+
+int userglue_method_EncryptFileAsync(
+    void *pdata, Gnupg *object, const std::string &param_path,
+    const std::string &param_output_path,
+    const std::vector<std::string> &param_keyids,
+    const std::vector<std::string> &param_hidden_keyids,
+    bool param_always_trust, const std::string &param_sign,
+    GpgRetEncryptInfoCallback *param_on_done) {
+  if (!IsTrustedOrigin(pdata)) {
+    return FailCall(param_on_done, kERR_UNTRUSTED_ORIGIN);
+  }
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new EncryptFileCall(object, queue, param_on_done,
+                                             param_path, param_output_path,
+                                             param_keyids,
+                                             param_hidden_keyids,
+                                             param_always_trust, param_sign));
+}
+
+int userglue_method_DecryptFileAsync(
+    void *pdata, Gnupg *object, const std::string &param_path,
+    const std::string &param_output_path,
+    GpgRetDecryptInfoCallback *param_on_done) {
+  if (!IsTrustedOrigin(pdata)) {
+    return FailCall(param_on_done, kERR_UNTRUSTED_ORIGIN);
+  }
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new DecryptFileCall(object, queue, param_on_done,
+                                             param_path, param_output_path));
+}
+
+int userglue_method_SignFileAsync(void *pdata, Gnupg *object,
+                                  const std::string &param_path,
+                                  const std::string &param_output_path,
+                                  const std::string &param_keyid,
+                                  bool param_clearsign,
+                                  GpgRetStringCallback *param_on_done) {
+  if (!IsTrustedOrigin(pdata)) {
+    return FailCall(param_on_done, kERR_UNTRUSTED_ORIGIN);
+  }
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new SignFileCall(object, queue, param_on_done,
+                                          param_path, param_output_path,
+                                          param_keyid, param_clearsign));
+}
+
+int userglue_method_VerifyFileAsync(void *pdata, Gnupg *object,
+                                    const std::string &param_path,
+                                    const std::string &param_signature_path,
+                                    GpgRetSignerInfoCallback *param_on_done) {
+  if (!IsTrustedOrigin(pdata)) {
+    return FailCall(param_on_done, kERR_UNTRUSTED_ORIGIN);
+  }
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new VerifyFileCall(object, queue, param_on_done,
+                                            param_path,
+                                            param_signature_path));
+}
+
+/*
+ * Have the browser fetch |url| for a call, and return the fetch, or NULL with
+ * the error in |error|. The data comes in on the main thread, so the call
+ * must run on a thread of its own.
+ */
+static GpgUrlFetch *StartFetch(void *pdata, const std::string &url,
+                               const char **error) {
+  NPP npp = PluginInstance(pdata);
+  if (npp == NULL || !IsPluginThreadAsyncCallSupported(npp) ||
+      GpgWorkerPool::Instance() == NULL) {
+    LOG("GPG: Can't fetch URLs without asynchronous calls\n");
+    *error = kERR_URL;
+    return NULL;
+  }
+  if (!MayFetchUrl(pdata, url)) {
+    *error = kERR_UNTRUSTED_ORIGIN;
+    return NULL;
+  }
+  /* The browser's reference is released by NPP_URLNotify(). */
+  GpgUrlFetch *fetch = new GpgUrlFetch();
+  if (NPN_GetURLNotify(npp, url.c_str(), NULL, fetch) != NPERR_NO_ERROR) {
+    LOG("GPG: NPN_GetURLNotify failed for %s\n", url.c_str());
+    fetch->Release();
+    *error = kERR_URL;
+    return NULL;
+  }
+  return fetch;
+}
+
+int userglue_method_DecryptUrlAsync(void *pdata, Gnupg *object,
+                                    const std::string &param_url,
+                                    GpgRetDecryptInfoCallback *param_on_done) {
+  const char *error;
+  GpgUrlFetch *fetch = StartFetch(pdata, param_url, &error);
+  if (fetch == NULL) {
+    return FailCall(param_on_done, error);
+  }
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new DecryptUrlCall(object, queue, param_on_done,
+                                            fetch));
+}
+
+int userglue_method_VerifyUrlAsync(void *pdata, Gnupg *object,
+                                   const std::string &param_url,
+                                   const std::string &param_signature,
+                                   GpgRetSignerInfoCallback *param_on_done) {
+  const char *error;
+  GpgUrlFetch *fetch = StartFetch(pdata, param_url, &error);
+  if (fetch == NULL) {
+    return FailCall(param_on_done, error);
+  }
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return RunAsync(queue, new VerifyUrlCall(object, queue, param_on_done,
+                                           fetch, param_signature));
+}
+
+/*
+ * Streams are operations of the same owner as the asynchronous calls, so
+ * that Cancel() works on them as well.
+ */
+int userglue_method_OpenEncryptStream(
+    void *pdata, Gnupg *object, const std::vector<std::string> &param_keyids,
+    const std::vector<std::string> &param_hidden_keyids,
+    bool param_always_trust, const std::string &param_sign) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return object->OpenEncryptStream(param_keyids, param_hidden_keyids,
+                                   param_always_trust, param_sign, queue);
+}
+
+int userglue_method_OpenSignStream(void *pdata, Gnupg *object,
+                                   const std::string &param_keyid,
+                                   bool param_clearsign) {
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  return object->OpenSignStream(param_keyid, param_clearsign, queue);
+}
+
+/*
+ * Only calls made on the same object can be canceled through it.
+ */
+GpgRetBool userglue_method_Cancel(void *pdata, Gnupg *object,
+                                  int param_handle) {
+  GpgRetBool retobj;
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  GnupgCompletionQueue *queue = object->CompletionQueue(PluginInstance(pdata));
+  retobj.set_retbool(watchdog != NULL &&
+                     watchdog->Cancel(param_handle, queue));
+  return retobj;
+}
 } /* namespace class_Gnupg */
 } /* namespace glue */
@@ -32,15 +32,32 @@
 #ifndef _GPGPLUGIN_GNUPG_H_
 #define _GPGPLUGIN_GNUPG_H_
 
+#include <npapi.h>
+#include <prinrval.h>
+
 #include <iosfwd>
+#include <map>
 #include <string>
 #include <vector>
 
+#include "openpgp.h"
 #include "prefs.h"
+#include "securemem.h"
+#include "stats.h"
+#include "status.h"
 #include "types.h"
 
+class AgentRequest;
+class GnupgCompletionQueue;
+class GnupgTask;
+class GpgAgent;
+class GpgOutputWatcher;
+class GpgSession;
+class GpgUrlFetch;
+class GpgmeEngine;
 struct PRFileDesc;
-struct PRProcess;
+struct PRCondVar;
+struct PRLock;
 
 /*
  * EXCEPTION INFORMATION
@@ -88,19 +105,81 @@ struct PRProcess;
  * ERR_BAD_PUBLIC_KEY
  * At least one public key we're supposed to be encrypting to is expired,
  * revoked or otherwise problematic.
+ *
+ * ERR_UNTRUSTED_ORIGIN
+ * The method may only be called from the extension, not from web pages.
+ *
+ * ERR_TIMEOUT
+ * gpg or gpg-agent took longer than the gpg_timeout preference allows and was
+ * given up on.
+ *
+ * ERR_CANCELED
+ * The asynchronous call was canceled with Cancel().
+ *
+ * ERR_NO_STREAM
+ * The handle isn't that of an open stream of the right kind.
+ *
+ * ERR_NO_RESULT
+ * The handle isn't that of a result kept by this object.
+ *
+ * ERR_BAD_FILE
+ * A file to read can't be read, or a path is missing.
+ *
+ * ERR_BAD_OUTPUT
+ * The path of a file to write isn't absolute.
+ *
+ * ERR_OUTPUT_EXISTS
+ * The file to write is already there, and the gpg_overwrite_files preference
+ * doesn't allow replacing it.
+ *
+ * ERR_URL
+ * The browser couldn't fetch all of a URL, or won't let us fetch it.
+ *
+ * ERR_BAD_ARMOR
+ * The armor of a cipher text or signature is broken, or missing, so gpg
+ * wasn't run (only with the gpg_armor preference set to "plugin").
  */
 
+/*
+ * A run of gpg that is given its standard input a piece at a time, see
+ * BaseGnupg::OpenGpgWithData(). Deleting it before Close() terminates gpg.
+ */
+class GpgInputStream {
+ public:
+  virtual ~GpgInputStream() {}
+
+  /*
+   * Pass |chunk| on to gpg, waiting until it has taken it. Returns false if
+   * gpg no longer reads its input.
+   */
+  virtual bool Write(const std::string &chunk) = 0;
+
+  /*
+   * End gpg's input and wait for it to exit. Returns what CallGpgWithData()
+   * would have, had it been given all of the input at once. Must be called
+   * at most once.
+   */
+  virtual bool Close(int *retval, std::string *output, SecureString *data) = 0;
+};
+
 /*
  * BaseGnupg is where most of our plugin is defined. There are two subclasses
  * of it: One is Gnupg, the actual object created from javascript, and the other
  * is the Mock class made from the unittests. Only things that need mocking are
  * created in the subclass, Gnupg. These must be virtual, which is why there's a
  * base class.
+ *
+ * Each run of gpg has a GpgSession of its own, so the API functions can be
+ * called from several threads at once. Preferences must not be changed while
+ * they run, though, and each stream must only be used by one call at a time.
  */
 class BaseGnupg {
  public:
+  BaseGnupg();
+  BaseGnupg(const BaseGnupg &other);
+  virtual ~BaseGnupg();
 
-  virtual ~BaseGnupg() {}
+  BaseGnupg &operator=(const BaseGnupg &other);
 
   /*
    * Simple check for if GPG is installed. You should always call this first.
@@ -129,6 +208,7 @@ class BaseGnupg {
    * OUT: JSObject (signer, trust_level, debug)
    * RAISES:
    *    ERR_INTERNAL
+   *    ERR_BAD_ARMOR
    *    ERR_BAD_SIGNATURE
    *    ERR_SIGNATURE_ERR
    *    ERR_UNKNOWN_GPG_ERR
@@ -160,6 +240,25 @@ class BaseGnupg {
                                 bool always_trust,
                                 const std::string &sign);
 
+  /*
+   * EncryptText() with |compression| in place of the gpg_compression
+   * preference for this call ("gpg", "auto", "none" or a zlib level from "0"
+   * to "9"), or the preference if it's empty. GPGME can't set the
+   * compression, so gpg runs for anything but gpg's default even if the
+   * gpg_engine preference is "gpgme".
+   *
+   * IN: as EncryptText(), then string Compression
+   * OUT: JSObject, see EncryptText()
+   * RAISES: see EncryptText()
+   */
+  GpgRetEncryptInfo EncryptTextCompressed(
+      const std::string &rawtext,
+      const std::vector<std::string> &keyids,
+      const std::vector<std::string> &hidden_keyids,
+      bool always_trust,
+      const std::string &sign,
+      const std::string &compression);
+
   /*
    * Sign rawtext using keyid. By default we detach sign and return
    * the signature, however, if clearsign is set, we return the
@@ -186,6 +285,7 @@ class BaseGnupg {
    *      signer/trust are returned of the encrypted data has a signature in it
    * RAISES:
    *    ERR_INTERNAL
+   *    ERR_BAD_ARMOR
    *    ERR_NO_SECRET_KEY
    *    ERR_UNKNOWN_GPG_ERR
    *    ERR_UNEXPECTED_GPG_OUTPUT
@@ -193,6 +293,158 @@ class BaseGnupg {
    */
   GpgRetDecryptInfo DecryptText(const std::string &cipher_text);
 
+  /*
+   * Batch versions of VerifySignedText(), EncryptText() and DecryptText().
+   * Each returns one result per input, in the same order and with what the
+   * single call would have returned for that input, but lets one gpg process
+   * handle many inputs (with --multifile). Large batches are spread over a
+   * few gpg processes running side by side.
+   *
+   * signatures[i] is the detached signature of signed_texts[i], or empty (or
+   * missing) if the signature is inline. Detached signatures, and encrypting
+   * with a signer, still take a gpg run per input.
+   *
+   * IN: array SignedTexts, array Signatures
+   * OUT: array of JSObject, see VerifySignedText()
+   * IN: array ClearTexts, array KeyIds, array HiddenKeyIds, bool always_trust,
+   *     optional string signer
+   * OUT: array of JSObject, see EncryptText()
+   * IN: array CipherTexts
+   * OUT: array of JSObject, see DecryptText()
+   */
+  std::vector<GpgRetSignerInfo> VerifySignedTextBatch(
+      const std::vector<std::string> &signed_texts,
+      const std::vector<std::string> &signatures);
+  std::vector<GpgRetEncryptInfo> EncryptTextBatch(
+      const std::vector<std::string> &rawtexts,
+      const std::vector<std::string> &keyids,
+      const std::vector<std::string> &hidden_keyids,
+      bool always_trust,
+      const std::string &sign);
+  std::vector<GpgRetDecryptInfo> DecryptTextBatch(
+      const std::vector<std::string> &cipher_texts);
+
+  /*
+   * Streaming versions of EncryptText() and SignText(), for texts too large
+   * to pass in one piece. Open...Stream() starts gpg and returns a handle for
+   * the stream, or 0 if gpg couldn't be started. The text is then given to
+   * WriteStream() in chunks, each of which is passed on to gpg right away,
+   * and Close...Stream() returns what EncryptText() or SignText() would have.
+   * Streams always go through gpg, with data pipes.
+   *
+   * The handle can be canceled by |owner| like an asynchronous call, see
+   * Gnupg::CompletionQueue(), and gpg_timeout counts from opening it. If
+   * WriteStream() returns false, gpg has stopped reading, and closing the
+   * stream tells why.
+   *
+   * IN: array KeyIds, array HiddenKeyIds, bool always_trust,
+   *     optional string signer
+   * IN: string KeyId, optional bool clearsign
+   * OUT: int handle
+   * IN: int handle, string chunk
+   * OUT: JSObject (retbool)
+   * IN: int handle
+   * OUT: JSObject, see EncryptText() or SignText()
+   * RAISES:
+   *    ERR_NO_STREAM
+   *    and those of EncryptText() or SignText()
+   */
+  int OpenEncryptStream(const std::vector<std::string> &keyids,
+                        const std::vector<std::string> &hidden_keyids,
+                        bool always_trust,
+                        const std::string &sign,
+                        const void *owner);
+  int OpenSignStream(const std::string &keyid, bool clearsign,
+                     const void *owner);
+  GpgRetBool WriteStream(int handle, const std::string &chunk);
+  GpgRetEncryptInfo CloseEncryptStream(int handle);
+  GpgRetString CloseSignStream(int handle);
+
+  /*
+   * When the gpg_large_result_kb preference is set, the cipher text or plain
+   * text of an encryption or decryption (single, batch, asynchronous or
+   * streamed) that's larger than that is kept by the object instead of being
+   * returned. The result then has an empty text, and the handle and size in
+   * bytes of the kept one in |result| and |result_size|.
+   *
+   * ReadChunk() returns up to |length| bytes of it from |offset| on, and the
+   * offset of the rest. Chunks don't split UTF-8 characters, so they may be
+   * a few bytes shorter (or longer, if |length| is less than a character).
+   * ReleaseResult() frees the text; it's otherwise kept until the object goes
+   * away.
+   *
+   * IN: int handle, int offset, int length
+   * OUT: JSObject (data, next_offset)
+   * IN: int handle
+   * OUT: JSObject (retbool)
+   * RAISES:
+   *    ERR_NO_RESULT
+   */
+  GpgRetChunk ReadChunk(int handle, int offset, int length);
+  GpgRetBool ReleaseResult(int handle);
+
+  /*
+   * Versions of EncryptText(), DecryptText(), SignText() and
+   * VerifySignedText() for local files, which hand the paths to gpg instead
+   * of passing the contents through the browser. gpg writes the cipher text,
+   * plain text or signature to |output_path|, so the text in the result is
+   * empty. |output_path| has to be absolute, and a file that's already there
+   * is only replaced if the gpg_overwrite_files preference is "true"; gpg
+   * isn't run otherwise. An empty |signature_path| means an inline signature.
+   * These always run gpg (rather than GPGME or gpg-agent), and may only be
+   * called from the extension.
+   *
+   * IN: string Path, string OutputPath, then as EncryptText()
+   * OUT: JSObject, see EncryptText()
+   * IN: string Path, string OutputPath
+   * OUT: JSObject, see DecryptText()
+   * IN: string Path, string OutputPath, string KeyId, optional bool clearsign
+   * OUT: JSObject, see SignText()
+   * IN: string Path, string SignaturePath
+   * OUT: JSObject, see VerifySignedText()
+   * RAISES:
+   *    ERR_UNTRUSTED_ORIGIN
+   *    ERR_BAD_FILE
+   *    ERR_BAD_OUTPUT (not VerifyFile())
+   *    ERR_OUTPUT_EXISTS (not VerifyFile())
+   *    and those of the text versions
+   */
+  GpgRetEncryptInfo EncryptFile(const std::string &path,
+                                const std::string &output_path,
+                                const std::vector<std::string> &keyids,
+                                const std::vector<std::string> &hidden_keyids,
+                                bool always_trust,
+                                const std::string &sign);
+  GpgRetDecryptInfo DecryptFile(const std::string &path,
+                                const std::string &output_path);
+  GpgRetString SignFile(const std::string &path,
+                        const std::string &output_path,
+                        const std::string &keyid,
+                        bool clearsign);
+  GpgRetSignerInfo VerifyFile(const std::string &path,
+                              const std::string &signature_path);
+
+  /*
+   * Versions of DecryptText() and VerifySignedText() for the data of a URL,
+   * which is written to gpg as the browser passes it on. Only the result
+   * comes back to javascript, through DecryptUrlAsync() and VerifyUrlAsync(),
+   * which have the browser fetch the URL. Web pages may only fetch URLs of
+   * their own origin. These always run gpg, and the wait for data counts
+   * towards gpg_timeout.
+   *
+   * IN: string Url
+   * OUT: JSObject, see DecryptText()
+   * IN: string Url, string signature
+   * OUT: JSObject, see VerifySignedText()
+   * RAISES:
+   *    ERR_UNTRUSTED_ORIGIN
+   *    ERR_URL
+   *    and those of the text versions
+   */
+  GpgRetDecryptInfo DecryptFetch(GpgUrlFetch *fetch);
+  GpgRetSignerInfo VerifyFetch(GpgUrlFetch *fetch,
+                               const std::string &signature);
+
   /*
    * Fetch keyid from keyserver to the local keyring. If keyserver is
    * NULL we won't pass one to gpg so one must be configured locally.
@@ -262,44 +514,325 @@ class BaseGnupg {
    */
   GpgRetBool SetConfigValue(const std::string &key, const std::string &value);
 
+  /*
+   * Get the counters collected by this object, see GpgStats::ToString().
+   * OUT: JSObject (retstring)
+   * RAISES:
+   *    ERR_UNTRUSTED_ORIGIN
+   */
+  GpgRetString GetStats();
+
   /*
    * In theory, these would be private, but then we can't test them.
    * There's no security reason to have them be private - the Nixysa
    * framework only exports what we want it to anyway.
    */
-  virtual PRProcess *CallGpg(const std::vector<const char*> &args) = 0;
-  virtual bool ReadAllGpgOutput(std::string *output) = 0;
-  virtual int WaitOnGpg(PRProcess *process) = 0;
-  virtual bool ReadFileToString(const char *filename, std::string *text) = 0;
-  bool ParseGpgLine(const std::string &line,
-                    std::vector<std::string> *output);
-  bool ParseGpgOutput(const std::string &input,
-                      std::vector< std::vector<std::string> > *lines);
-  bool ExpectString(const std::string &response);
+  virtual GpgSession *CallGpg(const std::vector<const char*> &args) = 0;
+  virtual bool ReadAllGpgOutput(GpgSession *session, std::string *output,
+                                GpgOutputWatcher *watcher) = 0;
+  virtual int WaitOnGpg(GpgSession *session) = 0;
+  /*
+   * What WaitOnGpg() returns instead of an exit code when gpg was terminated
+   * by the GpgWatchdog, or when its exit code was lost because NSPR reaped
+   * it. -1 means that waiting failed.
+   */
+  static const int kGPG_TIMED_OUT = -2;
+  static const int kGPG_CANCELED = -3;
+  static const int kGPG_LOST = -4;
+  virtual bool ReadFileToString(const char *filename, SecureString *text) = 0;
+  /*
+   * Run gpg with |args| like CallReadAndWaitOnGpg(), but with |input| on its
+   * standard input and what it writes to its standard output in |data|. If
+   * |extra| isn't NULL, it's written to another pipe, which an argument that's
+   * kGPG_EXTRA_INPUT stands for (gpg needs --enable-special-filenames then).
+   */
+  virtual bool CallGpgWithData(const std::vector<const char*> &args,
+                               const std::string &input,
+                               const std::string *extra,
+                               int *retval, std::string *output,
+                               SecureString *data) = 0;
+  static const char *const kGPG_EXTRA_INPUT;
+  /*
+   * Start gpg with |args| and data pipes like CallGpgWithData(), but leave
+   * writing its input to the stream returned. |extra| is written all at once
+   * as in CallGpgWithData(). Returns NULL on failure.
+   */
+  virtual GpgInputStream *OpenGpgWithData(
+      const std::vector<const char*> &args, const std::string *extra) = 0;
+  bool ParseGpgLine(const std::string &line, GpgStatusLine *output);
+  bool ParseGpgOutput(const std::string &input, GpgStatusLines *lines);
+  bool ExpectString(GpgSession *session, GpgStatus response);
   bool CheckForOrderedOutput(
-          const std::vector<std::string> &expected,
-          const std::vector< std::vector<std::string> > &output);
+          const GpgStatus *expected,
+          size_t count,
+          const GpgStatusLines &output);
   bool CheckForUnorderedOutput(
-          const std::vector<std::string> &expected,
-          const std::vector< std::vector<std::string> > &output);
+          const GpgStatusSet &expected,
+          const GpgStatusLines &output);
   bool CheckForSingleOutput(
-          const char *string,
-          const std::vector< std::vector<std::string> > &output);
-  bool SplitOnChar(const std::string &line,
-                   char schar,
-                   std::vector<std::string> *output);
+          GpgStatus expected,
+          const GpgStatusLines &output);
   std::string ReadFromFdIntoString(int fd);
-  bool SplitOnSpaces(const std::string &line, std::vector<std::string> *output);
   bool CallReadAndWaitOnGpg(const std::vector<const char*> &args,
-                            int *retval, std::string *output);
+                            int *retval, std::string *output,
+                            GpgOutputWatcher *watcher = NULL);
+  /*
+   * Run gpg with |args| followed by --multifile and |files|, and put what gpg
+   * said about each of the files (between its FILE_START and FILE_DONE) in
+   * |outputs|, in the same order, and the exit code of gpg for each file in
+   * |retvals|. Returns false if gpg couldn't be run, with |retval| set like
+   * CallReadAndWaitOnGpg() sets it.
+   */
+  bool CallGpgMultifile(const std::vector<const char*> &args,
+                        const std::vector<std::string> &files,
+                        int *retval,
+                        std::vector<int> *retvals,
+                        std::vector<std::string> *outputs);
+  /*
+   * What VerifySignedText(), EncryptText() and DecryptText() make of the exit
+   * code and output of gpg, also used for each file of a batch. The data gpg
+   * wrote is |data|, or read from the file gpg wrote it to if that's NULL.
+   * EncryptResult() and DecryptResult() may take the text from |data| (see
+   * SetResultText()).
+   */
+  GpgRetSignerInfo VerifyResult(int ret, const std::string &ret_text);
+  GpgRetEncryptInfo EncryptResult(int ret, const std::string &ret_text,
+                                  bool signed_too,
+                                  const std::string &res_filename,
+                                  SecureString *data);
+  GpgRetDecryptInfo DecryptResult(int ret, const std::string &ret_text,
+                                  const std::string &raw_file,
+                                  SecureString *data);
+  GpgRetString SignResult(int ret, const std::string &ret_text,
+                          const std::string &res_file,
+                          const SecureString *data);
 
 
  protected:
-  std::istream *instream_;
-  std::ostream *outstream_;
-  PRFileDesc *command_pipe_[2];
-  PRFileDesc *status_pipe_[2];
+  /* Runs the asynchronous calls, see Gnupg::ForCurrentThread(). */
+  friend class GnupgTask;
+
+  /* A stream opened by OpenEncryptStream() or OpenSignStream(). */
+  struct Stream {
+    GpgInputStream *input;
+    /* Whether it encrypts rather than signs, and if so, signs as well. */
+    bool encrypt;
+    bool signed_too;
+    /* How many WriteStream() calls are writing to |input| right now. */
+    int writers;
+    /* Whether it's being closed, after which it can't be written to. */
+    bool closing;
+  };
+
+  /*
+   * Open a stream for gpg with |args| as an operation of |owner|, and return
+   * its handle, or 0.
+   */
+  int OpenStream(const std::vector<const char*> &args, bool encrypt,
+                 bool signed_too, const void *owner);
+
+  /*
+   * Close the stream |handle| if it's one that encrypts (or signs, if not
+   * |encrypt|). Returns NULL with what gpg did in the other arguments, or the
+   * error to return.
+   */
+  const char *CloseStream(int handle, bool encrypt, bool *signed_too,
+                          int *retval, std::string *output,
+                          SecureString *data);
+
+  /*
+   * Run gpg with |args| like CallGpgWithData(), with the data of |fetch| as
+   * its input. Returns NULL with what gpg did in the other arguments, or the
+   * error to return.
+   */
+  const char *CallGpgWithFetch(const std::vector<const char*> &args,
+                               const std::string *extra, GpgUrlFetch *fetch,
+                               int *retval, std::string *output,
+                               SecureString *data);
+
+  /*
+   * Terminate gpg for the streams that haven't been closed, once they're no
+   * longer being written to. Called before the object goes away.
+   */
+  void AbortStreams();
+
+  /*
+   * Take the stream |handle| out of streams_ once it's no longer written to,
+   * into |stream|, unless it's already being closed. lock_ must be held, and
+   * is released while waiting.
+   */
+  bool TakeStreamLocked(int handle, Stream *stream);
+
+  /*
+   * Whether the gpg_large_result_kb preference says that a text of |size|
+   * bytes is too large to return.
+   */
+  bool IsLargeResult(size_t size);
+
+  /*
+   * Keep |text| in |results_| if it's too large to return, and return its
+   * handle, or 0. The text is moved rather than copied, and |text| is left
+   * empty.
+   */
+  int KeepLargeResult(SecureString *text);
+
+  /*
+   * Put the text gpg wrote in |retobj|, which is where it's first copied out
+   * of secure memory, or keep it with KeepLargeResult() and put its handle
+   * there instead. |text| is left empty either way.
+   */
+  void SetResultText(SecureString *text, GpgRetEncryptInfo *retobj);
+  void SetResultText(SecureString *text, GpgRetDecryptInfo *retobj);
+
+  /*
+   * The same for a cipher text that GPGME has already put in |retobj|: a
+   * large one is moved to |results_| and wiped from |retobj|.
+   */
+  void KeepLargeResult(GpgRetEncryptInfo *retobj);
+
+  /* Take over the texts in |results|, which is left empty. */
+  void AdoptResults(std::map<int, SecureString> *results);
+
+  /*
+   * The GPGME engine of the calling thread if the gpg_engine preference asks
+   * for it, otherwise NULL. Always NULL if GPGME isn't built in.
+   */
+  GpgmeEngine *Gpgme();
+
+  /*
+   * Have the watchdog interrupt |gpgme| like a gpg the plugin runs (see
+   * WaitOnGpg()) until UnwatchGpgme(), which returns the error the call
+   * should return if it was interrupted, or NULL. |gpgme| must not be used
+   * after an interruption, since the engine is replaced then.
+   */
+  void WatchGpgme(GpgmeEngine *gpgme);
+  const char *UnwatchGpgme(GpgmeEngine *gpgme);
+
+  /*
+   * Make the detached signature of rawtext with keyid through gpg-agent if
+   * the gpg_engine preference asks for it. Returns false if the agent can't
+   * do it, in which case the caller should run gpg instead.
+   */
+  bool AgentSignText(const std::string &rawtext, const std::string &keyid,
+                     GpgRetString *retobj);
+
+  /*
+   * Decrypt cipher_text with a session key that gpg-agent decrypts, if the
+   * gpg_engine preference asks for it. Returns false if the plugin can't do
+   * it this way, in which case the caller should run gpg instead.
+   */
+  bool AgentDecryptText(const std::string &cipher_text,
+                        GpgRetDecryptInfo *retobj);
+
+  /*
+   * Make |request| to gpg-agent, and get its |result| or |error| (0 if it
+   * succeeded). Returns false if the agent couldn't be asked, in which case
+   * gpg should be run instead, unless the watchdog interrupted the request:
+   * then |interrupted| is the error the call should return.
+   */
+  bool CallAgent(AgentRequest *request, std::string *result,
+                 unsigned int *error, const char **interrupted);
+
+  /*
+   * Get gpg's --with-colons |listing| of the secret key |keyid|, with its
+   * keygrips and key data. Returns false if that fails, with |interrupted|
+   * set like for CallAgent().
+   */
+  bool ListSecretKey(const std::string &keyid, std::string *listing,
+                     const char **interrupted);
+
+  /* Record an attempt to start gpg in |stats_|, see GpgStats::RecordSpawn(). */
+  void RecordSpawn(const std::string &strategy, PRInt64 elapsed, bool ok);
+
+  /* Add |stats| to |stats_|. */
+  void MergeStats(const GpgStats &stats);
+
+  /* Record in |stats_| that waiting on |target| was given up on. */
+  void RecordInterruption(const std::string &target, bool canceled);
+
+  /* Record in |stats_| that spawn strategy |strategy| was given up on. */
+  void RecordFallback(const std::string &strategy, GpgStats::Fallback reason);
+
+  /* How long to wait on gpg or gpg-agent, from the gpg_timeout preference. */
+  PRIntervalTime Timeout() const;
+
+  /*
+   * Whether the gpg_data_path preference asks for gpg's data to go through
+   * pipes (see CallGpgWithData()) rather than temporary files.
+   */
+  bool UseDataPipes() const;
+
+  /*
+   * Whether the gpg_temp_files preference asks for temporary files to be kept
+   * in memory, see TmpWrapper.
+   */
+  bool UseMemoryFiles() const;
+
+  /*
+   * Whether the gpg_armor preference asks for the plugin to armor and
+   * dearmor texts rather than gpg.
+   */
+  bool ArmorInPlugin() const;
+
+  /*
+   * The statuses that gpg is terminated for as soon as it writes one of them
+   * (see GpgStatusWatch), or NULL if the gpg_fail_fast preference is off.
+   */
+  const GpgStatusSet *FailFast() const;
+
+  /*
+   * The error for an output path that gpg shouldn't be handed, or NULL if
+   * it's fine: it has to be absolute, and name a file that doesn't exist yet
+   * unless the gpg_overwrite_files preference is on.
+   */
+  const char *OutputPathError(const std::string &output_path) const;
+
+  /* Add the arguments that have gpg write its output to |output_path|. */
+  void AddOutputArgs(const std::string &output_path,
+                     std::vector<const char *> *args) const;
+
+  /*
+   * The zlib level (or kCOMPRESS_DEFAULT, see compression.h) for gpg to
+   * compress |rawtext| with, as |compression| asks, or the gpg_compression
+   * preference if it's empty. "auto" needs |rawtext|, and leaves it to gpg
+   * if that's NULL. The choices "auto" makes are counted in |stats_|.
+   */
+  int CompressLevel(const std::string &compression,
+                    const std::string *rawtext);
+
   GpgPreferences preferences_;
+  /*
+   * Protects stats_, signing_keys_, decryption_keys_, streams_ and
+   * results_. A stream is written to and closed without it, but counted as
+   * in use meanwhile.
+   */
+  PRLock *lock_;
+  /* Notified under lock_ when a stream is no longer written to. */
+  PRCondVar *streams_idle_;
+  GpgStats stats_;
+  /*
+   * Held while agent_ is used, which may be for as long as the user takes to
+   * enter a passphrase.
+   */
+  PRLock *agent_lock_;
+  /* The connection to gpg-agent of the "agent" engine, made when needed. */
+  GpgAgent *agent_;
+  /* The socket path that agent_ is connected to. */
+  std::string agent_socket_;
+  /*
+   * The keys that signing with each keyid uses. A key without a keygrip
+   * means that the agent can't be used with it.
+   */
+  std::map<std::string, openpgp::SigningKey> signing_keys_;
+  /* The same for the keys that session keys are encrypted to. */
+  std::map<std::string, openpgp::DecryptionKey> decryption_keys_;
+  /* The open streams by handle. Not copied with the object. */
+  std::map<int, Stream> streams_;
+  /*
+   * The texts kept by KeepLargeResult() by handle. Their memory is zeroed
+   * when they're released, see SecureAllocator. Not copied either.
+   */
+  std::map<int, SecureString> results_;
 };
 
 /*
@@ -308,16 +841,84 @@ class BaseGnupg {
  */
 class Gnupg : public BaseGnupg {
  public:
-  PRProcess *CallGpg(const std::vector<const char*> &args);
-  bool ReadAllGpgOutput(std::string *output);
-  int WaitOnGpg(PRProcess *process);
-  bool ReadFileToString(const char *filename, std::string *text);
+  Gnupg();
+  /* Copies get a completion queue of their own. */
+  Gnupg(const Gnupg &other);
+  virtual ~Gnupg();
+
+  Gnupg &operator=(const Gnupg &other);
+
+  GpgSession *CallGpg(const std::vector<const char*> &args);
+  bool ReadAllGpgOutput(GpgSession *session, std::string *output,
+                        GpgOutputWatcher *watcher);
+  int WaitOnGpg(GpgSession *session);
+  bool ReadFileToString(const char *filename, SecureString *text);
+  bool CallGpgWithData(const std::vector<const char*> &args,
+                       const std::string &input,
+                       const std::string *extra,
+                       int *retval, std::string *output,
+                       SecureString *data);
+  GpgInputStream *OpenGpgWithData(const std::vector<const char*> &args,
+                                  const std::string *extra);
+
+  /*
+   * The object of the calling thread that the asynchronous methods of every
+   * Gnupg object run on there, with the preferences of the object they were
+   * called on. Returns NULL if it can't be created.
+   */
+  static Gnupg *ForCurrentThread();
+
+  /*
+   * The queue that the asynchronous calls made on this object in plugin
+   * instance |npp| complete through, created on first use.
+   */
+  GnupgCompletionQueue *CompletionQueue(NPP npp);
+
+  /*
+   * Called from NPP_Destroy() once the plugin instance's object has been
+   * released. The asynchronous calls made in |npp| that haven't completed
+   * yet then complete without running their callbacks.
+   */
+  static void InstanceDestroyed(NPP npp);
+
+  /*
+   * Called from NP_Shutdown(). Waits for the worker threads to exit and
+   * completes the calls they ran.
+   */
+  static void ShutdownAsync();
+
+ private:
+  /* Our ends of the data pipes of a gpg process. */
+  struct DataPipes {
+    /* Its standard input. */
+    PRFileDesc *input;
+    /* Its standard output. */
+    PRFileDesc *output;
+    /* The pipe for kGPG_EXTRA_INPUT, or NULL. */
+    PRFileDesc *extra;
+  };
+
+  GpgSession *StartGpg(const std::vector<const char*> &args,
+                       DataPipes *data, bool extra);
+
+  /*
+   * What tells that the gpg of |session| has exited if the gpg_reader
+   * preference asks to stop reading then, or -1.
+   */
+  int ExitFdToWatch(GpgSession *session);
+
+  GnupgCompletionQueue *completion_queue_;
 };
 
 
 namespace glue {
 namespace class_Gnupg {
 bool IsTrustedOrigin(void *pdata);
+/*
+ * Whether the page may have the plugin fetch |url|: our extensions may fetch
+ * any URL, web pages those of their own origin.
+ */
+bool MayFetchUrl(void *pdata, const std::string &url);
 }
 }
 
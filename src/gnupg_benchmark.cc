@@ -0,0 +1,360 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Benchmarks for the plugin, to be run by hand:
+ *
+ *   $ scons gnupg_benchmark && ./gnupg_benchmark --help
+ *
+ * Nothing here needs a keyring, except for the benchmarks that encrypt, which
+ * are skipped unless --recipient names a public key to encrypt to. The others
+ * only use gpg commands that work without one, or don't run gpg at all.
+ */
+
+#include <prtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gnupg.h"
+#include "securemem.h"
+#include "tmpwrapper.h"
+
+namespace {
+
+struct Options {
+  Options()
+      : iterations(100),
+        ballast_mb(0) {
+  }
+
+  std::string benchmark;
+  std::string gpg_path;
+  std::string launcher_path;
+  std::string recipient;
+  int iterations;
+  int ballast_mb;
+};
+
+/*
+ * Print min/median/mean/max of |samples| (in microseconds).
+ */
+void Report(const char *name, std::vector<PRTime> samples) {
+  if (samples.empty()) {
+    printf("%-24s no samples\n", name);
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  PRTime total = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    total += samples[i];
+  }
+  printf("%-24s n=%-5u min=%-8lld median=%-8lld mean=%-8lld max=%lld (us)\n",
+         name, static_cast<unsigned int>(samples.size()),
+         static_cast<long long>(samples.front()),
+         static_cast<long long>(samples[samples.size() / 2]),
+         static_cast<long long>(total / samples.size()),
+         static_cast<long long>(samples.back()));
+}
+
+/*
+ * The cost of fork() depends on the size of the forking process, and the
+ * plugin runs inside a browser that is a lot larger than this benchmark, so
+ * optionally make this process larger to get more realistic numbers.
+ */
+char *AllocateBallast(int megabytes) {
+  if (megabytes <= 0) {
+    return NULL;
+  }
+  size_t size = static_cast<size_t>(megabytes) * 1024 * 1024;
+  char *ballast = static_cast<char *>(malloc(size));
+  if (ballast != NULL) {
+    /* Touch every page so that it is actually mapped. */
+    memset(ballast, 1, size);
+  }
+  return ballast;
+}
+
+void ConfigureGnupg(const Options &options, Gnupg *gpg) {
+  gpg->SetConfigValue("gpg_plugin_initialized", "true");
+  if (!options.gpg_path.empty()) {
+    gpg->SetConfigValue("gpg_binary_path", options.gpg_path);
+  }
+  if (!options.launcher_path.empty()) {
+    gpg->SetConfigValue("gpg_launcher_path", options.launcher_path);
+  }
+}
+
+/*
+ * Time 'gpg --version' from CallGpg() to WaitOnGpg() with every strategy
+ * GpgPreferences::GpgSpawnStrategy supports.
+ */
+void BenchmarkSpawn(const Options &options) {
+  static const char *const kStrategies[] = {
+    "nspr",
+#ifndef OS_WINDOWS
+    "launcher",
+    "posix_spawn",
+#endif
+  };
+
+  for (size_t s = 0; s < sizeof kStrategies / sizeof kStrategies[0]; s++) {
+    Gnupg gpg;
+    ConfigureGnupg(options, &gpg);
+    gpg.SetConfigValue("gpg_spawn_strategy", kStrategies[s]);
+
+    /* Don't count starting the launcher. */
+    gpg.GetGnupgVersion();
+
+    std::vector<PRTime> samples;
+    for (int i = 0; i < options.iterations; i++) {
+      PRTime start = PR_Now();
+      GpgRetString version = gpg.GetGnupgVersion();
+      PRTime end = PR_Now();
+      if (version.is_error()) {
+        printf("spawn/%s: %s\n", kStrategies[s], version.error_str().c_str());
+        break;
+      }
+      samples.push_back(end - start);
+    }
+
+    std::string name = std::string("spawn/") + kStrategies[s];
+    Report(name.c_str(), samples);
+  }
+}
+
+/*
+ * The payload sizes the data benchmarks run with. Large payloads are handled
+ * fewer times, so that this doesn't take all day.
+ */
+const size_t kSizes[] = {
+  1024,
+  64 * 1024,
+  1024 * 1024,
+  10 * 1024 * 1024,
+  100 * 1024 * 1024,
+};
+const size_t kMaxBytesPerSize = 64 * 1024 * 1024;
+
+int IterationsFor(const Options &options, size_t size) {
+  int iterations = options.iterations;
+  if (iterations > static_cast<int>(kMaxBytesPerSize / size)) {
+    iterations = std::max(3, static_cast<int>(kMaxBytesPerSize / size));
+  }
+  return iterations;
+}
+
+/* A text of |size| bytes in lines, like a text that would be encrypted. */
+std::string MakeText(size_t size) {
+  std::string text(size, 'x');
+  for (size_t i = 71; i < text.size(); i += 72) {
+    text[i] = '\n';
+  }
+  text[size - 1] = '\n';
+  return text;
+}
+
+/*
+ * Time EncryptText() with each gpg_data_path, for texts from 1 KB to 100 MB.
+ */
+void BenchmarkDataPath(const Options &options) {
+  static const char *const kDataPaths[] = {
+    "files",
+#ifndef OS_WINDOWS
+    "pipes",
+#endif
+  };
+
+  if (options.recipient.empty()) {
+    printf("datapath: skipped, needs --recipient\n");
+    return;
+  }
+  std::vector<std::string> keyids(1, options.recipient);
+  std::vector<std::string> hidden_keyids;
+
+  for (size_t z = 0; z < sizeof kSizes / sizeof kSizes[0]; z++) {
+    std::string text = MakeText(kSizes[z]);
+    int iterations = IterationsFor(options, kSizes[z]);
+
+    for (size_t d = 0; d < sizeof kDataPaths / sizeof kDataPaths[0]; d++) {
+      Gnupg gpg;
+      ConfigureGnupg(options, &gpg);
+      gpg.SetConfigValue("gpg_data_path", kDataPaths[d]);
+
+      std::vector<PRTime> samples;
+      for (int i = 0; i < iterations; i++) {
+        PRTime start = PR_Now();
+        GpgRetEncryptInfo encrypted = gpg.EncryptText(text, keyids,
+                                                      hidden_keyids, true, "");
+        PRTime end = PR_Now();
+        if (encrypted.is_error()) {
+          printf("datapath/%s: %s\n", kDataPaths[d],
+                 encrypted.error_str().c_str());
+          break;
+        }
+        samples.push_back(end - start);
+      }
+
+      char name[64];
+      snprintf(name, sizeof name, "datapath/%s/%uk", kDataPaths[d],
+               static_cast<unsigned int>(kSizes[z] / 1024));
+      Report(name, samples);
+    }
+  }
+}
+
+/*
+ * How Gnupg::ReadFileToString() used to read gpg's output files, for
+ * comparison.
+ */
+bool ReadFileByLines(const char *filename, SecureString *text) {
+  std::ifstream file(filename);
+  if (!file) {
+    return false;
+  }
+  std::string line;
+  std::string data;
+  while (std::getline(file, line)) {
+    data.append(line + "\n");
+  }
+  text->assign(data.data(), data.size());
+  return true;
+}
+
+/*
+ * Time reading files from 1 KB to 100 MB the way output files from gpg are
+ * read, line by line and with Gnupg::ReadFileToString(). The files are likely
+ * to be in the page cache, as gpg's output would be.
+ */
+void BenchmarkReadFile(const Options &options) {
+  Gnupg gpg;
+  for (size_t z = 0; z < sizeof kSizes / sizeof kSizes[0]; z++) {
+    TmpWrapper tmp;
+    std::string filename = "gpgbench";
+    if (!tmp.CreateAndWriteTmpFile(MakeText(kSizes[z]), &filename)) {
+      printf("readfile: failed to write %s\n", filename.c_str());
+      return;
+    }
+    int iterations = IterationsFor(options, kSizes[z]);
+
+    for (int reader = 0; reader < 2; reader++) {
+      std::vector<PRTime> samples;
+      for (int i = 0; i < iterations; i++) {
+        SecureString text;
+        PRTime start = PR_Now();
+        bool ok = reader == 0 ? ReadFileByLines(filename.c_str(), &text)
+                              : gpg.ReadFileToString(filename.c_str(), &text);
+        PRTime end = PR_Now();
+        if (!ok || text.size() != kSizes[z]) {
+          printf("readfile: failed to read %s\n", filename.c_str());
+          return;
+        }
+        samples.push_back(end - start);
+      }
+
+      char name[64];
+      snprintf(name, sizeof name, "readfile/%s/%uk",
+               reader == 0 ? "getline" : "reader",
+               static_cast<unsigned int>(kSizes[z] / 1024));
+      Report(name, samples);
+    }
+  }
+}
+
+struct Benchmark {
+  const char *name;
+  void (*run)(const Options &options);
+};
+
+const Benchmark kBenchmarks[] = {
+  { "spawn", BenchmarkSpawn },
+  { "datapath", BenchmarkDataPath },
+  { "readfile", BenchmarkReadFile },
+};
+
+void Usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --benchmark=NAME    only run benchmark NAME\n"
+          "  --gpg=PATH          the gpg binary to use\n"
+          "  --launcher=PATH     the gpg-launcher binary to use\n"
+          "  --recipient=KEYID   the public key to encrypt to\n"
+          "  --iterations=N      repeat each measurement N times\n"
+          "  --ballast-mb=N      grow this process by N MB before measuring\n"
+          "Benchmarks:",
+          argv0);
+  for (size_t i = 0; i < sizeof kBenchmarks / sizeof kBenchmarks[0]; i++) {
+    fprintf(stderr, " %s", kBenchmarks[i].name);
+  }
+  fprintf(stderr, "\n");
+}
+
+bool ParseFlag(const char *arg, const char *flag, std::string *value) {
+  size_t length = strlen(flag);
+  if (strncmp(arg, flag, length) != 0 || arg[length] != '=') {
+    return false;
+  }
+  *value = arg + length + 1;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string value;
+    if (ParseFlag(argv[i], "--benchmark", &options.benchmark) ||
+        ParseFlag(argv[i], "--gpg", &options.gpg_path) ||
+        ParseFlag(argv[i], "--launcher", &options.launcher_path) ||
+        ParseFlag(argv[i], "--recipient", &options.recipient)) {
+      continue;
+    } else if (ParseFlag(argv[i], "--iterations", &value)) {
+      options.iterations = atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--ballast-mb", &value)) {
+      options.ballast_mb = atoi(value.c_str());
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  char *ballast = AllocateBallast(options.ballast_mb);
+
+  for (size_t i = 0; i < sizeof kBenchmarks / sizeof kBenchmarks[0]; i++) {
+    if (options.benchmark.empty() || options.benchmark == kBenchmarks[i].name) {
+      kBenchmarks[i].run(options);
+    }
+  }
+
+  free(ballast);
+  return 0;
+}
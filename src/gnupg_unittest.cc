@@ -35,20 +35,58 @@
 
 #include <npapi.h>
 #include <npruntime.h>
-
+#include <pratom.h>
+#include <prinrval.h>
+#include <prthread.h>
+#ifndef OS_WINDOWS
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "armor.h"
+#include "errors.h"
+#include "outputwatcher.h"
 #include "static_object.h"
+#ifndef OS_WINDOWS
+#include "testkeyring.h"
+#endif
+#include "tmpwrapper.h"
+#include "urlfetch.h"
+#include "watchdog.h"
 
 using ::testing::_;
+using ::testing::Invoke;
 using ::testing::Return;
 using ::testing::SetArgumentPointee;
 using ::testing::ElementsAre;
+using ::testing::IsNull;
+using ::testing::Pointee;
 using ::testing::StrEq;
 
+namespace glue {
+namespace class_Gnupg {
+/* From the glue, which the test isn't linked with. */
+int userglue_method_GetGnupgVersionAsync(void *pdata, Gnupg *object,
+                                         GpgRetStringCallback *param_on_done);
+}
+}
+
 
 namespace {
 
 static const std::string kTEST_STRING = "this is test stuff\n";
-static PRProcess *const kFAKE_PROCESS = reinterpret_cast<PRProcess *>(0xdead);
+static GpgSession *const kFAKE_SESSION =
+    reinterpret_cast<GpgSession *>(0xdead);
+
+/* What a mocked gpg writes as its data, which is read into secure memory. */
+static SecureString Secure(const std::string &text) {
+  return SecureString(text.begin(), text.end());
+}
 
 static const std::string kFIREFOX_ORIGIN =
     "chrome://browser/content/browser.xul";
@@ -68,10 +106,39 @@ static const NPIdentifier kUNKNOWN_IDENTIFIER =
 
 class MockGnupg : public BaseGnupg {
  public:
-  MOCK_METHOD1(CallGpg, PRProcess *(const std::vector<const char*> &args));
-  MOCK_METHOD1(ReadAllGpgOutput, bool(std::string *output));
-  MOCK_METHOD1(WaitOnGpg, int(PRProcess *process));
-  MOCK_METHOD2(ReadFileToString, bool(const char *filename, std::string *text));
+  MOCK_METHOD1(CallGpg, GpgSession *(const std::vector<const char*> &args));
+  MOCK_METHOD3(ReadAllGpgOutput, bool(GpgSession *session,
+                                      std::string *output,
+                                      GpgOutputWatcher *watcher));
+  MOCK_METHOD1(WaitOnGpg, int(GpgSession *session));
+  MOCK_METHOD2(ReadFileToString, bool(const char *filename,
+                                      SecureString *text));
+  MOCK_METHOD6(CallGpgWithData, bool(const std::vector<const char*> &args,
+                                     const std::string &input,
+                                     const std::string *extra,
+                                     int *retval, std::string *output,
+                                     SecureString *data));
+  MOCK_METHOD2(OpenGpgWithData,
+               GpgInputStream *(const std::vector<const char*> &args,
+                                const std::string *extra));
+};
+
+class MockInputStream : public GpgInputStream {
+ public:
+  explicit MockInputStream(bool *deleted)
+      : deleted_(deleted) {
+  }
+
+  ~MockInputStream() {
+    *deleted_ = true;
+  }
+
+  MOCK_METHOD1(Write, bool(const std::string &chunk));
+  MOCK_METHOD3(Close, bool(int *retval, std::string *output,
+                           SecureString *data));
+
+ private:
+  bool *deleted_;
 };
 
 /*
@@ -81,130 +148,98 @@ TEST(GnupgTestParseGpgOutput, DoesParse) {
   /* This test verifies that Gnupg does job Foo. */
   std::string output;
   output = "[GNUPG:] FOO Bar baz\n[GNUPG:] WONK wink bink\n";
-  std::vector< std::vector<std::string> > parsed;
+  GpgStatusLines parsed;
   Gnupg gpg;
-  gpg.ParseGpgOutput(output, &parsed);
-  EXPECT_EQ("FOO", parsed[0][0]);
+  EXPECT_TRUE(gpg.ParseGpgOutput(output, &parsed));
+  ASSERT_EQ(2U, parsed.size());
+  EXPECT_EQ("FOO", parsed[0].keyword.as_string());
+  EXPECT_EQ(kSTATUS_UNKNOWN, parsed[0].status);
+  EXPECT_EQ("wink bink", parsed[1].args.as_string());
+
+  GpgStatusLine line;
+  EXPECT_TRUE(gpg.ParseGpgLine("[GNUPG:] GOT_IT", &line));
+  EXPECT_EQ("GOT_IT", line.keyword.as_string());
+  EXPECT_EQ(kSTATUS_GOT_IT, line.status);
+  EXPECT_TRUE(line.args.empty());
+  EXPECT_FALSE(gpg.ParseGpgLine("[GNUPG:]", &line));
 }
 
 /*
  * The next few functions exercize the CheckOutput* functions.
  */
+static const char kSERIES[] =
+    "[GNUPG:] SIG_ID details\n"
+    "[GNUPG:] GOODSIG more details\n"
+    "[GNUPG:] VALIDSIG\n";
+
 TEST(GnupgTestCheckOuput, HasSeries) {
-  std::vector< std::vector<std::string> > output;
-  std::vector<std::string> line, expected;
-  line.push_back("SER1");
-  line.push_back("details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER2");
-  line.push_back("more details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER3");
-  output.push_back(line);
-
-  expected.push_back("SER1");
-  expected.push_back("SER2");
-  expected.push_back("SER3");
+  GpgStatusLines output;
+  ASSERT_TRUE(ParseStatusOutput(kSERIES, &output));
+
+  GpgStatus expected[] = { kSTATUS_SIG_ID, kSTATUS_GOODSIG, kSTATUS_VALIDSIG };
 
   Gnupg gpg;
-  EXPECT_TRUE(gpg.CheckForOrderedOutput(expected, output));
+  EXPECT_TRUE(gpg.CheckForOrderedOutput(expected, 3, output));
+  EXPECT_TRUE(gpg.CheckForOrderedOutput(expected, 2, output));
 }
 
 TEST(GnuTestCheckOutput, DoesNotHaveSeries) {
-  std::vector< std::vector<std::string> > output;
-  std::vector<std::string> line, expected;
-  line.push_back("SER1");
-  line.push_back("details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER2");
-  line.push_back("more details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER3");
-  output.push_back(line);
-
-  expected.push_back("SER1");
-  expected.push_back("SER3");
-  expected.push_back("SER2");
+  GpgStatusLines output;
+  ASSERT_TRUE(ParseStatusOutput(kSERIES, &output));
+
+  GpgStatus expected[] = { kSTATUS_SIG_ID, kSTATUS_VALIDSIG, kSTATUS_GOODSIG,
+                           kSTATUS_VALIDSIG };
 
   Gnupg gpg;
-  EXPECT_FALSE(gpg.CheckForOrderedOutput(expected, output));
+  EXPECT_FALSE(gpg.CheckForOrderedOutput(expected, 3, output));
+  EXPECT_FALSE(gpg.CheckForOrderedOutput(expected, 4, output));
 }
 
 TEST(GnupgTestCheckOuput, CheckHasVariousOutputs) {
   /* This is the same setup as above - except in this case, it should pass. */
-  std::vector< std::vector<std::string> > output;
-  std::vector<std::string> line, expected;
-  line.push_back("SER1");
-  line.push_back("details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER2");
-  line.push_back("more details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER3");
-  output.push_back(line);
-
-  expected.push_back("SER1");
-  expected.push_back("SER3");
-  expected.push_back("SER2");
+  GpgStatusLines output;
+  ASSERT_TRUE(ParseStatusOutput(kSERIES, &output));
+
+  GpgStatusSet expected;
+  expected.set(kSTATUS_SIG_ID);
+  expected.set(kSTATUS_VALIDSIG);
+  expected.set(kSTATUS_GOODSIG);
 
   Gnupg gpg;
   EXPECT_TRUE(gpg.CheckForUnorderedOutput(expected, output));
 }
 
 TEST(GnupgTestCheckOuput, CheckDoesNotHaveVariousOutputs) {
-  /* This is the same setup as above - except in this case, it should pass. */
-  std::vector< std::vector<std::string> > output;
-  std::vector<std::string> line, expected;
-  line.push_back("SER1");
-  line.push_back("details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER2");
-  line.push_back("more details");
-  output.push_back(line);
-
-  expected.push_back("SER1");
-  expected.push_back("SER3");
-  expected.push_back("SER2");
+  GpgStatusLines output;
+  ASSERT_TRUE(ParseStatusOutput("[GNUPG:] SIG_ID details\n"
+                                "[GNUPG:] GOODSIG more details\n", &output));
+
+  GpgStatusSet expected;
+  expected.set(kSTATUS_SIG_ID);
+  expected.set(kSTATUS_VALIDSIG);
+  expected.set(kSTATUS_GOODSIG);
 
   Gnupg gpg;
   EXPECT_FALSE(gpg.CheckForUnorderedOutput(expected, output));
 }
 
 TEST(GnupgTestCheckOutput, CheckHasSingleOutput) {
-  std::vector< std::vector<std::string> > output;
-  std::vector<std::string> line;
-  line.push_back("SER1");
-  line.push_back("details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER2");
-  line.push_back("more details");
-  output.push_back(line);
+  GpgStatusLines output;
+  ASSERT_TRUE(ParseStatusOutput("[GNUPG:] SIG_ID details\n"
+                                "[GNUPG:] GOODSIG more details\n", &output));
 
   Gnupg gpg;
-  EXPECT_TRUE(gpg.CheckForSingleOutput("SER2", output));
+  EXPECT_TRUE(gpg.CheckForSingleOutput(kSTATUS_GOODSIG, output));
 }
 
 TEST(GnupgTestCheckOutput, CheckDoesNotHaveSingleOutput) {
-  std::vector< std::vector<std::string> > output;
-  std::vector<std::string> line;
-  line.push_back("SER1");
-  line.push_back("details");
-  output.push_back(line);
-  line.clear();
-  line.push_back("SER2");
-  line.push_back("more details");
-  output.push_back(line);
+  GpgStatusLines output;
+  ASSERT_TRUE(ParseStatusOutput("[GNUPG:] SIG_ID details\n"
+                                "[GNUPG:] GOODSIGS more details\n", &output));
 
   Gnupg gpg;
-  EXPECT_FALSE(gpg.CheckForSingleOutput("SER3", output));
+  EXPECT_FALSE(gpg.CheckForSingleOutput(kSTATUS_VALIDSIG, output));
+  EXPECT_FALSE(gpg.CheckForSingleOutput(kSTATUS_GOODSIG, output));
 }
 
 /*
@@ -238,10 +273,10 @@ TEST(GnupgGetGnupgVersion, CheckCallsVersion) {
    * Apparently Contains() isn't actually here until the next release.
    */
   EXPECT_CALL(gpg, CallGpg(ElementsAre(StrEq("--version"))))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
       .WillOnce(Return(true));
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION));
   gpg.GetGnupgVersion();
 }
 
@@ -264,10 +299,10 @@ TEST(GnupgVerifySignedText, VerifiesValidSig) {
       "[GNUPG:] TRUST_ULTIMATE\n";
 
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(0));
   GpgRetSignerInfo si = gpg.VerifySignedText("", "");
   EXPECT_EQ("Phil Dibowitz <fixxxer@google.com>", si.signer());
@@ -280,16 +315,37 @@ TEST(GnupgVerifySignedText, DoesNotVerifyInvalidSig) {
   std::string ret =
      "[GNUPG:] BADSIG 2C157CF124CB0839 Phil Dibowitz <fixxxer@google.com>\n";
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(2));
   GpgRetSignerInfo si = gpg.VerifySignedText("", "");
   EXPECT_TRUE(si.is_error());
   EXPECT_EQ("Bad signature", si.error_str());
 }
 
+#ifndef HAVE_GPGME
+/*
+ * Without GPGME built in, asking for it still runs gpg.
+ */
+TEST(GnupgVerifySignedText, FallsBackToGpgWithoutGpgme) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_engine", "gpgme");
+  std::string ret =
+     "[GNUPG:] BADSIG 2C157CF124CB0839 Phil Dibowitz <fixxxer@google.com>\n";
+  EXPECT_CALL(gpg, CallGpg(_))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillOnce(Return(2));
+  GpgRetSignerInfo si = gpg.VerifySignedText("", "");
+  EXPECT_EQ("Bad signature", si.error_str());
+}
+#endif
+
 TEST(GnupgEncryptText, EncryptsToValidKey) {
   MockGnupg gpg;
   gpg.SetConfigValue("gpg_plugin_initialized", "true");
@@ -299,12 +355,13 @@ TEST(GnupgEncryptText, EncryptsToValidKey) {
       "[GNUPG:] END_ENCRYPTION\n";
 
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
   EXPECT_CALL(gpg, ReadFileToString(_, _))
-      .WillOnce(DoAll(SetArgumentPointee<1>(kTEST_STRING), Return(true)));
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+      .WillOnce(DoAll(SetArgumentPointee<1>(Secure(kTEST_STRING)),
+                      Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(0));
   GpgRetEncryptInfo ei =
       gpg.EncryptText("", keyids, hidden_keyids, false, "");
@@ -319,10 +376,10 @@ TEST(GnupgEncryptText, ErrorsOnBadKey) {
   std::string ret = "[GNUPG:] INV_RECP 0 3592D514\n";
 
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(2));
   GpgRetEncryptInfo ei =
       gpg.EncryptText("", keyids, hidden_keyids, false, "");
@@ -349,12 +406,13 @@ TEST(GnupgSignText, DetachSigns) {
       " 792836377D99F13F68B4D49B2C157CF124CB0839\n";
 
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
   EXPECT_CALL(gpg, ReadFileToString(_, _))
-      .WillOnce(DoAll(SetArgumentPointee<1>(kTEST_STRING), Return(true)));
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+      .WillOnce(DoAll(SetArgumentPointee<1>(Secure(kTEST_STRING)),
+                      Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(0));
   GpgRetString rs = gpg.SignText("", "", clearsign);
   EXPECT_FALSE(rs.is_error());
@@ -375,18 +433,375 @@ TEST(GnupgSignText, ClearSigns) {
       " 792836377D99F13F68B4D49B2C157CF124CB0839\n";
 
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
   EXPECT_CALL(gpg, ReadFileToString(_, _))
-      .WillOnce(DoAll(SetArgumentPointee<1>(kTEST_STRING), Return(true)));
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+      .WillOnce(DoAll(SetArgumentPointee<1>(Secure(kTEST_STRING)),
+                      Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(0));
 
   GpgRetString rs = gpg.SignText("", "", clearsign);
   EXPECT_EQ(kTEST_STRING, rs.retstring());
 }
 
+#ifndef OS_WINDOWS
+/*
+ * With data pipes, the text goes to gpg and the result comes back without
+ * temporary files.
+ */
+TEST(GnupgDataPipes, EncryptsThroughPipes) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_data_path", "pipes");
+  std::vector<std::string> keyids, hidden_keyids;
+  keyids.push_back("key");
+
+  std::string ret = "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--encrypt"), StrEq("--armor"), StrEq("--recipient"),
+                  StrEq("key"), StrEq("--output"), StrEq("-")),
+      "plain", IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      SetArgumentPointee<5>(Secure(kTEST_STRING)),
+                      Return(true)));
+  GpgRetEncryptInfo ei =
+      gpg.EncryptText("plain", keyids, hidden_keyids, false, "");
+  EXPECT_FALSE(ei.is_error());
+  EXPECT_EQ(kTEST_STRING, ei.cipher_text());
+}
+
+TEST(GnupgDataPipes, DecryptsThroughPipes) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_data_path", "pipes");
+
+  std::string ret = "[GNUPG:] ENC_TO 0123456789ABCDEF 1 0\n"
+      "[GNUPG:] USERID_HINT 0123456789ABCDEF Someone\n"
+      "[GNUPG:] PLAINTEXT 62 1251728234 \n"
+      "[GNUPG:] PLAINTEXT_LENGTH 5\n"
+      "[GNUPG:] DECRYPTION_OKAY\n"
+      "[GNUPG:] END_DECRYPTION\n";
+
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--output"), StrEq("-"), StrEq("--decrypt")),
+      "cipher", IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      SetArgumentPointee<5>(Secure("plain")),
+                      Return(true)));
+  GpgRetDecryptInfo di = gpg.DecryptText("cipher");
+  EXPECT_FALSE(di.is_error());
+  EXPECT_EQ("plain", di.data());
+}
+
+/*
+ * A detached signature goes through a pipe of its own, which gpg is told
+ * about with a special filename.
+ */
+TEST(GnupgDataPipes, VerifiesDetachedSignatureThroughExtraPipe) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_data_path", "pipes");
+  std::string ret =
+     "[GNUPG:] BADSIG 2C157CF124CB0839 Phil Dibowitz <fixxxer@google.com>\n";
+
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--enable-special-filenames"), StrEq("--verify"),
+                  StrEq("--"), StrEq(BaseGnupg::kGPG_EXTRA_INPUT),
+                  StrEq("-")),
+      "text", Pointee(std::string("signature")), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(1),
+                      SetArgumentPointee<4>(ret),
+                      Return(true)));
+  GpgRetSignerInfo si = gpg.VerifySignedText("text", "signature");
+  EXPECT_EQ("Bad signature", si.error_str());
+}
+
+#ifdef OS_LINUX
+/*
+ * A Gnupg that runs a fake gpg through data pipes, which reads its input,
+ * writes a status line and "cipher", and exits, leaving something running
+ * that holds on to its output. |script| gets the path to the fake gpg.
+ */
+static void ExitingFakeGpg(Gnupg *gpg, std::string *script) {
+  char path[] = "/tmp/gpg-test-XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  close(fd);
+  {
+    std::ofstream out(path);
+    out << "#!/bin/sh\n"
+        << "while [ \"$1\" != --status-fd ]; do shift; done\n"
+        << "cat > /dev/null\n"
+        << "echo '[GNUPG:] END_ENCRYPTION' >&$2\n"
+        << "echo cipher\n"
+        << "sleep 5 &\n";
+  }
+  chmod(path, 0700);
+  *script = path;
+  gpg->SetConfigValue("gpg_plugin_initialized", "true");
+  gpg->SetConfigValue("gpg_binary_path", path);
+  gpg->SetConfigValue("gpg_spawn_strategy", "posix_spawn");
+  gpg->SetConfigValue("gpg_reader", "exit");
+}
+
+/*
+ * With gpg_reader set to "exit", a call through pipes is over once gpg has
+ * exited, rather than when its output comes to an end.
+ */
+TEST(GnupgDataPipes, StopsReadingWhenGpgExits) {
+  Gnupg gpg;
+  std::string script;
+  ExitingFakeGpg(&gpg, &script);
+  std::vector<const char*> args;
+  args.push_back("--encrypt");
+
+  PRIntervalTime start = PR_IntervalNow();
+  int retval;
+  std::string output;
+  SecureString data;
+  EXPECT_TRUE(gpg.CallGpgWithData(args, "plain", NULL, &retval, &output,
+                                  &data));
+  EXPECT_GT(3U, PR_IntervalToSeconds(PR_IntervalNow() - start));
+  EXPECT_EQ(0, retval);
+  EXPECT_EQ("[GNUPG:] END_ENCRYPTION\n", output);
+  EXPECT_EQ("cipher\n", data);
+
+  start = PR_IntervalNow();
+  GpgInputStream *stream = gpg.OpenGpgWithData(args, NULL);
+  ASSERT_TRUE(stream != NULL);
+  EXPECT_TRUE(stream->Write("plain"));
+  output.clear();
+  data.clear();
+  EXPECT_TRUE(stream->Close(&retval, &output, &data));
+  delete stream;
+  EXPECT_GT(3U, PR_IntervalToSeconds(PR_IntervalNow() - start));
+  EXPECT_EQ("[GNUPG:] END_ENCRYPTION\n", output);
+  EXPECT_EQ("cipher\n", data);
+  unlink(script.c_str());
+}
+#endif
+
+/* gpg writes binary packets, which the plugin armors. */
+TEST(GnupgArmor, ArmorsWhatGpgEncrypts) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_data_path", "pipes");
+  gpg.SetConfigValue("gpg_armor", "plugin");
+  std::vector<std::string> keyids, hidden_keyids;
+  keyids.push_back("key");
+
+  std::string ret = "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--encrypt"), StrEq("--recipient"), StrEq("key"),
+                  StrEq("--output"), StrEq("-")),
+      "plain", IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      SetArgumentPointee<5>(Secure("packets")),
+                      Return(true)));
+  GpgRetEncryptInfo ei =
+      gpg.EncryptText("plain", keyids, hidden_keyids, false, "");
+  EXPECT_FALSE(ei.is_error());
+  EXPECT_EQ(Armor("MESSAGE", "packets"), ei.cipher_text());
+}
+
+TEST(GnupgArmor, DecryptsPackets) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_data_path", "pipes");
+  gpg.SetConfigValue("gpg_armor", "plugin");
+
+  std::string ret = "[GNUPG:] ENC_TO 0123456789ABCDEF 1 0\n"
+      "[GNUPG:] USERID_HINT 0123456789ABCDEF Someone\n"
+      "[GNUPG:] PLAINTEXT 62 1251728234 \n"
+      "[GNUPG:] PLAINTEXT_LENGTH 5\n"
+      "[GNUPG:] DECRYPTION_OKAY\n"
+      "[GNUPG:] END_DECRYPTION\n";
+
+  EXPECT_CALL(gpg, CallGpgWithData(_, "packets", IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      SetArgumentPointee<5>(Secure("plain")),
+                      Return(true)));
+  GpgRetDecryptInfo di = gpg.DecryptText(Armor("MESSAGE", "packets"));
+  EXPECT_FALSE(di.is_error());
+  EXPECT_EQ("plain", di.data());
+}
+
+TEST(GnupgArmor, TurnsAwayBadArmorWithoutGpg) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_armor", "plugin");
+  std::string bad = Armor("MESSAGE", "packets");
+  bad[bad.find("\n=") + 2] ^= 1;
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .Times(0);
+  EXPECT_CALL(gpg, CallGpgWithData(_, _, _, _, _, _))
+      .Times(0);
+  EXPECT_EQ(kERR_BAD_ARMOR, gpg.DecryptText(bad).error_str());
+  EXPECT_EQ(kERR_BAD_ARMOR, gpg.DecryptText("not armored").error_str());
+  EXPECT_EQ(kERR_BAD_ARMOR,
+            gpg.VerifySignedText("text", Armor("MESSAGE", "sig")).error_str());
+}
+
+TEST(GnupgCompression, SkipsCompressingRandomTexts) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_data_path", "pipes");
+  gpg.SetConfigValue("gpg_compression", "auto");
+  std::vector<std::string> keyids, hidden_keyids;
+  keyids.push_back("key");
+  std::string random(64 * 1024, '\0');
+  unsigned int x = 1;
+  for (size_t i = 0; i < random.size(); i++) {
+    x = x * 1103515245 + 12345;
+    random[i] = static_cast<char>(x >> 16);
+  }
+
+  std::string ret = "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--encrypt"), StrEq("--armor"),
+                  StrEq("--compress-algo"), StrEq("none"),
+                  StrEq("--recipient"), StrEq("key"),
+                  StrEq("--output"), StrEq("-")),
+      random, IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      Return(true)));
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--encrypt"), StrEq("--armor"),
+                  StrEq("--recipient"), StrEq("key"),
+                  StrEq("--output"), StrEq("-")),
+      "short", IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      Return(true)));
+  EXPECT_FALSE(gpg.EncryptText(random, keyids, hidden_keyids, false,
+                               "").is_error());
+  EXPECT_FALSE(gpg.EncryptText("short", keyids, hidden_keyids, false,
+                               "").is_error());
+  EXPECT_EQ("compression.gpg count=1 input_bytes=5\n"
+            "compression.none count=1 input_bytes=65536\n",
+            gpg.GetStats().retstring());
+}
+
+/*
+ * GPGME can't set the compression, so gpg runs for it even if GPGME is asked
+ * for (and built in).
+ */
+TEST(GnupgCompression, RunsGpgForCompressionWithGpgme) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_data_path", "pipes");
+  gpg.SetConfigValue("gpg_engine", "gpgme");
+  std::vector<std::string> keyids, hidden_keyids;
+  keyids.push_back("key");
+
+  std::string ret = "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--encrypt"), StrEq("--armor"),
+                  StrEq("--compress-algo"), StrEq("none"),
+                  StrEq("--recipient"), StrEq("key"),
+                  StrEq("--output"), StrEq("-")),
+      "plain", IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      Return(true)));
+  EXPECT_FALSE(gpg.EncryptTextCompressed("plain", keyids, hidden_keyids,
+                                         false, "", "none").is_error());
+}
+
+TEST(GnupgCompression, TakesLevelOfCall) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_data_path", "pipes");
+  gpg.SetConfigValue("gpg_compression", "none");
+  std::vector<std::string> keyids, hidden_keyids;
+  keyids.push_back("key");
+
+  std::string ret = "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--encrypt"), StrEq("--armor"),
+                  StrEq("--compress-level"), StrEq("9"),
+                  StrEq("--recipient"), StrEq("key"),
+                  StrEq("--output"), StrEq("-")),
+      "plain", IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      Return(true)));
+  EXPECT_CALL(gpg, CallGpgWithData(
+      ElementsAre(StrEq("--encrypt"), StrEq("--armor"),
+                  StrEq("--compress-algo"), StrEq("none"),
+                  StrEq("--recipient"), StrEq("key"),
+                  StrEq("--output"), StrEq("-")),
+      "plain", IsNull(), _, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<3>(0),
+                      SetArgumentPointee<4>(ret),
+                      Return(true)));
+  EXPECT_FALSE(gpg.EncryptTextCompressed("plain", keyids, hidden_keyids,
+                                         false, "", "9").is_error());
+  EXPECT_FALSE(gpg.EncryptTextCompressed("plain", keyids, hidden_keyids,
+                                         false, "", "").is_error());
+  EXPECT_EQ("", gpg.GetStats().retstring());
+}
+
+/*
+ * The agent engine looks up the key once and leaves keys it can't sign with,
+ * like this DSA key, to gpg.
+ */
+TEST(GnupgSignText, FallsBackToGpgForUnsupportedKeys) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_engine", "agent");
+  bool clearsign = false;
+
+  std::string listing =
+      "sec:u:1024:17:2C157CF124CB0839:1251728234:::u:::scSC:::+:::::0:\n"
+      "fpr:::::::::792836377D99F13F68B4D49B2C157CF124CB0839:\n"
+      "grp:::::::::5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7:\n";
+  std::string ret = "[GNUPG:] USERID_HINT 2C157CF124CB0839 Phil Dibowitz"
+      " <fixxxer@google.com>\n"
+      "[GNUPG:] NEED_PASSPHRASE 2C157CF124CB0839 2C157CF124CB0839 17 0\n"
+      "[GNUPG:] GOOD_PASSPHRASE\n"
+      "[GNUPG:] BEGIN_SIGNING\n"
+      "[GNUPG:] SIG_CREATED D 17 2 00 1251728234"
+      " 792836377D99F13F68B4D49B2C157CF124CB0839\n";
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .Times(3)
+      .WillRepeatedly(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(listing), Return(true)))
+      .WillRepeatedly(DoAll(SetArgumentPointee<1>(ret), Return(true)));
+  EXPECT_CALL(gpg, ReadFileToString(_, _))
+      .Times(2)
+      .WillRepeatedly(DoAll(SetArgumentPointee<1>(Secure(kTEST_STRING)),
+                            Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillRepeatedly(Return(0));
+
+  GpgRetString rs = gpg.SignText("", "2C157CF124CB0839", clearsign);
+  EXPECT_EQ(kTEST_STRING, rs.retstring());
+  rs = gpg.SignText("", "2C157CF124CB0839", clearsign);
+  EXPECT_EQ(kTEST_STRING, rs.retstring());
+}
+#endif
+
 TEST(GnupgSignText, FailsToSign) {
   MockGnupg gpg;
   gpg.SetConfigValue("gpg_plugin_initialized", "true");
@@ -399,11 +814,11 @@ TEST(GnupgSignText, FailsToSign) {
       "[GNUPG:] BAD_PASSPHRASE 2C157CF124CB0839";
 
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
   /* Code won't call ReadFileToString due to error code of 2 from gpg */
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(2));
 
   GpgRetString rs = gpg.SignText("", "", clearsign);
@@ -427,12 +842,13 @@ TEST(GnupgDecryptText, DecryptsText) {
       "[GNUPG:] END_DECRYPTION\n";
 
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
   EXPECT_CALL(gpg, ReadFileToString(_, _))
-      .WillOnce(DoAll(SetArgumentPointee<1>(kTEST_STRING), Return(true)));
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+      .WillOnce(DoAll(SetArgumentPointee<1>(Secure(kTEST_STRING)),
+                      Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(0));
 
   GpgRetDecryptInfo rd = gpg.DecryptText("");
@@ -451,17 +867,1001 @@ TEST(GnupgDecryptText, FailsToDecrypt) {
       "[GNUPG:] BAD_PASSPHRASE 2C157CF124CB0839";
 
   EXPECT_CALL(gpg, CallGpg(_))
-      .WillOnce(Return(kFAKE_PROCESS));
-  EXPECT_CALL(gpg, ReadAllGpgOutput(_))
-      .WillOnce(DoAll(SetArgumentPointee<0>(ret), Return(true)));
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
   /* Won't call ReadFileToString() with retval from gpg as 2 */
-  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_PROCESS))
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
       .WillOnce(Return(2));
 
   GpgRetDecryptInfo rd = gpg.DecryptText("");
   EXPECT_TRUE(rd.is_error());
 }
 
+/*
+ * gpg that the watchdog gave up on produces partial output at best, which
+ * mustn't be mistaken for an answer.
+ */
+TEST(GnupgInterruptions, ReportsTimeout) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(std::string("pub:f:")),
+                      Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillOnce(Return(BaseGnupg::kGPG_TIMED_OUT));
+
+  GpgRetString rs = gpg.GetTrust("2C157CF124CB0839");
+  EXPECT_TRUE(rs.is_error());
+  EXPECT_EQ("Timed out waiting for gpg", rs.error_str());
+}
+
+TEST(GnupgInterruptions, ReportsCancelAfterFailedRead) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(Return(false));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillOnce(Return(BaseGnupg::kGPG_CANCELED));
+
+  GpgRetDecryptInfo rd = gpg.DecryptText("");
+  EXPECT_TRUE(rd.is_error());
+  EXPECT_EQ("Canceled", rd.error_str());
+}
+
+/*
+ * Without its exit code, a good signature next to a bad one would look like a
+ * verified message.
+ */
+TEST(GnupgInterruptions, FailsWhenExitCodeIsLost) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  std::string ret =
+      "[GNUPG:] GOODSIG 2C157CF124CB0839 Phil Dibowitz"
+      " <fixxxer@google.com>\n"
+      "[GNUPG:] VALIDSIG 792836377D99F13F68B4D49B2C157CF124CB0839"
+      " 2009-07-16 1247743312 0 3 0 17 2 00"
+      " 792836377D99F13F68B4D49B2C157CF124CB0839\n"
+      "[GNUPG:] BADSIG 2C157CF124CB0839 Phil Dibowitz <fixxxer@google.com>\n";
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillOnce(Return(BaseGnupg::kGPG_LOST));
+
+  GpgRetSignerInfo si = gpg.VerifySignedText("", "");
+  EXPECT_TRUE(si.is_error());
+  EXPECT_EQ("Internal error", si.error_str());
+}
+
+TEST(GnupgInterruptions, AcceptsOnlyTimeoutsInSeconds) {
+  MockGnupg gpg;
+  EXPECT_TRUE(gpg.SetConfigValue("gpg_timeout", "30").retbool());
+  EXPECT_TRUE(gpg.SetConfigValue("gpg_timeout", "0").retbool());
+  EXPECT_FALSE(gpg.SetConfigValue("gpg_timeout", "").retbool());
+  EXPECT_FALSE(gpg.SetConfigValue("gpg_timeout", "30s").retbool());
+  EXPECT_FALSE(gpg.SetConfigValue("gpg_timeout", "-1").retbool());
+}
+
+/*
+ * gpg brackets what it says about each file with FILE_START and FILE_DONE, and
+ * exits with the worst exit code of them all.
+ */
+TEST(GnupgBatch, SplitsOutputByFile) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+
+  std::string ret = "[GNUPG:] FILE_START 1 /tmp/a\n"
+      "[GNUPG:] GOODSIG 2C157CF124CB0839 Phil Dibowitz\n"
+      "[GNUPG:] FILE_DONE\n"
+      "[GNUPG:] FILE_START 1 /tmp/b c\n"
+      "[GNUPG:] BADSIG 2C157CF124CB0839 Phil Dibowitz\n"
+      "[GNUPG:] FILE_DONE\n"
+      "[GNUPG:] FILE_START 1 /tmp/d\n"
+      "[GNUPG:] NEWSIG\n";
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillOnce(Return(1));
+
+  std::vector<const char*> args;
+  args.push_back("--verify");
+  std::vector<std::string> files;
+  files.push_back("/tmp/a");
+  files.push_back("/tmp/b c");
+  files.push_back("/tmp/d");
+  files.push_back("/tmp/e");
+  int retval;
+  std::vector<int> retvals;
+  std::vector<std::string> outputs;
+  ASSERT_TRUE(gpg.CallGpgMultifile(args, files, &retval, &retvals, &outputs));
+  EXPECT_EQ(1, retval);
+  EXPECT_THAT(retvals, ElementsAre(0, 1, 1, 1));
+  EXPECT_EQ("[GNUPG:] GOODSIG 2C157CF124CB0839 Phil Dibowitz\n", outputs[0]);
+  EXPECT_EQ("[GNUPG:] BADSIG 2C157CF124CB0839 Phil Dibowitz\n", outputs[1]);
+  EXPECT_EQ("[GNUPG:] NEWSIG\n", outputs[2]);
+  EXPECT_EQ("", outputs[3]);
+}
+
+/*
+ * Each fake multifile session holds the files it was started for, and gpg
+ * decrypts all of them except the ones that say "bad".
+ */
+struct MultifileSession {
+  std::vector<std::string> files;
+  int ret;
+};
+
+static GpgSession *StartMultifileSession(
+    const std::vector<const char*> &args) {
+  MultifileSession *session = new MultifileSession;
+  session->ret = 0;
+  bool is_file = false;
+  for (size_t i = 0; i < args.size(); i++) {
+    if (is_file) {
+      session->files.push_back(args[i]);
+    } else if (std::string(args[i]) == "--multifile") {
+      is_file = true;
+    }
+  }
+  return reinterpret_cast<GpgSession *>(session);
+}
+
+static bool ReadMultifileSession(GpgSession *gpg_session,
+                                 std::string *output,
+                                 GpgOutputWatcher *watcher) {
+  MultifileSession *session = reinterpret_cast<MultifileSession *>(gpg_session);
+  for (size_t i = 0; i < session->files.size(); i++) {
+    std::ifstream file(session->files[i].c_str());
+    std::string text;
+    std::getline(file, text);
+    output->append("[GNUPG:] FILE_START 3 " + session->files[i] + "\n");
+    output->append("[GNUPG:] ENC_TO D7974AEBC4DC6340 16 0\n"
+                   "[GNUPG:] USERID_HINT D7974AEBC4DC6340 Phil Dibowitz\n");
+    if (text == "bad") {
+      output->append("[GNUPG:] DECRYPTION_FAILED\n"
+                     "[GNUPG:] END_DECRYPTION\n");
+      session->ret = 2;
+    } else {
+      output->append("[GNUPG:] BEGIN_DECRYPTION\n"
+                     "[GNUPG:] PLAINTEXT 62 1253809952 test\n"
+                     "[GNUPG:] PLAINTEXT_LENGTH 4\n"
+                     "[GNUPG:] DECRYPTION_OKAY\n"
+                     "[GNUPG:] GOODMDC\n"
+                     "[GNUPG:] END_DECRYPTION\n");
+    }
+    output->append("[GNUPG:] FILE_DONE\n");
+  }
+  return true;
+}
+
+static int EndMultifileSession(GpgSession *gpg_session) {
+  MultifileSession *session = reinterpret_cast<MultifileSession *>(gpg_session);
+  int ret = session->ret;
+  delete session;
+  return ret;
+}
+
+TEST(GnupgBatch, DecryptsEachTextWithOneGpg) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .WillOnce(Invoke(StartMultifileSession));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(_, _, _))
+      .WillOnce(Invoke(ReadMultifileSession));
+  EXPECT_CALL(gpg, WaitOnGpg(_))
+      .WillOnce(Invoke(EndMultifileSession));
+  EXPECT_CALL(gpg, ReadFileToString(_, _))
+      .Times(2)
+      .WillRepeatedly(DoAll(SetArgumentPointee<1>(Secure(kTEST_STRING)),
+                            Return(true)));
+
+  std::vector<std::string> cipher_texts;
+  cipher_texts.push_back("good");
+  cipher_texts.push_back("bad");
+  cipher_texts.push_back("good");
+  std::vector<GpgRetDecryptInfo> rd = gpg.DecryptTextBatch(cipher_texts);
+  ASSERT_EQ(3U, rd.size());
+  EXPECT_EQ(kTEST_STRING, rd[0].data());
+  EXPECT_TRUE(rd[1].is_error());
+  EXPECT_EQ("Secret key not available", rd[1].error_str());
+  EXPECT_EQ(kTEST_STRING, rd[2].data());
+}
+
+TEST(GnupgBatch, SpreadsLargeBatchesOverSeveralGpgs) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .Times(3)
+      .WillRepeatedly(Invoke(StartMultifileSession));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(_, _, _))
+      .WillRepeatedly(Invoke(ReadMultifileSession));
+  EXPECT_CALL(gpg, WaitOnGpg(_))
+      .WillRepeatedly(Invoke(EndMultifileSession));
+  EXPECT_CALL(gpg, ReadFileToString(_, _))
+      .WillRepeatedly(DoAll(SetArgumentPointee<1>(Secure(kTEST_STRING)),
+                            Return(true)));
+
+  std::vector<std::string> cipher_texts(150, "good");
+  std::vector<GpgRetDecryptInfo> rd = gpg.DecryptTextBatch(cipher_texts);
+  ASSERT_EQ(150U, rd.size());
+  for (size_t i = 0; i < rd.size(); i++) {
+    EXPECT_EQ(kTEST_STRING, rd[i].data());
+  }
+}
+
+/*
+ * The shards of a batch run at once on the same object, so they all keep
+ * their large results in it at the same time.
+ */
+TEST(GnupgBatch, KeepsLargeResultsOfEveryShard) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  gpg.SetConfigValue("gpg_large_result_kb", "1");
+  const std::string large(2048, 'x');
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .Times(4)
+      .WillRepeatedly(Invoke(StartMultifileSession));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(_, _, _))
+      .WillRepeatedly(Invoke(ReadMultifileSession));
+  EXPECT_CALL(gpg, WaitOnGpg(_))
+      .WillRepeatedly(Invoke(EndMultifileSession));
+  EXPECT_CALL(gpg, ReadFileToString(_, _))
+      .WillRepeatedly(DoAll(SetArgumentPointee<1>(Secure(large)),
+                            Return(true)));
+
+  std::vector<std::string> cipher_texts(250, "good");
+  std::vector<GpgRetDecryptInfo> rd = gpg.DecryptTextBatch(cipher_texts);
+  ASSERT_EQ(250U, rd.size());
+  std::set<int> handles;
+  for (size_t i = 0; i < rd.size(); i++) {
+    ASSERT_FALSE(rd[i].is_error());
+    EXPECT_EQ(2048, rd[i].result_size());
+    handles.insert(rd[i].result());
+  }
+  EXPECT_EQ(250U, handles.size());
+  for (std::set<int>::const_iterator it = handles.begin();
+       it != handles.end(); ++it) {
+    EXPECT_EQ(large, gpg.ReadChunk(*it, 0, 4096).data());
+    EXPECT_TRUE(gpg.ReleaseResult(*it).retbool());
+  }
+}
+
+TEST(GnupgBatch, VerifiesDetachedSignaturesOneByOne) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .Times(2)
+      .WillRepeatedly(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillRepeatedly(Return(false));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillRepeatedly(Return(0));
+
+  std::vector<std::string> signed_texts(2, kTEST_STRING);
+  std::vector<std::string> signatures(2, "signature");
+  std::vector<GpgRetSignerInfo> rv =
+      gpg.VerifySignedTextBatch(signed_texts, signatures);
+  ASSERT_EQ(2U, rv.size());
+  EXPECT_TRUE(rv[0].is_error());
+  EXPECT_TRUE(rv[1].is_error());
+}
+
+/*
+ * Each fake session holds the keyid it was started for, and gpg's output for
+ * it is a key whose trust is the keyid.
+ */
+static GpgSession *StartSession(const std::vector<const char*> &args) {
+  return reinterpret_cast<GpgSession *>(new std::string(args.back()));
+}
+
+static bool ReadSession(GpgSession *session, std::string *output,
+                        GpgOutputWatcher *watcher) {
+  /* Give the other threads a chance to get in between. */
+  PR_Sleep(PR_INTERVAL_NO_WAIT);
+  const std::string *keyid = reinterpret_cast<std::string *>(session);
+  output->append("pub:" + *keyid + ":1024:17:2C157CF124CB0839:1251728234:::" +
+                 *keyid + ":::scSC:\n");
+  if (watcher != NULL) {
+    watcher->Grew(*output);
+  }
+  return true;
+}
+
+static int EndSession(GpgSession *session) {
+  delete reinterpret_cast<std::string *>(session);
+  return 0;
+}
+
+struct TrustLookups {
+  BaseGnupg *gpg;
+  const char *keyid;
+  const char *trust;
+  PRInt32 *mismatches;
+};
+
+static void PR_CALLBACK LookUpTrust(void *arg) {
+  TrustLookups *lookups = static_cast<TrustLookups *>(arg);
+  for (int i = 0; i < 200; i++) {
+    if (lookups->gpg->GetTrust(lookups->keyid).retstring() != lookups->trust) {
+      PR_AtomicIncrement(lookups->mismatches);
+    }
+  }
+}
+
+/*
+ * Operations running on the same object at the same time each get the output
+ * of their own gpg.
+ */
+TEST(GnupgConcurrency, KeepsSessionsApart) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  EXPECT_CALL(gpg, CallGpg(_))
+      .WillRepeatedly(Invoke(StartSession));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(_, _, _))
+      .WillRepeatedly(Invoke(ReadSession));
+  EXPECT_CALL(gpg, WaitOnGpg(_))
+      .WillRepeatedly(Invoke(EndSession));
+
+  PRInt32 mismatches = 0;
+  TrustLookups lookups[] = {
+    { &gpg, "f", "TRUST_FULL", &mismatches },
+    { &gpg, "m", "TRUST_MARGINAL", &mismatches },
+    { &gpg, "n", "TRUST_UNTRUSTED", &mismatches },
+    { &gpg, "u", "TRUST_ULTIMATE", &mismatches },
+  };
+  const size_t kTHREADS = sizeof(lookups) / sizeof(lookups[0]);
+  PRThread *threads[kTHREADS];
+  for (size_t i = 0; i < kTHREADS; i++) {
+    threads[i] = PR_CreateThread(PR_USER_THREAD, LookUpTrust, &lookups[i],
+                                 PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD,
+                                 PR_JOINABLE_THREAD, 0);
+    ASSERT_TRUE(threads[i] != NULL);
+  }
+  for (size_t i = 0; i < kTHREADS; i++) {
+    PR_JoinThread(threads[i]);
+  }
+  EXPECT_EQ(0, mismatches);
+}
+
+TEST(GnupgStreams, EncryptsChunks) {
+  MockGnupg gpg;
+  bool deleted = false;
+  MockInputStream *stream = new MockInputStream(&deleted);
+  std::vector<std::string> keyids, hidden_keyids;
+  keyids.push_back("key");
+
+  std::string ret = "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+
+  EXPECT_CALL(gpg, OpenGpgWithData(
+      ElementsAre(StrEq("--encrypt"), StrEq("--armor"), StrEq("--recipient"),
+                  StrEq("key"), StrEq("--output"), StrEq("-")),
+      IsNull()))
+      .WillOnce(Return(stream));
+  EXPECT_CALL(*stream, Write("first"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*stream, Write("second"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*stream, Close(_, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<0>(0),
+                      SetArgumentPointee<1>(ret),
+                      SetArgumentPointee<2>(Secure(kTEST_STRING)),
+                      Return(true)));
+
+  int handle = gpg.OpenEncryptStream(keyids, hidden_keyids, false, "", &gpg);
+  EXPECT_NE(0, handle);
+  EXPECT_TRUE(gpg.WriteStream(handle, "first").retbool());
+  EXPECT_TRUE(gpg.WriteStream(handle, "second").retbool());
+  GpgRetEncryptInfo ei = gpg.CloseEncryptStream(handle);
+  EXPECT_FALSE(ei.is_error());
+  EXPECT_EQ(kTEST_STRING, ei.cipher_text());
+  EXPECT_TRUE(deleted);
+
+  /* The stream is gone once it's closed. */
+  EXPECT_EQ(kERR_NO_STREAM, gpg.WriteStream(handle, "third").error_str());
+  EXPECT_EQ(kERR_NO_STREAM, gpg.CloseEncryptStream(handle).error_str());
+}
+
+TEST(GnupgStreams, ReportsWhyGpgStoppedReading) {
+  MockGnupg gpg;
+  bool deleted = false;
+  MockInputStream *stream = new MockInputStream(&deleted);
+
+  EXPECT_CALL(gpg, OpenGpgWithData(_, _))
+      .WillOnce(Return(stream));
+  EXPECT_CALL(*stream, Write(_))
+      .WillOnce(Return(false));
+  EXPECT_CALL(*stream, Close(_, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<0>(2), Return(true)));
+
+  int handle = gpg.OpenSignStream("nokey", false, &gpg);
+  GpgRetBool written = gpg.WriteStream(handle, "text");
+  EXPECT_FALSE(written.is_error());
+  EXPECT_FALSE(written.retbool());
+  /* An encryption stream it isn't. */
+  EXPECT_EQ(kERR_NO_STREAM, gpg.CloseEncryptStream(handle).error_str());
+  EXPECT_EQ(kERR_NO_SECRET_KEY, gpg.CloseSignStream(handle).error_str());
+}
+
+TEST(GnupgStreams, CanBeCanceled) {
+  MockGnupg gpg;
+  bool deleted = false;
+  MockInputStream *stream = new MockInputStream(&deleted);
+
+  EXPECT_CALL(gpg, OpenGpgWithData(_, _))
+      .WillOnce(Return(stream));
+  EXPECT_CALL(*stream, Close(_, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<0>(BaseGnupg::kGPG_CANCELED),
+                      Return(false)));
+
+  int handle = gpg.OpenSignStream("key", true, &gpg);
+  EXPECT_FALSE(GpgWatchdog::Instance()->Cancel(handle, NULL));
+  EXPECT_TRUE(GpgWatchdog::Instance()->Cancel(handle, &gpg));
+  EXPECT_EQ(kERR_CANCELED, gpg.CloseSignStream(handle).error_str());
+}
+
+TEST(GnupgStreams, AreAbortedWithTheObject) {
+  bool deleted = false;
+  {
+    MockGnupg gpg;
+    EXPECT_CALL(gpg, OpenGpgWithData(_, _))
+        .WillOnce(Return(new MockInputStream(&deleted)))
+        .WillOnce(Return(static_cast<GpgInputStream *>(NULL)));
+    EXPECT_NE(0, gpg.OpenSignStream("key", false, &gpg));
+    EXPECT_EQ(0, gpg.OpenSignStream("key", false, &gpg));
+  }
+  EXPECT_TRUE(deleted);
+}
+
+/* Holds up a stream's Write() until the stream is being closed. */
+struct SlowWrite {
+  MockGnupg *gpg;
+  int handle;
+  bool *deleted;
+  PRInt32 started;
+  bool deleted_while_writing;
+
+  bool operator()(const std::string &chunk) {
+    PR_AtomicSet(&started, 1);
+    PR_Sleep(PR_MillisecondsToInterval(200));
+    deleted_while_writing = *deleted;
+    return true;
+  }
+};
+
+static void WriteSlowly(void *arg) {
+  SlowWrite *write = static_cast<SlowWrite *>(arg);
+  write->gpg->WriteStream(write->handle, "chunk");
+}
+
+/* A stream that's being written to is only closed once the write is done. */
+TEST(GnupgStreams, WaitForWritesBeforeClosing) {
+  MockGnupg gpg;
+  bool deleted = false;
+  MockInputStream *stream = new MockInputStream(&deleted);
+  SlowWrite write = { &gpg, 0, &deleted, 0, true };
+
+  EXPECT_CALL(gpg, OpenGpgWithData(_, _))
+      .WillOnce(Return(stream));
+  EXPECT_CALL(*stream, Write("chunk"))
+      .WillOnce(Invoke(&write, &SlowWrite::operator()));
+  EXPECT_CALL(*stream, Close(_, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<0>(2), Return(true)));
+
+  write.handle = gpg.OpenSignStream("key", false, &gpg);
+  PRThread *thread = PR_CreateThread(PR_USER_THREAD, WriteSlowly, &write,
+                                     PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD,
+                                     PR_JOINABLE_THREAD, 0);
+  ASSERT_TRUE(thread != NULL);
+  while (!PR_AtomicAdd(&write.started, 0)) {
+    PR_Sleep(PR_MillisecondsToInterval(1));
+  }
+  gpg.CloseSignStream(write.handle);
+  EXPECT_TRUE(deleted);
+  PR_JoinThread(thread);
+  EXPECT_FALSE(write.deleted_while_writing);
+}
+
+/* The browser passes on the data of the URL while gpg is running. */
+TEST(GnupgUrls, DecryptsTheDataAsItComes) {
+  MockGnupg gpg;
+  bool deleted = false;
+  MockInputStream *stream = new MockInputStream(&deleted);
+  GpgUrlFetch *fetch = new GpgUrlFetch();
+  fetch->Write("ci", 2);
+  fetch->Write("pher", 4);
+  fetch->Finish(true);
+
+  std::string ret = "[GNUPG:] ENC_TO 0123456789ABCDEF 1 0\n"
+      "[GNUPG:] USERID_HINT 0123456789ABCDEF Someone\n"
+      "[GNUPG:] PLAINTEXT 62 1251728234 \n"
+      "[GNUPG:] PLAINTEXT_LENGTH 5\n"
+      "[GNUPG:] DECRYPTION_OKAY\n"
+      "[GNUPG:] END_DECRYPTION\n";
+
+  EXPECT_CALL(gpg, OpenGpgWithData(
+      ElementsAre(StrEq("--output"), StrEq("-"), StrEq("--decrypt")),
+      IsNull()))
+      .WillOnce(Return(stream));
+  EXPECT_CALL(*stream, Write("ci"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*stream, Write("pher"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*stream, Close(_, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<0>(0),
+                      SetArgumentPointee<1>(ret),
+                      SetArgumentPointee<2>(Secure("plain")),
+                      Return(true)));
+  GpgRetDecryptInfo di = gpg.DecryptFetch(fetch);
+  EXPECT_FALSE(di.is_error());
+  EXPECT_EQ("plain", di.data());
+  EXPECT_TRUE(deleted);
+
+  /* What comes after gpg is done is refused. */
+  EXPECT_EQ(-1, fetch->Write("more", 4));
+  fetch->Release();
+}
+
+TEST(GnupgUrls, VerifiesWithDetachedSignature) {
+  MockGnupg gpg;
+  bool deleted = false;
+  MockInputStream *stream = new MockInputStream(&deleted);
+  GpgUrlFetch *fetch = new GpgUrlFetch();
+  fetch->Write("text", 4);
+  fetch->Finish(true);
+  std::string ret =
+     "[GNUPG:] BADSIG 2C157CF124CB0839 Phil Dibowitz <fixxxer@google.com>\n";
+
+  EXPECT_CALL(gpg, OpenGpgWithData(
+      ElementsAre(StrEq("--enable-special-filenames"), StrEq("--verify"),
+                  StrEq("--"), StrEq(BaseGnupg::kGPG_EXTRA_INPUT),
+                  StrEq("-")),
+      Pointee(std::string("signature"))))
+      .WillOnce(Return(stream));
+  EXPECT_CALL(*stream, Write("text"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*stream, Close(_, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<0>(1),
+                      SetArgumentPointee<1>(ret),
+                      Return(true)));
+  EXPECT_EQ("Bad signature",
+            gpg.VerifyFetch(fetch, "signature").error_str());
+  fetch->Release();
+}
+
+/* gpg is terminated rather than given part of the data. */
+TEST(GnupgUrls, FailOnIncompleteFetches) {
+  MockGnupg gpg;
+  bool deleted = false;
+  MockInputStream *stream = new MockInputStream(&deleted);
+  GpgUrlFetch *fetch = new GpgUrlFetch();
+  fetch->Write("ci", 2);
+  fetch->Finish(false);
+
+  EXPECT_CALL(gpg, OpenGpgWithData(_, _))
+      .WillOnce(Return(stream));
+  EXPECT_CALL(*stream, Write("ci"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*stream, Close(_, _, _))
+      .Times(0);
+  EXPECT_EQ(kERR_URL, gpg.DecryptFetch(fetch).error_str());
+  EXPECT_TRUE(deleted);
+  fetch->Release();
+}
+
+/* The wait for data can be canceled like gpg. */
+TEST(GnupgUrls, CanBeCanceled) {
+  MockGnupg gpg;
+  bool deleted = false;
+  MockInputStream *stream = new MockInputStream(&deleted);
+  GpgUrlFetch *fetch = new GpgUrlFetch();
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  PRInt32 operation = watchdog->NewOperation(&gpg);
+  ASSERT_TRUE(watchdog->Cancel(operation, &gpg));
+
+  EXPECT_CALL(gpg, OpenGpgWithData(_, _))
+      .WillOnce(Return(stream));
+  EXPECT_CALL(*stream, Close(_, _, _))
+      .Times(0);
+  PRInt32 current = GpgWatchdog::CurrentOperation();
+  GpgWatchdog::SetCurrentOperation(operation);
+  EXPECT_EQ(kERR_CANCELED, gpg.VerifyFetch(fetch, "").error_str());
+  GpgWatchdog::SetCurrentOperation(current);
+  watchdog->EndOperation(operation);
+  EXPECT_TRUE(deleted);
+  fetch->Release();
+}
+
+/* Writes |content| to a temporary file and reads it back. */
+static std::string ReadBack(const std::string &content) {
+  TmpWrapper tmp;
+  std::string filename = "gpgut";
+  EXPECT_TRUE(tmp.CreateAndWriteTmpFile(content, &filename));
+  Gnupg gpg;
+  SecureString text = "left over";
+  EXPECT_TRUE(gpg.ReadFileToString(filename.c_str(), &text));
+  return std::string(text.begin(), text.end());
+}
+
+TEST(GnupgReadFileToString, KeepsBinaryData) {
+  std::string content("a\0b\r\nc\n\n\xff", 9);
+  EXPECT_EQ(content, ReadBack(content));
+}
+
+TEST(GnupgReadFileToString, DoesNotAddNewline) {
+  EXPECT_EQ("no newline", ReadBack("no newline"));
+  EXPECT_EQ("", ReadBack(""));
+}
+
+TEST(GnupgReadFileToString, ReadsLargeFiles) {
+  /* Many blocks long, and not a multiple of the block size. */
+  std::string content(5 * 1024 * 1024 + 17, '\0');
+  for (size_t i = 0; i < content.size(); i++) {
+    content[i] = static_cast<char>(i * 7);
+  }
+  EXPECT_TRUE(content == ReadBack(content));
+}
+
+TEST(GnupgReadFileToString, FailsOnMissingFile) {
+  Gnupg gpg;
+  SecureString text;
+  EXPECT_FALSE(gpg.ReadFileToString(
+      TmpWrapper::MkTmpFileName("gpgut").c_str(), &text));
+}
+
+/*
+ * What gpg --decrypt says about a successful decryption.
+ */
+static const std::string kDECRYPTED =
+    "[GNUPG:] ENC_TO 0123456789ABCDEF 1 0\n"
+    "[GNUPG:] USERID_HINT 0123456789ABCDEF Someone\n"
+    "[GNUPG:] PLAINTEXT 62 1251728234 \n"
+    "[GNUPG:] PLAINTEXT_LENGTH 5\n"
+    "[GNUPG:] DECRYPTION_OKAY\n"
+    "[GNUPG:] END_DECRYPTION\n";
+
+TEST(GnupgLargeResults, KeepsLargeTexts) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_large_result_kb", "1");
+  SecureString plain(2048, 'p');
+  SecureString cipher(1025, 'c');
+
+  GpgRetDecryptInfo di = gpg.DecryptResult(0, kDECRYPTED, "", &plain);
+  EXPECT_FALSE(di.is_error());
+  EXPECT_EQ("", di.data());
+  EXPECT_NE(0, di.result());
+  EXPECT_EQ(2048, di.result_size());
+
+  std::string ret = "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+  GpgRetEncryptInfo ei = gpg.EncryptResult(0, ret, false, "", &cipher);
+  EXPECT_EQ("", ei.cipher_text());
+  EXPECT_NE(di.result(), ei.result());
+  EXPECT_EQ(1025, ei.result_size());
+
+  GpgRetChunk chunk = gpg.ReadChunk(ei.result(), 1000, 100);
+  EXPECT_EQ(std::string(25, 'c'), chunk.data());
+  EXPECT_EQ(1025, chunk.next_offset());
+}
+
+TEST(GnupgLargeResults, ReturnsOtherTextsWhole) {
+  MockGnupg gpg;
+  std::string plain(2048, 'p');
+
+  /*
+   * Nothing is kept unless the preference asks for it. What gpg wrote is
+   * left empty.
+   */
+  SecureString data = Secure(plain);
+  GpgRetDecryptInfo di = gpg.DecryptResult(0, kDECRYPTED, "", &data);
+  EXPECT_EQ(plain, di.data());
+  EXPECT_EQ(0, di.result());
+  EXPECT_EQ("", data);
+
+  gpg.SetConfigValue("gpg_large_result_kb", "2");
+  data = Secure(plain);
+  di = gpg.DecryptResult(0, kDECRYPTED, "", &data);
+  EXPECT_EQ(plain, di.data());
+  EXPECT_EQ(0, di.result());
+}
+
+TEST(GnupgLargeResults, ReadsWholeCharacters) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_large_result_kb", "1");
+  /* "\xc3\xa9" is a two byte character, "\xe2\x82\xac" a three byte one. */
+  SecureString plain = SecureString(1024, 'a') + "\xc3\xa9\xe2\x82\xac" + "b";
+  int handle = gpg.DecryptResult(0, kDECRYPTED, "", &plain).result();
+
+  GpgRetChunk chunk = gpg.ReadChunk(handle, 1020, 5);
+  EXPECT_EQ("aaaa", chunk.data());
+  EXPECT_EQ(1024, chunk.next_offset());
+
+  chunk = gpg.ReadChunk(handle, chunk.next_offset(), 4);
+  EXPECT_EQ("\xc3\xa9", chunk.data());
+  EXPECT_EQ(1026, chunk.next_offset());
+
+  /* A chunk shorter than a character gets the whole character. */
+  chunk = gpg.ReadChunk(handle, chunk.next_offset(), 1);
+  EXPECT_EQ("\xe2\x82\xac", chunk.data());
+  EXPECT_EQ(1029, chunk.next_offset());
+
+  /* Offsets within a character start at the next one. */
+  chunk = gpg.ReadChunk(handle, 1027, 100);
+  EXPECT_EQ("b", chunk.data());
+  EXPECT_EQ(1030, chunk.next_offset());
+
+  chunk = gpg.ReadChunk(handle, 5000, 100);
+  EXPECT_FALSE(chunk.is_error());
+  EXPECT_EQ("", chunk.data());
+  EXPECT_EQ(1030, chunk.next_offset());
+}
+
+TEST(GnupgLargeResults, AreReleased) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_large_result_kb", "1");
+  SecureString plain(2048, 'p');
+  int handle = gpg.DecryptResult(0, kDECRYPTED, "", &plain).result();
+
+  EXPECT_TRUE(gpg.ReleaseResult(handle).retbool());
+  EXPECT_EQ(kERR_NO_RESULT, gpg.ReleaseResult(handle).error_str());
+  EXPECT_EQ(kERR_NO_RESULT, gpg.ReadChunk(handle, 0, 10).error_str());
+}
+
+TEST(GnupgFiles, HandsPathsToGpg) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  TmpWrapper tmp;
+  std::string path = "gpgut";
+  ASSERT_TRUE(tmp.CreateAndWriteTmpFile("plain", &path));
+  std::string output_path = TmpWrapper::MkTmpFileName("gpgut");
+  std::vector<std::string> keyids, hidden_keyids;
+  keyids.push_back("key");
+
+  std::string ret = "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+
+  EXPECT_CALL(gpg, CallGpg(
+      ElementsAre(StrEq("--encrypt"), StrEq("--armor"), StrEq("--recipient"),
+                  StrEq("key"), StrEq("--output"), StrEq(output_path),
+                  StrEq("--"), StrEq(path))))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(ret), Return(true)));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillOnce(Return(0));
+  /* The cipher text stays in the file. */
+  EXPECT_CALL(gpg, ReadFileToString(_, _))
+      .Times(0);
+  GpgRetEncryptInfo ei = gpg.EncryptFile(path, output_path, keyids,
+                                         hidden_keyids, false, "");
+  EXPECT_FALSE(ei.is_error());
+  EXPECT_EQ("", ei.cipher_text());
+}
+
+/*
+ * The output path comes before "--", so only absolute ones are taken: "-"
+ * would have gpg write the output where its status is read from.
+ */
+TEST(GnupgFiles, RefusesOutputPathsThatArentAbsolute) {
+  MockGnupg gpg;
+  TmpWrapper tmp;
+  std::string path = "gpgut";
+  ASSERT_TRUE(tmp.CreateAndWriteTmpFile("plain", &path));
+  std::vector<std::string> keyids, hidden_keyids;
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .Times(0);
+  EXPECT_EQ(kERR_BAD_OUTPUT, gpg.DecryptFile(path, "-").error_str());
+  EXPECT_EQ(kERR_BAD_OUTPUT, gpg.DecryptFile(path, "out").error_str());
+  EXPECT_EQ(kERR_BAD_OUTPUT,
+            gpg.EncryptFile(path, "--output=x", keyids, hidden_keyids, false,
+                            "").error_str());
+  EXPECT_EQ(kERR_BAD_OUTPUT, gpg.SignFile(path, "", "key", false).error_str());
+}
+
+/* A file that's there already is only replaced when that's been asked for. */
+TEST(GnupgFiles, OverwritesOnlyWhenAsked) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  TmpWrapper tmp, output_tmp;
+  std::string path = "gpgut";
+  std::string output_path = "gpgut";
+  ASSERT_TRUE(tmp.CreateAndWriteTmpFile("signed", &path));
+  ASSERT_TRUE(output_tmp.CreateAndWriteTmpFile("there", &output_path));
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .Times(0);
+  EXPECT_EQ(kERR_OUTPUT_EXISTS,
+            gpg.DecryptFile(path, output_path).error_str());
+
+  gpg.SetConfigValue("gpg_overwrite_files", "true");
+  EXPECT_CALL(gpg, CallGpg(
+      ElementsAre(StrEq("--yes"), StrEq("--output"), StrEq(output_path),
+                  StrEq("--decrypt"), StrEq("--"), StrEq(path))))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillOnce(Return(2));
+  gpg.DecryptFile(path, output_path);
+}
+
+TEST(GnupgFiles, VerifiesDetachedSignatures) {
+  MockGnupg gpg;
+  gpg.SetConfigValue("gpg_plugin_initialized", "true");
+  TmpWrapper tmp, sig_tmp;
+  std::string path = "gpgut";
+  std::string sig_path = "gpgut";
+  ASSERT_TRUE(tmp.CreateAndWriteTmpFile("signed", &path));
+  ASSERT_TRUE(sig_tmp.CreateAndWriteTmpFile("signature", &sig_path));
+
+  EXPECT_CALL(gpg, CallGpg(
+      ElementsAre(StrEq("--verify"), StrEq("--"), StrEq(sig_path),
+                  StrEq(path))))
+      .WillOnce(Return(kFAKE_SESSION));
+  EXPECT_CALL(gpg, ReadAllGpgOutput(kFAKE_SESSION, _, _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(gpg, WaitOnGpg(kFAKE_SESSION))
+      .WillOnce(Return(1));
+  gpg.VerifyFile(path, sig_path);
+}
+
+TEST(GnupgFiles, RefusesFilesItCantRead) {
+  MockGnupg gpg;
+  std::string missing = TmpWrapper::MkTmpFileName("gpgut");
+  std::vector<std::string> keyids, hidden_keyids;
+
+  EXPECT_CALL(gpg, CallGpg(_))
+      .Times(0);
+  EXPECT_EQ(kERR_BAD_FILE, gpg.DecryptFile(missing, "/out").error_str());
+  EXPECT_EQ(kERR_BAD_FILE, gpg.VerifyFile(missing, "").error_str());
+  EXPECT_EQ(kERR_BAD_FILE,
+            gpg.EncryptFile("", "/out", keyids, hidden_keyids, false, "")
+                .error_str());
+}
+
+#ifndef OS_WINDOWS
+/*
+ * These run the API functions against a keyring of their own (see
+ * TestKeyring) with each engine that gpg_engine can choose, so that they all
+ * return the same for the same request.
+ */
+class GnupgKeyring : public testing::TestWithParam<const char *> {
+ protected:
+  static void SetUpTestCase() {
+    ASSERT_TRUE(keyring_.Create());
+  }
+
+  static void TearDownTestCase() {
+    EXPECT_TRUE(keyring_.Destroy());
+  }
+
+  virtual void SetUp() {
+    gpg_.SetConfigValue("gpg_plugin_initialized", "true");
+    gpg_.SetConfigValue("gpg_engine", GetParam());
+  }
+
+  /*
+   * Whether the plugin started gpg itself so far, which it shouldn't have
+   * for what GPGME does.
+   */
+  bool RanGpg() {
+    return gpg_.GetStats().retstring().find("spawn.") != std::string::npos;
+  }
+
+  bool WithGpgme() const {
+    return std::string(GetParam()) == "gpgme";
+  }
+
+  static TestKeyring keyring_;
+  Gnupg gpg_;
+};
+
+TestKeyring GnupgKeyring::keyring_;
+
+TEST_P(GnupgKeyring, EncryptsAndDecrypts) {
+  std::vector<std::string> keyids(1, TestKeyring::kKEYID), hidden;
+  GpgRetEncryptInfo encrypted = gpg_.EncryptText("plain text", keyids, hidden,
+                                                 true, "");
+  ASSERT_FALSE(encrypted.is_error()) << encrypted.error_str();
+  EXPECT_EQ(0U, encrypted.cipher_text().find("-----BEGIN PGP MESSAGE-----"));
+
+  GpgRetDecryptInfo decrypted = gpg_.DecryptText(encrypted.cipher_text());
+  ASSERT_FALSE(decrypted.is_error()) << decrypted.error_str();
+  EXPECT_EQ("plain text", decrypted.data());
+  EXPECT_NE(WithGpgme(), RanGpg());
+
+  /* Once the agent engine knows the key, gpg doesn't run to decrypt. */
+  std::string stats = gpg_.GetStats().retstring();
+  decrypted = gpg_.DecryptText(encrypted.cipher_text());
+  ASSERT_FALSE(decrypted.is_error()) << decrypted.error_str();
+  EXPECT_EQ("plain text", decrypted.data());
+  if (std::string(GetParam()) == "agent") {
+    EXPECT_EQ(stats, gpg_.GetStats().retstring());
+  }
+}
+
+TEST_P(GnupgKeyring, SignsAndVerifies) {
+  GpgRetString signature = gpg_.SignText("signed text", TestKeyring::kKEYID,
+                                         false);
+  ASSERT_FALSE(signature.is_error()) << signature.error_str();
+  GpgRetSignerInfo verified = gpg_.VerifySignedText("signed text",
+                                                    signature.retstring());
+  EXPECT_FALSE(verified.is_error()) << verified.error_str();
+  EXPECT_EQ(TestKeyring::kUID, verified.signer());
+  EXPECT_EQ("TRUST_ULTIMATE", verified.trust_level());
+
+  verified = gpg_.VerifySignedText("other text", signature.retstring());
+  EXPECT_EQ(kERR_BAD_SIGNATURE, verified.error_str());
+
+  GpgRetString clearsigned = gpg_.SignText("signed text", TestKeyring::kKEYID,
+                                           true);
+  ASSERT_FALSE(clearsigned.is_error()) << clearsigned.error_str();
+  verified = gpg_.VerifySignedText(clearsigned.retstring(), "");
+  EXPECT_FALSE(verified.is_error()) << verified.error_str();
+  EXPECT_EQ(TestKeyring::kUID, verified.signer());
+  EXPECT_NE(WithGpgme(), RanGpg());
+}
+
+TEST_P(GnupgKeyring, GetsUids) {
+  GpgRetUidsInfo uids = gpg_.GetUids(TestKeyring::kKEYID);
+  ASSERT_FALSE(uids.is_error()) << uids.error_str();
+  ASSERT_EQ(1U, uids.uids().size());
+  EXPECT_EQ(TestKeyring::kUID, uids.uids()[0]);
+  EXPECT_NE(WithGpgme(), RanGpg());
+}
+
+/*
+ * A call for an operation that has been canceled is given up on whichever
+ * engine runs it, and the next one isn't affected.
+ */
+TEST_P(GnupgKeyring, CancelsCalls) {
+  GpgWatchdog *watchdog = GpgWatchdog::Instance();
+  ASSERT_TRUE(watchdog != NULL);
+  PRInt32 operation = watchdog->NewOperation(&gpg_);
+  ASSERT_TRUE(watchdog->Cancel(operation, &gpg_));
+
+  GpgWatchdog::SetCurrentOperation(operation);
+  GpgRetString fingerprint = gpg_.GetFingerprint(TestKeyring::kKEYID);
+  GpgWatchdog::SetCurrentOperation(0);
+  watchdog->EndOperation(operation);
+  EXPECT_EQ(kERR_CANCELED, fingerprint.error_str());
+  EXPECT_NE(std::string::npos,
+            gpg_.GetStats().retstring().find(
+                WithGpgme() ? "interrupted.gpgme timeouts=0 canceled=1\n" :
+                              "interrupted.gpg timeouts=0 canceled=1\n"));
+
+  fingerprint = gpg_.GetFingerprint(TestKeyring::kKEYID);
+  EXPECT_FALSE(fingerprint.is_error()) << fingerprint.error_str();
+}
+
+static const char *const kENGINES[] = {
+  "cli",
+  "agent",
+#ifdef HAVE_GPGME
+  "gpgme",
+#endif
+};
+
+INSTANTIATE_TEST_CASE_P(Engines, GnupgKeyring, testing::ValuesIn(kENGINES));
+#endif
+
 TEST(GnupgOriginDetection, TrustsSafeOrigins) {
   NPP npp = new NPP_t;
   glue::globals::NPAPIObject *object;
@@ -496,6 +1896,126 @@ TEST(GnupgOriginDetection, TrustsSafeOrigins) {
 
   delete npp;
 }
+
+TEST(GnupgOriginDetection, FetchesOnlyFromOwnOrigin) {
+  NPP npp = new NPP_t;
+  glue::globals::NPAPIObject *object;
+
+  /* kINVALID_ORIGIN is a web page. */
+  npp->pdata = kINVALID_TEST;
+  object = new glue::globals::NPAPIObject(npp);
+  void *pdata = reinterpret_cast<void *>(object);
+  EXPECT_TRUE(glue::class_Gnupg::MayFetchUrl(
+      pdata, "http://www.example.com/mail/attachment.gpg"));
+  EXPECT_TRUE(glue::class_Gnupg::MayFetchUrl(pdata, "HTTP://WWW.EXAMPLE.COM"));
+  EXPECT_FALSE(glue::class_Gnupg::MayFetchUrl(
+      pdata, "http://www.example.com.example.org/attachment.gpg"));
+  EXPECT_FALSE(glue::class_Gnupg::MayFetchUrl(
+      pdata, "http://www.example.com@example.org/attachment.gpg"));
+  EXPECT_FALSE(glue::class_Gnupg::MayFetchUrl(
+      pdata, "https://www.example.com/attachment.gpg"));
+  EXPECT_FALSE(glue::class_Gnupg::MayFetchUrl(pdata, "file:///etc/passwd"));
+  EXPECT_FALSE(glue::class_Gnupg::MayFetchUrl(pdata, "attachment.gpg"));
+  delete object;
+
+  /* The extension may fetch anything. */
+  npp->pdata = kCHROME_TEST;
+  object = new glue::globals::NPAPIObject(npp);
+  EXPECT_TRUE(glue::class_Gnupg::MayFetchUrl(
+      reinterpret_cast<void *>(object), "file:///tmp/attachment.gpg"));
+  delete object;
+
+  delete npp;
+}
+
+/* Counts how often it's run, and tells when it's deleted. */
+class CountingCallback : public GpgRetStringCallback {
+ public:
+  CountingCallback(int *runs, bool *deleted)
+      : runs_(runs),
+        deleted_(deleted) {
+  }
+
+  ~CountingCallback() {
+    *deleted_ = true;
+  }
+
+  void Run(const GpgRetString &ret) {
+    (*runs_)++;
+  }
+
+ private:
+  int *runs_;
+  bool *deleted_;
+};
+
+static bool async_calls_supported = false;
+/* Posted by the worker threads, which count them once they're there. */
+static std::vector<std::pair<void (*)(void *), void *> > posted_calls;
+static PRInt32 posted_count = 0;
+
+/* Wait up to 10 seconds for a call to be posted to the main thread. */
+static bool WaitForPostedCall() {
+  for (int i = 0; i < 1000 && PR_AtomicAdd(&posted_count, 0) == 0; i++) {
+    PR_Sleep(PR_MillisecondsToInterval(10));
+  }
+  return PR_AtomicAdd(&posted_count, 0) == 1;
+}
+
+/*
+ * The browser drops the calls posted to an instance that it destroys, so the
+ * call is completed by Gnupg::InstanceDestroyed(), without running its
+ * callback.
+ */
+TEST(GnupgAsyncTest, DropsCallbackOfDestroyedInstance) {
+  NPP npp = new NPP_t;
+  npp->pdata = kCHROME_TEST;
+  glue::globals::NPAPIObject *object = new glue::globals::NPAPIObject(npp);
+  Gnupg *gnupg = new Gnupg();
+  int runs = 0;
+  bool deleted = false;
+
+  async_calls_supported = true;
+  glue::class_Gnupg::userglue_method_GetGnupgVersionAsync(
+      object, gnupg, new CountingCallback(&runs, &deleted));
+  ASSERT_TRUE(WaitForPostedCall());
+  delete gnupg;
+  Gnupg::InstanceDestroyed(npp);
+  EXPECT_EQ(0, runs);
+  EXPECT_TRUE(deleted);
+  posted_calls.clear();
+  PR_AtomicSet(&posted_count, 0);
+  async_calls_supported = false;
+
+  delete object;
+  delete npp;
+}
+
+/* A call on an object that's gone while its instance lives on is released. */
+TEST(GnupgAsyncTest, DropsCallbackOfDestroyedObject) {
+  NPP npp = new NPP_t;
+  npp->pdata = kCHROME_TEST;
+  glue::globals::NPAPIObject *object = new glue::globals::NPAPIObject(npp);
+  Gnupg *gnupg = new Gnupg();
+  int runs = 0;
+  bool deleted = false;
+
+  async_calls_supported = true;
+  glue::class_Gnupg::userglue_method_GetGnupgVersionAsync(
+      object, gnupg, new CountingCallback(&runs, &deleted));
+  ASSERT_TRUE(WaitForPostedCall());
+  delete gnupg;
+  posted_calls[0].first(posted_calls[0].second);
+  EXPECT_EQ(0, runs);
+  EXPECT_TRUE(deleted);
+  posted_calls.clear();
+  PR_AtomicSet(&posted_count, 0);
+  async_calls_supported = false;
+
+  Gnupg::InstanceDestroyed(npp);
+  delete object;
+  delete npp;
+}
 } /* namespace */
 
 
@@ -519,10 +2039,9 @@ NPIdentifier NPN_GetStringIdentifier(const NPUTF8 *name) {
 
 NPError NPN_GetValue(NPP /*instance*/, NPNVariable variable, void *value) {
   if (variable == NPNVWindowNPObject) {
-    value = reinterpret_cast<void *>(0xdead);
+    *static_cast<NPObject **>(value) = reinterpret_cast<NPObject *>(0xdead);
     return NPERR_NO_ERROR;
   } else {
-    value = NULL;
     return NPERR_GENERIC_ERROR;
   }
 }
@@ -531,6 +2050,8 @@ bool NPN_GetProperty(NPP npp, NPObject* /*npobj*/, NPIdentifier propertyname,
                 NPVariant *result) {
   // The fixed NPIdentifier values are 0x1 for location and 0x2 for href.
   if (propertyname == kLOCATION) {
+    result->type = NPVariantType_Object;
+    result->value.objectValue = reinterpret_cast<NPObject *>(0xbeef);
     return true;
   } else if (propertyname == kHREF) {
     // Return a safe origin, e.g. chrome-extension://..."
@@ -573,6 +2094,27 @@ void *NPN_MemAlloc(uint32_t size) {
   return malloc(size);
 }
 
+/*
+ * Like Safari, so that the asynchronous methods complete right away, unless a
+ * test says otherwise. Posted calls are then left to the test.
+ */
+bool IsPluginThreadAsyncCallSupported(NPP /*instance*/) {
+  return async_calls_supported;
+}
+
+void NPN_PluginThreadAsyncCall(NPP /*instance*/, void (*func)(void *),
+                               void *user_data) {
+  EXPECT_TRUE(async_calls_supported);
+  posted_calls.push_back(std::make_pair(func, user_data));
+  PR_AtomicIncrement(&posted_count);
+}
+
+NPError NPN_GetURLNotify(NPP /*instance*/, const char * /*url*/,
+                         const char * /*target*/, void * /*notifyData*/) {
+  ADD_FAILURE();
+  return NPERR_GENERIC_ERROR;
+}
+
 /* End NPN_xxx helper functions. */
 
 
@@ -0,0 +1,682 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "gpgme_engine.h"
+
+#include <gpgme.h>
+#include <prinit.h>
+#include <prprf.h>
+#include <prthread.h>
+#include <prtypes.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "errors.h"
+#include "logging.h"
+#include "securemem.h"
+#include "types.h"
+
+static PRCallOnceType gpgme_once;
+static PRUintn engine_index;
+
+/*
+ * A gpgme_data_t that is released when it goes out of scope.
+ */
+class GpgmeData {
+ public:
+  GpgmeData()
+      : data_(NULL) {
+  }
+
+  ~GpgmeData() {
+    if (data_ != NULL) {
+      gpgme_data_release(data_);
+    }
+  }
+
+  gpgme_error_t New() {
+    return gpgme_data_new(&data_);
+  }
+
+  /*
+   * GPGME reads |text| in place, so it must outlive this object.
+   */
+  gpgme_error_t NewFromString(const std::string &text) {
+    return gpgme_data_new_from_mem(&data_, text.data(), text.size(), 0);
+  }
+
+  /*
+   * Have what GPGME writes appended to |text|, which must outlive this
+   * object, instead of kept in memory that GPGME allocates and frees without
+   * zeroing it.
+   */
+  gpgme_error_t NewForSecureString(SecureString *text) {
+    static struct gpgme_data_cbs callbacks = {
+      NULL, AppendToSecureString, NULL, NULL
+    };
+    return gpgme_data_new_from_cbs(&data_, &callbacks, text);
+  }
+
+  gpgme_data_t get() const {
+    return data_;
+  }
+
+  /*
+   * Release the data object and return what was written to it.
+   */
+  std::string TakeString() {
+    std::string text;
+    size_t size;
+    char *buffer = gpgme_data_release_and_get_mem(data_, &size);
+    data_ = NULL;
+    if (buffer != NULL) {
+      text.assign(buffer, size);
+      gpgme_free(buffer);
+    }
+    return text;
+  }
+
+ private:
+  static gpgme_ssize_t AppendToSecureString(void *handle, const void *buffer,
+                                            size_t size) {
+    static_cast<SecureString *>(handle)->append(
+        static_cast<const char *>(buffer), size);
+    return static_cast<gpgme_ssize_t>(size);
+  }
+
+  gpgme_data_t data_;
+
+  GpgmeData(const GpgmeData &);
+  void operator=(const GpgmeData &);
+};
+
+/*
+ * A gpgme_key_t that is released when it goes out of scope.
+ */
+class GpgmeKey {
+ public:
+  GpgmeKey()
+      : key_(NULL) {
+  }
+
+  ~GpgmeKey() {
+    if (key_ != NULL) {
+      gpgme_key_unref(key_);
+    }
+  }
+
+  gpgme_error_t Get(gpgme_ctx_t ctx, const std::string &keyid, bool secret) {
+    return gpgme_get_key(ctx, keyid.c_str(), &key_, secret ? 1 : 0);
+  }
+
+  gpgme_key_t get() const {
+    return key_;
+  }
+
+ private:
+  gpgme_key_t key_;
+
+  GpgmeKey(const GpgmeKey &);
+  void operator=(const GpgmeKey &);
+};
+
+GpgmeEngine::GpgmeEngine(gpgme_ctx_t ctx)
+    : ctx_(ctx) {
+}
+
+GpgmeEngine::~GpgmeEngine() {
+  gpgme_release(ctx_);
+}
+
+PRStatus GpgmeEngine::Init() {
+  /* This initializes GPGME, which must be done before anything else. */
+  const char *version = gpgme_check_version(NULL);
+  if (version == NULL) {
+    LOG("GPG: gpgme_check_version failed\n");
+    return PR_FAILURE;
+  }
+  LOG("GPG: Using GPGME %s\n", version);
+  return PR_NewThreadPrivateIndex(&engine_index, Destroy);
+}
+
+void PR_CALLBACK GpgmeEngine::Destroy(void *engine) {
+  delete static_cast<GpgmeEngine *>(engine);
+}
+
+GpgmeEngine *GpgmeEngine::ForCurrentThread(const std::string &gpg_path) {
+  gpgme_error_t err;
+
+  if (PR_CallOnce(&gpgme_once, Init) == PR_FAILURE) {
+    return NULL;
+  }
+
+  GpgmeEngine *engine =
+      static_cast<GpgmeEngine *>(PR_GetThreadPrivate(engine_index));
+  if (engine == NULL) {
+    gpgme_ctx_t ctx;
+    err = gpgme_new(&ctx);
+    if (err) {
+      LOG("GPG: gpgme_new failed: %s\n", gpgme_strerror(err));
+      return NULL;
+    }
+    engine = new GpgmeEngine(ctx);
+    err = gpgme_set_protocol(ctx, GPGME_PROTOCOL_OpenPGP);
+    if (err) {
+      LOG("GPG: gpgme_set_protocol failed: %s\n", gpgme_strerror(err));
+      delete engine;
+      return NULL;
+    }
+    gpgme_set_armor(ctx, 1);
+    if (PR_SetThreadPrivate(engine_index, engine) == PR_FAILURE) {
+      delete engine;
+      return NULL;
+    }
+  }
+
+  /* The preference may change between calls. */
+  if (engine->gpg_path_ != gpg_path) {
+    err = gpgme_ctx_set_engine_info(engine->ctx_, GPGME_PROTOCOL_OpenPGP,
+                                    gpg_path.c_str(), NULL);
+    if (err) {
+      LOG("GPG: gpgme_ctx_set_engine_info failed: %s\n", gpgme_strerror(err));
+      return NULL;
+    }
+    engine->gpg_path_ = gpg_path;
+  }
+  return engine;
+}
+
+void GpgmeEngine::ResetForCurrentThread() {
+  if (PR_CallOnce(&gpgme_once, Init) == PR_FAILURE) {
+    return;
+  }
+  /* This calls Destroy() on the engine that was set. */
+  PR_SetThreadPrivate(engine_index, NULL);
+}
+
+void GpgmeEngine::Interrupt(bool /*force*/) {
+  gpgme_error_t err = gpgme_cancel_async(ctx_);
+  if (err) {
+    LOG("GPG: gpgme_cancel_async failed: %s\n", gpgme_strerror(err));
+  }
+}
+
+/*
+ * The trust_level() of a good signature is the TRUST_* status line gpg prints
+ * after it.
+ */
+void GpgmeEngine::SetSignatureStatus(gpgme_signature_t signature,
+                                     GpgRetSignerInfo *retobj) {
+  if (signature == NULL) {
+    retobj->set_error_str(kERR_SIGNATURE_ERR);
+    return;
+  }
+
+  switch (gpg_err_code(signature->status)) {
+    case GPG_ERR_NO_ERROR:
+      break;
+    case GPG_ERR_BAD_SIGNATURE:
+      retobj->set_error_str(kERR_BAD_SIGNATURE);
+      return;
+    default:
+      LOG("GPG: Signature status: %s\n", gpgme_strerror(signature->status));
+      retobj->set_error_str(kERR_UNKNOWN_GPG_ERR);
+      return;
+  }
+
+  switch (signature->validity) {
+    case GPGME_VALIDITY_NEVER: retobj->set_trust_level("TRUST_NEVER"); break;
+    case GPGME_VALIDITY_MARGINAL:
+      retobj->set_trust_level("TRUST_MARGINAL");
+      break;
+    case GPGME_VALIDITY_FULL: retobj->set_trust_level("TRUST_FULLY"); break;
+    case GPGME_VALIDITY_ULTIMATE:
+      retobj->set_trust_level("TRUST_ULTIMATE");
+      break;
+    default: retobj->set_trust_level("TRUST_UNDEFINED"); break;
+  }
+}
+
+const char *GpgmeEngine::EncryptError(gpgme_error_t err,
+                                      gpgme_invalid_key_t invalid_recipients) {
+  if (invalid_recipients != NULL) {
+    switch (gpg_err_code(invalid_recipients->reason)) {
+      case GPG_ERR_PUBKEY_NOT_TRUSTED:
+        return kERR_PUBLIC_KEY_NOT_TRUSTED;
+      /* gpg often says 0 instead of 1 for a missing key, see EncryptText(). */
+      case GPG_ERR_GENERAL:
+      case GPG_ERR_NO_PUBKEY:
+        return kERR_NO_PUBLIC_KEY;
+      default:
+        return kERR_BAD_PUBLIC_KEY;
+    }
+  }
+  return SignError(err);
+}
+
+const char *GpgmeEngine::SignError(gpgme_error_t err) {
+  switch (gpg_err_code(err)) {
+    case GPG_ERR_NO_SECKEY:
+    case GPG_ERR_UNUSABLE_SECKEY:
+      return kERR_NO_SECRET_KEY;
+    case GPG_ERR_BAD_PASSPHRASE:
+    case GPG_ERR_NO_AGENT:
+    case GPG_ERR_CANCELED:
+      return kERR_BAD_PASSPHRASE;
+    default:
+      return kERR_UNKNOWN_GPG_ERR;
+  }
+}
+
+/*
+ * gpg says DECRYPTION_FAILED both when the secret key is missing and when
+ * the passphrase is wrong, and that has always been reported as a missing key.
+ */
+const char *GpgmeEngine::DecryptError(gpgme_error_t err) {
+  switch (gpg_err_code(err)) {
+    case GPG_ERR_NO_SECKEY:
+    case GPG_ERR_DECRYPT_FAILED:
+    case GPG_ERR_BAD_PASSPHRASE:
+      return kERR_NO_SECRET_KEY;
+    default:
+      return kERR_UNKNOWN_GPG_ERR;
+  }
+}
+
+/*
+ * The same strings GetTrust() makes from the validity field of the pub line
+ * in the --with-colons output, which is the best validity of any user ID.
+ */
+std::string GpgmeEngine::KeyTrust(gpgme_key_t key) {
+  if (key->revoked) {
+    return "TRUST_REVOKED";
+  }
+  if (key->expired) {
+    return "TRUST_EXPIRED";
+  }
+  if (key->invalid) {
+    return "TRUST_INVALID";
+  }
+
+  gpgme_validity_t validity = GPGME_VALIDITY_UNKNOWN;
+  for (gpgme_user_id_t uid = key->uids; uid != NULL; uid = uid->next) {
+    if (uid->validity > validity) {
+      validity = uid->validity;
+    }
+  }
+
+  switch (validity) {
+    case GPGME_VALIDITY_NEVER: return "TRUST_UNTRUSTED";
+    case GPGME_VALIDITY_MARGINAL: return "TRUST_MARGINAL";
+    case GPGME_VALIDITY_FULL: return "TRUST_FULL";
+    case GPGME_VALIDITY_ULTIMATE: return "TRUST_ULTIMATE";
+    default: return "TRUST_UNKNOWN";
+  }
+}
+
+/*
+ * Group the hex digits the way 'gpg --fingerprint' does: in fours for v4
+ * keys and in pairs for older ones, with a wider gap in the middle.
+ */
+std::string GpgmeEngine::FormatFingerprint(const char *fpr) {
+  std::string hex = fpr != NULL ? fpr : "";
+  size_t group = hex.size() == 40 ? 4 : 2;
+  std::string formatted;
+
+  for (size_t i = 0; i < hex.size(); i += group) {
+    if (i > 0) {
+      formatted.append(i == hex.size() / 2 ? "  " : " ");
+    }
+    formatted.append(hex, i, group);
+  }
+  return formatted;
+}
+
+/*
+ * The letter that 'gpg --fingerprint' shows after the size of a key for its
+ * algorithm.
+ */
+static char AlgorithmLetter(gpgme_pubkey_algo_t algo) {
+  switch (algo) {
+    case GPGME_PK_RSA:
+      return 'R';
+    case GPGME_PK_RSA_E:
+      return 'r';
+    case GPGME_PK_RSA_S:
+      return 's';
+    case GPGME_PK_ELG_E:
+      return 'g';
+    case GPGME_PK_ELG:
+      return 'G';
+    case GPGME_PK_DSA:
+      return 'D';
+    case GPGME_PK_ECDH:
+      return 'e';
+    case GPGME_PK_ECDSA:
+    case GPGME_PK_EDDSA:
+      return 'E';
+    default:
+      return '?';
+  }
+}
+
+/* A date as gpg shows it, in UTC. */
+static std::string FormatDate(long timestamp) {
+  time_t time = timestamp;
+  struct tm tm;
+  char date[16];
+  if (gmtime_r(&time, &tm) == NULL ||
+      strftime(date, sizeof date, "%Y-%m-%d", &tm) == 0) {
+    return "?";
+  }
+  return date;
+}
+
+/*
+ * The "pub" or "sub" line of |subkey|, e.g.
+ * "pub   2048R/24CB0839 2009-08-31 [expires: 2011-08-31]".
+ */
+static std::string SubkeyLine(const char *kind, gpgme_subkey_t subkey) {
+  std::string keyid = subkey->keyid != NULL ? subkey->keyid : "";
+  if (keyid.size() > 8) {
+    keyid.erase(0, keyid.size() - 8);
+  }
+  char size[32];
+  PR_snprintf(size, sizeof size, "%u%c/", subkey->length,
+              AlgorithmLetter(subkey->pubkey_algo));
+
+  std::string line = kind;
+  line.append("   ");
+  line.append(size);
+  line.append(keyid);
+  line.append(" ");
+  line.append(FormatDate(subkey->timestamp));
+  if (subkey->expires != 0) {
+    line.append(subkey->expired ? " [expired: " : " [expires: ");
+    line.append(FormatDate(subkey->expires));
+    line.append("]");
+  }
+  line.append("\n");
+  return line;
+}
+
+std::string GpgmeEngine::FingerprintText(gpgme_key_t key) {
+  std::string text = SubkeyLine("pub", key->subkeys);
+  text.append("      Key fingerprint = ");
+  text.append(FormatFingerprint(key->subkeys->fpr));
+  text.append("\n");
+  for (gpgme_user_id_t uid = key->uids; uid != NULL; uid = uid->next) {
+    text.append("uid                  ");
+    text.append(uid->uid);
+    text.append("\n");
+  }
+  for (gpgme_subkey_t subkey = key->subkeys->next; subkey != NULL;
+       subkey = subkey->next) {
+    text.append(SubkeyLine("sub", subkey));
+  }
+  text.append("\n");
+  return text;
+}
+
+/*
+ * The primary user ID of the key that made a signature, like gpg puts on the
+ * GOODSIG line.
+ */
+std::string GpgmeEngine::SignerName(const std::string &fpr) {
+  GpgmeKey key;
+  if (fpr.empty() || key.Get(ctx_, fpr, false) || key.get()->uids == NULL ||
+      key.get()->uids->uid == NULL) {
+    return fpr;
+  }
+  return key.get()->uids->uid;
+}
+
+GpgRetSignerInfo GpgmeEngine::VerifySignedText(const std::string &signed_text,
+                                               const std::string &signature) {
+  GpgRetSignerInfo retobj;
+  GpgmeData text, sig, plain;
+  gpgme_error_t err;
+
+  LOG("GPG: In GpgmeEngine::VerifySignedText\n");
+
+  err = text.NewFromString(signed_text);
+  if (!err) {
+    if (signature.size()) {
+      err = sig.NewFromString(signature);
+      if (!err) {
+        err = gpgme_op_verify(ctx_, sig.get(), text.get(), NULL);
+      }
+    } else {
+      err = plain.New();
+      if (!err) {
+        err = gpgme_op_verify(ctx_, text.get(), NULL, plain.get());
+      }
+    }
+  }
+  if (err) {
+    LOG("GPG: gpgme_op_verify failed: %s\n", gpgme_strerror(err));
+    if (gpg_err_code(err) == GPG_ERR_NO_DATA) {
+      retobj.set_error_str(kERR_SIGNATURE_ERR);
+    } else {
+      retobj.set_error_str(kERR_UNKNOWN_GPG_ERR);
+    }
+    return retobj;
+  }
+
+  /* The result is only valid until the next operation, like SignerName(). */
+  gpgme_verify_result_t result = gpgme_op_verify_result(ctx_);
+  gpgme_signature_t signatures = result != NULL ? result->signatures : NULL;
+  std::string fpr = signatures && signatures->fpr ? signatures->fpr : "";
+  SetSignatureStatus(signatures, &retobj);
+  if (!retobj.is_error()) {
+    retobj.set_signer(SignerName(fpr));
+  }
+  return retobj;
+}
+
+GpgRetEncryptInfo GpgmeEngine::EncryptText(
+    const std::string &rawtext,
+    const std::vector<std::string> &keyids,
+    const std::vector<std::string> &hidden_keyids,
+    bool always_trust,
+    const std::string &sign) {
+  GpgRetEncryptInfo retobj;
+  GpgmeData plain, cipher;
+  GpgmeKey signer;
+  gpgme_error_t err;
+
+  LOG("GPG: In GpgmeEngine::EncryptText\n");
+
+  /*
+   * One recipient per line. "--hidden" makes the ones after it hidden, just
+   * like --hidden-recipient.
+   */
+  std::string recipients;
+  for (size_t i = 0; i < keyids.size(); i++) {
+    recipients.append(keyids[i] + "\n");
+  }
+  if (hidden_keyids.size()) {
+    recipients.append("--hidden\n");
+    for (size_t i = 0; i < hidden_keyids.size(); i++) {
+      recipients.append(hidden_keyids[i] + "\n");
+    }
+  }
+
+  gpgme_encrypt_flags_t flags = static_cast<gpgme_encrypt_flags_t>(
+      always_trust ? GPGME_ENCRYPT_ALWAYS_TRUST : 0);
+
+  if ((err = plain.NewFromString(rawtext)) || (err = cipher.New())) {
+    LOG("GPG: gpgme_data_new failed: %s\n", gpgme_strerror(err));
+    retobj.set_error_str(kERR_INTERNAL);
+    return retobj;
+  }
+
+  if (sign.size()) {
+    gpgme_signers_clear(ctx_);
+    if (signer.Get(ctx_, sign, true) ||
+        gpgme_signers_add(ctx_, signer.get())) {
+      retobj.set_error_str(kERR_NO_SECRET_KEY);
+      return retobj;
+    }
+    err = gpgme_op_encrypt_sign_ext(ctx_, NULL, recipients.c_str(), flags,
+                                    plain.get(), cipher.get());
+    gpgme_signers_clear(ctx_);
+  } else {
+    err = gpgme_op_encrypt_ext(ctx_, NULL, recipients.c_str(), flags,
+                               plain.get(), cipher.get());
+  }
+
+  if (err) {
+    LOG("GPG: Encryption failed: %s\n", gpgme_strerror(err));
+    gpgme_encrypt_result_t result = gpgme_op_encrypt_result(ctx_);
+    retobj.set_error_str(EncryptError(
+        err, result != NULL ? result->invalid_recipients : NULL));
+    return retobj;
+  }
+
+  retobj.set_cipher_text(cipher.TakeString());
+  return retobj;
+}
+
+GpgRetString GpgmeEngine::SignText(const std::string &rawtext,
+                                   const std::string &keyid,
+                                   bool clearsign) {
+  GpgRetString retobj;
+  GpgmeData plain, sig;
+  GpgmeKey signer;
+  gpgme_error_t err;
+
+  LOG("GPG: In GpgmeEngine::SignText\n");
+
+  if ((err = plain.NewFromString(rawtext)) || (err = sig.New())) {
+    LOG("GPG: gpgme_data_new failed: %s\n", gpgme_strerror(err));
+    retobj.set_error_str(kERR_INTERNAL);
+    return retobj;
+  }
+
+  gpgme_signers_clear(ctx_);
+  if (signer.Get(ctx_, keyid, true) ||
+      gpgme_signers_add(ctx_, signer.get())) {
+    retobj.set_error_str(kERR_NO_SECRET_KEY);
+    return retobj;
+  }
+  err = gpgme_op_sign(ctx_, plain.get(), sig.get(),
+                      clearsign ? GPGME_SIG_MODE_CLEAR : GPGME_SIG_MODE_DETACH);
+  gpgme_signers_clear(ctx_);
+
+  if (err) {
+    LOG("GPG: Signing failed: %s\n", gpgme_strerror(err));
+    retobj.set_error_str(SignError(err));
+    return retobj;
+  }
+
+  retobj.set_retstring(sig.TakeString());
+  return retobj;
+}
+
+GpgRetDecryptInfo GpgmeEngine::DecryptText(const std::string &cipher_text,
+                                           SecureString *plain_text) {
+  GpgRetDecryptInfo retobj;
+  GpgmeData cipher, plain;
+  gpgme_error_t err;
+
+  LOG("GPG: In GpgmeEngine::DecryptText\n");
+
+  plain_text->clear();
+  if ((err = cipher.NewFromString(cipher_text)) ||
+      (err = plain.NewForSecureString(plain_text))) {
+    LOG("GPG: gpgme_data_new failed: %s\n", gpgme_strerror(err));
+    retobj.set_error_str(kERR_INTERNAL);
+    return retobj;
+  }
+
+  err = gpgme_op_decrypt_verify(ctx_, cipher.get(), plain.get());
+  if (err) {
+    LOG("GPG: Decryption failed: %s\n", gpgme_strerror(err));
+    retobj.set_error_str(DecryptError(err));
+    plain_text->clear();
+    return retobj;
+  }
+
+  gpgme_verify_result_t verify = gpgme_op_verify_result(ctx_);
+  if (verify != NULL && verify->signatures != NULL) {
+    std::string fpr = verify->signatures->fpr ? verify->signatures->fpr : "";
+    SetSignatureStatus(verify->signatures, &retobj);
+    if (retobj.is_error()) {
+      plain_text->clear();
+      return retobj;
+    }
+    retobj.set_signer(SignerName(fpr));
+  }
+  return retobj;
+}
+
+GpgRetUidsInfo GpgmeEngine::GetUids(const std::string &keyid) {
+  GpgRetUidsInfo retobj;
+  GpgmeKey key;
+
+  LOG("GPG: In GpgmeEngine::GetUids\n");
+
+  if (key.Get(ctx_, keyid, false)) {
+    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
+    return retobj;
+  }
+  for (gpgme_user_id_t uid = key.get()->uids; uid != NULL; uid = uid->next) {
+    retobj.add_uid(uid->uid);
+  }
+  return retobj;
+}
+
+GpgRetString GpgmeEngine::GetFingerprint(const std::string &keyid) {
+  GpgRetString retobj;
+  GpgmeKey key;
+
+  LOG("GPG: In GpgmeEngine::GetFingerprint\n");
+
+  if (key.Get(ctx_, keyid, false) || key.get()->subkeys == NULL) {
+    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
+    return retobj;
+  }
+
+  retobj.set_retstring(FingerprintText(key.get()));
+  return retobj;
+}
+
+GpgRetString GpgmeEngine::GetTrust(const std::string &keyid) {
+  GpgRetString retobj;
+  GpgmeKey key;
+
+  LOG("GPG: In GpgmeEngine::GetTrust\n");
+
+  if (key.Get(ctx_, keyid, false)) {
+    retobj.set_error_str(kERR_NO_PUBLIC_KEY);
+    return retobj;
+  }
+  retobj.set_retstring(KeyTrust(key.get()));
+  return retobj;
+}
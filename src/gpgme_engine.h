@@ -0,0 +1,129 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * This file declares GpgmeEngine, which runs the cryptographic operations of
+ * BaseGnupg through GPGME instead of executing gpg for each call and parsing
+ * its --status-fd output. Data is handed to GPGME from memory, so no temporary
+ * files are involved, and each thread keeps one GPGME context that is reused
+ * for all its calls.
+ *
+ * It's only built if SCons is run with --with-gpgme, and only used if the
+ * gpg_engine preference is set to "gpgme". The results are the same GpgRet*
+ * objects, with the same error strings, as those of the gpg engine.
+ *
+ * An engine is a GpgWatchdog target while it runs an operation, so that
+ * gpg_timeout and cancel() reach the gpg GPGME runs, too.
+ */
+
+#ifndef _GPGPLUGIN_GPGME_ENGINE_H_
+#define _GPGPLUGIN_GPGME_ENGINE_H_
+
+#include <gpgme.h>
+#include <prtypes.h>
+
+#include <string>
+#include <vector>
+
+#include "securemem.h"
+#include "types.h"
+#include "watchdog.h"
+
+class GpgmeEngine : public GpgWatchdog::Target {
+ public:
+  /*
+   * Get the engine of the calling thread, which is created the first time.
+   * Returns NULL if GPGME can't be initialized. |gpg_path| is the gpg binary
+   * GPGME should run.
+   */
+  static GpgmeEngine *ForCurrentThread(const std::string &gpg_path);
+
+  /*
+   * Drop the engine of the calling thread, so that the next call gets a new
+   * context. An interrupted context may still be marked as canceled.
+   */
+  static void ResetForCurrentThread();
+
+  /*
+   * Cancel the operation running on the context with gpgme_cancel_async(),
+   * which GPGME notices the next time it polls gpg's pipes and terminates
+   * gpg. There's nothing more forceful to do, so |force| changes nothing.
+   */
+  virtual void Interrupt(bool force);
+
+  GpgRetSignerInfo VerifySignedText(const std::string &signed_text,
+                                    const std::string &signature);
+  GpgRetEncryptInfo EncryptText(const std::string &rawtext,
+                                const std::vector<std::string> &keyids,
+                                const std::vector<std::string> &hidden_keyids,
+                                bool always_trust,
+                                const std::string &sign);
+  GpgRetString SignText(const std::string &rawtext,
+                        const std::string &keyid,
+                        bool clearsign);
+  /*
+   * The plain text goes to |plain_text| rather than into the result, so that
+   * it stays in secure memory until the caller puts it where it belongs. It's
+   * left empty on failure.
+   */
+  GpgRetDecryptInfo DecryptText(const std::string &cipher_text,
+                                SecureString *plain_text);
+  GpgRetUidsInfo GetUids(const std::string &keyid);
+  GpgRetString GetFingerprint(const std::string &keyid);
+  GpgRetString GetTrust(const std::string &keyid);
+
+  /*
+   * These turn GPGME results into what the gpg engine would have returned.
+   * They'd be private if it weren't for the unittests.
+   */
+  static void SetSignatureStatus(gpgme_signature_t signature,
+                                 GpgRetSignerInfo *retobj);
+  static const char *EncryptError(gpgme_error_t err,
+                                  gpgme_invalid_key_t invalid_recipients);
+  static const char *SignError(gpgme_error_t err);
+  static const char *DecryptError(gpgme_error_t err);
+  static std::string KeyTrust(gpgme_key_t key);
+  static std::string FormatFingerprint(const char *fpr);
+  /*
+   * What 'gpg --fingerprint' lists for |key|, in the layout of GnuPG 2.0:
+   * the primary key with its fingerprint, the user IDs and the subkeys.
+   */
+  static std::string FingerprintText(gpgme_key_t key);
+
+ private:
+  explicit GpgmeEngine(gpgme_ctx_t ctx);
+  virtual ~GpgmeEngine();
+
+  static PRStatus Init();
+  static void PR_CALLBACK Destroy(void *engine);
+
+  std::string SignerName(const std::string &fpr);
+
+  gpgme_ctx_t ctx_;
+  std::string gpg_path_;
+};
+
+#endif  // _GPGPLUGIN_GPGME_ENGINE_H_
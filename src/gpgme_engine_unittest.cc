@@ -0,0 +1,239 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gpgme.h>
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gpgme_engine.h"
+#include "prefs.h"
+#include "securemem.h"
+#include "testkeyring.h"
+#include "types.h"
+
+namespace {
+
+/*
+ * These cover the same cases as the GnupgVerifySignedText, GnupgEncryptText,
+ * GnupgSignText and GnupgDecryptText tests in gnupg_unittest.cc, starting from
+ * what GPGME reports instead of from the status output of gpg.
+ */
+
+TEST(GpgmeEngineVerify, VerifiesValidSig) {
+  struct _gpgme_signature signature;
+  std::memset(&signature, 0, sizeof signature);
+  signature.status = GPG_ERR_NO_ERROR;
+  signature.validity = GPGME_VALIDITY_ULTIMATE;
+
+  GpgRetSignerInfo si;
+  GpgmeEngine::SetSignatureStatus(&signature, &si);
+  EXPECT_FALSE(si.is_error());
+  EXPECT_EQ("TRUST_ULTIMATE", si.trust_level());
+}
+
+TEST(GpgmeEngineVerify, DoesNotVerifyInvalidSig) {
+  struct _gpgme_signature signature;
+  std::memset(&signature, 0, sizeof signature);
+  signature.status = gpg_error(GPG_ERR_BAD_SIGNATURE);
+
+  GpgRetSignerInfo si;
+  GpgmeEngine::SetSignatureStatus(&signature, &si);
+  EXPECT_TRUE(si.is_error());
+  EXPECT_EQ("Bad signature", si.error_str());
+}
+
+TEST(GpgmeEngineVerify, ErrorsWithoutSignature) {
+  GpgRetSignerInfo si;
+  GpgmeEngine::SetSignatureStatus(NULL, &si);
+  EXPECT_TRUE(si.is_error());
+  EXPECT_EQ("Signature not found or unreadable", si.error_str());
+}
+
+TEST(GpgmeEngineEncrypt, ErrorsOnBadKey) {
+  struct _gpgme_invalid_key invalid;
+  std::memset(&invalid, 0, sizeof invalid);
+
+  invalid.reason = gpg_error(GPG_ERR_NO_PUBKEY);
+  EXPECT_STREQ("Public key not available", GpgmeEngine::EncryptError(
+      gpg_error(GPG_ERR_UNUSABLE_PUBKEY), &invalid));
+
+  invalid.reason = gpg_error(GPG_ERR_PUBKEY_NOT_TRUSTED);
+  EXPECT_STREQ("Key not trusted", GpgmeEngine::EncryptError(
+      gpg_error(GPG_ERR_UNUSABLE_PUBKEY), &invalid));
+
+  invalid.reason = gpg_error(GPG_ERR_CERT_REVOKED);
+  EXPECT_STREQ("Key expired or revoked", GpgmeEngine::EncryptError(
+      gpg_error(GPG_ERR_UNUSABLE_PUBKEY), &invalid));
+}
+
+TEST(GpgmeEngineSign, FailsToSign) {
+  EXPECT_STREQ("Secret key not available",
+               GpgmeEngine::SignError(gpg_error(GPG_ERR_NO_SECKEY)));
+  EXPECT_STREQ("Bad passphrase or couldn't talk to gpg-agent",
+               GpgmeEngine::SignError(gpg_error(GPG_ERR_BAD_PASSPHRASE)));
+}
+
+TEST(GpgmeEngineDecrypt, FailsToDecrypt) {
+  EXPECT_STREQ("Secret key not available",
+               GpgmeEngine::DecryptError(gpg_error(GPG_ERR_DECRYPT_FAILED)));
+  EXPECT_STREQ("Secret key not available",
+               GpgmeEngine::DecryptError(gpg_error(GPG_ERR_NO_SECKEY)));
+}
+
+TEST(GpgmeEngineTrust, UsesBestUidValidity) {
+  struct _gpgme_user_id primary, other;
+  std::memset(&primary, 0, sizeof primary);
+  std::memset(&other, 0, sizeof other);
+  primary.validity = GPGME_VALIDITY_MARGINAL;
+  primary.next = &other;
+  other.validity = GPGME_VALIDITY_FULL;
+
+  struct _gpgme_key key;
+  std::memset(&key, 0, sizeof key);
+  key.uids = &primary;
+  EXPECT_EQ("TRUST_FULL", GpgmeEngine::KeyTrust(&key));
+
+  key.revoked = 1;
+  EXPECT_EQ("TRUST_REVOKED", GpgmeEngine::KeyTrust(&key));
+}
+
+TEST(GpgmeEngineFingerprint, GroupsLikeGpg) {
+  EXPECT_EQ("7928 3637 7D99 F13F 68B4  D49B 2C15 7CF1 24CB 0839",
+            GpgmeEngine::FormatFingerprint(
+                "792836377D99F13F68B4D49B2C157CF124CB0839"));
+}
+
+TEST(GpgmeEngineFingerprint, ListsSubkeysLikeGpg) {
+  struct _gpgme_subkey primary, sub;
+  std::memset(&primary, 0, sizeof primary);
+  std::memset(&sub, 0, sizeof sub);
+  primary.pubkey_algo = GPGME_PK_DSA;
+  primary.length = 1024;
+  primary.keyid = const_cast<char *>("2C157CF124CB0839");
+  primary.fpr = const_cast<char *>("792836377D99F13F68B4D49B2C157CF124CB0839");
+  primary.timestamp = 1251728234;
+  primary.next = &sub;
+  sub.pubkey_algo = GPGME_PK_ELG_E;
+  sub.length = 2048;
+  sub.keyid = const_cast<char *>("0123456789ABCDEF");
+  sub.timestamp = 1251728234;
+  sub.expires = 1314800234;
+  sub.expired = 1;
+
+  struct _gpgme_user_id uid;
+  std::memset(&uid, 0, sizeof uid);
+  uid.uid = const_cast<char *>("Phil Dibowitz <fixxxer@google.com>");
+
+  struct _gpgme_key key;
+  std::memset(&key, 0, sizeof key);
+  key.subkeys = &primary;
+  key.uids = &uid;
+  EXPECT_EQ("pub   1024D/24CB0839 2009-08-31\n"
+            "      Key fingerprint = 7928 3637 7D99 F13F 68B4  D49B 2C15 7CF1 "
+            "24CB 0839\n"
+            "uid                  Phil Dibowitz <fixxxer@google.com>\n"
+            "sub   2048g/89ABCDEF 2009-08-31 [expired: 2011-08-31]\n"
+            "\n",
+            GpgmeEngine::FingerprintText(&key));
+}
+
+/*
+ * These run the engine against a keyring of their own (see TestKeyring).
+ */
+class GpgmeEngineKeyring : public testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    ASSERT_TRUE(keyring_.Create());
+  }
+
+  static void TearDownTestCase() {
+    EXPECT_TRUE(keyring_.Destroy());
+  }
+
+  virtual void SetUp() {
+    GpgPreferences preferences;
+    engine_ = GpgmeEngine::ForCurrentThread(
+        preferences.StringPreference(GpgPreferences::GpgBinaryPath));
+    ASSERT_TRUE(engine_ != NULL);
+  }
+
+  static TestKeyring keyring_;
+  GpgmeEngine *engine_;
+};
+
+TestKeyring GpgmeEngineKeyring::keyring_;
+
+TEST_F(GpgmeEngineKeyring, EncryptsAndDecrypts) {
+  std::vector<std::string> keyids(1, TestKeyring::kKEYID), hidden;
+  GpgRetEncryptInfo encrypted = engine_->EncryptText("plain text", keyids,
+                                                     hidden, true, "");
+  ASSERT_FALSE(encrypted.is_error()) << encrypted.error_str();
+  EXPECT_NE(std::string::npos,
+            encrypted.cipher_text().find("-----BEGIN PGP MESSAGE-----"));
+
+  SecureString plain_text;
+  GpgRetDecryptInfo decrypted = engine_->DecryptText(encrypted.cipher_text(),
+                                                     &plain_text);
+  ASSERT_FALSE(decrypted.is_error()) << decrypted.error_str();
+  EXPECT_EQ("plain text", plain_text);
+}
+
+TEST_F(GpgmeEngineKeyring, SignsAndVerifies) {
+  GpgRetString signature = engine_->SignText("signed text",
+                                             TestKeyring::kKEYID, false);
+  ASSERT_FALSE(signature.is_error()) << signature.error_str();
+
+  GpgRetSignerInfo verified = engine_->VerifySignedText("signed text",
+                                                        signature.retstring());
+  EXPECT_FALSE(verified.is_error()) << verified.error_str();
+  EXPECT_EQ("TRUST_ULTIMATE", verified.trust_level());
+
+  verified = engine_->VerifySignedText("other text", signature.retstring());
+  EXPECT_TRUE(verified.is_error());
+}
+
+TEST_F(GpgmeEngineKeyring, GetsUids) {
+  GpgRetUidsInfo uids = engine_->GetUids(TestKeyring::kKEYID);
+  ASSERT_FALSE(uids.is_error()) << uids.error_str();
+  ASSERT_EQ(1U, uids.uids().size());
+  EXPECT_EQ(TestKeyring::kUID, uids.uids()[0]);
+}
+
+TEST_F(GpgmeEngineKeyring, ListsSubkeysInFingerprint) {
+  GpgRetString fingerprint = engine_->GetFingerprint(TestKeyring::kKEYID);
+  ASSERT_FALSE(fingerprint.is_error()) << fingerprint.error_str();
+  const std::string &text = fingerprint.retstring();
+  EXPECT_EQ(0U, text.find("pub   255E/"));
+  EXPECT_NE(std::string::npos, text.find("\n      Key fingerprint = "));
+  EXPECT_NE(std::string::npos,
+            text.find("\nuid                  Test <test@example.com>\n"));
+  EXPECT_NE(std::string::npos, text.find("\nsub   255e/"));
+}
+
+}  /* namespace */
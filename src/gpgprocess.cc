@@ -0,0 +1,91 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "gpgprocess.h"
+
+#include <prerror.h>
+#include <prproces.h>
+#include <prtypes.h>
+
+#include "logging.h"
+
+const int GpgProcess::kEXIT_UNKNOWN;
+
+NsprProcess::NsprProcess(PRProcess *process)
+    : process_(process) {
+}
+
+/*
+ * PR_WaitProcess() frees the PRProcess, so a process that was never waited on
+ * is detached here instead so that NSPR can reap it and release its memory.
+ */
+NsprProcess::~NsprProcess() {
+  if (process_ != NULL) {
+    if (PR_DetachProcess(process_) == PR_FAILURE) {
+      LOG("GPG: PR_DetachProcess failed: %d\n", PR_GetError());
+    }
+  }
+}
+
+bool NsprProcess::Wait(int *exit_code) {
+  PRInt32 ret;
+  PRStatus status = PR_WaitProcess(process_, &ret);
+  /* Never touch the PRProcess again after a wait, successful or not. */
+  process_ = NULL;
+  if (status == PR_FAILURE) {
+    LOG("GPG: Failed to PR_WaitProcess: %d\n", PR_GetError());
+    return false;
+  }
+  *exit_code = ret;
+  return true;
+}
+
+/*
+ * NSPR only knows how to kill processes. Its reaper thread may have reaped
+ * the process already, so its pid can't be used to send it anything else.
+ */
+bool NsprProcess::Terminate() {
+  return false;
+}
+
+bool NsprProcess::Kill() {
+  if (process_ == NULL) {
+    return false;
+  }
+  if (PR_KillProcess(process_) == PR_FAILURE) {
+    LOG("GPG: PR_KillProcess failed: %d\n", PR_GetError());
+    return false;
+  }
+  return true;
+}
+
+/*
+ * For the same reason there's no pidfd to be had: by the time one was opened,
+ * the pid could belong to another process.
+ */
+int NsprProcess::ExitFd() {
+  return -1;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifndef _GPGPLUGIN_GPGPROCESS_H_
+#define _GPGPLUGIN_GPGPROCESS_H_
+
+struct PRProcess;
+
+/*
+ * GpgProcess is a handle on a running gpg child.
+ *
+ * Not every child is started by PR_CreateProcess() (see posix/launcher.h), so
+ * not every child can be waited on or killed with the NSPR process functions.
+ * Everything that needs to do either goes through this interface instead.
+ */
+class GpgProcess {
+ public:
+  /*
+   * The exit code of a process that something else has reaped, so that its
+   * real one is lost.
+   */
+  static const int kEXIT_UNKNOWN = -4;
+
+  virtual ~GpgProcess() {}
+
+  /*
+   * Block until the process exits and store its exit code in |exit_code|, or
+   * kEXIT_UNKNOWN. Returns false if waiting failed. Must be called at most
+   * once.
+   */
+  virtual bool Wait(int *exit_code) = 0;
+
+  /*
+   * Ask the process to exit (with SIGTERM where there is such a thing).
+   * Returns false if that can't be done, in which case Kill() is the only
+   * way. It must still be waited on afterwards.
+   */
+  virtual bool Terminate() = 0;
+
+  /*
+   * Forcibly terminate the process. It must still be waited on afterwards.
+   */
+  virtual bool Kill() = 0;
+
+  /*
+   * A descriptor that becomes readable once the process has exited, without
+   * anything having to be read from it, or -1 if there is none (see
+   * posix/pump.h). It belongs to the process and is only valid until
+   * Wait().
+   */
+  virtual int ExitFd() = 0;
+};
+
+/*
+ * A GpgProcess created by PR_CreateProcess(). It's only waited on and killed
+ * through NSPR, which reaps it on its own thread.
+ */
+class NsprProcess : public GpgProcess {
+ public:
+  explicit NsprProcess(PRProcess *process);
+  virtual ~NsprProcess();
+
+  virtual bool Wait(int *exit_code);
+  virtual bool Terminate();
+  virtual bool Kill();
+  virtual int ExitFd();
+
+ private:
+  PRProcess *process_;
+};
+
+#endif  // _GPGPLUGIN_GPGPROCESS_H_
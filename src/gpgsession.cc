@@ -0,0 +1,121 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "gpgsession.h"
+
+#include <prerror.h>
+#include <prio.h>
+
+#include "gpgprocess.h"
+#include "logging.h"
+#include "outputwatcher.h"
+#include "prstrms.h"
+
+/*
+ * gpg's status output can run long (key listings, batches), so it's read in
+ * larger blocks than the streams' default.
+ */
+static const int kSTATUS_BUFFER_SIZE = 64 * 1024;
+
+GpgSession::GpgSession(GpgProcess *process, PRFileDesc *command,
+                       PRFileDesc *status)
+    : process_(process),
+      command_(command),
+      status_(status),
+      out_(new PRofstream(command)),
+      in_(NULL),
+      status_watcher_(NULL) {
+}
+
+GpgSession::~GpgSession() {
+  ClosePipes();
+  delete process_;
+  delete status_watcher_;
+}
+
+std::istream &GpgSession::in() {
+  if (in_ == NULL) {
+    in_ = new PRifstream(status_);
+    in_->rdbuf()->set_buffer_size(kSTATUS_BUFFER_SIZE);
+  }
+  return *in_;
+}
+
+PRFileDesc *GpgSession::StatusPipe() {
+  return in_ == NULL ? status_ : NULL;
+}
+
+int GpgSession::ExitFd() {
+  return process_->ExitFd();
+}
+
+void GpgSession::WatchStatus(GpgOutputWatcher *watcher) {
+  delete status_watcher_;
+  status_watcher_ = watcher;
+}
+
+GpgOutputWatcher *GpgSession::StatusWatcher() {
+  return status_watcher_;
+}
+
+std::ostream &GpgSession::out() {
+  return *out_;
+}
+
+bool GpgSession::Wait(int *exit_code) {
+  ClosePipes();
+  return process_->Wait(exit_code);
+}
+
+bool GpgSession::Kill() {
+  return process_->Kill();
+}
+
+/* Where there's no gentle way, the first interruption is forceful already. */
+void GpgSession::Interrupt(bool force) {
+  if (force || !process_->Terminate()) {
+    process_->Kill();
+  }
+}
+
+/*
+ * The streams don't close the file descriptors they're given, so that's done
+ * here, after the command stream has been flushed.
+ */
+void GpgSession::ClosePipes() {
+  delete out_;
+  delete in_;
+  out_ = NULL;
+  in_ = NULL;
+  if (command_ != NULL && PR_Close(command_) == PR_FAILURE) {
+    LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+  }
+  if (status_ != NULL && PR_Close(status_) == PR_FAILURE) {
+    LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+  }
+  command_ = NULL;
+  status_ = NULL;
+}
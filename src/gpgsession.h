@@ -0,0 +1,112 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifndef _GPGPLUGIN_GPGSESSION_H_
+#define _GPGPLUGIN_GPGSESSION_H_
+
+#include <iosfwd>
+
+#include "watchdog.h"
+
+class GpgOutputWatcher;
+class GpgProcess;
+class PRifstream;
+class PRofstream;
+struct PRFileDesc;
+
+/*
+ * GpgSession is everything that belongs to one run of gpg: the process, the
+ * pipes to and from it and the streams on them. CallGpg() creates one and
+ * WaitOnGpg() consumes it, so operations that run at the same time on the same
+ * Gnupg object don't share any of it.
+ *
+ * A session is watched by the GpgWatchdog while it's being read from, and
+ * interrupting it terminates gpg, so that the reads see the end of its
+ * output.
+ */
+class GpgSession : public GpgWatchdog::Target {
+ public:
+  /*
+   * Takes ownership of |process|, of |command|, which is gpg's --command-fd,
+   * and of |status|, which is its --status-fd.
+   */
+  GpgSession(GpgProcess *process, PRFileDesc *command, PRFileDesc *status);
+
+  /*
+   * Closes the pipes. A process that hasn't been waited on is left to exit by
+   * itself.
+   */
+  ~GpgSession();
+
+  /* What gpg writes to its status fd. */
+  std::istream &in();
+
+  /*
+   * The pipe from gpg's status fd, for reading it without in(), or NULL once
+   * in() has been used, as the stream may have read ahead.
+   */
+  PRFileDesc *StatusPipe();
+
+  /* See GpgProcess::ExitFd(). */
+  int ExitFd();
+
+  /*
+   * Have |watcher| told about the status output as it's read, see
+   * GpgStatusWatch. Takes ownership of |watcher|.
+   */
+  void WatchStatus(GpgOutputWatcher *watcher);
+
+  /* The watcher of the status output, or NULL. */
+  GpgOutputWatcher *StatusWatcher();
+
+  /* What gpg reads from its command fd. */
+  std::ostream &out();
+
+  /*
+   * Close the pipes, so that gpg sees the end of its input, and wait for it to
+   * exit. Returns false if waiting failed. Must be called at most once.
+   */
+  bool Wait(int *exit_code);
+
+  /*
+   * Forcibly terminate gpg. It must still be waited on afterwards.
+   */
+  bool Kill();
+
+  virtual void Interrupt(bool force);
+
+ private:
+  void ClosePipes();
+
+  GpgProcess *process_;
+  PRFileDesc *command_;
+  PRFileDesc *status_;
+  PRofstream *out_;
+  PRifstream *in_;
+  GpgOutputWatcher *status_watcher_;
+};
+
+#endif  // _GPGPLUGIN_GPGSESSION_H_
@@ -0,0 +1,1057 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "openpgp.h"
+
+#include <prtypes.h>
+#include <stdlib.h>
+#ifndef OS_WINDOWS
+#include <zlib.h>
+#endif
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "aes.h"
+#include "logging.h"
+#include "securemem.h"
+#include "sha1.h"
+#include "sha256.h"
+
+namespace openpgp {
+
+static const int kSIG_VERSION = 4;
+static const int kSIG_BINARY_DOCUMENT = 0x00;
+static const int kSUBPACKET_CREATED = 2;
+static const int kSUBPACKET_ISSUER = 16;
+static const int kSUBPACKET_ISSUER_FPR = 33;
+static const int kPACKET_SIGNATURE = 2;
+static const int kPACKET_SESSION_KEY = 1;
+static const int kPACKET_COMPRESSED = 8;
+static const int kPACKET_MARKER = 10;
+static const int kPACKET_LITERAL = 11;
+static const int kPACKET_ENCRYPTED_MDC = 18;
+static const int kPACKET_MDC = 19;
+static const int kSESSION_KEY_VERSION = 3;
+static const int kENCRYPTED_MDC_VERSION = 1;
+static const int kCOMPRESS_ZIP = 1;
+static const int kCOMPRESS_ZLIB = 2;
+
+/* What the key derivation of ECDH puts in place of the sender. */
+static const char kKDF_SENDER[] = "Anonymous Sender    ";
+
+static const char *kSEXP_SIG_VAL = "sig-val";
+static const char *kSEXP_RSA = "rsa";
+static const char *kSEXP_EDDSA = "eddsa";
+static const char *kCURVE_ED25519 = "ed25519";
+static const char *kSEXP_ECDH = "ecdh";
+static const char *kSEXP_VALUE = "value";
+
+/*
+ * Fields of the --with-colons records, see doc/DETAILS in GnuPG.
+ */
+static const size_t kFIELD_TYPE = 0;
+static const size_t kFIELD_VALIDITY = 1;
+static const size_t kFIELD_ALGO = 3;
+static const size_t kFIELD_KEYID = 4;
+static const size_t kFIELD_CREATED = 5;
+static const size_t kFIELD_USER_ID = 9;
+static const size_t kFIELD_CAPABILITIES = 11;
+static const size_t kFIELD_TOKEN = 14;
+static const size_t kFIELD_CURVE = 16;
+/* Of "pkd" records, which --with-key-data adds. */
+static const size_t kFIELD_KEY_DATA_INDEX = 1;
+static const size_t kFIELD_KEY_DATA = 3;
+
+static void AppendUint16(size_t value, std::string *out) {
+  out->push_back(static_cast<char>((value >> 8) & 0xff));
+  out->push_back(static_cast<char>(value & 0xff));
+}
+
+static void AppendUint32(PRUint32 value, std::string *out) {
+  out->push_back(static_cast<char>((value >> 24) & 0xff));
+  out->push_back(static_cast<char>((value >> 16) & 0xff));
+  out->push_back(static_cast<char>((value >> 8) & 0xff));
+  out->push_back(static_cast<char>(value & 0xff));
+}
+
+static void SplitFields(const std::string &line,
+                        std::vector<std::string> *fields) {
+  std::string::size_type start = 0;
+  std::string::size_type colon;
+
+  fields->clear();
+  while ((colon = line.find(':', start)) != std::string::npos) {
+    fields->push_back(line.substr(start, colon - start));
+    start = colon + 1;
+  }
+  fields->push_back(line.substr(start));
+}
+
+static const std::string &Field(const std::vector<std::string> &fields,
+                                size_t index) {
+  static const std::string empty;
+  return index < fields.size() ? fields[index] : empty;
+}
+
+/* Revoked, expired, invalid or disabled. */
+static bool IsUsable(const std::vector<std::string> &fields) {
+  const std::string &validity = Field(fields, kFIELD_VALIDITY);
+  return validity.find_first_of("reid") == std::string::npos;
+}
+
+static bool CanSign(const std::vector<std::string> &fields) {
+  /* "#" means that only a stub of the secret key is there. */
+  return IsUsable(fields) &&
+         Field(fields, kFIELD_CAPABILITIES).find('s') != std::string::npos &&
+         Field(fields, kFIELD_TOKEN) != "#";
+}
+
+bool ParseSigningKey(const std::string &listing, SigningKey *key) {
+  std::istringstream lines(listing);
+  std::string line;
+  std::vector<std::string> fields;
+  int primary_keys = 0;
+  bool primary_usable = false;
+  bool found = false;
+  bool in_best = false;
+  unsigned long best_created = 0;
+  std::string curve;
+  SigningKey best;
+
+  while (getline(lines, line)) {
+    SplitFields(line, &fields);
+    const std::string &type = fields[kFIELD_TYPE];
+    if (type == "sec" || type == "ssb") {
+      in_best = false;
+      if (type == "sec") {
+        primary_keys++;
+        primary_usable = IsUsable(fields);
+      }
+      if (!CanSign(fields)) {
+        continue;
+      }
+      unsigned long created = strtoul(Field(fields, kFIELD_CREATED).c_str(),
+                                      NULL, 10);
+      if (found && created < best_created) {
+        continue;
+      }
+      best = SigningKey();
+      best.keyid = Field(fields, kFIELD_KEYID);
+      best.algo = atoi(Field(fields, kFIELD_ALGO).c_str());
+      curve = Field(fields, kFIELD_CURVE);
+      best_created = created;
+      found = true;
+      in_best = true;
+    } else if (in_best && type == "fpr" && best.fingerprint.empty()) {
+      best.fingerprint = Field(fields, kFIELD_USER_ID);
+    } else if (in_best && type == "grp" && best.keygrip.empty()) {
+      best.keygrip = Field(fields, kFIELD_USER_ID);
+    }
+  }
+
+  if (primary_keys != 1 || !primary_usable || !found) {
+    LOG("GPG: No single usable signing key (%d keys)\n", primary_keys);
+    return false;
+  }
+  if (best.fingerprint.size() != 40 || best.keygrip.size() != 40) {
+    LOG("GPG: No v4 fingerprint or keygrip for %s\n", best.keyid.c_str());
+    return false;
+  }
+  switch (best.algo) {
+    case kPUBKEY_RSA:
+    case kPUBKEY_RSA_SIGN:
+      break;
+    case kPUBKEY_EDDSA:
+      if (curve == kCURVE_ED25519) {
+        break;
+      }
+      /* Fall through. */
+    default:
+      LOG("GPG: Can't sign with algorithm %d (%s)\n", best.algo,
+          curve.c_str());
+      return false;
+  }
+
+  *key = best;
+  return true;
+}
+
+SignatureBuilder::SignatureBuilder(const SigningKey &key, PRUint32 created)
+    : key_(key) {
+  std::string fingerprint;
+  HexDecode(key.fingerprint, &fingerprint);
+
+  std::string subpackets;
+  subpackets.push_back(static_cast<char>(2 + fingerprint.size()));
+  subpackets.push_back(static_cast<char>(kSUBPACKET_ISSUER_FPR));
+  subpackets.push_back(static_cast<char>(kSIG_VERSION));
+  subpackets.append(fingerprint);
+  subpackets.push_back(static_cast<char>(5));
+  subpackets.push_back(static_cast<char>(kSUBPACKET_CREATED));
+  AppendUint32(created, &subpackets);
+
+  hashed_.push_back(static_cast<char>(kSIG_VERSION));
+  hashed_.push_back(static_cast<char>(kSIG_BINARY_DOCUMENT));
+  hashed_.push_back(static_cast<char>(key.algo));
+  hashed_.push_back(static_cast<char>(kHASH_SHA256));
+  AppendUint16(subpackets.size(), &hashed_);
+  hashed_.append(subpackets);
+}
+
+std::string SignatureBuilder::Digest(const std::string &data) {
+  std::string trailer;
+  trailer.push_back(static_cast<char>(kSIG_VERSION));
+  trailer.push_back(static_cast<char>(0xff));
+  AppendUint32(hashed_.size(), &trailer);
+
+  Sha256 sha;
+  sha.Update(data);
+  sha.Update(hashed_);
+  sha.Update(trailer);
+  digest_ = sha.Final();
+  return digest_;
+}
+
+bool SignatureBuilder::Packet(const std::string &sig_val,
+                              std::string *packet) const {
+  std::vector<std::string> names;
+  const char *algo;
+  if (key_.algo == kPUBKEY_EDDSA) {
+    algo = kSEXP_EDDSA;
+    names.push_back("r");
+    names.push_back("s");
+  } else {
+    algo = kSEXP_RSA;
+    names.push_back("s");
+  }
+
+  std::vector<std::string> values;
+  if (digest_.size() != Sha256::kDigestSize ||
+      !ParseSigVal(sig_val, algo, names, &values)) {
+    return false;
+  }
+
+  std::string keyid;
+  HexDecode(key_.keyid, &keyid);
+
+  std::string body(hashed_);
+  AppendUint16(2 + keyid.size(), &body);
+  body.push_back(static_cast<char>(1 + keyid.size()));
+  body.push_back(static_cast<char>(kSUBPACKET_ISSUER));
+  body.append(keyid);
+  body.append(digest_, 0, 2);
+  for (size_t i = 0; i < values.size(); i++) {
+    body.append(Mpi(values[i]));
+  }
+
+  /* An old format packet header with the shortest length that fits. */
+  packet->clear();
+  if (body.size() < 0x100) {
+    packet->push_back(static_cast<char>(0x80 | (kPACKET_SIGNATURE << 2)));
+    packet->push_back(static_cast<char>(body.size()));
+  } else if (body.size() < 0x10000) {
+    packet->push_back(static_cast<char>(0x81 | (kPACKET_SIGNATURE << 2)));
+    AppendUint16(body.size(), packet);
+  } else {
+    packet->push_back(static_cast<char>(0x82 | (kPACKET_SIGNATURE << 2)));
+    AppendUint32(body.size(), packet);
+  }
+  packet->append(body);
+  return true;
+}
+
+/*
+ * A reader for canonical S-expressions, where atoms are "<length>:<bytes>".
+ */
+class SexpReader {
+ public:
+  explicit SexpReader(const std::string &sexp) : sexp_(sexp), pos_(0) {}
+
+  bool Open() { return Punctuation('('); }
+  bool Close() { return Punctuation(')'); }
+  bool AtOpen() const { return pos_ < sexp_.size() && sexp_[pos_] == '('; }
+  bool AtClose() const { return pos_ < sexp_.size() && sexp_[pos_] == ')'; }
+
+  bool Atom(std::string *atom) {
+    size_t length = 0;
+    size_t pos = pos_;
+    while (pos < sexp_.size() && sexp_[pos] >= '0' && sexp_[pos] <= '9') {
+      length = length * 10 + (sexp_[pos] - '0');
+      if (length > sexp_.size()) {
+        return false;
+      }
+      pos++;
+    }
+    if (pos == pos_ || pos >= sexp_.size() || sexp_[pos] != ':' ||
+        sexp_.size() - pos - 1 < length) {
+      return false;
+    }
+    atom->assign(sexp_, pos + 1, length);
+    pos_ = pos + 1 + length;
+    return true;
+  }
+
+  /* Skip to just after the ')' that closes the current list. */
+  bool SkipList() {
+    int depth = 1;
+    std::string atom;
+    while (depth > 0) {
+      if (Open()) {
+        depth++;
+      } else if (Close()) {
+        depth--;
+      } else if (!Atom(&atom)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  bool Punctuation(char c) {
+    if (pos_ < sexp_.size() && sexp_[pos_] == c) {
+      pos_++;
+      return true;
+    }
+    return false;
+  }
+
+  const std::string &sexp_;
+  size_t pos_;
+};
+
+bool ParseSigVal(const std::string &sig_val,
+                 const std::string &algo,
+                 const std::vector<std::string> &names,
+                 std::vector<std::string> *values) {
+  SexpReader reader(sig_val);
+  std::string atom;
+
+  if (!reader.Open() || !reader.Atom(&atom) || atom != kSEXP_SIG_VAL ||
+      !reader.Open() || !reader.Atom(&atom) || atom != algo) {
+    LOG("GPG: Not a %s signature value\n", algo.c_str());
+    return false;
+  }
+
+  values->assign(names.size(), std::string());
+  std::vector<bool> seen(names.size(), false);
+  while (reader.AtOpen()) {
+    std::string name;
+    std::string value;
+    if (!reader.Open() || !reader.Atom(&name)) {
+      return false;
+    }
+    if (!reader.AtOpen() && !reader.AtClose() && !reader.Atom(&value)) {
+      return false;
+    }
+    if (!reader.SkipList()) {
+      return false;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+      if (names[i] == name) {
+        (*values)[i] = value;
+        seen[i] = true;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < names.size(); i++) {
+    if (!seen[i]) {
+      LOG("GPG: Signature value lacks \"%s\"\n", names[i].c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Read the packet at |*pos| in |packets| and move |*pos| past it. The body
+ * of a packet with partial lengths is put together from its parts. Returns
+ * false at the end of |packets|, or if the packet is cut short.
+ */
+template <class String>
+static bool NextPacket(const String &packets, size_t *pos, int *tag,
+                       String *body) {
+  size_t size = packets.size();
+  size_t p = *pos;
+  if (p >= size) {
+    return false;
+  }
+  unsigned char ctb = static_cast<unsigned char>(packets[p++]);
+  if (!(ctb & 0x80)) {
+    return false;
+  }
+
+  body->clear();
+  if (ctb & 0x40) {
+    *tag = ctb & 0x3f;
+    bool partial = true;
+    while (partial) {
+      if (p >= size) {
+        return false;
+      }
+      unsigned char first = static_cast<unsigned char>(packets[p++]);
+      size_t length;
+      partial = false;
+      if (first < 192) {
+        length = first;
+      } else if (first < 224) {
+        if (p >= size) {
+          return false;
+        }
+        length = ((first - 192) << 8) +
+                 static_cast<unsigned char>(packets[p++]) + 192;
+      } else if (first == 255) {
+        if (size - p < 4) {
+          return false;
+        }
+        length = 0;
+        for (int i = 0; i < 4; i++) {
+          length = length << 8 | static_cast<unsigned char>(packets[p++]);
+        }
+      } else {
+        length = static_cast<size_t>(1) << (first & 0x1f);
+        partial = true;
+      }
+      if (size - p < length) {
+        return false;
+      }
+      body->append(packets, p, length);
+      p += length;
+    }
+  } else {
+    *tag = (ctb >> 2) & 0xf;
+    size_t length;
+    if ((ctb & 3) == 3) {
+      /* Indeterminate, i.e. up to the end. */
+      length = size - p;
+    } else {
+      size_t octets = static_cast<size_t>(1) << (ctb & 3);
+      if (size - p < octets) {
+        return false;
+      }
+      length = 0;
+      for (size_t i = 0; i < octets; i++) {
+        length = length << 8 | static_cast<unsigned char>(packets[p++]);
+      }
+    }
+    if (size - p < length) {
+      return false;
+    }
+    body->append(packets, p, length);
+    p += length;
+  }
+  *pos = p;
+  return true;
+}
+
+static bool ReadMpi(const std::string &body, size_t *pos, std::string *value) {
+  if (body.size() - *pos < 2) {
+    return false;
+  }
+  size_t bits = static_cast<unsigned char>(body[*pos]) << 8 |
+                static_cast<unsigned char>(body[*pos + 1]);
+  size_t bytes = (bits + 7) / 8;
+  if (body.size() - *pos - 2 < bytes) {
+    return false;
+  }
+  value->assign(body, *pos + 2, bytes);
+  *pos += 2 + bytes;
+  return true;
+}
+
+static std::string HexEncode(const std::string &bytes) {
+  static const char kHEX_DIGITS[] = "0123456789ABCDEF";
+  std::string hex;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(bytes[i]);
+    hex.push_back(kHEX_DIGITS[c >> 4]);
+    hex.push_back(kHEX_DIGITS[c & 0xf]);
+  }
+  return hex;
+}
+
+/* The key size of a symmetric algorithm we can decrypt with, or 0. */
+static size_t CipherKeySize(int cipher_algo) {
+  switch (cipher_algo) {
+    case kCIPHER_AES128:
+      return 16;
+    case kCIPHER_AES192:
+      return 24;
+    case kCIPHER_AES256:
+      return 32;
+    default:
+      return 0;
+  }
+}
+
+bool ParseDecryptionKey(const std::string &listing, const std::string &keyid,
+                        DecryptionKey *key) {
+  std::istringstream lines(listing);
+  std::string line;
+  std::vector<std::string> fields;
+  bool found = false;
+  bool in_key = false;
+  std::string capabilities;
+  std::string token;
+  DecryptionKey candidate;
+
+  while (getline(lines, line)) {
+    SplitFields(line, &fields);
+    const std::string &type = fields[kFIELD_TYPE];
+    if (type == "sec" || type == "ssb") {
+      in_key = !found && Field(fields, kFIELD_KEYID) == keyid;
+      if (in_key) {
+        found = true;
+        candidate.keyid = keyid;
+        candidate.algo = atoi(Field(fields, kFIELD_ALGO).c_str());
+        capabilities = Field(fields, kFIELD_CAPABILITIES);
+        token = Field(fields, kFIELD_TOKEN);
+      }
+    } else if (in_key && type == "fpr" && candidate.fingerprint.empty()) {
+      candidate.fingerprint = Field(fields, kFIELD_USER_ID);
+    } else if (in_key && type == "grp" && candidate.keygrip.empty()) {
+      candidate.keygrip = Field(fields, kFIELD_USER_ID);
+    } else if (in_key && type == "pkd") {
+      const std::string &index = Field(fields, kFIELD_KEY_DATA_INDEX);
+      const std::string &value = Field(fields, kFIELD_KEY_DATA);
+      if (index == "0") {
+        HexDecode(value, &candidate.curve);
+      } else if (index == "2") {
+        HexDecode(value, &candidate.kdf_params);
+      }
+    }
+  }
+
+  if (!found) {
+    LOG("GPG: No secret key %s\n", keyid.c_str());
+    return false;
+  }
+  /* "#" means that only a stub of the secret key is there. */
+  if (capabilities.find('e') == std::string::npos || token == "#") {
+    LOG("GPG: Key %s can't decrypt here\n", keyid.c_str());
+    return false;
+  }
+  if (candidate.fingerprint.size() != 40 || candidate.keygrip.size() != 40) {
+    LOG("GPG: No v4 fingerprint or keygrip for %s\n", keyid.c_str());
+    return false;
+  }
+  switch (candidate.algo) {
+    case kPUBKEY_RSA:
+    case kPUBKEY_RSA_ENCRYPT:
+      candidate.curve.clear();
+      candidate.kdf_params.clear();
+      break;
+    case kPUBKEY_ECDH:
+      /* The length, a reserved 1, and the KDF's hash and KEK algorithms. */
+      if (!candidate.curve.empty() && candidate.kdf_params.size() == 4 &&
+          candidate.kdf_params[0] == 3 && candidate.kdf_params[1] == 1 &&
+          candidate.kdf_params[2] == kHASH_SHA256 &&
+          CipherKeySize(candidate.kdf_params[3]) != 0) {
+        break;
+      }
+      /* Fall through. */
+    default:
+      LOG("GPG: Can't decrypt with algorithm %d\n", candidate.algo);
+      return false;
+  }
+
+  *key = candidate;
+  return true;
+}
+
+bool EncryptedMessage::Parse(const std::string &packets) {
+  size_t pos = 0;
+  int tag;
+  std::string body;
+
+  session_keys_.clear();
+  data_.clear();
+  while (NextPacket(packets, &pos, &tag, &body)) {
+    if (tag == kPACKET_MARKER) {
+      continue;
+    }
+    if (tag == kPACKET_SESSION_KEY) {
+      if (body.size() < 10 || body[0] != kSESSION_KEY_VERSION) {
+        break;
+      }
+      EncryptedSessionKey session_key;
+      session_key.keyid = HexEncode(body.substr(1, 8));
+      session_key.algo = static_cast<unsigned char>(body[9]);
+      size_t field = 10;
+      std::string value;
+      if (session_key.algo == kPUBKEY_RSA ||
+          session_key.algo == kPUBKEY_RSA_ENCRYPT) {
+        if (!ReadMpi(body, &field, &value)) {
+          break;
+        }
+        session_key.values.push_back(value);
+      } else if (session_key.algo == kPUBKEY_ECDH) {
+        if (!ReadMpi(body, &field, &value) || field >= body.size()) {
+          break;
+        }
+        session_key.values.push_back(value);
+        size_t wrapped = static_cast<unsigned char>(body[field]);
+        if (body.size() - field - 1 < wrapped) {
+          break;
+        }
+        session_key.values.push_back(body.substr(field + 1, wrapped));
+      }
+      session_keys_.push_back(session_key);
+      continue;
+    }
+    if (tag == kPACKET_ENCRYPTED_MDC && !session_keys_.empty() &&
+        pos == packets.size() && !body.empty() &&
+        body[0] == kENCRYPTED_MDC_VERSION) {
+      data_.assign(body, 1, std::string::npos);
+      return true;
+    }
+    break;
+  }
+
+  LOG("GPG: Not a public key encrypted message with an MDC\n");
+  session_keys_.clear();
+  return false;
+}
+
+/* Append |atom| to the canonical S-expression |sexp|. */
+static void AppendAtom(const std::string &atom, std::string *sexp) {
+  std::ostringstream length;
+  length << atom.size() << ':';
+  sexp->append(length.str());
+  sexp->append(atom);
+}
+
+/* An MPI value as Libgcrypt prints it, with a leading 0 if it looks negative. */
+static std::string SignedValue(const std::string &value) {
+  if (!value.empty() && (static_cast<unsigned char>(value[0]) & 0x80)) {
+    return std::string(1, '\0') + value;
+  }
+  return value;
+}
+
+std::string EncryptedMessage::EncVal(const EncryptedSessionKey &session_key) {
+  std::string enc_val("(7:enc-val(");
+  if (session_key.algo == kPUBKEY_ECDH && session_key.values.size() == 2) {
+    /* The agent only needs the point, but gpg sends the wrapped key too. */
+    const std::string &wrapped = session_key.values[1];
+    AppendAtom(kSEXP_ECDH, &enc_val);
+    enc_val.append("(1:s");
+    AppendAtom(std::string(1, static_cast<char>(wrapped.size())) + wrapped,
+               &enc_val);
+    enc_val.append(")(1:e");
+    AppendAtom(SignedValue(session_key.values[0]), &enc_val);
+  } else if ((session_key.algo == kPUBKEY_RSA ||
+              session_key.algo == kPUBKEY_RSA_ENCRYPT) &&
+             session_key.values.size() == 1) {
+    AppendAtom(kSEXP_RSA, &enc_val);
+    enc_val.append("(1:a");
+    AppendAtom(SignedValue(session_key.values[0]), &enc_val);
+  } else {
+    return std::string();
+  }
+  enc_val.append(")))");
+  return enc_val;
+}
+
+/*
+ * Take the symmetric key out of |frame|, which is its algorithm, the key and
+ * a checksum of it (RFC 4880, section 5.1).
+ */
+static bool SplitSessionKey(const SecureString &frame, int *cipher_algo,
+                            SecureString *symmetric_key) {
+  if (frame.empty()) {
+    return false;
+  }
+  int algo = static_cast<unsigned char>(frame[0]);
+  size_t key_size = CipherKeySize(algo);
+  if (key_size == 0 || frame.size() != 1 + key_size + 2) {
+    LOG("GPG: Can't decrypt data with algorithm %d\n", algo);
+    return false;
+  }
+  unsigned int sum = 0;
+  for (size_t i = 1; i <= key_size; i++) {
+    sum += static_cast<unsigned char>(frame[i]);
+  }
+  unsigned int checksum = static_cast<unsigned char>(frame[key_size + 1]) << 8 |
+                          static_cast<unsigned char>(frame[key_size + 2]);
+  if ((sum & 0xffff) != checksum) {
+    LOG("GPG: Bad session key checksum\n");
+    return false;
+  }
+  *cipher_algo = algo;
+  symmetric_key->assign(frame, 1, key_size);
+  return true;
+}
+
+/*
+ * Take the PKCS #1 v1.5 padding off an RSA session key, unless the agent
+ * already has: it says so with a PADDING status, but a padded frame can't
+ * be mistaken for a bare one since those start with the algorithm. The
+ * leading 0 is lost when the frame is handled as a number.
+ */
+static bool Unpad(const std::string &value, SecureString *frame) {
+  size_t start = 0;
+  if (start < value.size() && value[start] == 0) {
+    start++;
+  }
+  if (start < value.size() && value[start] == 2) {
+    start = value.find('\0', start + 1);
+    if (start == std::string::npos) {
+      return false;
+    }
+    start++;
+  }
+  frame->assign(value.data() + start, value.size() - start);
+  return true;
+}
+
+/*
+ * Unwrap the session key of ECDH (RFC 6637, sections 7 and 8) with a key
+ * derived from the x coordinate of |shared|, which the agent computed.
+ * Curve25519 points are a 0x40 octet and x, others are uncompressed.
+ */
+static bool EcdhUnwrap(const DecryptionKey &key, const std::string &shared,
+                       const std::string &wrapped, SecureString *frame) {
+  size_t x_size;
+  if (shared.size() > 1 && shared[0] == 0x40) {
+    x_size = shared.size() - 1;
+  } else if (shared.size() > 1 && shared[0] == 0x04 &&
+             shared.size() % 2 == 1) {
+    x_size = (shared.size() - 1) / 2;
+  } else {
+    LOG("GPG: Unexpected shared point from agent\n");
+    return false;
+  }
+
+  std::string fingerprint;
+  HexDecode(key.fingerprint, &fingerprint);
+  std::string param(key.curve);
+  param.push_back(static_cast<char>(kPUBKEY_ECDH));
+  param.append(key.kdf_params);
+  param.append(kKDF_SENDER, sizeof kKDF_SENDER - 1);
+  param.append(fingerprint);
+
+  Sha256 sha;
+  sha.Update("\0\0\0\1", 4);
+  sha.Update(shared.data() + 1, x_size);
+  sha.Update(param);
+  std::string kek = sha.Final();
+  bool unwrapped;
+  {
+    Aes aes(kek.data(), CipherKeySize(key.kdf_params[3]));
+    unwrapped = aes.Unwrap(wrapped, frame);
+  }
+  WipeString(&kek);
+  if (!unwrapped) {
+    LOG("GPG: Couldn't unwrap the session key\n");
+    return false;
+  }
+
+  /* The frame is padded to eight octets like in PKCS #5. */
+  size_t padding = frame->empty() ? 0 :
+                   static_cast<unsigned char>((*frame)[frame->size() - 1]);
+  if (padding == 0 || padding > frame->size()) {
+    return false;
+  }
+  for (size_t i = frame->size() - padding; i < frame->size(); i++) {
+    if (static_cast<unsigned char>((*frame)[i]) != padding) {
+      return false;
+    }
+  }
+  frame->resize(frame->size() - padding);
+  return true;
+}
+
+bool EncryptedMessage::SessionKey(const DecryptionKey &key,
+                                  const EncryptedSessionKey &session_key,
+                                  const std::string &value,
+                                  int *cipher_algo,
+                                  SecureString *symmetric_key) {
+  /* The agent ends the S-expression with a 0 octet, which is left alone. */
+  SexpReader reader(value);
+  std::string atom;
+  std::string decrypted;
+  if (!reader.Open() || !reader.Atom(&atom) || atom != kSEXP_VALUE ||
+      !reader.Atom(&decrypted) || !reader.Close()) {
+    LOG("GPG: Not a decrypted value\n");
+    WipeString(&decrypted);
+    return false;
+  }
+
+  SecureString frame;
+  bool ok;
+  if (key.algo == kPUBKEY_ECDH) {
+    ok = session_key.algo == kPUBKEY_ECDH &&
+         session_key.values.size() == 2 &&
+         EcdhUnwrap(key, decrypted, session_key.values[1], &frame);
+  } else {
+    ok = session_key.algo != kPUBKEY_ECDH && Unpad(decrypted, &frame);
+  }
+  WipeString(&decrypted);
+  return ok && SplitSessionKey(frame, cipher_algo, symmetric_key);
+}
+
+#ifndef OS_WINDOWS
+/* Room for the size of the block in front of what zlib gets. */
+static const size_t kZALLOC_HEADER = 16;
+static const size_t kINFLATE_CHUNK = 64 * 1024;
+/*
+ * A few KB of compressed data can hold GBs of plain text, which is left to
+ * gpg to uncompress in a process of its own: anything that grows by more than
+ * kINFLATE_RATIO, past kINFLATE_MIN, or at all past kINFLATE_MAX.
+ */
+static const size_t kINFLATE_RATIO = 64;
+static const size_t kINFLATE_MIN = 1024 * 1024;
+static const size_t kINFLATE_MAX = 64 * 1024 * 1024;
+
+/* zlib's window holds pieces of the plain text too. */
+static voidpf SecureZalloc(voidpf /* opaque */, uInt items, uInt size) {
+  size_t total = static_cast<size_t>(items) * size + kZALLOC_HEADER;
+  char *block = static_cast<char *>(GpgSecurePool::Allocate(total));
+  if (block == NULL) {
+    return Z_NULL;
+  }
+  std::memcpy(block, &total, sizeof total);
+  return block + kZALLOC_HEADER;
+}
+
+static void SecureZfree(voidpf /* opaque */, voidpf address) {
+  char *block = static_cast<char *>(address) - kZALLOC_HEADER;
+  size_t total;
+  std::memcpy(&total, block, sizeof total);
+  GpgSecurePool::Release(block, total);
+}
+#endif
+
+/*
+ * Uncompress the body of a compressed data packet, unless it's too large (see
+ * kINFLATE_RATIO). BZip2 isn't supported, and neither is anything on Windows,
+ * where the plugin has no zlib.
+ */
+static bool Decompress(const SecureString &body, SecureString *packets) {
+#ifdef OS_WINDOWS
+  return false;
+#else
+  if (body.empty()) {
+    return false;
+  }
+  int algo = static_cast<unsigned char>(body[0]);
+  z_stream stream;
+  std::memset(&stream, 0, sizeof stream);
+  stream.zalloc = SecureZalloc;
+  stream.zfree = SecureZfree;
+  int ret;
+  if (algo == kCOMPRESS_ZIP) {
+    ret = inflateInit2(&stream, -MAX_WBITS);
+  } else if (algo == kCOMPRESS_ZLIB) {
+    ret = inflateInit(&stream);
+  } else {
+    LOG("GPG: Can't uncompress algorithm %d\n", algo);
+    return false;
+  }
+  if (ret != Z_OK) {
+    return false;
+  }
+
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(
+      body.data() + 1));
+  stream.avail_in = static_cast<uInt>(body.size() - 1);
+  size_t limit = body.size() < kINFLATE_MAX / kINFLATE_RATIO ?
+      body.size() * kINFLATE_RATIO : kINFLATE_MAX;
+  if (limit < kINFLATE_MIN) {
+    limit = kINFLATE_MIN;
+  }
+  packets->clear();
+  do {
+    size_t used = packets->size();
+    if (used >= limit) {
+      break;
+    }
+    size_t chunk = limit - used < kINFLATE_CHUNK ? limit - used
+                                                 : kINFLATE_CHUNK;
+    packets->resize(used + chunk);
+    stream.next_out = reinterpret_cast<Bytef *>(&(*packets)[used]);
+    stream.avail_out = static_cast<uInt>(chunk);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    packets->resize(used + chunk - stream.avail_out);
+  } while (ret == Z_OK);
+  inflateEnd(&stream);
+  if (ret == Z_OK) {
+    LOG("GPG: Compressed data uncompresses to more than %u bytes\n",
+        static_cast<unsigned int>(limit));
+    return false;
+  }
+  if (ret != Z_STREAM_END) {
+    LOG("GPG: Bad compressed data (%d)\n", ret);
+    return false;
+  }
+  return true;
+#endif
+}
+
+/*
+ * Get the data of the one literal data packet that |packets| are, possibly
+ * inside a compressed data packet if |compressed| is allowed.
+ */
+static bool LiteralData(const SecureString &packets, bool compressed,
+                        SecureString *plain_text) {
+  size_t pos = 0;
+  int tag;
+  SecureString body;
+  if (!NextPacket(packets, &pos, &tag, &body) || pos != packets.size()) {
+    LOG("GPG: Decrypted data isn't a single packet\n");
+    return false;
+  }
+  if (tag == kPACKET_COMPRESSED && compressed) {
+    SecureString uncompressed;
+    return Decompress(body, &uncompressed) &&
+           LiteralData(uncompressed, false, plain_text);
+  }
+  if (tag != kPACKET_LITERAL) {
+    LOG("GPG: Decrypted data is a packet of type %d\n", tag);
+    return false;
+  }
+
+  /* The format, the file name and the date come before the data. */
+  if (body.size() < 2) {
+    return false;
+  }
+  size_t header = 2 + static_cast<unsigned char>(body[1]) + 4;
+  if (body.size() < header) {
+    return false;
+  }
+  plain_text->assign(body, header, SecureString::npos);
+  return true;
+}
+
+bool EncryptedMessage::Decrypt(int cipher_algo,
+                               const SecureString &symmetric_key,
+                               SecureString *plain_text) const {
+  static const size_t kBLOCK = Aes::kBlockSize;
+  /* The MDC packet: its header and a SHA-1 digest. */
+  static const size_t kMDC_SIZE = 2 + Sha1::kDigestSize;
+
+  size_t key_size = CipherKeySize(cipher_algo);
+  if (key_size == 0 || symmetric_key.size() != key_size ||
+      data_.size() < kBLOCK + 2 + kMDC_SIZE) {
+    return false;
+  }
+
+  /* CFB mode with an all zero IV and random data in the first block. */
+  SecureString decrypted(data_.size(), '\0');
+  {
+    Aes aes(symmetric_key.data(), symmetric_key.size());
+    unsigned char feedback[kBLOCK];
+    unsigned char mask[kBLOCK];
+    std::memset(feedback, 0, sizeof feedback);
+    for (size_t i = 0; i < data_.size(); i += kBLOCK) {
+      size_t n = data_.size() - i < kBLOCK ? data_.size() - i : kBLOCK;
+      aes.EncryptBlock(feedback, mask);
+      for (size_t j = 0; j < n; j++) {
+        decrypted[i + j] = static_cast<char>(data_[i + j] ^ mask[j]);
+      }
+      std::memcpy(feedback, data_.data() + i, n);
+    }
+    SecureZero(mask, sizeof mask);
+  }
+
+  /* The random block's last two octets are repeated. */
+  if (decrypted[kBLOCK - 2] != decrypted[kBLOCK] ||
+      decrypted[kBLOCK - 1] != decrypted[kBLOCK + 1]) {
+    LOG("GPG: Wrong session key\n");
+    return false;
+  }
+  size_t mdc = decrypted.size() - kMDC_SIZE;
+  Sha1 sha;
+  sha.Update(decrypted.data(), mdc + 2);
+  std::string digest = sha.Final();
+  if (static_cast<unsigned char>(decrypted[mdc]) !=
+          (0xc0 | kPACKET_MDC) ||
+      static_cast<unsigned char>(decrypted[mdc + 1]) != Sha1::kDigestSize ||
+      decrypted.compare(mdc + 2, Sha1::kDigestSize, digest.data(),
+                        digest.size()) != 0) {
+    LOG("GPG: Decrypted data fails its modification detection code\n");
+    return false;
+  }
+
+  SecureString packets(decrypted, kBLOCK + 2, mdc - kBLOCK - 2);
+  return LiteralData(packets, true, plain_text);
+}
+
+std::string Mpi(const std::string &value) {
+  std::string::size_type start = value.find_first_not_of('\0');
+  std::string mpi;
+
+  if (start == std::string::npos) {
+    AppendUint16(0, &mpi);
+    return mpi;
+  }
+
+  unsigned char top = static_cast<unsigned char>(value[start]);
+  size_t bits = (value.size() - start - 1) * 8;
+  while (top != 0) {
+    bits++;
+    top >>= 1;
+  }
+  AppendUint16(bits, &mpi);
+  mpi.append(value, start, std::string::npos);
+  return mpi;
+}
+
+static int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+bool HexDecode(const std::string &hex, std::string *bytes) {
+  if (hex.size() % 2) {
+    return false;
+  }
+  bytes->clear();
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    int high = HexValue(hex[i]);
+    int low = HexValue(hex[i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    bytes->push_back(static_cast<char>(high << 4 | low));
+  }
+  return true;
+}
+
+}  // namespace openpgp
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Just enough OpenPGP (RFC 4880) to put together a detached signature around
+ * a signature value made by gpg-agent, and to decrypt a message whose session
+ * key gpg-agent has decrypted, so that neither needs a gpg process once the
+ * key is known.
+ */
+
+#ifndef _GPGPLUGIN_OPENPGP_H_
+#define _GPGPLUGIN_OPENPGP_H_
+
+#include <prtypes.h>
+
+#include <string>
+#include <vector>
+
+#include "securemem.h"
+
+namespace openpgp {
+
+/* Public key algorithms (RFC 4880, section 9.1). */
+static const int kPUBKEY_RSA = 1;
+static const int kPUBKEY_RSA_ENCRYPT = 2;
+static const int kPUBKEY_RSA_SIGN = 3;
+static const int kPUBKEY_ECDH = 18;
+static const int kPUBKEY_EDDSA = 22;
+
+/* Symmetric key algorithms (RFC 4880, section 9.2). */
+static const int kCIPHER_AES128 = 7;
+static const int kCIPHER_AES192 = 8;
+static const int kCIPHER_AES256 = 9;
+
+/* Hash algorithms (RFC 4880, section 9.4). */
+static const int kHASH_SHA256 = 8;
+
+/*
+ * The key gpg would sign with, as found in its --with-colons listing.
+ * |keyid|, |fingerprint| and |keygrip| are upper case hex.
+ */
+struct SigningKey {
+  SigningKey() : algo(0) {}
+
+  std::string keyid;
+  std::string fingerprint;
+  std::string keygrip;
+  int algo;
+};
+
+/*
+ * Find the key that 'gpg --local-user <keyid> --detach-sign' would use in
+ * the output of 'gpg --with-colons --with-keygrip --list-secret-keys <keyid>',
+ * which is the newest usable signing (sub)key. Lines that aren't key listing
+ * records, such as status lines, are skipped.
+ *
+ * Returns false if there isn't exactly one matching key, if it has no usable
+ * signing key, or if that key is of a kind we can't build signatures for.
+ */
+bool ParseSigningKey(const std::string &listing, SigningKey *key);
+
+/*
+ * Builds a v4 binary document signature (type 0x00) with a SHA-256 digest,
+ * hashed creation time and issuer fingerprint subpackets and an unhashed
+ * issuer subpacket, like gpg makes by default.
+ */
+class SignatureBuilder {
+ public:
+  SignatureBuilder(const SigningKey &key, PRUint32 created);
+
+  /*
+   * The digest over |data| and the signature's hashed part, which is what
+   * the private key has to sign.
+   */
+  std::string Digest(const std::string &data);
+
+  /*
+   * Make the signature packet from |sig_val|, the canonical S-expression
+   * gpg-agent returns for PKSIGN on Digest(). Returns false if |sig_val|
+   * doesn't hold what the key's algorithm needs.
+   */
+  bool Packet(const std::string &sig_val, std::string *packet) const;
+
+ private:
+  SigningKey key_;
+  std::string hashed_;
+  std::string digest_;
+};
+
+/*
+ * The key gpg would decrypt a session key for |keyid| with, as found in its
+ * --with-colons listing. |curve| and |kdf_params| are only set for ECDH keys,
+ * as they are in the public key packet (each with its length octet).
+ */
+struct DecryptionKey {
+  DecryptionKey() : algo(0) {}
+
+  std::string keyid;
+  std::string fingerprint;
+  std::string keygrip;
+  int algo;
+  std::string curve;
+  std::string kdf_params;
+};
+
+/*
+ * Find the (sub)key |keyid| in the output of 'gpg --with-colons
+ * --with-keygrip --with-key-data --list-secret-keys <keyid>'. Expired and
+ * revoked keys still decrypt, like with gpg.
+ *
+ * Returns false if the key isn't there, only has a stub of its secret part
+ * (e.g. on a smartcard), or is of a kind we can't decrypt with: RSA, and
+ * ECDH with a SHA-256 key derivation and AES key wrapping, are supported.
+ */
+bool ParseDecryptionKey(const std::string &listing, const std::string &keyid,
+                        DecryptionKey *key);
+
+/*
+ * A public key encrypted session key packet. |keyid| is upper case hex, and
+ * all zeros for a hidden recipient. |values| are the algorithm's fields,
+ * MPIs as their big endian value: "m**e mod n" for RSA, the ephemeral point
+ * and the wrapped key for ECDH.
+ */
+struct EncryptedSessionKey {
+  EncryptedSessionKey() : algo(0) {}
+
+  std::string keyid;
+  int algo;
+  std::vector<std::string> values;
+};
+
+/*
+ * What gpg --encrypt makes: public key encrypted session keys, followed by
+ * the symmetrically encrypted and integrity protected data. Messages with
+ * other packets, such as passphrase encrypted session keys or data without
+ * a modification detection code, are left to gpg.
+ */
+class EncryptedMessage {
+ public:
+  /* Returns false if |packets| isn't a message of this kind. */
+  bool Parse(const std::string &packets);
+
+  const std::vector<EncryptedSessionKey> &session_keys() const {
+    return session_keys_;
+  }
+
+  /*
+   * The "(enc-val ...)" canonical S-expression that gpg-agent's PKDECRYPT
+   * takes for |session_key|, or an empty string for an algorithm other than
+   * RSA or ECDH.
+   */
+  static std::string EncVal(const EncryptedSessionKey &session_key);
+
+  /*
+   * Get the symmetric key of |session_key| from |value|, the "(value ...)"
+   * S-expression that gpg-agent returns for EncVal() when decrypting with
+   * |key|: the padded key itself for RSA, the shared point for ECDH.
+   */
+  static bool SessionKey(const DecryptionKey &key,
+                         const EncryptedSessionKey &session_key,
+                         const std::string &value,
+                         int *cipher_algo, SecureString *symmetric_key);
+
+  /*
+   * Decrypt the data with |symmetric_key|, check its modification detection
+   * code, and get the contents of the literal data packet in it, which may
+   * be compressed. Returns false if the data doesn't check out, or if it
+   * holds anything else, such as a signature that gpg would verify.
+   */
+  bool Decrypt(int cipher_algo, const SecureString &symmetric_key,
+               SecureString *plain_text) const;
+
+ private:
+  std::vector<EncryptedSessionKey> session_keys_;
+  /* The encrypted data, after the packet's version number. */
+  std::string data_;
+};
+
+/*
+ * Get the values of the parameters |names| from the signature value
+ * |sig_val|, e.g. "(7:sig-val(3:rsa(1:s3:...)))". Returns false if |sig_val|
+ * isn't an |algo| signature value or lacks one of the parameters.
+ */
+bool ParseSigVal(const std::string &sig_val,
+                 const std::string &algo,
+                 const std::vector<std::string> &names,
+                 std::vector<std::string> *values);
+
+/*
+ * Encode the big endian unsigned integer |value| as an OpenPGP MPI.
+ */
+std::string Mpi(const std::string &value);
+
+/*
+ * Turn hex into bytes. Returns false on odd lengths or non-hex characters.
+ */
+bool HexDecode(const std::string &hex, std::string *bytes);
+
+}  // namespace openpgp
+
+#endif  // _GPGPLUGIN_OPENPGP_H_
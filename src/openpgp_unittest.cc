@@ -0,0 +1,717 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "aes.h"
+#include "armor.h"
+#include "openpgp.h"
+#include "securemem.h"
+#include "sha1.h"
+#include "sha256.h"
+
+namespace {
+
+std::string Hex(const std::string &bytes) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string hex;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(bytes[i]);
+    hex.push_back(kDigits[c >> 4]);
+    hex.push_back(kDigits[c & 0xf]);
+  }
+  return hex;
+}
+
+std::string Bytes(const std::string &hex) {
+  std::string bytes;
+  EXPECT_TRUE(openpgp::HexDecode(hex, &bytes));
+  return bytes;
+}
+
+/* Examples from FIPS 180-4. */
+TEST(Sha256Test, MatchesTestVectors) {
+  Sha256 abc;
+  abc.Update("abc");
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            Hex(abc.Final()));
+
+  Sha256 two_blocks;
+  two_blocks.Update(
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq");
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            Hex(two_blocks.Final()));
+
+  Sha256 empty;
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            Hex(empty.Final()));
+}
+
+TEST(Sha256Test, SplitUpdatesGiveSameDigest) {
+  std::string data(1000, 'a');
+  Sha256 whole;
+  whole.Update(data);
+
+  Sha256 pieces;
+  for (size_t i = 0; i < data.size(); i += 7) {
+    pieces.Update(data.substr(i, 7));
+  }
+  EXPECT_EQ(Hex(whole.Final()), Hex(pieces.Final()));
+}
+
+TEST(Sha1Test, MatchesTestVectors) {
+  Sha1 abc;
+  abc.Update("abc");
+  EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d", Hex(abc.Final()));
+
+  Sha1 two_blocks;
+  two_blocks.Update(
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq");
+  EXPECT_EQ("84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+            Hex(two_blocks.Final()));
+
+  Sha1 empty;
+  EXPECT_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709", Hex(empty.Final()));
+}
+
+/* Examples from FIPS 197, appendix C. */
+TEST(AesTest, MatchesTestVectors) {
+  const char *const keys[] = {
+    "000102030405060708090a0b0c0d0e0f",
+    "000102030405060708090a0b0c0d0e0f1011121314151617",
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+  };
+  const char *const cipher_texts[] = {
+    "69c4e0d86a7b0430d8cdb78070b4c55a",
+    "dda97ca4864cdfe06eaf70a0ec0d7191",
+    "8ea2b7ca516745bfeafc49904b496089",
+  };
+  std::string plain_text = Bytes("00112233445566778899aabbccddeeff");
+  for (size_t i = 0; i < 3; i++) {
+    std::string key = Bytes(keys[i]);
+    Aes aes(key.data(), key.size());
+    ASSERT_TRUE(aes.valid());
+    unsigned char block[Aes::kBlockSize];
+    aes.EncryptBlock(reinterpret_cast<const unsigned char *>(
+        plain_text.data()), block);
+    EXPECT_EQ(cipher_texts[i],
+              Hex(std::string(reinterpret_cast<char *>(block), sizeof block)));
+    aes.DecryptBlock(block, block);
+    EXPECT_EQ(Hex(plain_text),
+              Hex(std::string(reinterpret_cast<char *>(block), sizeof block)));
+  }
+
+  EXPECT_FALSE(Aes("short", 5).valid());
+}
+
+/* The example from RFC 3394, section 4.1. */
+TEST(AesTest, UnwrapsKeys) {
+  std::string kek = Bytes("000102030405060708090a0b0c0d0e0f");
+  std::string wrapped = Bytes(
+      "1fa68b0a8112b447aef34bd8fb5a7b829d3e862371d2cfe5");
+  Aes aes(kek.data(), kek.size());
+  SecureString key;
+  ASSERT_TRUE(aes.Unwrap(wrapped, &key));
+  EXPECT_EQ("00112233445566778899aabbccddeeff",
+            Hex(std::string(key.data(), key.size())));
+
+  wrapped[20] ^= 1;
+  EXPECT_FALSE(aes.Unwrap(wrapped, &key));
+  EXPECT_TRUE(key.empty());
+  EXPECT_FALSE(aes.Unwrap(wrapped.substr(0, 20), &key));
+}
+
+TEST(ArmorTest, ComputesCrc24) {
+  EXPECT_EQ(0xb704ceu, Crc24("", 0));
+  EXPECT_EQ(0x21cf02u, Crc24("123456789", 9));
+}
+
+/* The CRC-24 a bit at a time, as in RFC 4880, section 6.1. */
+unsigned int BitwiseCrc24(const std::string &data) {
+  unsigned int crc = 0xb704ce;
+  for (size_t i = 0; i < data.size(); i++) {
+    crc ^= static_cast<unsigned char>(data[i]) << 16;
+    for (int bit = 0; bit < 8; bit++) {
+      crc <<= 1;
+      if (crc & 0x1000000)
+        crc ^= 0x1864cfb;
+    }
+  }
+  return crc & 0xffffff;
+}
+
+/* Four bytes are done at a time, with the rest a byte at a time. */
+TEST(ArmorTest, Crc24OfAnyLengthMatchesBitwise) {
+  std::string data;
+  for (int i = 0; i < 70; i++) {
+    data.push_back(static_cast<char>(i * 37 + 11));
+    EXPECT_EQ(BitwiseCrc24(data), Crc24(data.data(), data.size()));
+  }
+}
+
+/*
+ * A signature made by 'gpg --armor --detach-sign', which has to come out
+ * exactly as gpg armored it.
+ */
+TEST(ArmorTest, ArmorsLikeGpg) {
+  std::string packet = Bytes(
+      "888504001608002d162104012c0768c2b6e018df98874752f8d67e0dd41c8f0502"
+      "6ad35cda0f1c6564406578616d706c652e636f6d000a091052f8d67e0dd41c8ff8"
+      "3800fc0b3658f89853ddf1d27f2aec2cea19c1e7c2accf67a537d486299d787d34"
+      "df1000ff642e513bfdd1acc0f09bb86be32e65ca8365237c30bbfeb5921e94031c"
+      "8cdc0e");
+  EXPECT_EQ("-----BEGIN PGP SIGNATURE-----\n"
+            "\n"
+            "iIUEABYIAC0WIQQBLAdowrbgGN+Yh0dS+NZ+DdQcjwUCatNc2g8cZWRAZXhhbXBs\n"
+            "ZS5jb20ACgkQUvjWfg3UHI/4OAD8CzZY+JhT3fHSfyrsLOoZwefCrM9npTfUhimd\n"
+            "eH003xAA/2QuUTv90azA8Ju4a+MuZcqDZSN8MLv+tZIelAMcjNwO\n"
+            "=YdGC\n"
+            "-----END PGP SIGNATURE-----\n",
+            Armor("SIGNATURE", packet));
+}
+
+TEST(ArmorTest, DearmorsWhatItArmors) {
+  std::string packets;
+  for (int size = 0; size < 100; size++) {
+    std::string armored = Armor("MESSAGE", packets);
+    std::string dearmored = "left over";
+    ASSERT_TRUE(Dearmor(armored, "MESSAGE", &dearmored)) << size;
+    EXPECT_EQ(Hex(packets), Hex(dearmored));
+    packets.push_back(static_cast<char>(size * 251));
+  }
+}
+
+/*
+ * Armor as gpg 1.4 writes it, with a header, and as it comes back from a
+ * mail, with line ends of CRLF and text around it.
+ */
+TEST(ArmorTest, DearmorsGpgArmor) {
+  std::string packet = Bytes(
+      "888504001608002d162104012c0768c2b6e018df98874752f8d67e0dd41c8f0502"
+      "6ad35cda0f1c6564406578616d706c652e636f6d000a091052f8d67e0dd41c8ff8"
+      "3800fc0b3658f89853ddf1d27f2aec2cea19c1e7c2accf67a537d486299d787d34"
+      "df1000ff642e513bfdd1acc0f09bb86be32e65ca8365237c30bbfeb5921e94031c"
+      "8cdc0e");
+  std::string signature;
+  EXPECT_TRUE(Dearmor(
+      "> quoted -----BEGIN PGP SIGNATURE-----\r\n"
+      "-----BEGIN PGP SIGNATURE-----\r\n"
+      "Version: GnuPG v1.4.11 (GNU/Linux)\r\n"
+      "\r\n"
+      "iIUEABYIAC0WIQQBLAdowrbgGN+Yh0dS+NZ+DdQcjwUCatNc2g8cZWRAZXhhbXBs\r\n"
+      "ZS5jb20ACgkQUvjWfg3UHI/4OAD8CzZY+JhT3fHSfyrsLOoZwefCrM9npTfUhimd\r\n"
+      "eH003xAA/2QuUTv90azA8Ju4a+MuZcqDZSN8MLv+tZIelAMcjNwO\r\n"
+      "=YdGC\r\n"
+      "-----END PGP SIGNATURE-----\r\n"
+      "Sent from my phone\r\n",
+      "SIGNATURE", &signature));
+  EXPECT_EQ(Hex(packet), Hex(signature));
+}
+
+TEST(ArmorTest, RejectsBadArmor) {
+  std::string armored = Armor("MESSAGE", "some packets");
+  std::string packets;
+  ASSERT_TRUE(Dearmor(armored, "MESSAGE", &packets));
+
+  EXPECT_FALSE(Dearmor("some packets", "MESSAGE", &packets));
+  EXPECT_FALSE(Dearmor(armored, "SIGNATURE", &packets));
+
+  /* Checksum. */
+  std::string bad = armored;
+  bad[bad.find("\n=") + 2] ^= 1;
+  EXPECT_FALSE(Dearmor(bad, "MESSAGE", &packets));
+
+  /* Data. */
+  bad = armored;
+  bad[bad.find("\n\n") + 2] ^= 1;
+  EXPECT_FALSE(Dearmor(bad, "MESSAGE", &packets));
+  bad = armored;
+  bad[bad.find("\n\n") + 2] = '!';
+  EXPECT_FALSE(Dearmor(bad, "MESSAGE", &packets));
+  bad = armored;
+  bad.erase(bad.find("\n\n") + 2, 1);
+  EXPECT_FALSE(Dearmor(bad, "MESSAGE", &packets));
+
+  /* Tail. */
+  EXPECT_FALSE(Dearmor(armored.substr(0, armored.find("-----END")),
+                       "MESSAGE", &packets));
+}
+
+const char kED25519_LISTING[] =
+    "sec:u:255:22:52F8D67E0DD41C8F:1792236759:1855308759::u:::scSC:::+::"
+    "ed25519:::0:\n"
+    "fpr:::::::::012C0768C2B6E018DF98874752F8D67E0DD41C8F:\n"
+    "grp:::::::::5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7:\n"
+    "uid:u::::1792236759::C648685D54D497B6C71F520BAB15540524CC54EF::"
+    "Ed <ed@example.com>::::::::::0:\n";
+
+TEST(OpenPgpParseSigningKeyTest, FindsPrimaryKey) {
+  openpgp::SigningKey key;
+  ASSERT_TRUE(openpgp::ParseSigningKey(
+      std::string("[GNUPG:] KEY_CONSIDERED 012C 0\n") + kED25519_LISTING,
+      &key));
+  EXPECT_EQ("52F8D67E0DD41C8F", key.keyid);
+  EXPECT_EQ("012C0768C2B6E018DF98874752F8D67E0DD41C8F", key.fingerprint);
+  EXPECT_EQ("5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7", key.keygrip);
+  EXPECT_EQ(openpgp::kPUBKEY_EDDSA, key.algo);
+}
+
+/*
+ * Like gpg, use the newest signing subkey that isn't revoked or expired.
+ */
+TEST(OpenPgpParseSigningKeyTest, PrefersNewestUsableSubkey) {
+  std::string listing =
+      "sec:u:2048:1:ADA6BD7EAFE07B0A:1000:::u:::scSC:::+:::23::0:\n"
+      "fpr:::::::::7C29E768810FD42874A3075FADA6BD7EAFE07B0A:\n"
+      "grp:::::::::1E30FE9718699140FA08F67357D0A5ECB7C25E70:\n"
+      "ssb:u:2048:1:1111111111111111:2000::::::s:::+:::23:\n"
+      "fpr:::::::::AAAAAAAAAAAAAAAAAAAAAAAA1111111111111111:\n"
+      "grp:::::::::AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA:\n"
+      "ssb:u:2048:1:2222222222222222:3000::::::e:::+:::23:\n"
+      "fpr:::::::::BBBBBBBBBBBBBBBBBBBBBBBB2222222222222222:\n"
+      "grp:::::::::BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB:\n"
+      "ssb:r:2048:1:3333333333333333:4000::::::s:::+:::23:\n"
+      "fpr:::::::::CCCCCCCCCCCCCCCCCCCCCCCC3333333333333333:\n"
+      "grp:::::::::CCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCC:\n";
+  openpgp::SigningKey key;
+  ASSERT_TRUE(openpgp::ParseSigningKey(listing, &key));
+  EXPECT_EQ("1111111111111111", key.keyid);
+  EXPECT_EQ("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", key.keygrip);
+  EXPECT_EQ(openpgp::kPUBKEY_RSA, key.algo);
+}
+
+TEST(OpenPgpParseSigningKeyTest, RejectsWhatGpgShouldHandle) {
+  openpgp::SigningKey key;
+  /* More than one key matched. */
+  EXPECT_FALSE(openpgp::ParseSigningKey(
+      std::string(kED25519_LISTING) + kED25519_LISTING, &key));
+  /* DSA. */
+  EXPECT_FALSE(openpgp::ParseSigningKey(
+      "sec:u:2048:17:52F8D67E0DD41C8F:1000:::u:::scSC:::+:::::0:\n"
+      "fpr:::::::::012C0768C2B6E018DF98874752F8D67E0DD41C8F:\n"
+      "grp:::::::::5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7:\n", &key));
+  /* EdDSA on a curve other than Ed25519. */
+  EXPECT_FALSE(openpgp::ParseSigningKey(
+      "sec:u:448:22:52F8D67E0DD41C8F:1000:::u:::scSC:::+::ed448:::0:\n"
+      "fpr:::::::::012C0768C2B6E018DF98874752F8D67E0DD41C8F:\n"
+      "grp:::::::::5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7:\n", &key));
+  /* Only a stub of the secret key. */
+  EXPECT_FALSE(openpgp::ParseSigningKey(
+      "sec:u:255:22:52F8D67E0DD41C8F:1000:::u:::scSC:::#::ed25519:::0:\n"
+      "fpr:::::::::012C0768C2B6E018DF98874752F8D67E0DD41C8F:\n"
+      "grp:::::::::5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7:\n", &key));
+  /* Expired. */
+  EXPECT_FALSE(openpgp::ParseSigningKey(
+      "sec:e:255:22:52F8D67E0DD41C8F:1000:2000::u:::scSC:::+::ed25519:::0:\n"
+      "fpr:::::::::012C0768C2B6E018DF98874752F8D67E0DD41C8F:\n"
+      "grp:::::::::5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7:\n", &key));
+  EXPECT_FALSE(openpgp::ParseSigningKey("", &key));
+}
+
+TEST(OpenPgpSigValTest, GetsParameters) {
+  std::vector<std::string> names;
+  names.push_back("r");
+  names.push_back("s");
+  std::vector<std::string> values;
+  /* Values can hold anything, even parentheses. */
+  const char sig_val[] = "(7:sig-val(5:eddsa(1:r2:\x01\x02)(1:s3:)\x00()))";
+  ASSERT_TRUE(openpgp::ParseSigVal(std::string(sig_val, sizeof sig_val - 1),
+                                   "eddsa", names, &values));
+  ASSERT_EQ(2u, values.size());
+  EXPECT_EQ("\x01\x02", values[0]);
+  EXPECT_EQ(std::string(")\x00(", 3), values[1]);
+
+  EXPECT_FALSE(openpgp::ParseSigVal("(7:sig-val(3:rsa(1:s1:x)))", "eddsa",
+                                    names, &values));
+  EXPECT_FALSE(openpgp::ParseSigVal("(7:sig-val(5:eddsa(1:r1:x)))", "eddsa",
+                                    names, &values));
+  EXPECT_FALSE(openpgp::ParseSigVal("(7:sig-val(5:eddsa(1:r9:x", "eddsa",
+                                    names, &values));
+}
+
+TEST(OpenPgpMpiTest, StripsLeadingZeros) {
+  EXPECT_EQ("0000", Hex(openpgp::Mpi(std::string(2, '\0'))));
+  EXPECT_EQ("000101", Hex(openpgp::Mpi(std::string("\x00\x01", 2))));
+  EXPECT_EQ("00110180ff", Hex(openpgp::Mpi(Bytes("0180ff"))));
+  EXPECT_EQ("0010ffff", Hex(openpgp::Mpi(Bytes("ffff"))));
+}
+
+TEST(OpenPgpSignatureBuilderTest, BuildsDetachedSignature) {
+  openpgp::SigningKey key;
+  key.keyid = "52F8D67E0DD41C8F";
+  key.fingerprint = "012C0768C2B6E018DF98874752F8D67E0DD41C8F";
+  key.keygrip = "5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7";
+  key.algo = openpgp::kPUBKEY_EDDSA;
+
+  openpgp::SignatureBuilder builder(key, 0x6ad35cda);
+  std::string digest = builder.Digest("hello\n");
+  ASSERT_EQ(Sha256::kDigestSize, digest.size());
+
+  std::string sig_val("(7:sig-val(5:eddsa(1:r32:");
+  sig_val.append(Bytes("0f" + std::string(62, '1')));
+  sig_val.append(")(1:s32:");
+  sig_val.append(Bytes(std::string(64, 'f')));
+  sig_val.append(")))");
+
+  std::string packet;
+  ASSERT_TRUE(builder.Packet(sig_val, &packet));
+  EXPECT_EQ(
+      /* Old format signature packet, 117 bytes. */
+      "8875"
+      /* Version 4, binary document, EdDSA, SHA-256. */
+      "04001608"
+      /* Issuer fingerprint and creation time subpackets. */
+      "001d" "162104012c0768c2b6e018df98874752f8d67e0dd41c8f" "05026ad35cda"
+      /* Issuer subpacket. */
+      "000a" "091052f8d67e0dd41c8f"
+      /* The top of the digest and both MPIs. */
+      + Hex(digest.substr(0, 2)) +
+      "00fc" "0f" + std::string(62, '1') +
+      "0100" + std::string(64, 'f'),
+      Hex(packet));
+
+  EXPECT_FALSE(builder.Packet("(7:sig-val(3:rsa(1:s1:x)))", &packet));
+}
+
+/*
+ * gpg's listing of a key with an Ed25519 primary key and a Curve25519
+ * encryption subkey, as ListSecretKey() asks for it.
+ */
+const char kCV25519_LISTING[] =
+    "sec:u:255:22:294DC16D3BD7959A:1792252695:::u:::scESC:::+::ed25519:::0:\n"
+    "fpr:::::::::97C63BE58376CBCFE18A0441294DC16D3BD7959A:\n"
+    "grp:::::::::66DAD4FE54BFCC4DDB2D1C50F139412097C611CA:\n"
+    "pkd:0:80:092B06010401DA470F01:\n"
+    "pkd:1:263:40A3574F90AFAE7D04B0842F1276C9D8FB7B49020F3DB51EA3A35FC3DA1C27"
+    "68EC:\n"
+    "uid:u::::1792252695::2AA126F0209F2D9BB9A8807D93E0C99CCA22D5D8::"
+    "T <t@e.com>::::::::::0:\n"
+    "ssb:u:255:18:D8BBFD78A8AA68AA:1792252695::::::e:::+::cv25519::\n"
+    "fpr:::::::::E043A79B97DC39E78FC231CBD8BBFD78A8AA68AA:\n"
+    "grp:::::::::4D2463F4C1EE628A74BA5B3241226F66B7EE4DD3:\n"
+    "pkd:0:88:0A2B060104019755010501:\n"
+    "pkd:1:263:401CBB3A89DF03C6C5E3701D611A5168711035F39276CEE9BCB114AA9E99F7"
+    "BA57:\n"
+    "pkd:2:32:03010807:\n";
+
+TEST(OpenPgpParseDecryptionKeyTest, FindsSubkey) {
+  openpgp::DecryptionKey key;
+  ASSERT_TRUE(openpgp::ParseDecryptionKey(kCV25519_LISTING,
+                                          "D8BBFD78A8AA68AA", &key));
+  EXPECT_EQ("D8BBFD78A8AA68AA", key.keyid);
+  EXPECT_EQ("E043A79B97DC39E78FC231CBD8BBFD78A8AA68AA", key.fingerprint);
+  EXPECT_EQ("4D2463F4C1EE628A74BA5B3241226F66B7EE4DD3", key.keygrip);
+  EXPECT_EQ(openpgp::kPUBKEY_ECDH, key.algo);
+  EXPECT_EQ("0a2b060104019755010501", Hex(key.curve));
+  EXPECT_EQ("03010807", Hex(key.kdf_params));
+
+  /* Expired keys still decrypt. */
+  ASSERT_TRUE(openpgp::ParseDecryptionKey(
+      "sec:e:2048:1:ADA6BD7EAFE07B0A:1000:2000::u:::scESC:::+:::23::0:\n"
+      "fpr:::::::::7C29E768810FD42874A3075FADA6BD7EAFE07B0A:\n"
+      "grp:::::::::1E30FE9718699140FA08F67357D0A5ECB7C25E70:\n"
+      "ssb:e:2048:1:2222222222222222:1000:2000:::::e:::+:::23:\n"
+      "fpr:::::::::BBBBBBBBBBBBBBBBBBBBBBBB2222222222222222:\n"
+      "grp:::::::::BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB:\n"
+      "pkd:0:2048:C0FFEE:\n",
+      "2222222222222222", &key));
+  EXPECT_EQ(openpgp::kPUBKEY_RSA, key.algo);
+  EXPECT_EQ("BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB", key.keygrip);
+  EXPECT_TRUE(key.curve.empty());
+}
+
+TEST(OpenPgpParseDecryptionKeyTest, RejectsWhatGpgShouldHandle) {
+  openpgp::DecryptionKey key;
+  std::string listing(kCV25519_LISTING);
+  /* Not there. */
+  EXPECT_FALSE(openpgp::ParseDecryptionKey(listing, "1111111111111111",
+                                           &key));
+  /* Not an encryption key. */
+  EXPECT_FALSE(openpgp::ParseDecryptionKey(listing, "294DC16D3BD7959A",
+                                           &key));
+  /* Only a stub of the secret key. */
+  std::string stub(listing);
+  stub.replace(stub.find(":+::cv25519"), 2, ":#");
+  EXPECT_FALSE(openpgp::ParseDecryptionKey(stub, "D8BBFD78A8AA68AA", &key));
+  /* A key derivation with SHA-512. */
+  std::string sha512(listing);
+  sha512.replace(sha512.find("03010807"), 8, "03010A09");
+  EXPECT_FALSE(openpgp::ParseDecryptionKey(sha512, "D8BBFD78A8AA68AA",
+                                           &key));
+  /* ElGamal. */
+  EXPECT_FALSE(openpgp::ParseDecryptionKey(
+      "ssb:u:2048:16:2222222222222222:1000::::::e:::+::::\n"
+      "fpr:::::::::BBBBBBBBBBBBBBBBBBBBBBBB2222222222222222:\n"
+      "grp:::::::::BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB:\n",
+      "2222222222222222", &key));
+}
+
+/*
+ * "plain text" encrypted by gpg 2.2 with AES-256 to the subkey above, with
+ * the session key gpg --show-session-key gives for it.
+ */
+const char kZLIB_MESSAGE[] =
+    "-----BEGIN PGP MESSAGE-----\n"
+    "\n"
+    "hF4D2Lv9eKiqaKoSAQdAt7o8nsGg5+9A7EjmpOXfZIj/7rbXSlqXIrxaj/CVzkUw\n"
+    "SKbJQfjfg9Zqzm/7z90dv2g330ybLhNkeR9JvNtVuZ7XOSEOk5mrSqaIv4AaJzc0\n"
+    "0kUBcNl6o1wLlZJlQeKGjv5AVnjwp9j80HwVFrG84enh1Z2TkILRgzCMJbfFuYXf\n"
+    "nJMB/X2n0ZzHjtbeh8bOWjBya0X2qOY=\n"
+    "=V/jU\n"
+    "-----END PGP MESSAGE-----\n";
+const char kZLIB_SESSION_KEY[] =
+    "174862CC2AAA49D8BF762DA325656E978EE200220E3B78DB3D464164627C630F";
+
+/* The same with ZIP (i.e. raw deflate) compression. */
+const char kZIP_MESSAGE[] =
+    "-----BEGIN PGP MESSAGE-----\n"
+    "\n"
+    "hF4D2Lv9eKiqaKoSAQdAm0R++BL0Z7bvlEjncjHHM80hPLjF38GmfwrsPmt7wRAw\n"
+    "xm5JVa0yeoUo1jwItTmemV4iTAxT7l+rPJEw5b8jPY/IxTDShRa+ScLkWtyNKXnx\n"
+    "0j8BLkKFrulPk2a9T9GdPW5lvijqWTpYslzpFK/hIzLJV+9koefdAurSz7FAXNmX\n"
+    "p/hCirAzIc0JxHlEK4S46Tc=\n"
+    "=sK/5\n"
+    "-----END PGP MESSAGE-----\n";
+const char kZIP_SESSION_KEY[] =
+    "75FA405E47AF9F2C61910D272B990B734D69AFEE55BE2C60249C89546EAB0106";
+
+/* And without compression. */
+const char kPLAIN_MESSAGE[] =
+    "-----BEGIN PGP MESSAGE-----\n"
+    "\n"
+    "hF4D2Lv9eKiqaKoSAQdA3Na6TDAOiX0umywWa1F2hQ0pRTTkfiw08EKliHtveTAw\n"
+    "5HOg+/SeJDkg/Z0sxx3k96ZBIn5LBBkDdsEl44XrM5Ffxi8TxcfL41PzFZ7xfuDt\n"
+    "0jsB25Hf5CmwCFI8TM4egegvNiu1zCMPkjvFddSxjWZNQYo+AjwoMPl81QkKi78T\n"
+    "6qsL+A4rcnnnI5NzuA==\n"
+    "=BDFn\n"
+    "-----END PGP MESSAGE-----\n";
+const char kPLAIN_SESSION_KEY[] =
+    "525249C8C767FE4293AFAEA5007DD595601A65306E741CEA7D600E8173163ECA";
+
+/* Signed as well as encrypted, without compression. */
+const char kSIGNED_MESSAGE[] =
+    "-----BEGIN PGP MESSAGE-----\n"
+    "\n"
+    "hF4D2Lv9eKiqaKoSAQdAeglWPBDgxufsHc6yU63bzIRm7RKMqnIQVnGKiwrmFhww\n"
+    "BluSGPjSkrFHDSeiOPVIMD6w8wwxO8F9o9WNLUyI1O+PURBjLkT9ZZ0b+LKkLYh8\n"
+    "0sABAUJn1ocVEceg/5jvteD5UXRDbmVTHoOyiG4EdLP6b7C7QmVeHzNFAYieA5Kv\n"
+    "H2EzKyqDJrzL2sK20Qq8YfOEoVmATsHp6X7FHNGRLGgbDO+47xQ//9IgJmdWzxIx\n"
+    "sal/QdGwKEE7rfHfSh8zsOjT5Od7VjSvWFbnbvEB1sJMBQcpkzXSom99kr57gUuO\n"
+    "IEGx2h4q9kB99NZ+jmwV4neQWXPSmCnCd2ZwdlBlrkrV5J9qhZS/kwZF6e+Wk+L9\n"
+    "tXzsfA==\n"
+    "=wkwY\n"
+    "-----END PGP MESSAGE-----\n";
+const char kSIGNED_SESSION_KEY[] =
+    "06AC262016369334C14BFA6AB26BC589CA57BB8D5F0D3B30FF3755424051DF0B";
+
+/*
+ * 1200000 zero bytes that gpg 2.2 compressed with zlib to about 1 KB and
+ * encrypted with AES-256 to another key, with its session key.
+ */
+const char kBOMB_MESSAGE[] =
+    "-----BEGIN PGP MESSAGE-----\n"
+    "\n"
+    "hF4DZ2xYc/I2vtwSAQdACetStsHo4myhIsnJt+vRbEKvKjAeDcXDQyj3KEaiIV4w\n"
+    "cdDMOQIq/2pbS0/1ghhx4ThXiDaHfElm+Wz4AhcU7ml32Yi3ySzpfGxY0rDm5uhL\n"
+    "0uoBYWep5kjxfzw8+pRxvHH0MlSu3GGpAFXbgsYjnLF4mK4TiSbhPqmOAsW6hEVH\n"
+    "Snurufa9nB13om0Luk+G/SYAZdWh/lSxo5d6APkUAfdUGM1Z8A6W6pfwqLIxFON9\n"
+    "DULcYGOSWMRGPVrwiVRri8cwph4rp7+YufWfJu5S0Fxi2hr6Gfg0SnmPSXvnoPix\n"
+    "6neqkLRGM2XlUzgxvG2NoyYeF/dpHdM17MsUvqFFUHwxD9Ujf9R/ifQZG2iE9SE7\n"
+    "n5wq0ueuDV4yeldhPT38Rbs2QmtSIm7OO4Y+YwT/gRwcWTWOlbVS46mhp3UUkjjw\n"
+    "qYsBtdavQGzKOx8RlSQ7V+o73owa5vHq+Z8Asr04MTYFkn/ryeLkJxDU0gcFC0MH\n"
+    "65MoKqqX3Td+1LLspNMSW9ypvHQnyQYWeRtuwGrz6ygZkhsVinmyb8r6Cn4Bk3+C\n"
+    "dkHybTRedB1n0/S19RHGhXt7oXtxFlhOoWj3KWaxtkIp5EzxVe0D7DMkHSDMz5+O\n"
+    "bzn+M7GMSmx3e0AOI0n2RfUXuLziq0hB2gzJSYb0bl5Tvgkf1JjrzPUtHvyDYKHy\n"
+    "NO1DfnyYelqnio9xy1J5nvu5JP7X2DyPc0pC/DoFSSqaVKKyY4JOhCr6Js56J+0W\n"
+    "wjiR4KpFYBBcVk9APcG6x7z5CvHuXCNMveejJED7h/ObGmILeCPBw96+eiYbSgbU\n"
+    "BD/JLYLB1QOTYHZX9yP7q31wQvSdKQwlrBl+yM4AhssIgdzKYTAFQBBj3n456rhr\n"
+    "vdbmWntmgoWPsQGQtTUXaa4tV7o23zITS869LRL42CtGf0hTFXj10Fi7TnUt93V6\n"
+    "jcBBwBupRKh2Vty8F0AeoAmnm4kITvortPxo5TG7bjgj27lQVlh8u2K9Y0L7Wu2J\n"
+    "5z/OrsYDsr4EY1pfxMCvOLe0ov0G74DHjXjI2eUebd1Bi12erw+LDjEISD/yvm8J\n"
+    "CfbuxiWH4fA7BXQaKNuzk0RVX0l8CqAGILr+fyZMbxTBss0hnvyx3cFn8u/zuQFy\n"
+    "EuItIqyfrhENNO1vzPlIDAW9gqO+q4/ZYY7tk+/DUAKwi4YcXDqjHrxIIwQJ2lpb\n"
+    "2yq535FGJ5j8xDq80yYiu3M/dlz+yykC92d/BRU67FHY72sNpHvA1hH5wsggCNmE\n"
+    "zY/WLTIbbK8g/Y4yXdjT+eZfh8G5zvA4CgLmLe9Fvr1+nIfHt22phBCWPfo2KDar\n"
+    "y6/MTMS+xdbUf6U1dObNjEKQbKb1oBV1f5W/A4O1TYyxBYAdzSx01o+Sz8IMQi5/\n"
+    "P0ox2yIwGikOq15RIkAG9XcknOk7+QzzFCWe4KYFqy+hJqIUUmZ9m8ATUC6PC3C/\n"
+    "Gbu8DeIf2nQIQQRMQzJ5RyKWwCgT3JfI2PCQMy6ECCPck84+QykdHoaJEsclNWL3\n"
+    "QZzvkjKRVkvfJczUUNPtPK89Ba7ewQrOIzien0wDh5ozY0tYUdGGV8Bx8vF2Xcqg\n"
+    "VCYPw+UNpSZcXASro+s/NesFqb7JI7hpKfOUD+NVaBKF42R3TwrnADdzBktSkVAK\n"
+    "pDucfm8xRVyrpj/O+pNdnw7eRa+vlIb58U88JvlKd3ET8+vaJk39h2lao/CA2TMW\n"
+    "jBrlc3gIWtBEcTDS9YVA90u1FHCOIWgkLTPqK3j0RpTt1gcgViMjH6Z1CjVLGhHv\n"
+    "3QfJSof98cpRXlQ/\n"
+    "=uvVM\n"
+    "-----END PGP MESSAGE-----\n";
+const char kBOMB_SESSION_KEY[] =
+    "DD4CEF1E6279FC5112B88CC8484EFD261A509E5489EA0A3B9622776CBA9AA396";
+
+bool ParseMessage(const char *armored, openpgp::EncryptedMessage *message) {
+  std::string packets;
+  return Dearmor(armored, "MESSAGE", &packets) && message->Parse(packets);
+}
+
+SecureString SecureBytes(const std::string &hex) {
+  std::string bytes = Bytes(hex);
+  return SecureString(bytes.data(), bytes.size());
+}
+
+TEST(OpenPgpEncryptedMessageTest, ParsesSessionKeys) {
+  openpgp::EncryptedMessage message;
+  ASSERT_TRUE(ParseMessage(kZLIB_MESSAGE, &message));
+  ASSERT_EQ(1u, message.session_keys().size());
+  const openpgp::EncryptedSessionKey &session_key =
+      message.session_keys()[0];
+  EXPECT_EQ("D8BBFD78A8AA68AA", session_key.keyid);
+  EXPECT_EQ(openpgp::kPUBKEY_ECDH, session_key.algo);
+  ASSERT_EQ(2u, session_key.values.size());
+  /* A Curve25519 point, and an AES-256 key wrapped with its checksum. */
+  EXPECT_EQ(33u, session_key.values[0].size());
+  EXPECT_EQ(0x40, session_key.values[0][0]);
+  EXPECT_EQ(48u, session_key.values[1].size());
+
+  std::string enc_val = openpgp::EncryptedMessage::EncVal(session_key);
+  EXPECT_EQ("(7:enc-val(4:ecdh(1:s49:\x30" + session_key.values[1] +
+            ")(1:e33:" + session_key.values[0] + ")))", enc_val);
+}
+
+TEST(OpenPgpEncryptedMessageTest, RejectsOtherMessages) {
+  openpgp::EncryptedMessage message;
+  std::string packets;
+  ASSERT_TRUE(Dearmor(kZLIB_MESSAGE, "MESSAGE", &packets));
+  /* No session key. */
+  EXPECT_FALSE(message.Parse(packets.substr(96)));
+  /* Cut short. */
+  EXPECT_FALSE(message.Parse(packets.substr(0, packets.size() - 1)));
+  /* Something after the data. */
+  EXPECT_FALSE(message.Parse(packets + packets.substr(0, 96)));
+  /* Data without an MDC, i.e. a symmetrically encrypted data packet. */
+  packets[96] = static_cast<char>(0xc9);
+  EXPECT_FALSE(message.Parse(packets));
+  EXPECT_FALSE(message.Parse(""));
+}
+
+TEST(OpenPgpEncryptedMessageTest, DecryptsData) {
+  const char *const messages[] = {
+    kZLIB_MESSAGE, kZIP_MESSAGE, kPLAIN_MESSAGE,
+  };
+  const char *const session_keys[] = {
+    kZLIB_SESSION_KEY, kZIP_SESSION_KEY, kPLAIN_SESSION_KEY,
+  };
+  for (size_t i = 0; i < 3; i++) {
+    openpgp::EncryptedMessage message;
+    ASSERT_TRUE(ParseMessage(messages[i], &message));
+    SecureString plain_text;
+    ASSERT_TRUE(message.Decrypt(openpgp::kCIPHER_AES256,
+                                SecureBytes(session_keys[i]), &plain_text))
+        << i;
+    EXPECT_EQ("plain text", std::string(plain_text.data(), plain_text.size()));
+  }
+}
+
+TEST(OpenPgpEncryptedMessageTest, RejectsBadData) {
+  openpgp::EncryptedMessage message;
+  SecureString plain_text;
+  ASSERT_TRUE(ParseMessage(kPLAIN_MESSAGE, &message));
+  /* The wrong key, or the right one for the wrong algorithm. */
+  EXPECT_FALSE(message.Decrypt(openpgp::kCIPHER_AES256,
+                               SecureBytes(kZIP_SESSION_KEY), &plain_text));
+  EXPECT_FALSE(message.Decrypt(openpgp::kCIPHER_AES128,
+                               SecureBytes(kPLAIN_SESSION_KEY), &plain_text));
+
+  /* A changed byte of the data fails the MDC. */
+  std::string packets;
+  ASSERT_TRUE(Dearmor(kPLAIN_MESSAGE, "MESSAGE", &packets));
+  packets[packets.size() - 30] ^= 1;
+  ASSERT_TRUE(message.Parse(packets));
+  EXPECT_FALSE(message.Decrypt(openpgp::kCIPHER_AES256,
+                               SecureBytes(kPLAIN_SESSION_KEY), &plain_text));
+
+  /* Signed messages are for gpg, which can check the signature. */
+  ASSERT_TRUE(ParseMessage(kSIGNED_MESSAGE, &message));
+  EXPECT_FALSE(message.Decrypt(openpgp::kCIPHER_AES256,
+                               SecureBytes(kSIGNED_SESSION_KEY), &plain_text));
+}
+
+/*
+ * Plain text that compresses too well is left to gpg, rather than
+ * uncompressed into the plugin's locked memory.
+ */
+TEST(OpenPgpEncryptedMessageTest, RejectsTooMuchUncompressedData) {
+  openpgp::EncryptedMessage message;
+  ASSERT_TRUE(ParseMessage(kBOMB_MESSAGE, &message));
+  SecureString plain_text;
+  EXPECT_FALSE(message.Decrypt(openpgp::kCIPHER_AES256,
+                               SecureBytes(kBOMB_SESSION_KEY), &plain_text));
+  EXPECT_TRUE(plain_text.empty());
+}
+
+/*
+ * An RSA session key comes back from the agent with its PKCS #1 padding,
+ * but without the leading 0.
+ */
+TEST(OpenPgpEncryptedMessageTest, GetsRsaSessionKey) {
+  openpgp::DecryptionKey key;
+  key.algo = openpgp::kPUBKEY_RSA;
+  openpgp::EncryptedSessionKey session_key;
+  session_key.algo = openpgp::kPUBKEY_RSA;
+  session_key.values.push_back(Bytes("0102"));
+
+  std::string symmetric = Bytes("000102030405060708090a0b0c0d0eff");
+  /* The algorithm, the key and the sum of its bytes. */
+  std::string frame = "\x07" + symmetric + Bytes("0168");
+  std::string padded = "\x02" + std::string(20, '\x5a') + std::string(1, '\0') +
+                       frame;
+  std::string value = "(5:value" + std::string(1, '0' + padded.size() / 10) +
+                      std::string(1, '0' + padded.size() % 10) + ":" +
+                      padded + ")" + std::string(1, '\0');
+
+  int cipher_algo = 0;
+  SecureString result;
+  ASSERT_TRUE(openpgp::EncryptedMessage::SessionKey(key, session_key, value,
+                                                    &cipher_algo, &result));
+  EXPECT_EQ(openpgp::kCIPHER_AES128, cipher_algo);
+  EXPECT_EQ(Hex(symmetric), Hex(std::string(result.data(), result.size())));
+
+  /* Without the padding, as when the agent has taken it off. */
+  ASSERT_TRUE(openpgp::EncryptedMessage::SessionKey(
+      key, session_key, "(5:value19:" + frame + ")", &cipher_algo, &result));
+  EXPECT_EQ(Hex(symmetric), Hex(std::string(result.data(), result.size())));
+
+  /* A bad checksum. */
+  frame[frame.size() - 1] ^= 1;
+  EXPECT_FALSE(openpgp::EncryptedMessage::SessionKey(
+      key, session_key, "(5:value19:" + frame + ")", &cipher_algo, &result));
+  EXPECT_FALSE(openpgp::EncryptedMessage::SessionKey(
+      key, session_key, "(7:sig-val)", &cipher_algo, &result));
+
+  EXPECT_EQ("(7:enc-val(3:rsa(1:a2:\x01\x02)))",
+            openpgp::EncryptedMessage::EncVal(session_key));
+}
+
+}  /* namespace */
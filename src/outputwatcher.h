@@ -0,0 +1,48 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * This file declares GpgOutputWatcher, which the readers of gpg's pipes tell
+ * about output as it comes in, rather than only once all of it has been read.
+ */
+
+#ifndef _GPGPLUGIN_OUTPUTWATCHER_H_
+#define _GPGPLUGIN_OUTPUTWATCHER_H_
+
+#include <string>
+
+class GpgOutputWatcher {
+ public:
+  virtual ~GpgOutputWatcher() {}
+
+  /*
+   * More has been appended to |output|, which is everything read so far.
+   * Called on whichever thread does the reading, so it must not block.
+   */
+  virtual void Grew(const std::string &output) = 0;
+};
+
+#endif  // _GPGPLUGIN_OUTPUTWATCHER_H_
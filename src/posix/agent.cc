@@ -0,0 +1,377 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "posix/agent.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "logging.h"
+
+static const char kSOCKET_NAME[] = "S.gpg-agent";
+
+/* Assuan lines, including the LF, are at most this long. */
+static const size_t kMAX_LINE = 1000;
+/* Don't buffer unlimited amounts if the agent never ends a line. */
+static const size_t kMAX_RECEIVED_LINE = 64 * 1024;
+
+#ifdef MSG_NOSIGNAL
+static const int kSEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int kSEND_FLAGS = 0;
+#endif
+
+static const char kHEX_DIGITS[] = "0123456789ABCDEF";
+
+const unsigned int GpgAgent::kERR_BAD_PASSPHRASE;
+const unsigned int GpgAgent::kERR_NO_SECKEY;
+const unsigned int GpgAgent::kERR_CANCELED;
+
+static bool IsSocket(const std::string &path) {
+  struct stat file_info;
+  return stat(path.c_str(), &file_info) == 0 && S_ISSOCK(file_info.st_mode);
+}
+
+/*
+ * gpg 2.1 and later put the socket in /run/user/<uid>/gnupg if that exists,
+ * and in the home directory otherwise. With a non-default GNUPGHOME the
+ * socket under /run/user is in a hashed subdirectory, which is only known to
+ * gpgconf; set the gpg_agent_socket preference for those.
+ */
+std::string GpgAgent::DefaultSocketPath() {
+  const char *gnupghome = getenv("GNUPGHOME");
+  if (gnupghome != NULL && *gnupghome != '\0') {
+    std::string path(gnupghome);
+    path.append("/");
+    path.append(kSOCKET_NAME);
+    return IsSocket(path) ? path : std::string();
+  }
+
+  char run_path[64];
+  snprintf(run_path, sizeof run_path, "/run/user/%u/gnupg/%s",
+           static_cast<unsigned int>(getuid()), kSOCKET_NAME);
+  if (IsSocket(run_path)) {
+    return run_path;
+  }
+
+  const char *home = getenv("HOME");
+  if (home != NULL) {
+    std::string path(home);
+    path.append("/.gnupg/");
+    path.append(kSOCKET_NAME);
+    if (IsSocket(path)) {
+      return path;
+    }
+  }
+  return std::string();
+}
+
+GpgAgent *GpgAgent::Connect(const std::string &socket_path) {
+  struct sockaddr_un address;
+  if (socket_path.empty() || socket_path.size() >= sizeof address.sun_path) {
+    LOG("GPG: Bad agent socket path \"%s\"\n", socket_path.c_str());
+    return NULL;
+  }
+  std::memset(&address, 0, sizeof address);
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, socket_path.data(), socket_path.size());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    LOG("GPG: socket failed: %s\n", std::strerror(errno));
+    return NULL;
+  }
+  int flags = fcntl(fd, F_GETFD);
+  if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+    LOG("GPG: fcntl failed: %s\n", std::strerror(errno));
+  }
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+              sizeof address) == -1) {
+    LOG("GPG: Can't connect to agent at %s: %s\n", socket_path.c_str(),
+        std::strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  GpgAgent *agent = new GpgAgent(fd);
+  std::string greeting;
+  if (!agent->ReadLine(&greeting) || greeting.compare(0, 2, "OK") != 0) {
+    LOG("GPG: No greeting from agent at %s\n", socket_path.c_str());
+    delete agent;
+    return NULL;
+  }
+
+  /* Without this, pinentry shows up on the display the agent started on. */
+  const char *display = getenv("DISPLAY");
+  if (display != NULL) {
+    unsigned int error;
+    std::string option("OPTION display=");
+    option.append(Escape(display, false));
+    if (!agent->Transact(option, &error) && !agent->connected()) {
+      delete agent;
+      return NULL;
+    }
+  }
+
+  LOG("GPG: Connected to agent at %s\n", socket_path.c_str());
+  return agent;
+}
+
+GpgAgent::GpgAgent(int socket)
+    : socket_(socket),
+      connected_(true) {
+}
+
+GpgAgent::~GpgAgent() {
+  Disconnect();
+  close(socket_);
+}
+
+void GpgAgent::Disconnect() {
+  if (connected_) {
+    shutdown(socket_, SHUT_RDWR);
+    connected_ = false;
+  }
+  buffer_.clear();
+}
+
+void GpgAgent::Interrupt(bool /* force */) {
+  shutdown(socket_, SHUT_RDWR);
+}
+
+bool GpgAgent::PkSign(const std::string &keygrip,
+                      const std::string &description,
+                      int hash_algo, const std::string &digest,
+                      std::string *sig_val, unsigned int *error) {
+  std::string sethash("SETHASH ");
+  char algo[16];
+  snprintf(algo, sizeof algo, "%d ", hash_algo);
+  sethash.append(algo);
+  for (size_t i = 0; i < digest.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(digest[i]);
+    sethash.push_back(kHEX_DIGITS[c >> 4]);
+    sethash.push_back(kHEX_DIGITS[c & 0xf]);
+  }
+
+  if (!Transact("RESET", error) ||
+      !Transact("SIGKEY " + keygrip, error) ||
+      (!description.empty() &&
+       !Transact("SETKEYDESC " + Escape(description, true), error)) ||
+      !Transact(sethash, error)) {
+    return false;
+  }
+  return Transact("PKSIGN", NULL, std::string(), sig_val, error);
+}
+
+bool GpgAgent::PkDecrypt(const std::string &keygrip,
+                         const std::string &description,
+                         const std::string &ciphertext,
+                         std::string *plaintext, unsigned int *error) {
+  if (!Transact("RESET", error) ||
+      !Transact("SETKEY " + keygrip, error) ||
+      (!description.empty() &&
+       !Transact("SETKEYDESC " + Escape(description, true), error))) {
+    return false;
+  }
+  return Transact("PKDECRYPT", "CIPHERTEXT", ciphertext, plaintext, error);
+}
+
+bool GpgAgent::Transact(const std::string &command, unsigned int *error) {
+  std::string data;
+  return Transact(command, NULL, std::string(), &data, error);
+}
+
+bool GpgAgent::Transact(const std::string &command,
+                        const char *inquire_keyword,
+                        const std::string &inquire_data,
+                        std::string *data, unsigned int *error) {
+  std::string line;
+
+  *error = 0;
+  data->clear();
+  if (!connected() || !WriteLine(command)) {
+    goto error_disconnect;
+  }
+
+  while (ReadLine(&line)) {
+    if (line == "OK" || line.compare(0, 3, "OK ") == 0) {
+      return true;
+    } else if (line.compare(0, 4, "ERR ") == 0) {
+      *error = strtoul(line.c_str() + 4, NULL, 10);
+      LOG("GPG: Agent failed %s: %s\n",
+          command.substr(0, command.find(' ')).c_str(), line.c_str());
+      return false;
+    } else if (line.compare(0, 2, "D ") == 0) {
+      std::string chunk;
+      if (!Unescape(line.substr(2), &chunk)) {
+        LOG("GPG: Bad data line from agent\n");
+        goto error_disconnect;
+      }
+      data->append(chunk);
+    } else if (line.compare(0, 8, "INQUIRE ") == 0) {
+      /* Any other one, e.g. PINENTRY_LAUNCHED, only wants an END. */
+      std::string keyword = line.substr(8, line.find(' ', 8) - 8);
+      if (inquire_keyword != NULL && keyword == inquire_keyword &&
+          !SendData(inquire_data)) {
+        goto error_disconnect;
+      }
+      if (!WriteLine("END")) {
+        goto error_disconnect;
+      }
+    }
+    /* Status ("S ...") and comment ("# ...") lines are of no interest. */
+  }
+
+error_disconnect:
+  Disconnect();
+  return false;
+}
+
+bool GpgAgent::SendData(const std::string &data) {
+  std::string escaped = Escape(data, false);
+  /* Don't split escape sequences between lines. */
+  size_t start = 0;
+  while (start < escaped.size()) {
+    size_t end = start + kMAX_LINE - 3;
+    if (end >= escaped.size()) {
+      end = escaped.size();
+    } else if (escaped[end - 1] == '%') {
+      end -= 1;
+    } else if (escaped[end - 2] == '%') {
+      end -= 2;
+    }
+    if (!WriteLine("D " + escaped.substr(start, end - start))) {
+      return false;
+    }
+    start = end;
+  }
+  return true;
+}
+
+bool GpgAgent::WriteLine(const std::string &line) {
+  std::string buf(line);
+  buf.push_back('\n');
+  const char *p = buf.data();
+  size_t left = buf.size();
+  while (left > 0) {
+    ssize_t n = send(socket_, p, left, kSEND_FLAGS);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      LOG("GPG: send to agent failed: %s\n", std::strerror(errno));
+      return false;
+    }
+    p += n;
+    left -= n;
+  }
+  return true;
+}
+
+bool GpgAgent::ReadLine(std::string *line) {
+  std::string::size_type newline;
+  while ((newline = buffer_.find('\n')) == std::string::npos) {
+    if (buffer_.size() > kMAX_RECEIVED_LINE) {
+      LOG("GPG: Line from agent too long\n");
+      return false;
+    }
+    char buf[4096];
+    ssize_t n = recv(socket_, buf, sizeof buf, 0);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      LOG("GPG: Lost connection to agent: %s\n",
+          n == 0 ? "EOF" : std::strerror(errno));
+      return false;
+    }
+    buffer_.append(buf, n);
+  }
+  line->assign(buffer_, 0, newline);
+  buffer_.erase(0, newline + 1);
+  return true;
+}
+
+std::string GpgAgent::Escape(const std::string &raw, bool plus) {
+  std::string escaped;
+  for (size_t i = 0; i < raw.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(raw[i]);
+    if (plus && c == ' ') {
+      escaped.push_back('+');
+    } else if (c == '%' || c == '\r' || c == '\n' || (plus && c == '+')) {
+      escaped.push_back('%');
+      escaped.push_back(kHEX_DIGITS[c >> 4]);
+      escaped.push_back(kHEX_DIGITS[c & 0xf]);
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+static int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+bool GpgAgent::Unescape(const std::string &escaped, std::string *raw) {
+  raw->clear();
+  for (size_t i = 0; i < escaped.size(); i++) {
+    if (escaped[i] != '%') {
+      raw->push_back(escaped[i]);
+      continue;
+    }
+    if (i + 2 >= escaped.size()) {
+      return false;
+    }
+    int high = HexValue(escaped[i + 1]);
+    int low = HexValue(escaped[i + 2]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    raw->push_back(static_cast<char>(high << 4 | low));
+    i += 2;
+  }
+  return true;
+}
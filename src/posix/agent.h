@@ -0,0 +1,137 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * A client for gpg-agent's Assuan protocol, which lets the plugin have the
+ * agent do the private key operations of signing and decryption itself
+ * instead of starting gpg to ask the agent for them.
+ *
+ * A connection is a sequence of transactions: a command line, answered by any
+ * number of "D <data>", "S <status>" and "INQUIRE <keyword>" lines and then a
+ * final "OK" or "ERR <code> <description>".
+ */
+
+#ifndef _GPGPLUGIN_POSIX_AGENT_H_
+#define _GPGPLUGIN_POSIX_AGENT_H_
+
+#include <string>
+
+#include "watchdog.h"
+
+/*
+ * A connection can be watched by the GpgWatchdog. Interrupting it shuts the
+ * socket down, which fails the request in progress and the connection with
+ * it.
+ */
+class GpgAgent : public GpgWatchdog::Target {
+ public:
+  /*
+   * Codes of the gpg_error_t values in ERR lines that callers care about,
+   * see ErrorCode().
+   */
+  static const unsigned int kERR_BAD_PASSPHRASE = 11;
+  static const unsigned int kERR_NO_SECKEY = 17;
+  static const unsigned int kERR_CANCELED = 99;
+
+  /*
+   * The socket of the agent gpg would use when run with the environment of
+   * the plugin, or an empty string if none of the usual places has one.
+   */
+  static std::string DefaultSocketPath();
+
+  /*
+   * Connect to the agent listening on |socket_path|. Returns NULL if there's
+   * nobody there or it doesn't greet us like an agent.
+   */
+  static GpgAgent *Connect(const std::string &socket_path);
+
+  virtual ~GpgAgent();
+
+  /*
+   * Have the key with |keygrip| sign |digest|, a hash of algorithm
+   * |hash_algo| (an OpenPGP hash algorithm number). On success, |sig_val|
+   * gets the signature as a canonical S-expression. |description| is shown
+   * by pinentry if a passphrase is needed, unless it's empty.
+   *
+   * On failure |error| gets the error the agent returned, or 0 if the
+   * connection broke, after which the object can't be used anymore.
+   */
+  bool PkSign(const std::string &keygrip, const std::string &description,
+              int hash_algo, const std::string &digest,
+              std::string *sig_val, unsigned int *error);
+
+  /*
+   * Have the key with |keygrip| decrypt |ciphertext|, an "(enc-val ...)"
+   * canonical S-expression. On success, |plaintext| gets the agent's
+   * "(value ...)" S-expression. Failures are reported like for PkSign().
+   */
+  bool PkDecrypt(const std::string &keygrip, const std::string &description,
+                 const std::string &ciphertext,
+                 std::string *plaintext, unsigned int *error);
+
+  bool connected() const { return connected_; }
+
+  virtual void Interrupt(bool force);
+
+  /* The error code (without the error source) of a gpg_error_t. */
+  static unsigned int ErrorCode(unsigned int error) { return error & 0xffff; }
+
+  /*
+   * Percent escaping of Assuan lines, which protects '%', CR and LF and
+   * also '+' and spaces if |plus| is set, as in SETKEYDESC arguments.
+   * Public for the unittests.
+   */
+  static std::string Escape(const std::string &raw, bool plus);
+  static bool Unescape(const std::string &escaped, std::string *raw);
+
+ private:
+  explicit GpgAgent(int socket);
+
+  /*
+   * Run one transaction. The data lines of the answer are collected in
+   * |data|. An INQUIRE for |inquire_keyword| is answered with
+   * |inquire_data|, any other one with no data.
+   */
+  bool Transact(const std::string &command,
+                const char *inquire_keyword, const std::string &inquire_data,
+                std::string *data, unsigned int *error);
+  bool Transact(const std::string &command, unsigned int *error);
+  bool SendData(const std::string &data);
+  bool WriteLine(const std::string &line);
+  bool ReadLine(std::string *line);
+  void Disconnect();
+
+  /*
+   * Only closed by the destructor, so that Interrupt() can't hit a file
+   * descriptor that has been reused in the meantime.
+   */
+  int socket_;
+  bool connected_;
+  /* What has been received beyond the last line returned by ReadLine(). */
+  std::string buffer_;
+};
+
+#endif  // _GPGPLUGIN_POSIX_AGENT_H_
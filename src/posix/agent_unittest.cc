@@ -0,0 +1,290 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+#include <prthread.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "posix/agent.h"
+
+namespace {
+
+const char kKEYGRIP[] = "5E2B2227B0F9B6ED20BE3D6553E75FDA8379B7F7";
+
+/*
+ * A stand-in for gpg-agent that serves one connection on a socket in a
+ * temporary directory. It says OK to everything, except that PKSIGN gets
+ * |sign_reply| and PKDECRYPT asks for the ciphertext and then returns a
+ * fixed value. An empty |sign_reply| hangs up instead.
+ */
+class FakeAgent {
+ public:
+  explicit FakeAgent(const std::string &sign_reply)
+      : sign_reply_(sign_reply),
+        listener_(-1),
+        thread_(NULL) {
+    char dir[] = "/tmp/agent_unittestXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+      return;
+    }
+    dir_ = dir;
+    path_ = dir_ + "/S.gpg-agent";
+
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path_.c_str(),
+                 sizeof address.sun_path - 1);
+    listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener_ == -1 ||
+        bind(listener_, reinterpret_cast<struct sockaddr *>(&address),
+             sizeof address) == -1 ||
+        listen(listener_, 1) == -1) {
+      return;
+    }
+    thread_ = PR_CreateThread(PR_USER_THREAD, Serve, this,
+                              PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD,
+                              PR_JOINABLE_THREAD, 0);
+  }
+
+  ~FakeAgent() {
+    Join();
+    if (listener_ != -1) {
+      close(listener_);
+    }
+    unlink(path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  /* Wait until the client has gone, after which the members can be read. */
+  void Join() {
+    if (thread_ != NULL) {
+      PR_JoinThread(thread_);
+      thread_ = NULL;
+    }
+  }
+
+  const std::string &path() const { return path_; }
+  bool started() const { return thread_ != NULL; }
+
+  std::vector<std::string> commands_;
+  std::string ciphertext_;
+
+ private:
+  static void Serve(void *arg) {
+    FakeAgent *agent = static_cast<FakeAgent *>(arg);
+    int fd = accept(agent->listener_, NULL, NULL);
+    if (fd != -1) {
+      agent->Converse(fd);
+      close(fd);
+    }
+  }
+
+  void Converse(int fd) {
+    std::string line;
+    Write(fd, "OK Pleased to meet you\n");
+    while (ReadLine(fd, &line)) {
+      commands_.push_back(line);
+      if (line == "PKSIGN") {
+        if (sign_reply_.empty()) {
+          return;
+        }
+        Write(fd, sign_reply_);
+      } else if (line == "PKDECRYPT") {
+        Write(fd, "INQUIRE CIPHERTEXT\n");
+        while (ReadLine(fd, &line) && line != "END") {
+          std::string data;
+          GpgAgent::Unescape(line.substr(2), &data);
+          ciphertext_.append(data);
+        }
+        Write(fd, "S PADDING 0\nD (5:value3:abc)\nOK\n");
+      } else {
+        Write(fd, "OK\n");
+      }
+    }
+  }
+
+  void Write(int fd, const std::string &data) {
+    ssize_t n = write(fd, data.data(), data.size());
+    EXPECT_EQ(static_cast<ssize_t>(data.size()), n);
+  }
+
+  bool ReadLine(int fd, std::string *line) {
+    line->clear();
+    char c;
+    while (read(fd, &c, 1) == 1) {
+      if (c == '\n') {
+        return true;
+      }
+      line->push_back(c);
+    }
+    return false;
+  }
+
+  std::string sign_reply_;
+  std::string dir_;
+  std::string path_;
+  int listener_;
+  PRThread *thread_;
+};
+
+std::vector<std::string> LastCommands(const std::vector<std::string> &commands,
+                                      size_t n) {
+  if (commands.size() < n) {
+    return commands;
+  }
+  return std::vector<std::string>(commands.end() - n, commands.end());
+}
+
+TEST(GpgAgentTest, Signs) {
+  /* The signature holds bytes that have to be escaped on the way. */
+  std::string sig_val("(7:sig-val(3:rsa(1:s4:%\n\r+)))");
+  FakeAgent fake("D " + GpgAgent::Escape(sig_val, false) + "\nOK\n");
+  ASSERT_TRUE(fake.started());
+
+  GpgAgent *agent = GpgAgent::Connect(fake.path());
+  ASSERT_TRUE(agent != NULL);
+  std::string result;
+  unsigned int error = 1;
+  EXPECT_TRUE(agent->PkSign(kKEYGRIP, "Sign it", 8, std::string("\x01\xab", 2),
+                            &result, &error));
+  EXPECT_EQ(0u, error);
+  EXPECT_EQ(sig_val, result);
+  delete agent;
+  fake.Join();
+
+  std::vector<std::string> expected;
+  expected.push_back("RESET");
+  expected.push_back(std::string("SIGKEY ") + kKEYGRIP);
+  expected.push_back("SETKEYDESC Sign+it");
+  expected.push_back("SETHASH 8 01AB");
+  expected.push_back("PKSIGN");
+  EXPECT_EQ(expected, LastCommands(fake.commands_, expected.size()));
+}
+
+/* The agent tells about pinentry with an INQUIRE, which only wants an END. */
+TEST(GpgAgentTest, AnswersInquiries) {
+  FakeAgent fake("D (7:sig-val)\nINQUIRE PINENTRY_LAUNCHED 1234\n");
+  ASSERT_TRUE(fake.started());
+
+  GpgAgent *agent = GpgAgent::Connect(fake.path());
+  ASSERT_TRUE(agent != NULL);
+  std::string result;
+  unsigned int error = 1;
+  EXPECT_TRUE(agent->PkSign(kKEYGRIP, "", 8, "x", &result, &error));
+  EXPECT_EQ("(7:sig-val)", result);
+  delete agent;
+  fake.Join();
+
+  std::vector<std::string> expected;
+  expected.push_back("PKSIGN");
+  expected.push_back("END");
+  EXPECT_EQ(expected, LastCommands(fake.commands_, expected.size()));
+}
+
+TEST(GpgAgentTest, ReportsAgentErrors) {
+  FakeAgent fake("ERR 83886179 Operation cancelled <Pinentry>\n");
+  ASSERT_TRUE(fake.started());
+
+  GpgAgent *agent = GpgAgent::Connect(fake.path());
+  ASSERT_TRUE(agent != NULL);
+  std::string result;
+  unsigned int error = 0;
+  EXPECT_FALSE(agent->PkSign(kKEYGRIP, "", 8, "x", &result, &error));
+  EXPECT_EQ(GpgAgent::kERR_CANCELED, GpgAgent::ErrorCode(error));
+  EXPECT_TRUE(agent->connected());
+  delete agent;
+}
+
+TEST(GpgAgentTest, NoticesLostConnection) {
+  FakeAgent fake("");
+  ASSERT_TRUE(fake.started());
+
+  GpgAgent *agent = GpgAgent::Connect(fake.path());
+  ASSERT_TRUE(agent != NULL);
+  std::string result;
+  unsigned int error = 1;
+  EXPECT_FALSE(agent->PkSign(kKEYGRIP, "", 8, "x", &result, &error));
+  EXPECT_EQ(0u, error);
+  EXPECT_FALSE(agent->connected());
+  delete agent;
+}
+
+/*
+ * The ciphertext is sent when the agent inquires for it, split into lines
+ * that Assuan can take.
+ */
+TEST(GpgAgentTest, Decrypts) {
+  FakeAgent fake("");
+  ASSERT_TRUE(fake.started());
+
+  std::string ciphertext("(7:enc-val(3:rsa(1:a2000:");
+  for (int i = 0; i < 2000; i++) {
+    ciphertext.push_back(static_cast<char>(i % 7 == 0 ? '%' : i));
+  }
+  ciphertext.append(")))");
+
+  GpgAgent *agent = GpgAgent::Connect(fake.path());
+  ASSERT_TRUE(agent != NULL);
+  std::string plaintext;
+  unsigned int error = 1;
+  EXPECT_TRUE(agent->PkDecrypt(kKEYGRIP, "", ciphertext, &plaintext, &error));
+  EXPECT_EQ("(5:value3:abc)", plaintext);
+  delete agent;
+  fake.Join();
+
+  EXPECT_EQ(ciphertext, fake.ciphertext_);
+  std::vector<std::string> expected;
+  expected.push_back("RESET");
+  expected.push_back(std::string("SETKEY ") + kKEYGRIP);
+  expected.push_back("PKDECRYPT");
+  EXPECT_EQ(expected, LastCommands(fake.commands_, expected.size()));
+}
+
+TEST(GpgAgentTest, FailsWithoutAgent) {
+  EXPECT_TRUE(GpgAgent::Connect("/nonexistent/S.gpg-agent") == NULL);
+  EXPECT_TRUE(GpgAgent::Connect("") == NULL);
+}
+
+TEST(GpgAgentTest, Escapes) {
+  EXPECT_EQ("a%25b%0A%0D c+", GpgAgent::Escape("a%b\n\r c+", false));
+  EXPECT_EQ("a+b%2B", GpgAgent::Escape("a b+", true));
+  std::string raw;
+  EXPECT_TRUE(GpgAgent::Unescape("a%25b%0a", &raw));
+  EXPECT_EQ("a%b\n", raw);
+  EXPECT_FALSE(GpgAgent::Unescape("a%2", &raw));
+  EXPECT_FALSE(GpgAgent::Unescape("a%zz", &raw));
+}
+
+}  /* namespace */
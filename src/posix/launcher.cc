@@ -0,0 +1,413 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "posix/launcher.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <prinit.h>
+#include <prio.h>
+#include <prlock.h>
+#include <private/pprio.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gpgprocess.h"
+#include "logging.h"
+
+extern char **environ;
+
+static const char kLAUNCHER_NAME[] = "gpg-launcher";
+
+/*
+ * How long the launcher is given to exit once its socket is closed, in steps
+ * of kSTOP_STEP_US, before it's killed.
+ */
+static const int kSTOP_STEPS = 100;
+static const useconds_t kSTOP_STEP_US = 10 * 1000;
+
+#ifdef MSG_NOSIGNAL
+static const int kSEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int kSEND_FLAGS = 0;
+#endif
+
+static void SetCloseOnExec(int fd) {
+  int flags = fcntl(fd, F_GETFD);
+  if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+    LOG("GPG: fcntl failed: %s\n", std::strerror(errno));
+  }
+}
+
+static bool ReadFully(int fd, void *buf, size_t size) {
+  char *p = static_cast<char *>(buf);
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/*
+ * A gpg child started by the launcher. It isn't a child of the plugin, so its
+ * exit status arrives through a pipe that the launcher writes to when it has
+ * reaped the child.
+ */
+class LauncherProcess : public GpgProcess {
+ public:
+  LauncherProcess(pid_t pid, int status_fd)
+      : pid_(pid),
+        status_fd_(status_fd) {
+  }
+
+  virtual ~LauncherProcess() {
+    if (status_fd_ != -1) {
+      close(status_fd_);
+    }
+  }
+
+  virtual bool Wait(int *exit_code) {
+    int32_t status;
+    bool ok = ReadFully(status_fd_, &status, sizeof status);
+    close(status_fd_);
+    status_fd_ = -1;
+    if (!ok) {
+      LOG("GPG: Lost exit status of launched process %d\n",
+          static_cast<int>(pid_));
+      return false;
+    }
+    /* This is how NSPR reports the exit code of a PRProcess. */
+    *exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return true;
+  }
+
+  virtual bool Terminate() {
+    return Signal(SIGTERM);
+  }
+
+  virtual bool Kill() {
+    return Signal(SIGKILL);
+  }
+
+  /* The launcher writes the exit status as soon as it has reaped the child. */
+  virtual int ExitFd() {
+    return status_fd_;
+  }
+
+ private:
+  bool Signal(int signal) {
+    if (status_fd_ == -1) {
+      return false;
+    }
+    /*
+     * If the exit status is already waiting in the pipe, the launcher has
+     * reaped the child and the pid may belong to someone else by now.
+     */
+    struct pollfd pfd = { status_fd_, POLLIN, 0 };
+    if (poll(&pfd, 1, 0) == 1) {
+      return true;
+    }
+    if (kill(pid_, signal) == -1) {
+      LOG("GPG: kill failed: %s\n", std::strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  pid_t pid_;
+  int status_fd_;
+};
+
+static PRCallOnceType once;
+static GpgLauncher *instance = NULL;
+
+PRStatus GpgLauncher::CreateInstance() {
+  instance = new GpgLauncher;
+  return PR_SUCCESS;
+}
+
+GpgLauncher *GpgLauncher::Instance() {
+  if (PR_CallOnce(&once, CreateInstance) == PR_FAILURE) {
+    return NULL;
+  }
+  return instance;
+}
+
+GpgLauncher::GpgLauncher()
+    : lock_(PR_NewLock()),
+      socket_(-1),
+      pid_(-1) {
+}
+
+/*
+ * gpg-launcher is installed next to the plugin itself.
+ */
+std::string GpgLauncher::DefaultPath() {
+  Dl_info info;
+  if (dladdr(kLAUNCHER_NAME, &info) == 0 || info.dli_fname == NULL) {
+    LOG("GPG: dladdr failed\n");
+    return kLAUNCHER_NAME;
+  }
+  std::string path(info.dli_fname);
+  std::string::size_type slash = path.rfind('/');
+  if (slash == std::string::npos) {
+    return kLAUNCHER_NAME;
+  }
+  return path.substr(0, slash + 1) + kLAUNCHER_NAME;
+}
+
+/*
+ * Start gpg-launcher with one end of a socket pair as its standard input.
+ * This is the only time the plugin needs to create a process of its own, and
+ * posix_spawn() allows the C library to do that without copying the address
+ * space of the browser.
+ */
+bool GpgLauncher::StartLocked(const std::string &launcher_path) {
+  std::string path = launcher_path.empty() ? DefaultPath() : launcher_path;
+  if (path == failed_path_) {
+    return false;
+  }
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    LOG("GPG: socketpair failed: %s\n", std::strerror(errno));
+    return false;
+  }
+  SetCloseOnExec(fds[0]);
+  SetCloseOnExec(fds[1]);
+#ifdef SO_NOSIGPIPE
+  int on = 1;
+  setsockopt(fds[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], 0);
+  char *argv[] = { const_cast<char *>(path.c_str()), NULL };
+  pid_t pid;
+  int err = posix_spawn(&pid, path.c_str(), &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+
+  if (err != 0) {
+    LOG("GPG: Failed to start %s: %s\n", path.c_str(), std::strerror(err));
+    close(fds[0]);
+    failed_path_ = path;
+    return false;
+  }
+
+  LOG("GPG: Started %s as %d\n", path.c_str(), static_cast<int>(pid));
+  socket_ = fds[0];
+  pid_ = pid;
+  failed_path_.clear();
+  return true;
+}
+
+/*
+ * The launcher exits when it reads the end of its socket. It's waited for so
+ * that it doesn't stay around as a zombie, and killed if it doesn't exit in
+ * time.
+ */
+void GpgLauncher::StopLocked() {
+  close(socket_);
+  socket_ = -1;
+  pid_t reaped = 0;
+  for (int i = 0; i < kSTOP_STEPS && reaped == 0; i++) {
+    reaped = waitpid(pid_, NULL, WNOHANG);
+    if (reaped == -1 && errno == EINTR) {
+      reaped = 0;
+    }
+    if (reaped == 0) {
+      usleep(kSTOP_STEP_US);
+    }
+  }
+  if (reaped == 0) {
+    LOG("GPG: Launcher %d didn't exit, killing it\n", static_cast<int>(pid_));
+    kill(pid_, SIGKILL);
+    do {
+      reaped = waitpid(pid_, NULL, 0);
+    } while (reaped == -1 && errno == EINTR);
+  }
+  if (reaped == -1) {
+    LOG("GPG: waitpid failed: %s\n", std::strerror(errno));
+  }
+  pid_ = -1;
+}
+
+void GpgLauncher::Stop() {
+  PR_Lock(lock_);
+  if (socket_ != -1) {
+    StopLocked();
+  }
+  PR_Unlock(lock_);
+}
+
+bool GpgLauncher::SendRequestLocked(const launcher::LaunchRequest &request,
+                                    const std::string &strings,
+                                    const int *fds, int nfds) {
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<launcher::LaunchRequest *>(&request);
+  iov[0].iov_len = sizeof request;
+  iov[1].iov_base = const_cast<char *>(strings.data());
+  iov[1].iov_len = strings.size();
+
+  char control[CMSG_SPACE(sizeof(int) * (launcher::kMaxFds + 1))];
+  std::memset(control, 0, sizeof control);
+
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof msg);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+  size_t total = iov[0].iov_len + iov[1].iov_len;
+  ssize_t n;
+  do {
+    n = sendmsg(socket_, &msg, kSEND_FLAGS);
+  } while (n == -1 && errno == EINTR);
+  if (n == -1) {
+    LOG("GPG: sendmsg to launcher failed: %s\n", std::strerror(errno));
+    return false;
+  }
+
+  /* The descriptors went with the first chunk, send whatever is left. */
+  size_t sent = n;
+  while (sent < total) {
+    const char *p;
+    size_t left;
+    if (sent < iov[0].iov_len) {
+      p = static_cast<const char *>(iov[0].iov_base) + sent;
+      left = iov[0].iov_len - sent;
+    } else {
+      p = strings.data() + (sent - iov[0].iov_len);
+      left = total - sent;
+    }
+    n = send(socket_, p, left, kSEND_FLAGS);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      LOG("GPG: send to launcher failed: %s\n", std::strerror(errno));
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+GpgProcess *GpgLauncher::Launch(const std::string &launcher_path,
+                                const char *path, char *const *argv,
+                                PRFileDesc *in, PRFileDesc *out,
+                                PRFileDesc *err,
+                                const std::vector<PRFileDesc *> &inherit) {
+  launcher::LaunchRequest request;
+  std::memset(&request, 0, sizeof request);
+
+  std::string strings(path, std::strlen(path) + 1);
+  for (request.argc = 0; argv[request.argc] != NULL; request.argc++) {
+    strings.append(argv[request.argc], std::strlen(argv[request.argc]) + 1);
+  }
+  if (strings.size() > static_cast<size_t>(launcher::kMaxStringsSize)) {
+    LOG("GPG: Command line too long for the launcher\n");
+    return NULL;
+  }
+  request.strings_size = strings.size();
+  if (inherit.size() > static_cast<size_t>(launcher::kMaxFds - 3)) {
+    LOG("GPG: Too many descriptors for the launcher\n");
+    return NULL;
+  }
+
+  int status_pipe[2];
+  if (pipe(status_pipe) == -1) {
+    LOG("GPG: pipe failed: %s\n", std::strerror(errno));
+    return NULL;
+  }
+  SetCloseOnExec(status_pipe[0]);
+  SetCloseOnExec(status_pipe[1]);
+
+  int fds[launcher::kMaxFds + 1];
+  fds[0] = PR_FileDesc2NativeHandle(in);
+  fds[1] = PR_FileDesc2NativeHandle(out);
+  fds[2] = PR_FileDesc2NativeHandle(err);
+  for (request.nfds = 0; request.nfds < 3; request.nfds++) {
+    request.targets[request.nfds] = request.nfds;
+  }
+  for (size_t i = 0; i < inherit.size(); i++) {
+    fds[request.nfds] = PR_FileDesc2NativeHandle(inherit[i]);
+    request.targets[request.nfds] = fds[request.nfds];
+    request.nfds++;
+  }
+  fds[request.nfds] = status_pipe[1];
+
+  int32_t pid = 0;
+  PR_Lock(lock_);
+  if (socket_ != -1 || StartLocked(launcher_path)) {
+    if (!SendRequestLocked(request, strings, fds, request.nfds + 1) ||
+        !ReadFully(socket_, &pid, sizeof pid)) {
+      LOG("GPG: Lost connection to the launcher\n");
+      StopLocked();
+      pid = 0;
+    }
+  }
+  PR_Unlock(lock_);
+
+  close(status_pipe[1]);
+  if (pid <= 0) {
+    if (pid < 0) {
+      LOG("GPG: Launcher failed to start %s: %s\n", path,
+          std::strerror(-pid));
+    }
+    close(status_pipe[0]);
+    return NULL;
+  }
+
+  return new LauncherProcess(pid, status_pipe[0]);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * This file declares GpgLauncher, the plugin side of gpg-launcher (see
+ * launcher_main.cc), a small resident helper process that forks and executes
+ * gpg on behalf of the plugin.
+ *
+ * The plugin usually lives inside a browser process with a very large address
+ * space, and fork() has to copy all of its page tables before gpg can be
+ * executed. The launcher is started once, is tiny, and does the forking
+ * instead. The plugin sends it the argument vector over a UNIX domain socket,
+ * along with the file descriptors the child should use as SCM_RIGHTS ancillary
+ * data.
+ */
+
+#ifndef _GPGPLUGIN_POSIX_LAUNCHER_H_
+#define _GPGPLUGIN_POSIX_LAUNCHER_H_
+
+#include <prtypes.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+class GpgProcess;
+struct PRFileDesc;
+struct PRLock;
+
+/*
+ * The wire format shared by GpgLauncher and gpg-launcher.
+ *
+ * A request is a LaunchRequest followed by |strings_size| bytes holding the
+ * NUL-terminated path of the program to execute and then its |argc| arguments.
+ * The request carries |nfds| + 1 descriptors: the first |nfds| are installed
+ * in the child as |targets|, and the last one is the writing end of a pipe
+ * that the launcher writes the raw wait() status of the child to when it has
+ * exited.
+ *
+ * The launcher answers each request with an int32_t holding the pid of the
+ * child, or a negated errno value if it couldn't be started.
+ */
+namespace launcher {
+
+static const int32_t kMaxFds = 8;
+static const int32_t kMaxStringsSize = 64 * 1024;
+
+struct LaunchRequest {
+  int32_t nfds;
+  int32_t targets[kMaxFds];
+  int32_t argc;
+  int32_t strings_size;
+};
+
+}  // namespace launcher
+
+class GpgLauncher {
+ public:
+  /*
+   * Returns the launcher shared by all plugin instances. The gpg-launcher
+   * process itself isn't started until the first call to Launch().
+   */
+  static GpgLauncher *Instance();
+
+  /*
+   * Have the launcher execute |path| with |argv|, with the standard input,
+   * output and error of the child connected to |in|, |out| and |err|. Each
+   * of |inherit| is passed to the child as well, under the number it has in
+   * this process.
+   *
+   * If the launcher isn't running, the gpg-launcher binary at |launcher_path|
+   * is started first. If |launcher_path| is empty, gpg-launcher is looked for
+   * in the directory the plugin was loaded from.
+   *
+   * Returns NULL on failure, in which case the caller should start the process
+   * some other way.
+   */
+  GpgProcess *Launch(const std::string &launcher_path,
+                     const char *path, char *const *argv,
+                     PRFileDesc *in, PRFileDesc *out, PRFileDesc *err,
+                     const std::vector<PRFileDesc *> &inherit);
+
+  /*
+   * Stop the launcher if it's running, and wait for it to exit. It's started
+   * again by the next Launch(). Processes it has launched run on.
+   */
+  void Stop();
+
+ private:
+  GpgLauncher();
+
+  static PRStatus CreateInstance();
+  static std::string DefaultPath();
+
+  bool StartLocked(const std::string &launcher_path);
+  void StopLocked();
+  bool SendRequestLocked(const launcher::LaunchRequest &request,
+                         const std::string &strings,
+                         const int *fds, int nfds);
+
+  /* Everything below is protected by lock_. */
+  PRLock *lock_;
+  int socket_;
+  pid_t pid_;
+  /* Don't keep trying to start a launcher that isn't there. */
+  std::string failed_path_;
+};
+
+#endif  // _GPGPLUGIN_POSIX_LAUNCHER_H_
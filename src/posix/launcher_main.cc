@@ -0,0 +1,344 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * gpg-launcher: a tiny resident process that forks and executes gpg on behalf
+ * of the plugin, so that the plugin never has to fork the browser. See
+ * launcher.h for the protocol.
+ *
+ * The launcher is started by the plugin with one end of a UNIX domain socket
+ * as its standard input, and exits when the plugin closes the other end.
+ * It deliberately doesn't use NSPR or anything else that would make it larger
+ * than it needs to be.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "posix/launcher.h"
+
+using launcher::LaunchRequest;
+using launcher::kMaxFds;
+using launcher::kMaxStringsSize;
+
+static const int kSOCKET = 0;
+
+/* Written to from the SIGCHLD handler to wake up the main loop. */
+static int sigchld_pipe[2];
+
+static void SigchldHandler(int) {
+  int saved_errno = errno;
+  char c = 0;
+  if (write(sigchld_pipe[1], &c, 1) == -1) {
+    /* The pipe is full, so the main loop will wake up anyway. */
+  }
+  errno = saved_errno;
+}
+
+static void SetCloseOnExec(int fd) {
+  fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+static bool ReadFully(int fd, void *buf, size_t size) {
+  char *p = static_cast<char *>(buf);
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool WriteFully(int fd, const void *buf, size_t size) {
+  const char *p = static_cast<const char *>(buf);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/*
+ * Whatever the browser left open without FD_CLOEXEC was inherited by the
+ * launcher, and would otherwise be passed on to every gpg it starts.
+ */
+static void CloseInheritedFds() {
+  struct rlimit limit;
+  int max = 1024;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    max = static_cast<int>(limit.rlim_cur);
+  for (int fd = STDERR_FILENO + 1; fd < max; fd++) {
+    close(fd);
+  }
+}
+
+/*
+ * Receive a request and the descriptors that came with it. Returns false when
+ * the plugin has gone away.
+ */
+static bool ReceiveRequest(LaunchRequest *request, std::vector<char> *strings,
+                           std::vector<int> *fds) {
+  char control[CMSG_SPACE(sizeof(int) * (kMaxFds + 1))];
+  struct iovec iov;
+  iov.iov_base = request;
+  iov.iov_len = sizeof *request;
+
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
+
+  ssize_t n;
+  do {
+    n = recvmsg(kSOCKET, &msg, 0);
+  } while (n == -1 && errno == EINTR);
+  if (n <= 0) {
+    return false;
+  }
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int *received = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+      for (size_t i = 0; i < count; i++) {
+        SetCloseOnExec(received[i]);
+        fds->push_back(received[i]);
+      }
+    }
+  }
+
+  /* The rest of the request follows the descriptors. */
+  if (!ReadFully(kSOCKET, reinterpret_cast<char *>(request) + n,
+                 sizeof *request - n)) {
+    return false;
+  }
+  if (request->strings_size <= 0 || request->strings_size > kMaxStringsSize) {
+    return false;
+  }
+  strings->resize(request->strings_size);
+  return ReadFully(kSOCKET, &(*strings)[0], strings->size());
+}
+
+/*
+ * This runs in the child between fork() and exec().
+ */
+static void ExecChild(const LaunchRequest &request, const std::vector<int> &fds,
+                      const char *path, char *const *argv) {
+  /*
+   * First move every descriptor out of the way, so that installing one of
+   * them can't overwrite another that hasn't been installed yet, which means
+   * above every target. The copies are closed by exec(), the installed
+   * descriptors are not.
+   */
+  int moved[kMaxFds];
+  int lowest = kMaxFds + STDERR_FILENO + 1;
+  for (int i = 0; i < request.nfds; i++) {
+    if (request.targets[i] >= lowest) {
+      lowest = request.targets[i] + 1;
+    }
+  }
+  for (int i = 0; i < request.nfds; i++) {
+    moved[i] = fcntl(fds[i], F_DUPFD, lowest);
+    if (moved[i] == -1) {
+      _exit(127);
+    }
+    SetCloseOnExec(moved[i]);
+  }
+  for (int i = 0; i < request.nfds; i++) {
+    if (dup2(moved[i], request.targets[i]) == -1) {
+      _exit(127);
+    }
+  }
+
+  signal(SIGPIPE, SIG_DFL);
+  signal(SIGCHLD, SIG_DFL);
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
+
+  if (chdir("/") == -1) {
+    _exit(127);
+  }
+  execv(path, argv);
+  _exit(127);
+}
+
+static int32_t Launch(const LaunchRequest &request,
+                      const std::vector<char> &strings,
+                      const std::vector<int> &fds) {
+  if (request.nfds < 0 || request.nfds > kMaxFds ||
+      fds.size() != static_cast<size_t>(request.nfds) + 1 ||
+      request.argc <= 0 || strings.back() != '\0') {
+    return -EINVAL;
+  }
+  for (int i = 0; i < request.nfds; i++) {
+    if (request.targets[i] < 0) {
+      return -EINVAL;
+    }
+  }
+
+  const char *path = &strings[0];
+  std::vector<char *> argv;
+  for (size_t i = std::strlen(path) + 1; i < strings.size();
+       i += std::strlen(&strings[i]) + 1) {
+    argv.push_back(const_cast<char *>(&strings[i]));
+  }
+  if (argv.size() != static_cast<size_t>(request.argc)) {
+    return -EINVAL;
+  }
+  argv.push_back(NULL);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    ExecChild(request, fds, path, &argv[0]);
+  }
+  if (pid == -1) {
+    return -errno;
+  }
+  return pid;
+}
+
+/*
+ * Report the exit status of every child that has exited to the plugin.
+ */
+static void ReapChildren(std::map<pid_t, int> *status_fds) {
+  pid_t pid;
+  int status;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    std::map<pid_t, int>::iterator it = status_fds->find(pid);
+    if (it == status_fds->end()) {
+      continue;
+    }
+    int32_t raw = status;
+    WriteFully(it->second, &raw, sizeof raw);
+    close(it->second);
+    status_fds->erase(it);
+  }
+}
+
+int main() {
+  CloseInheritedFds();
+  SetCloseOnExec(kSOCKET);
+
+  if (pipe(sigchld_pipe) == -1) {
+    perror("gpg-launcher: pipe");
+    return 1;
+  }
+  for (int i = 0; i < 2; i++) {
+    SetCloseOnExec(sigchld_pipe[i]);
+    fcntl(sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+  }
+
+  /* The plugin may close a status pipe before its child has exited. */
+  signal(SIGPIPE, SIG_IGN);
+
+  struct sigaction action;
+  std::memset(&action, 0, sizeof action);
+  action.sa_handler = SigchldHandler;
+  action.sa_flags = SA_NOCLDSTOP | SA_RESTART;
+  sigaction(SIGCHLD, &action, NULL);
+
+  std::map<pid_t, int> status_fds;
+
+  for (;;) {
+    struct pollfd pfds[2] = {
+      { kSOCKET, POLLIN, 0 },
+      { sigchld_pipe[0], POLLIN, 0 },
+    };
+    if (poll(pfds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("gpg-launcher: poll");
+      return 1;
+    }
+
+    if (pfds[1].revents & POLLIN) {
+      char buf[64];
+      while (read(sigchld_pipe[0], buf, sizeof buf) > 0) {
+      }
+      ReapChildren(&status_fds);
+    }
+
+    if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      LaunchRequest request;
+      std::vector<char> strings;
+      std::vector<int> fds;
+      if (!ReceiveRequest(&request, &strings, &fds)) {
+        break;
+      }
+      int32_t pid = Launch(request, strings, fds);
+      /*
+       * The child has its own copies now, except for the status pipe which
+       * is kept until the child has been reaped.
+       */
+      for (size_t i = 0; i + 1 < fds.size(); i++) {
+        close(fds[i]);
+      }
+      if (pid > 0) {
+        status_fds[pid] = fds.back();
+      } else if (!fds.empty()) {
+        close(fds.back());
+      }
+      if (!WriteFully(kSOCKET, &pid, sizeof pid)) {
+        break;
+      }
+    }
+  }
+
+  return 0;
+}
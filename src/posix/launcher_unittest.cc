@@ -0,0 +1,238 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <prio.h>
+#include <private/pprio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gpgprocess.h"
+#include "posix/launcher.h"
+#include "prstrms.h"
+
+namespace {
+
+/*
+ * The unit test is run from the build directory, where gpg-launcher is built.
+ */
+static const std::string kLAUNCHER = "./gpg-launcher";
+
+/*
+ * Run a shell command through the launcher and collect its output.
+ */
+bool RunThroughLauncher(const char *command, std::string *output,
+                        int *exit_code) {
+  PRFileDesc *in[2], *out[2];
+  if (PR_CreatePipe(&in[0], &in[1]) == PR_FAILURE ||
+      PR_CreatePipe(&out[0], &out[1]) == PR_FAILURE) {
+    return false;
+  }
+
+  const char *argv[] = { "sh", "-c", command, NULL };
+  GpgProcess *process = GpgLauncher::Instance()->Launch(
+      kLAUNCHER, "/bin/sh", const_cast<char *const *>(argv),
+      in[0], out[1], out[1], std::vector<PRFileDesc *>());
+  PR_Close(in[0]);
+  PR_Close(out[1]);
+  PR_Close(in[1]);
+  if (process == NULL) {
+    PR_Close(out[0]);
+    return false;
+  }
+
+  PRifstream stream(out[0]);
+  std::string line;
+  while (std::getline(stream, line)) {
+    output->append(line + "\n");
+  }
+  bool waited = process->Wait(exit_code);
+  delete process;
+  return waited;
+}
+
+TEST(GpgLauncherTest, RunsProcess) {
+  std::string output;
+  int exit_code = -1;
+  ASSERT_TRUE(RunThroughLauncher("echo hello", &output, &exit_code));
+  EXPECT_EQ("hello\n", output);
+  EXPECT_EQ(0, exit_code);
+}
+
+TEST(GpgLauncherTest, ReportsExitCode) {
+  std::string output;
+  int exit_code = -1;
+  ASSERT_TRUE(RunThroughLauncher("exit 3", &output, &exit_code));
+  EXPECT_EQ(3, exit_code);
+}
+
+/*
+ * The descriptors are passed to the child in order, even when the numbers
+ * they have in the launcher collide with the ones they get in the child.
+ */
+TEST(GpgLauncherTest, ConnectsStdio) {
+  std::string output;
+  int exit_code = -1;
+  ASSERT_TRUE(RunThroughLauncher("echo out; echo err >&2; read x || echo eof",
+                                 &output, &exit_code));
+  EXPECT_EQ("out\nerr\neof\n", output);
+}
+
+/*
+ * Other descriptors keep their numbers, even ones that are above where the
+ * launcher moves descriptors to while installing them.
+ */
+TEST(GpgLauncherTest, PassesInheritedDescriptors) {
+  PRFileDesc *null = PR_Open("/dev/null", PR_RDWR, 0);
+  PRFileDesc *extra[2];
+  ASSERT_TRUE(null != NULL);
+  ASSERT_EQ(PR_SUCCESS, PR_CreatePipe(&extra[0], &extra[1]));
+  int fd = PR_FileDesc2NativeHandle(extra[1]);
+  int high = fcntl(fd, F_DUPFD, 40);
+  ASSERT_NE(-1, high);
+  PRFileDesc *high_pipe = PR_ImportPipe(high);
+  ASSERT_TRUE(high_pipe != NULL);
+
+  char command[64];
+  std::snprintf(command, sizeof command,
+                "echo low >/dev/fd/%d; echo high >/dev/fd/%d", fd, high);
+  const char *argv[] = { "sh", "-c", command, NULL };
+  std::vector<PRFileDesc *> inherit;
+  inherit.push_back(extra[1]);
+  inherit.push_back(high_pipe);
+  GpgProcess *process = GpgLauncher::Instance()->Launch(
+      kLAUNCHER, "/bin/sh", const_cast<char *const *>(argv),
+      null, null, null, inherit);
+  PR_Close(null);
+  PR_Close(extra[1]);
+  PR_Close(high_pipe);
+  ASSERT_TRUE(process != NULL);
+
+  PRifstream stream(extra[0]);
+  std::string line, output;
+  while (std::getline(stream, line)) {
+    output.append(line + "\n");
+  }
+  int exit_code = -1;
+  EXPECT_TRUE(process->Wait(&exit_code));
+  EXPECT_EQ(0, exit_code);
+  EXPECT_EQ("low\nhigh\n", output);
+  delete process;
+}
+
+TEST(GpgLauncherTest, FailsForMissingProgram) {
+  PRFileDesc *null = PR_Open("/dev/null", PR_RDWR, 0);
+  ASSERT_TRUE(null != NULL);
+  const char *argv[] = { "missing", NULL };
+  GpgProcess *process = GpgLauncher::Instance()->Launch(
+      kLAUNCHER, "/nonexistent/missing", const_cast<char *const *>(argv),
+      null, null, null, std::vector<PRFileDesc *>());
+  PR_Close(null);
+  ASSERT_TRUE(process != NULL);
+  int exit_code = -1;
+  EXPECT_TRUE(process->Wait(&exit_code));
+  EXPECT_EQ(127, exit_code);
+  delete process;
+}
+
+/*
+ * Have the launcher be a shell script that runs |command| in place of the
+ * protocol, and try to launch through it, which fails. The pid of the script
+ * is returned.
+ */
+pid_t LaunchThroughFakeLauncher(const std::string &command) {
+  char script[] = "/tmp/gpg-launcher-test-XXXXXX";
+  int fd = mkstemp(script);
+  if (fd == -1) {
+    return -1;
+  }
+  close(fd);
+  std::string pid_file = std::string(script) + ".pid";
+  {
+    std::ofstream out(script);
+    out << "#!/bin/sh\necho $$ > " << pid_file << "\n" << command << "\n";
+  }
+  chmod(script, 0700);
+
+  GpgLauncher::Instance()->Stop();
+  PRFileDesc *null = PR_Open("/dev/null", PR_RDWR, 0);
+  const char *argv[] = { "true", NULL };
+  GpgProcess *process = GpgLauncher::Instance()->Launch(
+      script, "/bin/true", const_cast<char *const *>(argv),
+      null, null, null, std::vector<PRFileDesc *>());
+  PR_Close(null);
+  delete process;
+  EXPECT_TRUE(process == NULL);
+
+  pid_t pid = -1;
+  std::ifstream in(pid_file.c_str());
+  in >> pid;
+  unlink(script);
+  unlink(pid_file.c_str());
+  return pid;
+}
+
+/* Whether |pid| is gone, zombie and all. */
+bool IsReaped(pid_t pid) {
+  return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+/*
+ * A launcher that is lost is waited for, so that it isn't left behind as a
+ * zombie, even if it takes a moment to exit.
+ */
+TEST(GpgLauncherTest, ReapsLostLauncher) {
+  pid_t pid = LaunchThroughFakeLauncher("exec 0<&-; exec sleep 0.2");
+  ASSERT_GT(pid, 0);
+  EXPECT_TRUE(IsReaped(pid));
+}
+
+/* One that doesn't exit on its own is killed. */
+TEST(GpgLauncherTest, KillsLauncherThatStaysAround) {
+  pid_t pid = LaunchThroughFakeLauncher("exec 0<&-; exec sleep 30");
+  ASSERT_GT(pid, 0);
+  EXPECT_TRUE(IsReaped(pid));
+}
+
+/* Launching after Stop() starts the launcher again. */
+TEST(GpgLauncherTest, RestartsAfterStop) {
+  GpgLauncher::Instance()->Stop();
+  std::string output;
+  int exit_code = -1;
+  ASSERT_TRUE(RunThroughLauncher("echo again", &output, &exit_code));
+  EXPECT_EQ("again\n", output);
+}
+
+}  /* namespace */
@@ -0,0 +1,253 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "posix/pump.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <prerror.h>
+#include <prio.h>
+#include <private/pprio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "logging.h"
+#include "outputwatcher.h"
+
+/* How much is read or written at a time, the size of a Linux pipe buffer. */
+static const size_t kPUMP_CHUNK = 64 * 1024;
+
+static bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    LOG("GPG: fcntl failed: %s\n", std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+GpgPipePump::GpgPipePump()
+    : exit_fd_(-1) {
+}
+
+GpgPipePump::~GpgPipePump() {
+  for (size_t i = 0; i < inputs_.size(); i++) {
+    CloseInput(&inputs_[i]);
+  }
+}
+
+void GpgPipePump::AddInput(PRFileDesc *pipe, const std::string &data) {
+  Input input = { pipe, &data, 0 };
+  inputs_.push_back(input);
+}
+
+void GpgPipePump::AddOutput(PRFileDesc *pipe, std::string *data,
+                            GpgOutputWatcher *watcher) {
+  Output output = { pipe, data, NULL, watcher, false };
+  outputs_.push_back(output);
+}
+
+void GpgPipePump::AddOutput(PRFileDesc *pipe, SecureString *data) {
+  Output output = { pipe, NULL, data, NULL, false };
+  outputs_.push_back(output);
+}
+
+void GpgPipePump::SetExitFd(int exit_fd) {
+  exit_fd_ = exit_fd;
+}
+
+void GpgPipePump::CloseInput(Input *input) {
+  if (input->pipe != NULL && PR_Close(input->pipe) == PR_FAILURE) {
+    LOG("GPG: PR_Close failed: %d\n", PR_GetError());
+  }
+  input->pipe = NULL;
+}
+
+void GpgPipePump::Append(Output *output, const char *data, size_t size) {
+  if (output->secure_data != NULL) {
+    output->secure_data->append(data, size);
+    return;
+  }
+  output->data->append(data, size);
+  if (output->watcher != NULL) {
+    output->watcher->Grew(*output->data);
+  }
+}
+
+bool GpgPipePump::Drain(Output *output, std::vector<char> *buffer) {
+  for (;;) {
+    ssize_t n = read(PR_FileDesc2NativeHandle(output->pipe), &(*buffer)[0],
+                     buffer->size());
+    if (n > 0) {
+      Append(output, &(*buffer)[0], n);
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && errno != EAGAIN) {
+      LOG("GPG: read failed: %s\n", std::strerror(errno));
+      return false;
+    } else {
+      output->done = true;
+      return true;
+    }
+  }
+}
+
+bool GpgPipePump::Run() {
+  bool ok = true;
+  for (size_t i = 0; i < inputs_.size(); i++) {
+    if (inputs_[i].data->empty()) {
+      CloseInput(&inputs_[i]);
+    } else if (!SetNonBlocking(PR_FileDesc2NativeHandle(inputs_[i].pipe))) {
+      ok = false;
+    }
+  }
+  for (size_t i = 0; i < outputs_.size(); i++) {
+    if (!SetNonBlocking(PR_FileDesc2NativeHandle(outputs_[i].pipe))) {
+      ok = false;
+    }
+  }
+
+  /*
+   * Writing to a pipe that the process has closed raises SIGPIPE, which would
+   * take the browser down unless it ignores it. Block it on this thread while
+   * writing, and take a SIGPIPE that writing raised off again afterwards.
+   */
+  sigset_t sigpipe, old_mask, pending;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+  sigpending(&pending);
+  bool was_pending = sigismember(&pending, SIGPIPE);
+  bool broken = false;
+  bool exited = false;
+
+  std::vector<struct pollfd> fds;
+  std::vector<size_t> owners;
+  std::vector<char> buffer(kPUMP_CHUNK);
+  while (ok) {
+    fds.clear();
+    owners.clear();
+    for (size_t i = 0; i < inputs_.size(); i++) {
+      if (inputs_[i].pipe != NULL) {
+        struct pollfd fd = { PR_FileDesc2NativeHandle(inputs_[i].pipe),
+                             POLLOUT, 0 };
+        fds.push_back(fd);
+        owners.push_back(i);
+      }
+    }
+    size_t first_output = fds.size();
+    for (size_t i = 0; i < outputs_.size(); i++) {
+      if (!outputs_[i].done) {
+        struct pollfd fd = { PR_FileDesc2NativeHandle(outputs_[i].pipe),
+                             POLLIN, 0 };
+        fds.push_back(fd);
+        owners.push_back(i);
+      }
+    }
+    if (fds.empty()) {
+      break;
+    }
+    size_t exit_index = fds.size();
+    if (exit_fd_ != -1) {
+      struct pollfd fd = { exit_fd_, POLLIN, 0 };
+      fds.push_back(fd);
+      owners.push_back(0);
+    }
+
+    if (poll(&fds[0], fds.size(), -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG("GPG: poll failed: %s\n", std::strerror(errno));
+      ok = false;
+      break;
+    }
+
+    for (size_t j = 0; j < fds.size() && ok; j++) {
+      if (fds[j].revents == 0) {
+        continue;
+      }
+      if (j == exit_index) {
+        exited = true;
+      } else if (j < first_output) {
+        Input *input = &inputs_[owners[j]];
+        size_t left = input->data->size() - input->written;
+        ssize_t n = write(fds[j].fd, input->data->data() + input->written,
+                          left < kPUMP_CHUNK ? left : kPUMP_CHUNK);
+        if (n > 0) {
+          input->written += n;
+          if (input->written == input->data->size()) {
+            CloseInput(input);
+          }
+        } else if (n == -1 && errno == EPIPE) {
+          broken = true;
+          CloseInput(input);
+        } else if (n == -1 && errno != EAGAIN && errno != EINTR) {
+          LOG("GPG: write failed: %s\n", std::strerror(errno));
+          ok = false;
+        }
+      } else {
+        Output *output = &outputs_[owners[j]];
+        ssize_t n = read(fds[j].fd, &buffer[0], buffer.size());
+        if (n > 0) {
+          Append(output, &buffer[0], n);
+        } else if (n == 0) {
+          output->done = true;
+        } else if (errno != EAGAIN && errno != EINTR) {
+          LOG("GPG: read failed: %s\n", std::strerror(errno));
+          ok = false;
+        }
+      }
+    }
+
+    if (exited && ok) {
+      /* Everything the process wrote before it exited is in the pipes now. */
+      for (size_t i = 0; i < outputs_.size() && ok; i++) {
+        if (!outputs_[i].done) {
+          ok = Drain(&outputs_[i], &buffer);
+        }
+      }
+      for (size_t i = 0; i < inputs_.size(); i++) {
+        CloseInput(&inputs_[i]);
+      }
+      break;
+    }
+  }
+
+  if (broken && !was_pending) {
+    sigpending(&pending);
+    if (sigismember(&pending, SIGPIPE)) {
+      int signal;
+      sigwait(&sigpipe, &signal);
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+  return ok;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * This file declares GpgPipePump, which moves data in and out of the pipes to
+ * a process at the same time.
+ *
+ * A process that reads its input and writes its output as it goes blocks once
+ * a pipe it writes to is full, so writing all of its input before reading any
+ * of its output can deadlock as soon as either is larger than a pipe buffer.
+ * The pump puts its ends of the pipes in non-blocking mode and serves
+ * whichever of them is ready with poll().
+ *
+ * It can also be told when the process has exited (see SetExitFd()). Whatever
+ * is left in the pipes then is all there is, so something the process started
+ * that holds on to them can't keep the pump waiting for their end.
+ */
+
+#ifndef _GPGPLUGIN_POSIX_PUMP_H_
+#define _GPGPLUGIN_POSIX_PUMP_H_
+
+#include <string>
+#include <vector>
+
+#include "securemem.h"
+
+class GpgOutputWatcher;
+struct PRFileDesc;
+
+class GpgPipePump {
+ public:
+  GpgPipePump();
+
+  /* Closes the inputs that haven't been closed by Run(). */
+  ~GpgPipePump();
+
+  /*
+   * Write |data| to |pipe| and then close it, so that the process sees the end
+   * of its input. Takes ownership of |pipe|. |data| must outlive Run().
+   */
+  void AddInput(PRFileDesc *pipe, const std::string &data);
+
+  /*
+   * Append what can be read from |pipe| to |data|, up to the end of it, and
+   * tell |watcher| (unless it's NULL) each time it has grown.
+   */
+  void AddOutput(PRFileDesc *pipe, std::string *data,
+                 GpgOutputWatcher *watcher = NULL);
+  /* The same for output that may be plain text, such as decrypted data. */
+  void AddOutput(PRFileDesc *pipe, SecureString *data);
+
+  /*
+   * Stop once |exit_fd| has become readable, which it does when the process
+   * exits (see GpgProcess::ExitFd()), and the outputs have been emptied. What
+   * hasn't been written of the inputs by then is dropped. Nothing is read
+   * from |exit_fd|, and -1 means there's none.
+   */
+  void SetExitFd(int exit_fd);
+
+  /*
+   * Move the data until every input has been written and every output has
+   * come to its end. A process that stops reading an input before its end
+   * (by closing it or by exiting) isn't an error, the rest of that input is
+   * dropped. Returns false if reading or writing failed otherwise.
+   */
+  bool Run();
+
+ private:
+  struct Input {
+    PRFileDesc *pipe;
+    const std::string *data;
+    size_t written;
+  };
+
+  /* One of |data| and |secure_data| is NULL. */
+  struct Output {
+    PRFileDesc *pipe;
+    std::string *data;
+    SecureString *secure_data;
+    GpgOutputWatcher *watcher;
+    bool done;
+  };
+
+  void CloseInput(Input *input);
+  /* Append |size| bytes at |data| to |output|. */
+  void Append(Output *output, const char *data, size_t size);
+  /* Read what's left in |output| once the process has exited. */
+  bool Drain(Output *output, std::vector<char> *buffer);
+
+  std::vector<Input> inputs_;
+  std::vector<Output> outputs_;
+  int exit_fd_;
+};
+
+#endif  // _GPGPLUGIN_POSIX_PUMP_H_
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <prinrval.h>
+#include <prio.h>
+#include <private/pprio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gpgprocess.h"
+#include "outputwatcher.h"
+#include "posix/pump.h"
+#include "posix/spawn.h"
+
+namespace {
+
+void SetBlocking(PRFileDesc *pipe) {
+  int fd = PR_FileDesc2NativeHandle(pipe);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+}
+
+/* Keeps each size that the output it's told about has grown to. */
+class SizeWatcher : public GpgOutputWatcher {
+ public:
+  virtual void Grew(const std::string &output) {
+    sizes.push_back(output.size());
+  }
+
+  std::vector<size_t> sizes;
+};
+
+/*
+ * Run a shell command with |input| on its standard input, and collect its
+ * standard output and error separately through a GpgPipePump, telling
+ * |watcher| (unless it's NULL) about the output.
+ */
+bool PumpThrough(const char *command, const std::string &input,
+                 std::string *output, std::string *error,
+                 GpgOutputWatcher *watcher = NULL) {
+  PRFileDesc *in[2], *out[2], *err[2];
+  if (PR_CreatePipe(&in[0], &in[1]) == PR_FAILURE ||
+      PR_CreatePipe(&out[0], &out[1]) == PR_FAILURE ||
+      PR_CreatePipe(&err[0], &err[1]) == PR_FAILURE) {
+    return false;
+  }
+  PR_SetFDInheritable(in[1], PR_FALSE);
+  PR_SetFDInheritable(out[0], PR_FALSE);
+  PR_SetFDInheritable(err[0], PR_FALSE);
+  /* NSPR makes pipes non-blocking, which cat doesn't expect. */
+  SetBlocking(in[0]);
+  SetBlocking(out[1]);
+  SetBlocking(err[1]);
+
+  const char *argv[] = { "sh", "-c", command, NULL };
+  GpgProcess *process = CreateProcessPosixSpawn(
+      "/bin/sh", const_cast<char *const *>(argv), in[0], out[1], err[1]);
+  PR_Close(in[0]);
+  PR_Close(out[1]);
+  PR_Close(err[1]);
+  if (process == NULL) {
+    PR_Close(in[1]);
+    PR_Close(out[0]);
+    PR_Close(err[0]);
+    return false;
+  }
+
+  bool ok;
+  {
+    GpgPipePump pump;
+    pump.AddInput(in[1], input);
+    pump.AddOutput(out[0], output, watcher);
+    pump.AddOutput(err[0], error);
+    ok = pump.Run();
+  }
+  PR_Close(out[0]);
+  PR_Close(err[0]);
+  int exit_code;
+  ok = process->Wait(&exit_code) && ok;
+  delete process;
+  return ok;
+}
+
+/*
+ * More than fits into the pipes at once in either direction, which would
+ * deadlock if the input was written before the output was read.
+ */
+TEST(GpgPipePumpTest, MovesMoreThanPipeBuffers) {
+  std::string input;
+  for (int i = 0; input.size() < 4 * 1024 * 1024; i++) {
+    input.append(1, static_cast<char>('a' + i % 26));
+  }
+  std::string output, error;
+  ASSERT_TRUE(PumpThrough("cat; cat /dev/null >&2", input, &output, &error));
+  EXPECT_TRUE(input == output);
+  EXPECT_EQ("", error);
+}
+
+TEST(GpgPipePumpTest, ReadsEachOutput) {
+  std::string output, error;
+  ASSERT_TRUE(PumpThrough("cat; echo done >&2", "in\n", &output, &error));
+  EXPECT_EQ("in\n", output);
+  EXPECT_EQ("done\n", error);
+}
+
+/*
+ * A process that exits without reading all of its input doesn't take this
+ * process down with SIGPIPE.
+ */
+TEST(GpgPipePumpTest, DropsInputThatIsNotRead) {
+  std::string input(1024 * 1024, 'x');
+  std::string output, error;
+  ASSERT_TRUE(PumpThrough("echo early", input, &output, &error));
+  EXPECT_EQ("early\n", output);
+}
+
+TEST(GpgPipePumpTest, ClosesEmptyInput) {
+  std::string output, error;
+  ASSERT_TRUE(PumpThrough("cat; echo eof", "", &output, &error));
+  EXPECT_EQ("eof\n", output);
+}
+
+/* The watcher hears about the output as it comes, not only at the end. */
+TEST(GpgPipePumpTest, WatchesOutputAsItGrows) {
+  std::string output, error;
+  SizeWatcher watcher;
+  ASSERT_TRUE(PumpThrough("echo one; sleep 1; echo two", "", &output, &error,
+                          &watcher));
+  EXPECT_EQ("one\ntwo\n", output);
+  ASSERT_EQ(2U, watcher.sizes.size());
+  EXPECT_EQ(4U, watcher.sizes[0]);
+  EXPECT_EQ(8U, watcher.sizes[1]);
+}
+
+/*
+ * Once the process has exited, what's in the pipe is all there is, even if
+ * its end is still open somewhere.
+ */
+TEST(GpgPipePumpTest, StopsAtExit) {
+  PRFileDesc *out[2];
+  ASSERT_EQ(PR_SUCCESS, PR_CreatePipe(&out[0], &out[1]));
+  ASSERT_EQ(4, PR_Write(out[1], "left", 4));
+  int exit_fds[2];
+  ASSERT_EQ(0, pipe(exit_fds));
+  ASSERT_EQ(1, write(exit_fds[1], "x", 1));
+
+  std::string output;
+  {
+    GpgPipePump pump;
+    pump.AddOutput(out[0], &output);
+    pump.SetExitFd(exit_fds[0]);
+    EXPECT_TRUE(pump.Run());
+  }
+  EXPECT_EQ("left", output);
+  close(exit_fds[0]);
+  close(exit_fds[1]);
+  PR_Close(out[0]);
+  PR_Close(out[1]);
+}
+
+/* Plain text can be read into secure memory instead. */
+TEST(GpgPipePumpTest, ReadsIntoSecureString) {
+  PRFileDesc *out[2];
+  ASSERT_EQ(PR_SUCCESS, PR_CreatePipe(&out[0], &out[1]));
+  ASSERT_EQ(5, PR_Write(out[1], "plain", 5));
+  PR_Close(out[1]);
+
+  SecureString output = "kept ";
+  {
+    GpgPipePump pump;
+    pump.AddOutput(out[0], &output);
+    EXPECT_TRUE(pump.Run());
+  }
+  EXPECT_EQ("kept plain", output);
+  PR_Close(out[0]);
+}
+
+#ifdef OS_LINUX
+/*
+ * Something that the process leaves running with its output shouldn't keep
+ * the pump waiting.
+ */
+TEST(GpgPipePumpTest, DoesNotWaitForGrandchildren) {
+  PRFileDesc *in[2], *out[2];
+  ASSERT_EQ(PR_SUCCESS, PR_CreatePipe(&in[0], &in[1]));
+  ASSERT_EQ(PR_SUCCESS, PR_CreatePipe(&out[0], &out[1]));
+  PR_SetFDInheritable(in[1], PR_FALSE);
+  PR_SetFDInheritable(out[0], PR_FALSE);
+  SetBlocking(in[0]);
+  SetBlocking(out[1]);
+
+  /* The shell waits for its input to end so that it can't exit too soon. */
+  const char *argv[] = { "sh", "-c", "echo hi; sleep 10 & read x", NULL };
+  GpgProcess *process = CreateProcessPosixSpawn(
+      "/bin/sh", const_cast<char *const *>(argv), in[0], out[1], out[1]);
+  PR_Close(in[0]);
+  PR_Close(out[1]);
+  ASSERT_TRUE(process != NULL);
+  ASSERT_NE(-1, process->ExitFd());
+
+  PRIntervalTime start = PR_IntervalNow();
+  std::string output;
+  {
+    GpgPipePump pump;
+    pump.AddInput(in[1], "");
+    pump.AddOutput(out[0], &output);
+    pump.SetExitFd(process->ExitFd());
+    EXPECT_TRUE(pump.Run());
+  }
+  EXPECT_EQ("hi\n", output);
+  EXPECT_GT(5U, PR_IntervalToSeconds(PR_IntervalNow() - start));
+  int exit_code;
+  EXPECT_TRUE(process->Wait(&exit_code));
+  delete process;
+  PR_Close(out[0]);
+}
+#endif
+
+}  /* namespace */
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "posix/spawn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pratom.h>
+#include <prio.h>
+#include <private/pprio.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "gpgprocess.h"
+#include "logging.h"
+
+extern char **environ;
+
+/* See PosixSpawnChildren(). */
+static PRInt32 children = 0;
+
+#ifdef OS_LINUX
+/*
+ * A pidfd for |pid|, or -1 if the kernel doesn't have them or the process is
+ * already gone.
+ */
+static int OpenPidFd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  int fd = syscall(SYS_pidfd_open, pid, 0);
+  if (fd == -1) {
+    LOG("GPG: pidfd_open failed: %s\n", std::strerror(errno));
+    return -1;
+  }
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+    LOG("GPG: fcntl failed: %s\n", std::strerror(errno));
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+#endif
+
+/*
+ * A gpg child started by posix_spawn().
+ */
+class SpawnedProcess : public GpgProcess {
+ public:
+  explicit SpawnedProcess(pid_t pid)
+      : pid_(pid),
+        exit_fd_(-1) {
+    PR_ATOMIC_INCREMENT(&children);
+  }
+
+  /*
+   * There's no way to detach a child, so one that was never waited on is
+   * killed and reaped here rather than left behind as a zombie.
+   */
+  virtual ~SpawnedProcess() {
+    if (pid_ != -1) {
+      int ret;
+      Kill();
+      Wait(&ret);
+    }
+  }
+
+  virtual bool Wait(int *exit_code) {
+    int status;
+    pid_t ret;
+    if (exit_fd_ != -1) {
+      close(exit_fd_);
+      exit_fd_ = -1;
+    }
+    do {
+      ret = waitpid(pid_, &status, 0);
+    } while (ret == -1 && errno == EINTR);
+    pid_ = -1;
+    PR_ATOMIC_DECREMENT(&children);
+    if (ret == -1 && errno == ECHILD) {
+      /*
+       * Something else reaped the process, which is what NSPR does once
+       * PR_CreateProcess() has been used. StartGpg() doesn't use it while
+       * there are any of these, so this shouldn't happen.
+       */
+      LOG("GPG: gpg was reaped elsewhere\n");
+      *exit_code = kEXIT_UNKNOWN;
+      return true;
+    }
+    if (ret == -1) {
+      LOG("GPG: waitpid failed: %s\n", std::strerror(errno));
+      return false;
+    }
+    /* This is how NSPR reports the exit code of a PRProcess. */
+    *exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return true;
+  }
+
+  virtual bool Terminate() {
+    return Signal(SIGTERM);
+  }
+
+  virtual bool Kill() {
+    return Signal(SIGKILL);
+  }
+
+  virtual int ExitFd() {
+#ifdef OS_LINUX
+    if (exit_fd_ == -1 && pid_ != -1) {
+      exit_fd_ = OpenPidFd(pid_);
+    }
+#endif
+    return exit_fd_;
+  }
+
+ private:
+  bool Signal(int signal) {
+    if (pid_ == -1) {
+      return false;
+    }
+    if (kill(pid_, signal) == -1) {
+      LOG("GPG: kill failed: %s\n", std::strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  pid_t pid_;
+  int exit_fd_;
+};
+
+GpgProcess *CreateProcessPosixSpawn(const char *path,
+                                    char *const *argv,
+                                    PRFileDesc *in,
+                                    PRFileDesc *out,
+                                    PRFileDesc *err) {
+  PRFileDesc *stdio[3] = { in, out, err };
+  int fds[3] = { -1, -1, -1 };
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t signals;
+  short flags;
+  pid_t pid;
+  int ret;
+  int i;
+  GpgProcess *process = NULL;
+
+  /*
+   * The file actions are carried out in order, so a descriptor that already
+   * is 0, 1 or 2 could be overwritten before it's been installed. Use copies
+   * that are out of the way instead, and that the child won't inherit.
+   */
+  for (i = 0; i < 3; i++) {
+    fds[i] = fcntl(PR_FileDesc2NativeHandle(stdio[i]), F_DUPFD_CLOEXEC, 3);
+    if (fds[i] == -1) {
+      LOG("GPG: fcntl failed: %s\n", std::strerror(errno));
+      goto cleanup_fds;
+    }
+  }
+
+  ret = posix_spawn_file_actions_init(&actions);
+  if (ret != 0) {
+    LOG("GPG: posix_spawn_file_actions_init failed: %s\n",
+        std::strerror(ret));
+    goto cleanup_fds;
+  }
+  ret = posix_spawnattr_init(&attr);
+  if (ret != 0) {
+    LOG("GPG: posix_spawnattr_init failed: %s\n", std::strerror(ret));
+    goto cleanup_actions;
+  }
+
+  for (i = 0; i < 3; i++) {
+    ret = posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+    if (ret != 0) {
+      LOG("GPG: posix_spawn_file_actions_adddup2 failed: %s\n",
+          std::strerror(ret));
+      goto cleanup_attr;
+    }
+  }
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 29)
+  ret = posix_spawn_file_actions_addchdir_np(&actions, "/");
+  if (ret != 0) {
+    LOG("GPG: posix_spawn_file_actions_addchdir_np failed: %s\n",
+        std::strerror(ret));
+    goto cleanup_attr;
+  }
+#endif
+
+  /*
+   * The thread we're called on may have signals blocked, and gpg would
+   * inherit that mask. Signals the browser catches are reset to their
+   * default by exec in any case.
+   */
+  flags = POSIX_SPAWN_SETSIGMASK;
+#ifdef POSIX_SPAWN_USEVFORK
+  /* Only needed by glibc older than 2.24, newer ones always do this. */
+  flags |= POSIX_SPAWN_USEVFORK;
+#endif
+  sigemptyset(&signals);
+  if ((ret = posix_spawnattr_setflags(&attr, flags)) != 0 ||
+      (ret = posix_spawnattr_setsigmask(&attr, &signals)) != 0) {
+    LOG("GPG: posix_spawnattr_set failed: %s\n", std::strerror(ret));
+    goto cleanup_attr;
+  }
+
+  ret = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+  if (ret != 0) {
+    LOG("GPG: posix_spawn failed: %s\n", std::strerror(ret));
+    goto cleanup_attr;
+  }
+  process = new SpawnedProcess(pid);
+
+ cleanup_attr:
+  posix_spawnattr_destroy(&attr);
+ cleanup_actions:
+  posix_spawn_file_actions_destroy(&actions);
+ cleanup_fds:
+  for (i = 0; i < 3; i++) {
+    if (fds[i] != -1) {
+      close(fds[i]);
+    }
+  }
+  return process;
+}
+
+int PosixSpawnChildren() {
+  return PR_ATOMIC_ADD(&children, 0);
+}
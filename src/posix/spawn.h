@@ -0,0 +1,62 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * This file declares CreateProcessPosixSpawn(), which starts gpg with
+ * posix_spawn() instead of the fork() and exec used by PR_CreateProcess().
+ *
+ * fork() has to copy the page tables of the whole browser before gpg can be
+ * executed. glibc implements posix_spawn() with clone(CLONE_VM | CLONE_VFORK),
+ * so the child borrows the address space of the plugin until exec and nothing
+ * is copied no matter how large the browser is.
+ */
+
+#ifndef _GPGPLUGIN_POSIX_SPAWN_H_
+#define _GPGPLUGIN_POSIX_SPAWN_H_
+
+class GpgProcess;
+struct PRFileDesc;
+
+/*
+ * Execute |path| with |argv| and with |in|, |out| and |err| as its standard
+ * input, output and error, in the root directory. Returns NULL if the process
+ * couldn't be created or if exec failed.
+ */
+GpgProcess *CreateProcessPosixSpawn(const char *path,
+                                    char *const *argv,
+                                    PRFileDesc *in,
+                                    PRFileDesc *out,
+                                    PRFileDesc *err);
+
+/*
+ * How many of the processes that CreateProcessPosixSpawn() started haven't
+ * been waited on yet. Their pids are only theirs as long as nothing else
+ * reaps children with waitpid(-1), as NSPR does once PR_CreateProcess() has
+ * been used.
+ */
+int PosixSpawnChildren();
+
+#endif  // _GPGPLUGIN_POSIX_SPAWN_H_
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+#include <prio.h>
+#include <sys/wait.h>
+
+#include <string>
+
+#include "gpgprocess.h"
+#include "posix/spawn.h"
+#include "prstrms.h"
+
+namespace {
+
+/*
+ * Run a shell command with CreateProcessPosixSpawn() and collect its output.
+ */
+bool RunWithPosixSpawn(const char *command, std::string *output,
+                       int *exit_code) {
+  PRFileDesc *in[2], *out[2];
+  if (PR_CreatePipe(&in[0], &in[1]) == PR_FAILURE ||
+      PR_CreatePipe(&out[0], &out[1]) == PR_FAILURE) {
+    return false;
+  }
+  PR_SetFDInheritable(in[1], PR_FALSE);
+  PR_SetFDInheritable(out[0], PR_FALSE);
+
+  const char *argv[] = { "sh", "-c", command, NULL };
+  GpgProcess *process = CreateProcessPosixSpawn(
+      "/bin/sh", const_cast<char *const *>(argv), in[0], out[1], out[1]);
+  PR_Close(in[0]);
+  PR_Close(out[1]);
+  PR_Close(in[1]);
+  if (process == NULL) {
+    PR_Close(out[0]);
+    return false;
+  }
+
+  PRifstream stream(out[0]);
+  std::string line;
+  while (std::getline(stream, line)) {
+    output->append(line + "\n");
+  }
+  bool waited = process->Wait(exit_code);
+  delete process;
+  return waited;
+}
+
+TEST(CreateProcessPosixSpawnTest, RunsProcess) {
+  std::string output;
+  int exit_code = -1;
+  ASSERT_TRUE(RunWithPosixSpawn("echo hello", &output, &exit_code));
+  EXPECT_EQ("hello\n", output);
+  EXPECT_EQ(0, exit_code);
+}
+
+TEST(CreateProcessPosixSpawnTest, ReportsExitCode) {
+  std::string output;
+  int exit_code = -1;
+  ASSERT_TRUE(RunWithPosixSpawn("exit 3", &output, &exit_code));
+  EXPECT_EQ(3, exit_code);
+}
+
+TEST(CreateProcessPosixSpawnTest, ConnectsStdio) {
+  std::string output;
+  int exit_code = -1;
+  ASSERT_TRUE(RunWithPosixSpawn("echo out; echo err >&2; read x || echo eof",
+                                &output, &exit_code));
+  EXPECT_EQ("out\nerr\neof\n", output);
+}
+
+TEST(CreateProcessPosixSpawnTest, FailsForMissingProgram) {
+  PRFileDesc *null = PR_Open("/dev/null", PR_RDWR, 0);
+  ASSERT_TRUE(null != NULL);
+  const char *argv[] = { "missing", NULL };
+  GpgProcess *process = CreateProcessPosixSpawn(
+      "/nonexistent/missing", const_cast<char *const *>(argv),
+      null, null, null);
+  PR_Close(null);
+  EXPECT_TRUE(process == NULL);
+}
+
+TEST(CreateProcessPosixSpawnTest, TerminatesProcess) {
+  PRFileDesc *null = PR_Open("/dev/null", PR_RDWR, 0);
+  ASSERT_TRUE(null != NULL);
+  const char *argv[] = { "sleep", "60", NULL };
+  GpgProcess *process = CreateProcessPosixSpawn(
+      "/bin/sleep", const_cast<char *const *>(argv), null, null, null);
+  PR_Close(null);
+  ASSERT_TRUE(process != NULL);
+  EXPECT_TRUE(process->Terminate());
+  int exit_code = 0;
+  EXPECT_TRUE(process->Wait(&exit_code));
+  EXPECT_EQ(-1, exit_code);
+  delete process;
+}
+
+/*
+ * A process counts as running until it's been waited on, whether or not it
+ * has exited, since its pid is reserved until then.
+ */
+TEST(CreateProcessPosixSpawnTest, CountsChildrenUntilWaitedOn) {
+  int before = PosixSpawnChildren();
+  PRFileDesc *null = PR_Open("/dev/null", PR_RDWR, 0);
+  ASSERT_TRUE(null != NULL);
+  const char *argv[] = { "true", NULL };
+  GpgProcess *process = CreateProcessPosixSpawn(
+      "/bin/true", const_cast<char *const *>(argv), null, null, null);
+  PR_Close(null);
+  ASSERT_TRUE(process != NULL);
+  EXPECT_EQ(before + 1, PosixSpawnChildren());
+  int exit_code = -1;
+  EXPECT_TRUE(process->Wait(&exit_code));
+  EXPECT_EQ(before, PosixSpawnChildren());
+  delete process;
+  EXPECT_EQ(before, PosixSpawnChildren());
+}
+
+/*
+ * A process that something else has reaped, as NSPR would, has no exit code
+ * left, and isn't signaled either since its pid may have been reused.
+ */
+TEST(CreateProcessPosixSpawnTest, HasNoExitCodeOnceReapedElsewhere) {
+  PRFileDesc *null = PR_Open("/dev/null", PR_RDWR, 0);
+  ASSERT_TRUE(null != NULL);
+  const char *argv[] = { "true", NULL };
+  GpgProcess *process = CreateProcessPosixSpawn(
+      "/bin/true", const_cast<char *const *>(argv), null, null, null);
+  PR_Close(null);
+  ASSERT_TRUE(process != NULL);
+  int status;
+  ASSERT_NE(-1, waitpid(-1, &status, 0));
+
+  int exit_code = 0;
+  EXPECT_TRUE(process->Wait(&exit_code));
+  EXPECT_EQ(GpgProcess::kEXIT_UNKNOWN, exit_code);
+  EXPECT_FALSE(process->Kill());
+  delete process;
+}
+
+}  /* namespace */
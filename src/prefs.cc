@@ -27,6 +27,8 @@
  * ***** END LICENSE BLOCK *****
  */
 
+#include <stdlib.h>
+
 #include <algorithm>
 #include <map>
 #include <string>
@@ -46,6 +48,22 @@
 
 static const char *kPLUGIN_INITIALIZED = "gpg_plugin_initialized";
 static const char *kPATH_TO_GPG_BINARY = "gpg_binary_path";
+static const char *kSPAWN_STRATEGY = "gpg_spawn_strategy";
+static const char *kPATH_TO_LAUNCHER = "gpg_launcher_path";
+static const char *kENGINE = "gpg_engine";
+static const char *kAGENT_SOCKET = "gpg_agent_socket";
+static const char *kTIMEOUT = "gpg_timeout";
+static const char *kREADER = "gpg_reader";
+static const char *kDATA_PATH = "gpg_data_path";
+static const char *kTEMP_FILES = "gpg_temp_files";
+static const char *kLARGE_RESULT_KB = "gpg_large_result_kb";
+static const char *kARMOR = "gpg_armor";
+static const char *kCOMPRESSION = "gpg_compression";
+static const char *kFAIL_FAST = "gpg_fail_fast";
+static const char *kOVERWRITE_FILES = "gpg_overwrite_files";
+
+/* The largest value of an int preference. */
+static const long kMAX_INT_PREFERENCE = 86400;
 
 /*
  * This function returns the bool form of the directive that was
@@ -65,6 +83,21 @@ bool GpgPreferences::BoolPreference(ConfigDirective directive) const {
   return false;
 }
 
+/*
+ * This function returns the int form of the directive that was
+ * passed in.  It uses the type hints in ConfigTypes[] to notify
+ * the caller if they are calling this on an int type.
+ */
+int GpgPreferences::IntPreference(ConfigDirective directive) const {
+  if (ConfigTypes[directive] == kIntPreference) {
+    return atoi(Preferences[directive].c_str());
+  } else {
+    LOG("error: int preference incorrectly requested for directive %d\n",
+        directive);
+  }
+  return 0;
+}
+
 /*
  * This function returns the string form of the directive that was
  * passed in.  It uses the type hints in ConfigTypes[] to notify
@@ -87,8 +120,9 @@ const std::string &GpgPreferences::StringPreference(ConfigDirective directive)
  * This function is responsible for setting a configuration directive.
  * It uses the type hints provided in ConfigTypes[] to convert the
  * string to lowercase (in the case of boolean types) for ease
- * of comparison later.  string types are stored exactly as they were
- * passed in.
+ * of comparison later, and to reject int types that aren't a number
+ * from 0 to kMAX_INT_PREFERENCE.  string types are stored exactly as
+ * they were passed in.
  */
 bool GpgPreferences::SetDirective(const std::string &key,
                                   const std::string &value) {
@@ -114,6 +148,20 @@ bool GpgPreferences::SetDirective(const std::string &key,
             value.c_str(), directive);
       }
       break;
+    case kIntPreference: {
+      const char *begin = value.c_str();
+      char *end;
+      long number = strtol(begin, &end, 10);
+      if (end != begin && *end == '\0' && number >= 0 &&
+          number <= kMAX_INT_PREFERENCE) {
+        Preferences[directive] = value;
+        rv = true;
+      } else {
+        LOG("error: int value incorrectly set(%s) for %d\n",
+            value.c_str(), directive);
+      }
+      break;
+    }
     default:
       LOG("error: unknown config type for directive %d\n", directive);
       break;
@@ -125,17 +173,43 @@ bool GpgPreferences::SetDirective(const std::string &key,
 /*
  * The default constructor for GpgPreferences is responsible for:
  * 1. initializing the map of strings to config directives
- * 2. setting the type(string or bool) for each directive,
+ * 2. setting the type(string, bool or int) for each directive,
  * 3. initializing sane defaults
  */
 GpgPreferences::GpgPreferences() {
   // Step 1
   ConfigMap[kPLUGIN_INITIALIZED] = GpgPluginInitialized;
   ConfigMap[kPATH_TO_GPG_BINARY] = GpgBinaryPath;
+  ConfigMap[kSPAWN_STRATEGY] = GpgSpawnStrategy;
+  ConfigMap[kPATH_TO_LAUNCHER] = GpgLauncherPath;
+  ConfigMap[kENGINE] = GpgEngine;
+  ConfigMap[kAGENT_SOCKET] = GpgAgentSocket;
+  ConfigMap[kTIMEOUT] = GpgTimeout;
+  ConfigMap[kREADER] = GpgReader;
+  ConfigMap[kDATA_PATH] = GpgDataPath;
+  ConfigMap[kTEMP_FILES] = GpgTempFiles;
+  ConfigMap[kLARGE_RESULT_KB] = GpgLargeResultKb;
+  ConfigMap[kARMOR] = GpgArmor;
+  ConfigMap[kCOMPRESSION] = GpgCompression;
+  ConfigMap[kFAIL_FAST] = GpgFailFast;
+  ConfigMap[kOVERWRITE_FILES] = GpgOverwriteFiles;
 
   // Step 2
   ConfigTypes[GpgPluginInitialized] = kBoolPreference;
   ConfigTypes[GpgBinaryPath] = kStringPreference;
+  ConfigTypes[GpgSpawnStrategy] = kStringPreference;
+  ConfigTypes[GpgLauncherPath] = kStringPreference;
+  ConfigTypes[GpgEngine] = kStringPreference;
+  ConfigTypes[GpgAgentSocket] = kStringPreference;
+  ConfigTypes[GpgTimeout] = kIntPreference;
+  ConfigTypes[GpgReader] = kStringPreference;
+  ConfigTypes[GpgDataPath] = kStringPreference;
+  ConfigTypes[GpgTempFiles] = kStringPreference;
+  ConfigTypes[GpgLargeResultKb] = kIntPreference;
+  ConfigTypes[GpgArmor] = kStringPreference;
+  ConfigTypes[GpgCompression] = kStringPreference;
+  ConfigTypes[GpgFailFast] = kBoolPreference;
+  ConfigTypes[GpgOverwriteFiles] = kBoolPreference;
 
   // Step 3
   Preferences[GpgPluginInitialized] = "false";
@@ -146,4 +220,76 @@ GpgPreferences::GpgPreferences() {
 #else
   Preferences[GpgBinaryPath] = "/usr/bin/gpg";
 #endif
+  /*
+   * "nspr" creates gpg with PR_CreateProcess(), "posix_spawn" with
+   * posix_spawn() (see posix/spawn.h) and "launcher" hands it to gpg-launcher
+   * (see posix/launcher.h). An empty launcher path means the one installed
+   * next to the plugin.
+   */
+  Preferences[GpgSpawnStrategy] = "nspr";
+  Preferences[GpgLauncherPath] = "";
+  /*
+   * "cli" runs the gpg binary for every call, "gpgme" uses GPGME instead for
+   * the operations it supports (see gpgme_engine.h), if it's been built in.
+   * "agent" has gpg-agent make detached signatures and decrypt session keys
+   * without running gpg for each of them (see posix/agent.h). An empty agent socket means wherever
+   * gpg would look for it.
+   */
+  Preferences[GpgEngine] = "cli";
+  Preferences[GpgAgentSocket] = "";
+  /*
+   * How many seconds a single run of gpg or request to gpg-agent may take
+   * before it's given up on (see watchdog.h), or "0" for no limit. Signing
+   * and decrypting can include the user typing a passphrase, so this is
+   * generous.
+   */
+  Preferences[GpgTimeout] = "300";
+  /*
+   * "streams" reads the output of gpg until its end, "exit" only until gpg
+   * has exited where that can be told (see posix/pump.h), not on Windows.
+   * Either way it's read on the thread of the call.
+   */
+  Preferences[GpgReader] = "streams";
+  /*
+   * "files" passes texts to gpg and gets its results back through temporary
+   * files, "pipes" through pipes (not on Windows), so that nothing is written
+   * to disk.
+   */
+  Preferences[GpgDataPath] = "files";
+  /*
+   * Where the temporary files of the "files" data path are kept: "disk" in
+   * the temporary directory, "memory" in anonymous files in memory, where
+   * that's available (Linux).
+   */
+  Preferences[GpgTempFiles] = "disk";
+  /*
+   * Texts that encrypting or decrypting results in which are larger than this
+   * many KB are kept by the plugin and read a chunk at a time (see
+   * BaseGnupg::ReadChunk()), or "0" to always return them whole.
+   */
+  Preferences[GpgLargeResultKb] = "0";
+  /*
+   * "gpg" has gpg armor what it encrypts and signs and dearmor what it
+   * decrypts and verifies, "plugin" runs gpg in binary mode and does the
+   * armoring in the plugin (see armor.h), which turns away bad armor without
+   * running gpg.
+   */
+  Preferences[GpgArmor] = "gpg";
+  /*
+   * How gpg compresses texts it encrypts: "gpg" leaves it to gpg, "none" (or
+   * "0") turns compression off, "1" to "9" set the zlib level, and "auto"
+   * picks one of these from a sample of each text.
+   */
+  Preferences[GpgCompression] = "gpg";
+  /*
+   * "true" watches gpg's status as it's read and kills gpg as soon as it
+   * reports that encrypting, decrypting or verifying has failed, rather than
+   * letting it read the rest of its input first.
+   */
+  Preferences[GpgFailFast] = "false";
+  /*
+   * "true" lets encryptFile() and the other file methods replace a file that
+   * already exists at the output path, rather than refusing to.
+   */
+  Preferences[GpgOverwriteFiles] = "false";
 }
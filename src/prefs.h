@@ -38,18 +38,33 @@ class GpgPreferences {
   enum ConfigDirective {
     GpgPluginInitialized,
     GpgBinaryPath,
+    GpgSpawnStrategy,
+    GpgLauncherPath,
+    GpgEngine,
+    GpgAgentSocket,
+    GpgTimeout,
+    GpgReader,
+    GpgDataPath,
+    GpgTempFiles,
+    GpgLargeResultKb,
+    GpgArmor,
+    GpgCompression,
+    GpgFailFast,
+    GpgOverwriteFiles,
     NumberOfDirectives
   };
 
   GpgPreferences();
 
   bool BoolPreference(ConfigDirective directive) const;
+  int IntPreference(ConfigDirective directive) const;
   const std::string& StringPreference(ConfigDirective directive) const;
   bool SetDirective(const std::string &key, const std::string &value);
 
  private:
   static const unsigned int kStringPreference = 0;
   static const unsigned int kBoolPreference = 1;
+  static const unsigned int kIntPreference = 2;
 
   std::map<std::string, ConfigDirective> ConfigMap;
   unsigned int ConfigTypes[NumberOfDirectives];
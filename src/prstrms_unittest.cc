@@ -0,0 +1,140 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+#include <prio.h>
+
+#include <string>
+
+#include "prstrms.h"
+#include "tmpwrapper.h"
+
+namespace {
+
+/* Data that is larger than the streams' buffers and doesn't repeat soon. */
+std::string MakeData(size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<char>(i * 7 + i / 251);
+  }
+  return data;
+}
+
+std::string ReadPipe(PRFileDesc *pipe) {
+  std::string data;
+  char buffer[4096];
+  PRInt32 count;
+  while ((count = PR_Read(pipe, buffer, sizeof buffer)) > 0) {
+    data.append(buffer, count);
+  }
+  return data;
+}
+
+TEST(PRfilebufTest, ReadsPastBufferIntoCallerMemory) {
+  std::string data = MakeData(1024 * 1024);
+  std::string pattern = "gpgut";
+  TmpWrapper tmp;
+  ASSERT_TRUE(tmp.CreateAndWriteTmpFile(data + "\nlast line\n", &pattern));
+
+  PRifstream stream(pattern.c_str());
+  ASSERT_TRUE(stream.is_open());
+  std::string head(10, '\0');
+  std::string rest(data.size() - head.size(), '\0');
+  EXPECT_TRUE(stream.read(&head[0], head.size()));
+  EXPECT_TRUE(stream.read(&rest[0], rest.size()));
+  EXPECT_TRUE(data == head + rest);
+
+  std::string line;
+  EXPECT_TRUE(std::getline(stream, line));
+  EXPECT_EQ("", line);
+  EXPECT_TRUE(std::getline(stream, line));
+  EXPECT_EQ("last line", line);
+  EXPECT_FALSE(std::getline(stream, line));
+}
+
+TEST(PRfilebufTest, WritesBufferedDataBeforeLargeBlock) {
+  std::string data = MakeData(32 * 1024);
+  PRFileDesc *pipe[2];
+  ASSERT_EQ(PR_SUCCESS, PR_CreatePipe(&pipe[0], &pipe[1]));
+
+  /* Small enough for the pipe, so that nothing needs to read it meanwhile. */
+  {
+    PRofstream stream(pipe[1]);
+    stream << "head ";
+    stream.write(data.data(), data.size());
+    stream << " tail";
+    EXPECT_TRUE(stream.flush());
+  }
+  PR_Close(pipe[1]);
+
+  EXPECT_TRUE("head " + data + " tail" == ReadPipe(pipe[0]));
+  PR_Close(pipe[0]);
+}
+
+TEST(PRfilebufTest, UsesConfiguredBufferSize) {
+  std::string pattern = "gpgut";
+  TmpWrapper tmp;
+  ASSERT_TRUE(tmp.CreateAndWriteTmpFile("a line longer than 16 bytes\nb\n",
+                                        &pattern));
+
+  PRifstream stream(pattern.c_str());
+  EXPECT_TRUE(stream.rdbuf()->set_buffer_size(16) != NULL);
+  std::string line;
+  EXPECT_TRUE(std::getline(stream, line));
+  EXPECT_EQ("a line longer than 16 bytes", line);
+  /* Too late once something has been read. */
+  EXPECT_TRUE(stream.rdbuf()->set_buffer_size(1024) == NULL);
+  char rest[8];
+  EXPECT_FALSE(stream.read(rest, sizeof rest));
+  EXPECT_EQ(2, stream.gcount());
+  EXPECT_EQ("b\n", std::string(rest, 2));
+}
+
+TEST(PRfilebufTest, WritesFileThroughBothPaths) {
+  std::string data = MakeData(100 * 1024);
+  std::string filename = TmpWrapper::MkTmpFileName("gpgut");
+  TmpWrapper tmp;
+  tmp.UnlinkAndTrackFile(filename);
+
+  PRFileDesc *file = PR_Open(filename.c_str(), TmpWrapper::kFLAGS,
+                             TmpWrapper::kMODE);
+  ASSERT_TRUE(file != NULL);
+  {
+    PRofstream stream(file);
+    stream << "x";
+    stream.write(data.data(), data.size());
+    stream << "y";
+  }
+  PR_Close(file);
+
+  PRifstream stream(filename.c_str());
+  std::string read(data.size() + 2, '\0');
+  EXPECT_TRUE(stream.read(&read[0], read.size()));
+  EXPECT_TRUE("x" + data + "y" == read);
+  EXPECT_EQ(PRfilebuf::traits_type::eof(), stream.peek());
+}
+
+} /* namespace */
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "securemem.h"
+
+#include <prinit.h>
+#include <prlock.h>
+#include <prsystem.h>
+
+#include <cstring>
+#include <string>
+
+#ifdef OS_WINDOWS
+#include <windows.h>
+#else
+#include <errno.h>
+#include <sys/mman.h>
+#endif
+
+#include "logging.h"
+
+const size_t GpgSecurePool::kMIN_BLOCK;
+const size_t GpgSecurePool::kMAX_BLOCK;
+
+/*
+ * Blocks smaller than this are cut from slabs of this size, which stay in
+ * the pool for good. Larger ones are mapped one at a time, and at most
+ * kMAX_FREE_BLOCKS of each size are kept when they're released.
+ */
+static const size_t kSLAB = 64 * 1024;
+static const size_t kMAX_FREE_BLOCKS = 4;
+
+/* The sizes from kMIN_BLOCK to kMAX_BLOCK, by powers of two. */
+static const int kCLASSES = 15;
+
+/* What a free block in the pool starts with. */
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+static PRCallOnceType pool_once;
+static PRLock *pool_lock;
+static FreeBlock *free_blocks[kCLASSES];
+static size_t free_counts[kCLASSES];
+
+static PRStatus PR_CALLBACK InitPool() {
+  pool_lock = PR_NewLock();
+  return pool_lock == NULL ? PR_FAILURE : PR_SUCCESS;
+}
+
+/* The class of blocks |size| fits in, if it isn't over kMAX_BLOCK. */
+static int ClassOf(size_t size) {
+  int index = 0;
+  for (size_t block = GpgSecurePool::kMIN_BLOCK; block < size; block <<= 1) {
+    index++;
+  }
+  return index;
+}
+
+static size_t RoundToPages(size_t size) {
+  size_t page = static_cast<size_t>(PR_GetPageSize());
+  return (size + page - 1) / page * page;
+}
+
+/*
+ * Map |size| bytes (a multiple of the page size) of zeroed memory and lock
+ * them in, or, if that fails, just map them. Returns NULL if mapping fails.
+ */
+static void *MapLocked(size_t size) {
+#ifdef OS_WINDOWS
+  void *data = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE,
+                            PAGE_READWRITE);
+  if (data == NULL) {
+    return NULL;
+  }
+  if (!VirtualLock(data, size)) {
+    LOG("GPG: Couldn't lock %u bytes: %u\n", static_cast<unsigned>(size),
+        static_cast<unsigned>(GetLastError()));
+  }
+#else
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+#ifdef MADV_DONTDUMP
+  madvise(data, size, MADV_DONTDUMP);
+#endif
+  if (mlock(data, size) != 0) {
+    LOG("GPG: Couldn't lock %u bytes: %d\n", static_cast<unsigned>(size),
+        errno);
+  }
+#endif
+  return data;
+}
+
+static void Unmap(void *data, size_t size) {
+#ifdef OS_WINDOWS
+  VirtualUnlock(data, size);
+  VirtualFree(data, 0, MEM_RELEASE);
+#else
+  munlock(data, size);
+  munmap(data, size);
+#endif
+}
+
+void *GpgSecurePool::Allocate(size_t size) {
+  if (PR_CallOnce(&pool_once, InitPool) != PR_SUCCESS) {
+    return NULL;
+  }
+  if (size > kMAX_BLOCK) {
+    return MapLocked(RoundToPages(size));
+  }
+
+  int index = ClassOf(size);
+  size_t block = kMIN_BLOCK << index;
+  PR_Lock(pool_lock);
+  FreeBlock *free = free_blocks[index];
+  if (free != NULL) {
+    free_blocks[index] = free->next;
+    free_counts[index]--;
+  }
+  PR_Unlock(pool_lock);
+  if (free != NULL) {
+    free->next = NULL;
+    return free;
+  }
+
+  if (block >= kSLAB) {
+    return MapLocked(RoundToPages(block));
+  }
+  /* Keep the first block of a new slab, and pool the rest. */
+  char *slab = static_cast<char *>(MapLocked(kSLAB));
+  if (slab == NULL) {
+    return NULL;
+  }
+  PR_Lock(pool_lock);
+  for (size_t offset = kSLAB - block; offset > 0; offset -= block) {
+    FreeBlock *rest = reinterpret_cast<FreeBlock *>(slab + offset);
+    rest->next = free_blocks[index];
+    free_blocks[index] = rest;
+    free_counts[index]++;
+  }
+  PR_Unlock(pool_lock);
+  return slab;
+}
+
+void GpgSecurePool::Release(void *data, size_t size) {
+  if (data == NULL) {
+    return;
+  }
+  if (size > kMAX_BLOCK) {
+    SecureZero(data, size);
+    Unmap(data, RoundToPages(size));
+    return;
+  }
+
+  int index = ClassOf(size);
+  size_t block = kMIN_BLOCK << index;
+  SecureZero(data, block);
+  PR_Lock(pool_lock);
+  if (block >= kSLAB && free_counts[index] >= kMAX_FREE_BLOCKS) {
+    PR_Unlock(pool_lock);
+    Unmap(data, RoundToPages(block));
+    return;
+  }
+  FreeBlock *free = static_cast<FreeBlock *>(data);
+  free->next = free_blocks[index];
+  free_blocks[index] = free;
+  free_counts[index]++;
+  PR_Unlock(pool_lock);
+}
+
+void SecureZero(void *data, size_t size) {
+#ifdef OS_WINDOWS
+  SecureZeroMemory(data, size);
+#else
+  memset(data, 0, size);
+  /* Make the compiler assume that the zeros are read. */
+  __asm__ __volatile__("" : : "r"(data) : "memory");
+#endif
+}
+
+void WipeString(std::string *text) {
+  /* Zero the spare capacity too, it may hold what the text used to. */
+  text->resize(text->capacity());
+  if (!text->empty()) {
+    SecureZero(&(*text)[0], text->size());
+  }
+  text->clear();
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Memory for plaintext that the plugin holds on to: blocks locked into RAM
+ * (so they aren't swapped out), zeroed when they're released, and kept in a
+ * pool of size classes for the next text rather than handed back to the
+ * system each time.
+ */
+
+#ifndef _GPGPLUGIN_SECUREMEM_H_
+#define _GPGPLUGIN_SECUREMEM_H_
+
+#include <cstddef>
+#include <new>
+#include <string>
+
+/*
+ * The pool behind SecureAllocator. Requests are rounded up to a power of two
+ * from kMIN_BLOCK to kMAX_BLOCK, and blocks of each size are reused; larger
+ * ones get pages of their own, which go back to the system when released.
+ * Locking a block may fail (e.g. over RLIMIT_MEMLOCK), in which case it's
+ * used unlocked, but it's still zeroed when released. Safe to use from any
+ * thread.
+ */
+class GpgSecurePool {
+ public:
+  static const size_t kMIN_BLOCK = 64;
+  static const size_t kMAX_BLOCK = 1024 * 1024;
+
+  /* A block of at least |size| bytes, all zero, or NULL if out of memory. */
+  static void *Allocate(size_t size);
+
+  /* Zero the block |data| that Allocate(|size|) returned, and release it. */
+  static void Release(void *data, size_t size);
+};
+
+/*
+ * Zero |size| bytes at |data| in a way the compiler can't leave out because
+ * the memory isn't read again.
+ */
+void SecureZero(void *data, size_t size);
+
+/*
+ * Zero all of |text|'s buffer and empty it, for a std::string that held
+ * plaintext and is about to be released.
+ */
+void WipeString(std::string *text);
+
+/* A standard allocator on GpgSecurePool. */
+template <class T>
+class SecureAllocator {
+ public:
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef T value_type;
+
+  template <class U>
+  struct rebind {
+    typedef SecureAllocator<U> other;
+  };
+
+  SecureAllocator() {}
+  template <class U>
+  SecureAllocator(const SecureAllocator<U> &) {}
+
+  pointer address(reference value) const { return &value; }
+  const_pointer address(const_reference value) const { return &value; }
+
+  pointer allocate(size_type count, const void * /* hint */ = 0) {
+    void *data = GpgSecurePool::Allocate(count * sizeof(T));
+    if (data == NULL) {
+      throw std::bad_alloc();
+    }
+    return static_cast<pointer>(data);
+  }
+
+  void deallocate(pointer data, size_type count) {
+    GpgSecurePool::Release(data, count * sizeof(T));
+  }
+
+  size_type max_size() const {
+    return static_cast<size_type>(-1) / sizeof(T);
+  }
+
+  void construct(pointer data, const T &value) { new (data) T(value); }
+  void destroy(pointer data) { data->~T(); }
+};
+
+template <class T, class U>
+bool operator==(const SecureAllocator<T> &, const SecureAllocator<U> &) {
+  return true;
+}
+
+template <class T, class U>
+bool operator!=(const SecureAllocator<T> &, const SecureAllocator<U> &) {
+  return false;
+}
+
+/*
+ * A string whose buffer comes from GpgSecurePool. Note that very short
+ * strings may be kept inside the object by the standard library instead.
+ */
+typedef std::basic_string<char, std::char_traits<char>,
+                          SecureAllocator<char> > SecureString;
+
+#endif  // _GPGPLUGIN_SECUREMEM_H_
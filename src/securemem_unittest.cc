@@ -0,0 +1,100 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "securemem.h"
+
+namespace {
+
+static bool AllZero(const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    if (bytes[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * A released block is the next one handed out for its size, and is zero
+ * by then.
+ */
+TEST(GpgSecurePoolTest, ReusesZeroedBlocks) {
+  char *data = static_cast<char *>(GpgSecurePool::Allocate(3000));
+  ASSERT_TRUE(data != NULL);
+  EXPECT_TRUE(AllZero(data, 3000));
+  memset(data, 'x', 3000);
+  GpgSecurePool::Release(data, 3000);
+
+  char *again = static_cast<char *>(GpgSecurePool::Allocate(4096));
+  EXPECT_EQ(data, again);
+  EXPECT_TRUE(AllZero(again, 4096));
+  GpgSecurePool::Release(again, 4096);
+}
+
+TEST(GpgSecurePoolTest, KeepsBlocksApart) {
+  std::vector<char *> blocks;
+  for (size_t size = 1; size <= 4 * GpgSecurePool::kMAX_BLOCK; size *= 3) {
+    char *data = static_cast<char *>(GpgSecurePool::Allocate(size));
+    ASSERT_TRUE(data != NULL);
+    memset(data, static_cast<int>(blocks.size()), size);
+    blocks.push_back(data);
+  }
+  size_t size = 1;
+  for (size_t i = 0; i < blocks.size(); i++, size *= 3) {
+    EXPECT_EQ(static_cast<char>(i), blocks[i][0]);
+    EXPECT_EQ(static_cast<char>(i), blocks[i][size - 1]);
+    GpgSecurePool::Release(blocks[i], size);
+  }
+}
+
+TEST(SecureStringTest, WorksLikeAString) {
+  SecureString text("plain");
+  text.append(" text");
+  SecureString copy = text;
+  EXPECT_EQ("plain text", std::string(copy.data(), copy.size()));
+
+  SecureString large(3 * GpgSecurePool::kMAX_BLOCK, 'p');
+  large += text;
+  EXPECT_EQ(3 * GpgSecurePool::kMAX_BLOCK + 10, large.size());
+  EXPECT_EQ('t', large[large.size() - 1]);
+}
+
+TEST(WipeStringTest, ZeroesAndEmpties) {
+  std::string text(1000, 'p');
+  text.resize(10);
+  WipeString(&text);
+  EXPECT_TRUE(text.empty());
+  EXPECT_TRUE(AllZero(text.data(), text.capacity()));
+}
+
+}  /* namespace */
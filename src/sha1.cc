@@ -0,0 +1,148 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "sha1.h"
+
+#include <prtypes.h>
+
+#include <cstring>
+#include <string>
+
+const size_t Sha1::kDigestSize;
+
+static inline PRUint32 RotateLeft(PRUint32 x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+Sha1::Sha1()
+    : length_(0),
+      buffered_(0) {
+  state_[0] = 0x67452301;
+  state_[1] = 0xefcdab89;
+  state_[2] = 0x98badcfe;
+  state_[3] = 0x10325476;
+  state_[4] = 0xc3d2e1f0;
+}
+
+void Sha1::Transform(const unsigned char *block) {
+  PRUint32 w[80];
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = (static_cast<PRUint32>(block[i * 4]) << 24) |
+           (static_cast<PRUint32>(block[i * 4 + 1]) << 16) |
+           (static_cast<PRUint32>(block[i * 4 + 2]) << 8) |
+           static_cast<PRUint32>(block[i * 4 + 3]);
+  }
+  for (i = 16; i < 80; i++) {
+    w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  PRUint32 a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  PRUint32 e = state_[4];
+
+  for (i = 0; i < 80; i++) {
+    PRUint32 f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    PRUint32 t = RotateLeft(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = RotateLeft(b, 30);
+    b = a;
+    a = t;
+  }
+
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+}
+
+void Sha1::Update(const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  length_ += size;
+
+  if (buffered_ > 0) {
+    size_t n = sizeof buffer_ - buffered_;
+    if (n > size) {
+      n = size;
+    }
+    std::memcpy(buffer_ + buffered_, p, n);
+    buffered_ += n;
+    p += n;
+    size -= n;
+    if (buffered_ < sizeof buffer_) {
+      return;
+    }
+    Transform(buffer_);
+    buffered_ = 0;
+  }
+
+  while (size >= sizeof buffer_) {
+    Transform(p);
+    p += sizeof buffer_;
+    size -= sizeof buffer_;
+  }
+
+  std::memcpy(buffer_, p, size);
+  buffered_ = size;
+}
+
+std::string Sha1::Final() {
+  PRUint64 bits = length_ * 8;
+  unsigned char padding[72];
+  size_t padding_size = (buffered_ < 56 ? 56 : 120) - buffered_;
+  int i;
+
+  std::memset(padding, 0, sizeof padding);
+  padding[0] = 0x80;
+  for (i = 0; i < 8; i++) {
+    padding[padding_size + i] = static_cast<unsigned char>(bits >> (56 - i * 8));
+  }
+  Update(padding, padding_size + 8);
+
+  std::string digest(kDigestSize, '\0');
+  for (i = 0; i < 5; i++) {
+    digest[i * 4] = static_cast<char>(state_[i] >> 24);
+    digest[i * 4 + 1] = static_cast<char>(state_[i] >> 16);
+    digest[i * 4 + 2] = static_cast<char>(state_[i] >> 8);
+    digest[i * 4 + 3] = static_cast<char>(state_[i]);
+  }
+  return digest;
+}
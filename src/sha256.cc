@@ -0,0 +1,166 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "sha256.h"
+
+#include <prtypes.h>
+
+#include <cstring>
+#include <string>
+
+static const PRUint32 kROUND_CONSTANTS[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const size_t Sha256::kDigestSize;
+
+static inline PRUint32 RotateRight(PRUint32 x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256()
+    : length_(0),
+      buffered_(0) {
+  state_[0] = 0x6a09e667;
+  state_[1] = 0xbb67ae85;
+  state_[2] = 0x3c6ef372;
+  state_[3] = 0xa54ff53a;
+  state_[4] = 0x510e527f;
+  state_[5] = 0x9b05688c;
+  state_[6] = 0x1f83d9ab;
+  state_[7] = 0x5be0cd19;
+}
+
+void Sha256::Transform(const unsigned char *block) {
+  PRUint32 w[64];
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = (static_cast<PRUint32>(block[i * 4]) << 24) |
+           (static_cast<PRUint32>(block[i * 4 + 1]) << 16) |
+           (static_cast<PRUint32>(block[i * 4 + 2]) << 8) |
+           static_cast<PRUint32>(block[i * 4 + 3]);
+  }
+  for (i = 16; i < 64; i++) {
+    PRUint32 s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    PRUint32 s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  PRUint32 a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  PRUint32 e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+
+  for (i = 0; i < 64; i++) {
+    PRUint32 s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+    PRUint32 ch = (e & f) ^ (~e & g);
+    PRUint32 t1 = h + s1 + ch + kROUND_CONSTANTS[i] + w[i];
+    PRUint32 s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+    PRUint32 maj = (a & b) ^ (a & c) ^ (b & c);
+    PRUint32 t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+
+void Sha256::Update(const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  length_ += size;
+
+  if (buffered_ > 0) {
+    size_t n = sizeof buffer_ - buffered_;
+    if (n > size) {
+      n = size;
+    }
+    std::memcpy(buffer_ + buffered_, p, n);
+    buffered_ += n;
+    p += n;
+    size -= n;
+    if (buffered_ < sizeof buffer_) {
+      return;
+    }
+    Transform(buffer_);
+    buffered_ = 0;
+  }
+
+  while (size >= sizeof buffer_) {
+    Transform(p);
+    p += sizeof buffer_;
+    size -= sizeof buffer_;
+  }
+
+  std::memcpy(buffer_, p, size);
+  buffered_ = size;
+}
+
+std::string Sha256::Final() {
+  PRUint64 bits = length_ * 8;
+  unsigned char padding[72];
+  size_t padding_size = (buffered_ < 56 ? 56 : 120) - buffered_;
+  int i;
+
+  std::memset(padding, 0, sizeof padding);
+  padding[0] = 0x80;
+  for (i = 0; i < 8; i++) {
+    padding[padding_size + i] = static_cast<unsigned char>(bits >> (56 - i * 8));
+  }
+  Update(padding, padding_size + 8);
+
+  std::string digest(kDigestSize, '\0');
+  for (i = 0; i < 8; i++) {
+    digest[i * 4] = static_cast<char>(state_[i] >> 24);
+    digest[i * 4 + 1] = static_cast<char>(state_[i] >> 16);
+    digest[i * 4 + 2] = static_cast<char>(state_[i] >> 8);
+    digest[i * 4 + 3] = static_cast<char>(state_[i]);
+  }
+  return digest;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifndef _GPGPLUGIN_SHA256_H_
+#define _GPGPLUGIN_SHA256_H_
+
+#include <prtypes.h>
+
+#include <cstddef>
+#include <string>
+
+/*
+ * SHA-256 (FIPS 180-4), for hashing the data of OpenPGP signatures that are
+ * built by the plugin itself (see openpgp.h). NSPR has no message digests.
+ */
+class Sha256 {
+ public:
+  static const size_t kDigestSize = 32;
+
+  Sha256();
+
+  void Update(const void *data, size_t size);
+  void Update(const std::string &data) {
+    Update(data.data(), data.size());
+  }
+
+  /*
+   * Return the digest of everything passed to Update(). The object can't be
+   * updated any further afterwards.
+   */
+  std::string Final();
+
+ private:
+  void Transform(const unsigned char *block);
+
+  PRUint32 state_[8];
+  PRUint64 length_;
+  unsigned char buffer_[64];
+  size_t buffered_;
+};
+
+#endif  // _GPGPLUGIN_SHA256_H_
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "stats.h"
+
+#include <prprf.h>
+#include <prtypes.h>
+
+#include <map>
+#include <string>
+
+GpgStats::Timings::Timings()
+    : count(0),
+      failed(0),
+      total(0),
+      min(0),
+      max(0) {
+}
+
+GpgStats::Interruptions::Interruptions()
+    : timeouts(0),
+      canceled(0) {
+}
+
+GpgStats::Fallbacks::Fallbacks()
+    : disabled(0),
+      failed(0),
+      reaped(0) {
+}
+
+GpgStats::Sizes::Sizes()
+    : count(0),
+      bytes(0) {
+}
+
+void GpgStats::RecordSpawn(const std::string &strategy, PRInt64 elapsed,
+                           bool ok) {
+  Timings &timings = spawns_[strategy];
+  if (!ok) {
+    timings.failed++;
+    return;
+  }
+  if (timings.count == 0 || elapsed < timings.min) {
+    timings.min = elapsed;
+  }
+  if (elapsed > timings.max) {
+    timings.max = elapsed;
+  }
+  timings.count++;
+  timings.total += elapsed;
+}
+
+void GpgStats::RecordInterruption(const std::string &target,
+                                  bool canceled) {
+  Interruptions &interruptions = interruptions_[target];
+  if (canceled) {
+    interruptions.canceled++;
+  } else {
+    interruptions.timeouts++;
+  }
+}
+
+void GpgStats::RecordFallback(const std::string &strategy,
+                              Fallback reason) {
+  Fallbacks &fallbacks = fallbacks_[strategy];
+  switch (reason) {
+    case kFALLBACK_DISABLED:
+      fallbacks.disabled++;
+      break;
+    case kFALLBACK_FAILED:
+      fallbacks.failed++;
+      break;
+    case kFALLBACK_REAPED:
+      fallbacks.reaped++;
+      break;
+  }
+}
+
+void GpgStats::RecordCompression(const std::string &choice, PRInt64 bytes) {
+  Sizes &sizes = compressions_[choice];
+  sizes.count++;
+  sizes.bytes += bytes;
+}
+
+void GpgStats::Merge(const GpgStats &other) {
+  for (std::map<std::string, Timings>::const_iterator it =
+           other.spawns_.begin();
+       it != other.spawns_.end(); ++it) {
+    const Timings &theirs = it->second;
+    Timings &timings = spawns_[it->first];
+    if (theirs.count > 0) {
+      if (timings.count == 0 || theirs.min < timings.min) {
+        timings.min = theirs.min;
+      }
+      if (theirs.max > timings.max) {
+        timings.max = theirs.max;
+      }
+    }
+    timings.count += theirs.count;
+    timings.failed += theirs.failed;
+    timings.total += theirs.total;
+  }
+  for (std::map<std::string, Interruptions>::const_iterator it =
+           other.interruptions_.begin();
+       it != other.interruptions_.end(); ++it) {
+    Interruptions &interruptions = interruptions_[it->first];
+    interruptions.timeouts += it->second.timeouts;
+    interruptions.canceled += it->second.canceled;
+  }
+  for (std::map<std::string, Fallbacks>::const_iterator it =
+           other.fallbacks_.begin();
+       it != other.fallbacks_.end(); ++it) {
+    Fallbacks &fallbacks = fallbacks_[it->first];
+    fallbacks.disabled += it->second.disabled;
+    fallbacks.failed += it->second.failed;
+    fallbacks.reaped += it->second.reaped;
+  }
+  for (std::map<std::string, Sizes>::const_iterator it =
+           other.compressions_.begin();
+       it != other.compressions_.end(); ++it) {
+    Sizes &sizes = compressions_[it->first];
+    sizes.count += it->second.count;
+    sizes.bytes += it->second.bytes;
+  }
+}
+
+std::string GpgStats::ToString() const {
+  std::string output;
+  char line[256];
+
+  for (std::map<std::string, Timings>::const_iterator it = spawns_.begin();
+       it != spawns_.end(); ++it) {
+    const Timings &timings = it->second;
+    PR_snprintf(line, sizeof line,
+                "spawn.%s count=%lld failed=%lld min_us=%lld mean_us=%lld "
+                "max_us=%lld\n",
+                it->first.c_str(), timings.count, timings.failed, timings.min,
+                timings.count == 0 ? 0 : timings.total / timings.count,
+                timings.max);
+    output.append(line);
+  }
+  for (std::map<std::string, Interruptions>::const_iterator it =
+           interruptions_.begin();
+       it != interruptions_.end(); ++it) {
+    PR_snprintf(line, sizeof line,
+                "interrupted.%s timeouts=%lld canceled=%lld\n",
+                it->first.c_str(), it->second.timeouts, it->second.canceled);
+    output.append(line);
+  }
+  for (std::map<std::string, Fallbacks>::const_iterator it =
+           fallbacks_.begin();
+       it != fallbacks_.end(); ++it) {
+    PR_snprintf(line, sizeof line,
+                "fallback.%s disabled=%lld failed=%lld reaped=%lld\n",
+                it->first.c_str(), it->second.disabled, it->second.failed,
+                it->second.reaped);
+    output.append(line);
+  }
+  for (std::map<std::string, Sizes>::const_iterator it =
+           compressions_.begin();
+       it != compressions_.end(); ++it) {
+    PR_snprintf(line, sizeof line, "compression.%s count=%lld input_bytes=%lld\n",
+                it->first.c_str(), it->second.count, it->second.bytes);
+    output.append(line);
+  }
+  return output;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifndef _GPGPLUGIN_STATS_H_
+#define _GPGPLUGIN_STATS_H_
+
+#include <prtypes.h>
+
+#include <map>
+#include <string>
+
+/*
+ * GpgStats collects counters about how the plugin runs gpg, so that the
+ * choices made through GpgPreferences can be compared on real installations.
+ * JavaScript reads them with Gnupg.GetStats().
+ */
+class GpgStats {
+ public:
+  /* Why a spawn strategy was given up on in favour of PR_CreateProcess(). */
+  enum Fallback {
+    /* It wasn't tried, because PR_CreateProcess() had been used already. */
+    kFALLBACK_DISABLED,
+    /* It failed to start gpg. */
+    kFALLBACK_FAILED,
+    /* NSPR reaped a gpg it had started, so its exit code was lost. */
+    kFALLBACK_REAPED,
+  };
+
+  /*
+   * Record an attempt to start gpg with spawn strategy |strategy| that took
+   * |elapsed| microseconds. Only successful attempts count towards the times.
+   */
+  void RecordSpawn(const std::string &strategy, PRInt64 elapsed, bool ok);
+
+  /*
+   * Record that waiting on |target| ("gpg", say) was given up on, because it
+   * timed out or, if |canceled|, because the operation was canceled.
+   */
+  void RecordInterruption(const std::string &target, bool canceled);
+
+  /* Record that spawn strategy |strategy| was given up on, for |reason|. */
+  void RecordFallback(const std::string &strategy, Fallback reason);
+
+  /*
+   * Record that gpg_compression "auto" chose |choice| ("none", "fast" or
+   * "gpg") for a text of |bytes| bytes. These are counted as the input the
+   * choice covered, not as what compressing saved or would have saved.
+   */
+  void RecordCompression(const std::string &choice, PRInt64 bytes);
+
+  /* Add the counters of |other|, e.g. those of an operation run elsewhere. */
+  void Merge(const GpgStats &other);
+
+  /*
+   * One line per counter, each a name followed by space-separated key=value
+   * pairs, e.g. "spawn.nspr count=3 failed=0 min_us=1400 mean_us=1610
+   * max_us=2010", "interrupted.gpg timeouts=1 canceled=0",
+   * "fallback.posix_spawn disabled=4 failed=1 reaped=0" or
+   * "compression.none count=2 input_bytes=1048576".
+   */
+  std::string ToString() const;
+
+ private:
+  struct Timings {
+    Timings();
+
+    PRInt64 count;
+    PRInt64 failed;
+    PRInt64 total;
+    PRInt64 min;
+    PRInt64 max;
+  };
+
+  struct Interruptions {
+    Interruptions();
+
+    PRInt64 timeouts;
+    PRInt64 canceled;
+  };
+
+  struct Fallbacks {
+    Fallbacks();
+
+    PRInt64 disabled;
+    PRInt64 failed;
+    PRInt64 reaped;
+  };
+
+  struct Sizes {
+    Sizes();
+
+    PRInt64 count;
+    PRInt64 bytes;
+  };
+
+  std::map<std::string, Timings> spawns_;
+  std::map<std::string, Interruptions> interruptions_;
+  std::map<std::string, Fallbacks> fallbacks_;
+  std::map<std::string, Sizes> compressions_;
+};
+
+#endif  // _GPGPLUGIN_STATS_H_
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "stats.h"
+
+namespace {
+
+TEST(GpgStatsTest, EmptyWhenNothingRecorded) {
+  GpgStats stats;
+  EXPECT_EQ("", stats.ToString());
+}
+
+TEST(GpgStatsTest, SummarizesSpawnTimes) {
+  GpgStats stats;
+  stats.RecordSpawn("nspr", 300, true);
+  stats.RecordSpawn("nspr", 100, true);
+  stats.RecordSpawn("nspr", 200, true);
+  EXPECT_EQ("spawn.nspr count=3 failed=0 min_us=100 mean_us=200 max_us=300\n",
+            stats.ToString());
+}
+
+/*
+ * Failed attempts are counted, but their times would only skew the others.
+ */
+TEST(GpgStatsTest, CountsFailuresSeparately) {
+  GpgStats stats;
+  stats.RecordSpawn("posix_spawn", 10, false);
+  stats.RecordSpawn("nspr", 1000, true);
+  stats.RecordSpawn("posix_spawn", 50, true);
+  EXPECT_EQ("spawn.nspr count=1 failed=0 min_us=1000 mean_us=1000 "
+            "max_us=1000\n"
+            "spawn.posix_spawn count=1 failed=1 min_us=50 mean_us=50 "
+            "max_us=50\n",
+            stats.ToString());
+}
+
+TEST(GpgStatsTest, MergesCounters) {
+  GpgStats stats;
+  stats.RecordSpawn("nspr", 200, true);
+  GpgStats other;
+  other.RecordSpawn("nspr", 100, true);
+  other.RecordSpawn("nspr", 600, true);
+  other.RecordSpawn("launcher", 10, false);
+  stats.Merge(other);
+  EXPECT_EQ("spawn.launcher count=0 failed=1 min_us=0 mean_us=0 max_us=0\n"
+            "spawn.nspr count=3 failed=0 min_us=100 mean_us=300 max_us=600\n",
+            stats.ToString());
+}
+
+TEST(GpgStatsTest, CountsInterruptions) {
+  GpgStats stats;
+  stats.RecordSpawn("nspr", 100, true);
+  stats.RecordInterruption("gpg", false);
+  stats.RecordInterruption("gpg", true);
+  GpgStats other;
+  other.RecordInterruption("gpg", false);
+  other.RecordInterruption("agent", true);
+  stats.Merge(other);
+  EXPECT_EQ("spawn.nspr count=1 failed=0 min_us=100 mean_us=100 max_us=100\n"
+            "interrupted.agent timeouts=0 canceled=1\n"
+            "interrupted.gpg timeouts=2 canceled=1\n",
+            stats.ToString());
+}
+
+TEST(GpgStatsTest, CountsFallbacks) {
+  GpgStats stats;
+  stats.RecordFallback("posix_spawn", GpgStats::kFALLBACK_FAILED);
+  stats.RecordFallback("posix_spawn", GpgStats::kFALLBACK_DISABLED);
+  GpgStats other;
+  other.RecordFallback("posix_spawn", GpgStats::kFALLBACK_REAPED);
+  other.RecordFallback("launcher", GpgStats::kFALLBACK_FAILED);
+  stats.Merge(other);
+  EXPECT_EQ("fallback.launcher disabled=0 failed=1 reaped=0\n"
+            "fallback.posix_spawn disabled=1 failed=1 reaped=1\n",
+            stats.ToString());
+}
+
+TEST(GpgStatsTest, CountsCompressionChoices) {
+  GpgStats stats;
+  stats.RecordCompression("none", 5000);
+  stats.RecordCompression("gpg", 10);
+  GpgStats other;
+  other.RecordCompression("none", 2000);
+  stats.Merge(other);
+  EXPECT_EQ("compression.gpg count=1 input_bytes=10\n"
+            "compression.none count=2 input_bytes=7000\n",
+            stats.ToString());
+}
+
+}  /* namespace */
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "status.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "stringpiece.h"
+
+static const char kSTATUS_PREFIX[] = "[GNUPG:] ";
+
+/* Indexed by GpgStatus, so in the order of the names after the first. */
+static const char *const kSTATUS_NAMES[kSTATUS_COUNT] = {
+  "",
+  "ALREADY_SIGNED",
+  "ATTRIBUTE",
+  "BACKUP_KEY_CREATED",
+  "BADARMOR",
+  "BADMDC",
+  "BADSIG",
+  "BAD_PASSPHRASE",
+  "BEGIN_DECRYPTION",
+  "BEGIN_ENCRYPTION",
+  "BEGIN_SIGNING",
+  "BEGIN_STREAM",
+  "CARDCTRL",
+  "DECRYPTION_COMPLIANCE_MODE",
+  "DECRYPTION_FAILED",
+  "DECRYPTION_INFO",
+  "DECRYPTION_KEY",
+  "DECRYPTION_OKAY",
+  "DELETE_PROBLEM",
+  "ENCRYPTION_COMPLIANCE_MODE",
+  "ENC_TO",
+  "END_DECRYPTION",
+  "END_ENCRYPTION",
+  "END_STREAM",
+  "ERRMDC",
+  "ERROR",
+  "ERRSIG",
+  "EXPKEYSIG",
+  "EXPORTED",
+  "EXPORT_RES",
+  "EXPSIG",
+  "FAILURE",
+  "FILE_DONE",
+  "FILE_ERROR",
+  "FILE_START",
+  "GET_BOOL",
+  "GET_HIDDEN",
+  "GET_LINE",
+  "GOODMDC",
+  "GOODSIG",
+  "GOOD_PASSPHRASE",
+  "GOT_IT",
+  "IMPORTED",
+  "IMPORT_CHECK",
+  "IMPORT_OK",
+  "IMPORT_PROBLEM",
+  "IMPORT_RES",
+  "INQUIRE_MAXLEN",
+  "INV_RECP",
+  "INV_SGNR",
+  "KEYEXPIRED",
+  "KEYREVOKED",
+  "KEY_CONSIDERED",
+  "KEY_CREATED",
+  "KEY_NOT_CREATED",
+  "MISSING_PASSPHRASE",
+  "MOUNTPOINT",
+  "NEED_PASSPHRASE",
+  "NEED_PASSPHRASE_PIN",
+  "NEED_PASSPHRASE_SYM",
+  "NEWSIG",
+  "NODATA",
+  "NOTATION_DATA",
+  "NOTATION_FLAGS",
+  "NOTATION_NAME",
+  "NO_PUBKEY",
+  "NO_RECP",
+  "NO_SECKEY",
+  "NO_SGNR",
+  "PINENTRY_LAUNCHED",
+  "PKA_TRUST_BAD",
+  "PKA_TRUST_GOOD",
+  "PLAINTEXT",
+  "PLAINTEXT_LENGTH",
+  "POLICY_URL",
+  "PROGRESS",
+  "REVKEYSIG",
+  "RSA_OR_IDEA",
+  "SC_OP_FAILURE",
+  "SC_OP_SUCCESS",
+  "SESSION_KEY",
+  "SIGEXPIRED",
+  "SIG_CREATED",
+  "SIG_ID",
+  "SIG_SUBPACKET",
+  "SUCCESS",
+  "TOFU_STATS",
+  "TOFU_STATS_LONG",
+  "TOFU_USER",
+  "TRUNCATED",
+  "TRUST_FULLY",
+  "TRUST_MARGINAL",
+  "TRUST_NEVER",
+  "TRUST_ULTIMATE",
+  "TRUST_UNDEFINED",
+  "UNEXPECTED",
+  "USERID_HINT",
+  "VALIDSIG",
+  "VERIFICATION_COMPLIANCE_MODE",
+  "WARNING",
+};
+
+const size_t StringPiece::npos;
+const size_t GpgStatusLines::kINLINE;
+
+/*
+ * strcmp() of |keyword| and |name|, for bisecting kSTATUS_NAMES.
+ */
+static int CompareKeyword(const StringPiece &keyword, const char *name) {
+  size_t length = strlen(name);
+  int diff = memcmp(keyword.data(), name, std::min(keyword.size(), length));
+  if (diff != 0) {
+    return diff;
+  }
+  return keyword.size() < length ? -1 : keyword.size() > length ? 1 : 0;
+}
+
+GpgStatus LookupStatus(const StringPiece &keyword) {
+  int low = kSTATUS_UNKNOWN + 1;
+  int high = kSTATUS_COUNT - 1;
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    int diff = CompareKeyword(keyword, kSTATUS_NAMES[middle]);
+    if (diff == 0) {
+      return static_cast<GpgStatus>(middle);
+    }
+    if (diff < 0) {
+      high = middle - 1;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return kSTATUS_UNKNOWN;
+}
+
+const char *StatusName(GpgStatus status) {
+  if (status < 0 || status >= kSTATUS_COUNT) {
+    return kSTATUS_NAMES[kSTATUS_UNKNOWN];
+  }
+  return kSTATUS_NAMES[status];
+}
+
+GpgStatusLines::GpgStatusLines()
+    : size_(0) {
+}
+
+void GpgStatusLines::push_back(const GpgStatusLine &line) {
+  if (size_ < kINLINE) {
+    inline_[size_] = line;
+  } else {
+    more_.push_back(line);
+  }
+  size_++;
+  statuses_.set(line.status);
+}
+
+void GpgStatusLines::clear() {
+  more_.clear();
+  size_ = 0;
+  statuses_.reset();
+}
+
+bool ParseStatusLine(const StringPiece &text, GpgStatusLine *line) {
+  const StringPiece prefix(kSTATUS_PREFIX, sizeof kSTATUS_PREFIX - 1);
+  size_t start;
+  if (text.starts_with(prefix)) {
+    start = prefix.size();
+  } else {
+    /* Not from --status-fd, but the first word is dropped all the same. */
+    start = text.find(' ');
+    if (start == StringPiece::npos) {
+      return false;
+    }
+    start++;
+  }
+  if (start >= text.size()) {
+    return false;
+  }
+
+  size_t space = text.find(' ', start);
+  if (space == StringPiece::npos) {
+    line->keyword = text.substr(start);
+    line->args = StringPiece();
+  } else {
+    line->keyword = text.substr(start, space - start);
+    line->args = text.substr(space + 1);
+  }
+  line->status = LookupStatus(line->keyword);
+  return true;
+}
+
+bool ParseStatusOutput(const StringPiece &output, GpgStatusLines *lines) {
+  const char *next = output.begin();
+  const char *end = output.end();
+  while (next < end) {
+    const char *newline = static_cast<const char *>(
+        memchr(next, '\n', end - next));
+    const char *line_end = newline == NULL ? end : newline;
+
+    GpgStatusLine line;
+    if (!ParseStatusLine(StringPiece(next, line_end - next), &line)) {
+      return false;
+    }
+    lines->push_back(line);
+    next = line_end + 1;
+  }
+  return true;
+}
+
+/*
+ * The next space-separated word of |rest|, which is left with what follows.
+ */
+static StringPiece NextWord(StringPiece *rest) {
+  size_t space = rest->find(' ');
+  StringPiece word = rest->substr(0, space);
+  *rest = space == StringPiece::npos ? StringPiece() : rest->substr(space + 1);
+  return word;
+}
+
+bool ParseStatusEvent(const GpgStatusLine &line, GpgGoodSig *event) {
+  if (line.status != kSTATUS_GOODSIG) {
+    return false;
+  }
+  StringPiece rest(line.args);
+  event->keyid = NextWord(&rest);
+  event->uid = rest;
+  return !event->keyid.empty();
+}
+
+bool ParseStatusEvent(const GpgStatusLine &line, GpgValidSig *event) {
+  if (line.status != kSTATUS_VALIDSIG) {
+    return false;
+  }
+  StringPiece rest(line.args);
+  event->fingerprint = NextWord(&rest);
+  NextWord(&rest);
+  event->timestamp = NextWord(&rest);
+  return !event->fingerprint.empty() && !event->timestamp.empty();
+}
+
+bool ParseStatusEvent(const GpgStatusLine &line, GpgEncTo *event) {
+  if (line.status != kSTATUS_ENC_TO) {
+    return false;
+  }
+  StringPiece rest(line.args);
+  event->keyid = NextWord(&rest);
+  return !event->keyid.empty();
+}
+
+bool ParseStatusEvent(const GpgStatusLine &line, GpgInvRecp *event) {
+  if (line.status != kSTATUS_INV_RECP) {
+    return false;
+  }
+  StringPiece rest(line.args);
+  event->code = NextWord(&rest);
+  event->key = rest;
+  return !event->code.empty();
+}
+
+bool ParseStatusEvent(const GpgStatusLine &line, GpgTrustLevel *event) {
+  switch (line.status) {
+    case kSTATUS_TRUST_UNDEFINED:
+    case kSTATUS_TRUST_NEVER:
+    case kSTATUS_TRUST_MARGINAL:
+    case kSTATUS_TRUST_FULLY:
+    case kSTATUS_TRUST_ULTIMATE:
+      event->status = line.status;
+      event->name = line.keyword;
+      return true;
+    default:
+      return false;
+  }
+}
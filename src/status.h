@@ -0,0 +1,260 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Parsing the status lines gpg writes with --status-fd, in place: the lines
+ * are found in the output as it is, and their parts are StringPieces into it
+ * rather than strings of their own.
+ */
+
+#ifndef _GPGPLUGIN_STATUS_H_
+#define _GPGPLUGIN_STATUS_H_
+
+#include <bitset>
+#include <cstddef>
+#include <vector>
+
+#include "stringpiece.h"
+
+/*
+ * The status keywords that gnupg documents in doc/DETAILS, with
+ * kSTATUS_UNKNOWN for any other. They're in the order of their names, which
+ * LookupStatus() relies on.
+ */
+enum GpgStatus {
+  kSTATUS_UNKNOWN,
+  kSTATUS_ALREADY_SIGNED,
+  kSTATUS_ATTRIBUTE,
+  kSTATUS_BACKUP_KEY_CREATED,
+  kSTATUS_BADARMOR,
+  kSTATUS_BADMDC,
+  kSTATUS_BADSIG,
+  kSTATUS_BAD_PASSPHRASE,
+  kSTATUS_BEGIN_DECRYPTION,
+  kSTATUS_BEGIN_ENCRYPTION,
+  kSTATUS_BEGIN_SIGNING,
+  kSTATUS_BEGIN_STREAM,
+  kSTATUS_CARDCTRL,
+  kSTATUS_DECRYPTION_COMPLIANCE_MODE,
+  kSTATUS_DECRYPTION_FAILED,
+  kSTATUS_DECRYPTION_INFO,
+  kSTATUS_DECRYPTION_KEY,
+  kSTATUS_DECRYPTION_OKAY,
+  kSTATUS_DELETE_PROBLEM,
+  kSTATUS_ENCRYPTION_COMPLIANCE_MODE,
+  kSTATUS_ENC_TO,
+  kSTATUS_END_DECRYPTION,
+  kSTATUS_END_ENCRYPTION,
+  kSTATUS_END_STREAM,
+  kSTATUS_ERRMDC,
+  kSTATUS_ERROR,
+  kSTATUS_ERRSIG,
+  kSTATUS_EXPKEYSIG,
+  kSTATUS_EXPORTED,
+  kSTATUS_EXPORT_RES,
+  kSTATUS_EXPSIG,
+  kSTATUS_FAILURE,
+  kSTATUS_FILE_DONE,
+  kSTATUS_FILE_ERROR,
+  kSTATUS_FILE_START,
+  kSTATUS_GET_BOOL,
+  kSTATUS_GET_HIDDEN,
+  kSTATUS_GET_LINE,
+  kSTATUS_GOODMDC,
+  kSTATUS_GOODSIG,
+  kSTATUS_GOOD_PASSPHRASE,
+  kSTATUS_GOT_IT,
+  kSTATUS_IMPORTED,
+  kSTATUS_IMPORT_CHECK,
+  kSTATUS_IMPORT_OK,
+  kSTATUS_IMPORT_PROBLEM,
+  kSTATUS_IMPORT_RES,
+  kSTATUS_INQUIRE_MAXLEN,
+  kSTATUS_INV_RECP,
+  kSTATUS_INV_SGNR,
+  kSTATUS_KEYEXPIRED,
+  kSTATUS_KEYREVOKED,
+  kSTATUS_KEY_CONSIDERED,
+  kSTATUS_KEY_CREATED,
+  kSTATUS_KEY_NOT_CREATED,
+  kSTATUS_MISSING_PASSPHRASE,
+  kSTATUS_MOUNTPOINT,
+  kSTATUS_NEED_PASSPHRASE,
+  kSTATUS_NEED_PASSPHRASE_PIN,
+  kSTATUS_NEED_PASSPHRASE_SYM,
+  kSTATUS_NEWSIG,
+  kSTATUS_NODATA,
+  kSTATUS_NOTATION_DATA,
+  kSTATUS_NOTATION_FLAGS,
+  kSTATUS_NOTATION_NAME,
+  kSTATUS_NO_PUBKEY,
+  kSTATUS_NO_RECP,
+  kSTATUS_NO_SECKEY,
+  kSTATUS_NO_SGNR,
+  kSTATUS_PINENTRY_LAUNCHED,
+  kSTATUS_PKA_TRUST_BAD,
+  kSTATUS_PKA_TRUST_GOOD,
+  kSTATUS_PLAINTEXT,
+  kSTATUS_PLAINTEXT_LENGTH,
+  kSTATUS_POLICY_URL,
+  kSTATUS_PROGRESS,
+  kSTATUS_REVKEYSIG,
+  kSTATUS_RSA_OR_IDEA,
+  kSTATUS_SC_OP_FAILURE,
+  kSTATUS_SC_OP_SUCCESS,
+  kSTATUS_SESSION_KEY,
+  kSTATUS_SIGEXPIRED,
+  kSTATUS_SIG_CREATED,
+  kSTATUS_SIG_ID,
+  kSTATUS_SIG_SUBPACKET,
+  kSTATUS_SUCCESS,
+  kSTATUS_TOFU_STATS,
+  kSTATUS_TOFU_STATS_LONG,
+  kSTATUS_TOFU_USER,
+  kSTATUS_TRUNCATED,
+  kSTATUS_TRUST_FULLY,
+  kSTATUS_TRUST_MARGINAL,
+  kSTATUS_TRUST_NEVER,
+  kSTATUS_TRUST_ULTIMATE,
+  kSTATUS_TRUST_UNDEFINED,
+  kSTATUS_UNEXPECTED,
+  kSTATUS_USERID_HINT,
+  kSTATUS_VALIDSIG,
+  kSTATUS_VERIFICATION_COMPLIANCE_MODE,
+  kSTATUS_WARNING,
+  kSTATUS_COUNT
+};
+
+/* A set of statuses, e.g. those an operation must have written. */
+typedef std::bitset<kSTATUS_COUNT> GpgStatusSet;
+
+/* The status named |keyword|, or kSTATUS_UNKNOWN. */
+GpgStatus LookupStatus(const StringPiece &keyword);
+
+/* The name of |status|, which is "" for kSTATUS_UNKNOWN. */
+const char *StatusName(GpgStatus status);
+
+/*
+ * A status line, "[GNUPG:] <keyword> <args>", e.g. "GOODSIG" and
+ * "0123456789ABCDEF Someone <someone@example.com>". Both point into the
+ * output the line was parsed from, which must outlive them. |status| is
+ * what LookupStatus() makes of the keyword.
+ */
+struct GpgStatusLine {
+  GpgStatus status;
+  StringPiece keyword;
+  StringPiece args;
+};
+
+/*
+ * The lines of a status output. The first kINLINE lines, which is all that
+ * gpg writes for a single operation, are kept in the object itself, so that
+ * parsing them doesn't allocate. The set of their statuses is kept as they're
+ * added, so whether a status was written doesn't take a search.
+ */
+class GpgStatusLines {
+ public:
+  GpgStatusLines();
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const GpgStatusLine &operator[](size_t i) const {
+    return i < kINLINE ? inline_[i] : more_[i - kINLINE];
+  }
+  const GpgStatusLine &back() const { return (*this)[size_ - 1]; }
+  const GpgStatusSet &statuses() const { return statuses_; }
+
+  void push_back(const GpgStatusLine &line);
+  void clear();
+
+ private:
+  static const size_t kINLINE = 32;
+
+  GpgStatusLine inline_[kINLINE];
+  std::vector<GpgStatusLine> more_;
+  size_t size_;
+  GpgStatusSet statuses_;
+};
+
+/*
+ * Parse |text|, a line without its newline, into |line|. The "[GNUPG:] "
+ * prefix (or whatever word comes first) is skipped. Returns false if there's
+ * no keyword after it.
+ */
+bool ParseStatusLine(const StringPiece &text, GpgStatusLine *line);
+
+/*
+ * Add the lines of |output| to |lines|. Returns false, having added the lines
+ * before it, at the first line that ParseStatusLine() can't parse.
+ */
+bool ParseStatusOutput(const StringPiece &output, GpgStatusLines *lines);
+
+/*
+ * The arguments of the status lines that results are made of. Like the line
+ * they come from, they point into gpg's output.
+ */
+
+/* GOODSIG <long keyid> <user id> */
+struct GpgGoodSig {
+  StringPiece keyid;
+  StringPiece uid;
+};
+
+/* VALIDSIG <fingerprint> <creation date> <timestamp> ... */
+struct GpgValidSig {
+  StringPiece fingerprint;
+  StringPiece timestamp;
+};
+
+/* ENC_TO <long keyid> <key type> <key length> */
+struct GpgEncTo {
+  StringPiece keyid;
+};
+
+/* INV_RECP <reason code> <recipient as given> */
+struct GpgInvRecp {
+  StringPiece code;
+  StringPiece key;
+};
+
+/* TRUST_UNDEFINED, TRUST_NEVER, TRUST_MARGINAL, TRUST_FULLY, TRUST_ULTIMATE */
+struct GpgTrustLevel {
+  GpgStatus status;
+  StringPiece name;
+};
+
+/*
+ * Fill in |event| from |line|. Returns false if |line| is another status, or
+ * is missing arguments.
+ */
+bool ParseStatusEvent(const GpgStatusLine &line, GpgGoodSig *event);
+bool ParseStatusEvent(const GpgStatusLine &line, GpgValidSig *event);
+bool ParseStatusEvent(const GpgStatusLine &line, GpgEncTo *event);
+bool ParseStatusEvent(const GpgStatusLine &line, GpgInvRecp *event);
+bool ParseStatusEvent(const GpgStatusLine &line, GpgTrustLevel *event);
+
+#endif  // _GPGPLUGIN_STATUS_H_
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "status.h"
+#include "stringpiece.h"
+
+namespace {
+
+TEST(StringPieceTest, PointsIntoItsText) {
+  std::string text("keyword args");
+  StringPiece piece(text);
+  EXPECT_EQ(text.data(), piece.data());
+  EXPECT_EQ(text.size(), piece.size());
+  EXPECT_EQ(7U, piece.find(' '));
+  EXPECT_EQ(StringPiece::npos, piece.find('x'));
+  EXPECT_EQ("args", piece.substr(8).as_string());
+  EXPECT_EQ("key", piece.substr(0, 3).as_string());
+  EXPECT_TRUE(piece.starts_with("keyword"));
+  EXPECT_FALSE(piece.starts_with("args"));
+  EXPECT_TRUE(piece.substr(0, 7) == "keyword");
+  EXPECT_TRUE(piece.substr(0, 3) != "keyword");
+  EXPECT_TRUE(StringPiece().empty());
+}
+
+TEST(LookupStatusTest, KnowsEveryName) {
+  for (int i = kSTATUS_UNKNOWN + 1; i < kSTATUS_COUNT; i++) {
+    GpgStatus status = static_cast<GpgStatus>(i);
+    EXPECT_EQ(status, LookupStatus(StatusName(status))) << StatusName(status);
+    /* The names have to be in order for the lookup to find them. */
+    EXPECT_LT(strcmp(StatusName(static_cast<GpgStatus>(i - 1)),
+                     StatusName(status)), 0);
+  }
+}
+
+TEST(LookupStatusTest, DoesNotKnowOtherKeywords) {
+  EXPECT_EQ(kSTATUS_UNKNOWN, LookupStatus(""));
+  EXPECT_EQ(kSTATUS_UNKNOWN, LookupStatus("GOODSI"));
+  EXPECT_EQ(kSTATUS_UNKNOWN, LookupStatus("GOODSIGS"));
+  EXPECT_EQ(kSTATUS_UNKNOWN, LookupStatus("goodsig"));
+  EXPECT_EQ(kSTATUS_UNKNOWN, LookupStatus("AAA"));
+  EXPECT_EQ(kSTATUS_UNKNOWN, LookupStatus("ZZZ"));
+  EXPECT_STREQ("", StatusName(kSTATUS_UNKNOWN));
+  EXPECT_STREQ("INV_RECP", StatusName(kSTATUS_INV_RECP));
+}
+
+TEST(ParseStatusLineTest, SplitsKeywordAndArgs) {
+  GpgStatusLine line;
+  ASSERT_TRUE(ParseStatusLine("[GNUPG:] GOODSIG 0123 Someone", &line));
+  EXPECT_EQ(kSTATUS_GOODSIG, line.status);
+  EXPECT_EQ("GOODSIG", line.keyword.as_string());
+  EXPECT_EQ("0123 Someone", line.args.as_string());
+
+  ASSERT_TRUE(ParseStatusLine("[GNUPG:] BEGIN_ENCRYPTION", &line));
+  EXPECT_EQ("BEGIN_ENCRYPTION", line.keyword.as_string());
+  EXPECT_TRUE(line.args.empty());
+
+  /* Whatever the first word is, it's skipped. */
+  ASSERT_TRUE(ParseStatusLine("[GNUPG] FOO bar", &line));
+  EXPECT_EQ(kSTATUS_UNKNOWN, line.status);
+  EXPECT_EQ("FOO", line.keyword.as_string());
+  EXPECT_EQ("bar", line.args.as_string());
+}
+
+TEST(ParseStatusLineTest, RejectsLinesWithoutKeyword) {
+  GpgStatusLine line;
+  EXPECT_FALSE(ParseStatusLine("", &line));
+  EXPECT_FALSE(ParseStatusLine("[GNUPG:]", &line));
+  EXPECT_FALSE(ParseStatusLine("[GNUPG:] ", &line));
+}
+
+TEST(ParseStatusOutputTest, PointsIntoOutput) {
+  std::string output("[GNUPG:] ONE a\n[GNUPG:] TWO\n[GNUPG:] THREE b c\n");
+  GpgStatusLines lines;
+  ASSERT_TRUE(ParseStatusOutput(output, &lines));
+  ASSERT_EQ(3U, lines.size());
+  EXPECT_EQ("ONE", lines[0].keyword.as_string());
+  EXPECT_EQ("a", lines[0].args.as_string());
+  EXPECT_EQ("TWO", lines[1].keyword.as_string());
+  EXPECT_EQ("b c", lines.back().args.as_string());
+  EXPECT_EQ(output.data() + 9, lines[0].keyword.data());
+}
+
+TEST(ParseStatusOutputTest, KeepsSetOfStatuses) {
+  GpgStatusLines lines;
+  ASSERT_TRUE(ParseStatusOutput("[GNUPG:] ENC_TO 1 2\n"
+                                "[GNUPG:] PLAINTEXT 62\n"
+                                "[GNUPG:] ENC_TO 3 4\n", &lines));
+  GpgStatusSet expected;
+  expected.set(kSTATUS_ENC_TO);
+  expected.set(kSTATUS_PLAINTEXT);
+  EXPECT_EQ(expected, lines.statuses());
+
+  lines.clear();
+  EXPECT_TRUE(lines.statuses().none());
+}
+
+TEST(ParseStatusOutputTest, TakesLastLineWithoutNewline) {
+  GpgStatusLines lines;
+  ASSERT_TRUE(ParseStatusOutput("[GNUPG:] ONE\n[GNUPG:] TWO", &lines));
+  ASSERT_EQ(2U, lines.size());
+  EXPECT_EQ("TWO", lines[1].keyword.as_string());
+}
+
+TEST(ParseStatusOutputTest, StopsAtBadLine) {
+  GpgStatusLines lines;
+  EXPECT_FALSE(ParseStatusOutput("[GNUPG:] ONE\nbroken\n[GNUPG:] TWO\n",
+                                 &lines));
+  ASSERT_EQ(1U, lines.size());
+  EXPECT_EQ("ONE", lines[0].keyword.as_string());
+}
+
+TEST(ParseStatusOutputTest, KeepsLinesPastInline) {
+  std::string output;
+  for (int i = 0; i < 100; i++) {
+    char line[32];
+    snprintf(line, sizeof(line), "[GNUPG:] LINE%d %d\n", i, i);
+    output += line;
+  }
+  GpgStatusLines lines;
+  ASSERT_TRUE(ParseStatusOutput(output, &lines));
+  ASSERT_EQ(100U, lines.size());
+  EXPECT_EQ("LINE0", lines[0].keyword.as_string());
+  EXPECT_EQ("LINE31", lines[31].keyword.as_string());
+  EXPECT_EQ("LINE32", lines[32].keyword.as_string());
+  EXPECT_EQ("99", lines.back().args.as_string());
+
+  lines.clear();
+  EXPECT_TRUE(lines.empty());
+  ASSERT_TRUE(ParseStatusOutput("[GNUPG:] AGAIN\n", &lines));
+  ASSERT_EQ(1U, lines.size());
+  EXPECT_EQ("AGAIN", lines[0].keyword.as_string());
+}
+
+} /* namespace */
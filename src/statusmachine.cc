@@ -0,0 +1,286 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "statusmachine.h"
+
+#include <cstring>
+
+#include "errors.h"
+#include "logging.h"
+#include "status.h"
+#include "stringpiece.h"
+#include "types.h"
+
+/* Reasons in INV_RECP, see the |code| of GpgInvRecp. */
+static const char *kINV_RECP_NOT_TRUSTED = "10";
+/* It's supposed to be "1", but is often "0"... */
+static const char *kINV_RECP_NOT_FOUND1 = "0";
+static const char *kINV_RECP_NOT_FOUND2 = "1";
+
+GpgStatusMachine::GpgStatusMachine()
+    : lines_(0) {
+}
+
+GpgStatusMachine::~GpgStatusMachine() {
+}
+
+void GpgStatusMachine::Feed(const GpgStatusLine &line) {
+  lines_++;
+  Take(line);
+}
+
+void GpgStatusMachine::FeedOutput(const StringPiece &output) {
+  const char *next = output.begin();
+  const char *end = output.end();
+  while (next < end) {
+    const char *newline = static_cast<const char *>(
+        memchr(next, '\n', end - next));
+    const char *line_end = newline == NULL ? end : newline;
+
+    GpgStatusLine line;
+    if (ParseStatusLine(StringPiece(next, line_end - next), &line)) {
+      Feed(line);
+    }
+    next = line_end + 1;
+  }
+}
+
+GpgVerifyMachine::GpgVerifyMachine()
+    : state_(kWAITING),
+      signed_(false),
+      bad_(false),
+      nodata_(false) {
+}
+
+void GpgVerifyMachine::Take(const GpgStatusLine &line) {
+  switch (line.status) {
+    case kSTATUS_NEWSIG:
+    case kSTATUS_SIG_ID:
+    case kSTATUS_EXPSIG:
+    case kSTATUS_EXPKEYSIG:
+    case kSTATUS_REVKEYSIG:
+    case kSTATUS_ERRSIG:
+      signed_ = true;
+      break;
+    case kSTATUS_BADSIG:
+      signed_ = true;
+      bad_ = true;
+      break;
+    case kSTATUS_NODATA:
+      nodata_ = true;
+      break;
+    case kSTATUS_GOODSIG:
+      signed_ = true;
+      if (state_ == kWAITING && ParseStatusEvent(line, &good_)) {
+        state_ = kGOOD;
+      }
+      break;
+    case kSTATUS_VALIDSIG: {
+      GpgValidSig valid;
+      if (state_ == kGOOD && ParseStatusEvent(line, &valid)) {
+        LOG("GPG: Valid signature by %.*s at %.*s\n",
+            static_cast<int>(valid.fingerprint.size()),
+            valid.fingerprint.data(),
+            static_cast<int>(valid.timestamp.size()), valid.timestamp.data());
+        state_ = kVALID;
+      }
+      break;
+    }
+    default:
+      if (state_ == kVALID && ParseStatusEvent(line, &trust_)) {
+        state_ = kDONE;
+      }
+      break;
+  }
+}
+
+bool GpgVerifyMachine::Finish(int ret, GpgRetSignerInfo *retobj) const {
+  if (ret) {
+    LOG("GPG: Gnupg retval is %d, returning\n", ret);
+    if (lines() == 0) {
+      retobj->set_error_str(kERR_UNKNOWN_GPG_ERR);
+    } else if (bad_) {
+      retobj->set_error_str(kERR_BAD_SIGNATURE);
+    } else if (nodata_) {
+      retobj->set_error_str(kERR_SIGNATURE_ERR);
+    } else {
+      retobj->set_error_str(kERR_UNKNOWN_GPG_ERR);
+    }
+    return false;
+  }
+
+  if (state_ != kVALID && state_ != kDONE) {
+    LOG("GPG: No good and valid signature\n");
+    retobj->set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+    return false;
+  }
+
+  retobj->set_signer(good_.uid.as_string());
+  retobj->set_trust_level(state_ == kDONE ? trust_.name.as_string() : "");
+  return true;
+}
+
+GpgDecryptMachine::GpgDecryptMachine()
+    : state_(kWAITING),
+      encrypted_to_(false) {
+}
+
+void GpgDecryptMachine::Take(const GpgStatusLine &line) {
+  signature_.Feed(line);
+
+  switch (line.status) {
+    case kSTATUS_ENC_TO: {
+      GpgEncTo enc_to;
+      if (ParseStatusEvent(line, &enc_to)) {
+        encrypted_to_ = true;
+        LOG("GPG: Encrypted to %.*s\n", static_cast<int>(enc_to.keyid.size()),
+            enc_to.keyid.data());
+      }
+      break;
+    }
+    case kSTATUS_DECRYPTION_FAILED:
+      state_ = kFAILED;
+      break;
+    case kSTATUS_PLAINTEXT:
+      if (state_ == kWAITING) {
+        state_ = kPLAINTEXT;
+      }
+      break;
+    case kSTATUS_DECRYPTION_OKAY:
+      if (state_ == kPLAINTEXT) {
+        state_ = kOKAY;
+      }
+      break;
+    case kSTATUS_END_DECRYPTION:
+      if (state_ == kOKAY) {
+        state_ = kDONE;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+bool GpgDecryptMachine::Finish(int ret, GpgRetDecryptInfo *retobj) const {
+  if (ret) {
+    if (lines() == 0) {
+      retobj->set_error_str(kERR_UNKNOWN_GPG_ERR);
+    } else if (state_ == kFAILED) {
+      LOG("GPG: Private key not available\n");
+      retobj->set_error_str(kERR_NO_SECRET_KEY);
+    } else if (signature_.is_signed()) {
+      signature_.Finish(ret, retobj);
+    } else {
+      LOG("GPG: Decryption failed for unknown reasons\n");
+      retobj->set_error_str(kERR_UNKNOWN_GPG_ERR);
+    }
+    return false;
+  }
+
+  if (!encrypted_to_) {
+    LOG("GPG: Message wasn't encrypted to a key\n");
+    retobj->set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+    return false;
+  }
+  if (state_ != kDONE) {
+    LOG("GPG: Decryption wasn't reported to have worked\n");
+    retobj->set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+    return false;
+  }
+
+  if (signature_.is_signed()) {
+    return signature_.Finish(ret, retobj);
+  }
+  return true;
+}
+
+GpgEncryptMachine::GpgEncryptMachine(bool signing)
+    : state_(kWAITING),
+      signing_(signing),
+      signed_(false),
+      invalid_(false) {
+}
+
+void GpgEncryptMachine::Take(const GpgStatusLine &line) {
+  switch (line.status) {
+    case kSTATUS_INV_RECP:
+      if (!invalid_ && ParseStatusEvent(line, &inv_recp_)) {
+        invalid_ = true;
+      }
+      break;
+    case kSTATUS_SIG_CREATED:
+      signed_ = true;
+      break;
+    case kSTATUS_BEGIN_ENCRYPTION:
+      if (state_ == kWAITING) {
+        state_ = kENCRYPTING;
+      }
+      break;
+    case kSTATUS_END_ENCRYPTION:
+      if (state_ == kENCRYPTING) {
+        state_ = kDONE;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+bool GpgEncryptMachine::Finish(int ret, GpgRetEncryptInfo *retobj) const {
+  if (ret) {
+    LOG("GPG: Gnupg retval is %d, returning\n", ret);
+    if (lines() == 0 || !invalid_) {
+      retobj->set_error_str(kERR_UNKNOWN_GPG_ERR);
+    } else if (inv_recp_.code == kINV_RECP_NOT_TRUSTED) {
+      LOG("GPG: Key not trusted\n");
+      retobj->set_error_str(kERR_PUBLIC_KEY_NOT_TRUSTED);
+    } else if (inv_recp_.code == kINV_RECP_NOT_FOUND1 ||
+               inv_recp_.code == kINV_RECP_NOT_FOUND2) {
+      LOG("GPG: Key not found\n");
+      retobj->set_error_str(kERR_NO_PUBLIC_KEY);
+    } else {
+      LOG("GPG: Key bad\n");
+      retobj->set_error_str(kERR_BAD_PUBLIC_KEY);
+    }
+    return false;
+  }
+
+  if (lines() == 0) {
+    retobj->set_error_str(kERR_UNKNOWN_GPG_ERR);
+    return false;
+  }
+  if (signing_ && !signed_) {
+    LOG("GPG: Signing wasn't reported to have worked\n");
+    retobj->set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+    return false;
+  }
+  if (state_ != kDONE) {
+    LOG("GPG: Encryption wasn't reported to have worked\n");
+    retobj->set_error_str(kERR_UNEXPECTED_GPG_OUTPUT);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Making the results of gpg's operations from its status lines, in a single
+ * pass over them. Each operation has a machine that takes the lines in the
+ * order gpg wrote them, moves on as the ones it's waiting for come, and
+ * passes over any others (KEY_CONSIDERED, PROGRESS, ...) that it doesn't
+ * need.
+ */
+
+#ifndef _GPGPLUGIN_STATUSMACHINE_H_
+#define _GPGPLUGIN_STATUSMACHINE_H_
+
+#include <cstddef>
+
+#include "status.h"
+#include "stringpiece.h"
+#include "types.h"
+
+class GpgStatusMachine {
+ public:
+  GpgStatusMachine();
+  virtual ~GpgStatusMachine();
+
+  /* Take the next status line. */
+  void Feed(const GpgStatusLine &line);
+
+  /* Feed() each line of |output|, passing over those that don't parse. */
+  void FeedOutput(const StringPiece &output);
+
+  /* How many lines there have been. */
+  size_t lines() const { return lines_; }
+
+ protected:
+  virtual void Take(const GpgStatusLine &line) = 0;
+
+ private:
+  size_t lines_;
+};
+
+/*
+ * gpg --verify, or the signature part of gpg --decrypt. The first signature
+ * that is both good and valid is the one reported.
+ */
+class GpgVerifyMachine : public GpgStatusMachine {
+ public:
+  GpgVerifyMachine();
+
+  /* Whether there's been a signature at all, good or bad. */
+  bool is_signed() const { return signed_; }
+
+  /*
+   * Set the signer and trust level in |retobj|, or its error if gpg exited
+   * with |ret| or didn't report a good signature. Returns false on error.
+   */
+  bool Finish(int ret, GpgRetSignerInfo *retobj) const;
+
+ protected:
+  virtual void Take(const GpgStatusLine &line);
+
+ private:
+  enum State {
+    kWAITING,  /* for GOODSIG */
+    kGOOD,     /* waiting for VALIDSIG */
+    kVALID,    /* waiting for a TRUST_ line */
+    kDONE
+  };
+
+  State state_;
+  bool signed_;
+  bool bad_;
+  bool nodata_;
+  GpgGoodSig good_;
+  GpgTrustLevel trust_;
+};
+
+/* gpg --decrypt, signed or not. */
+class GpgDecryptMachine : public GpgStatusMachine {
+ public:
+  GpgDecryptMachine();
+
+  /*
+   * Set the signer and trust level in |retobj| if it was signed, or its
+   * error if gpg exited with |ret| or didn't report decrypting. A message
+   * that wasn't encrypted to a key (ENC_TO), such as a symmetrically
+   * encrypted one, is an error too. Returns false on error.
+   */
+  bool Finish(int ret, GpgRetDecryptInfo *retobj) const;
+
+ protected:
+  virtual void Take(const GpgStatusLine &line);
+
+ private:
+  enum State {
+    kWAITING,    /* for PLAINTEXT */
+    kPLAINTEXT,  /* waiting for DECRYPTION_OKAY */
+    kOKAY,       /* waiting for END_DECRYPTION */
+    kDONE,
+    kFAILED
+  };
+
+  State state_;
+  bool encrypted_to_;
+  GpgVerifyMachine signature_;
+};
+
+/* gpg --encrypt, with --sign if |signing|. */
+class GpgEncryptMachine : public GpgStatusMachine {
+ public:
+  explicit GpgEncryptMachine(bool signing);
+
+  /*
+   * Set the error in |retobj| if gpg exited with |ret| or didn't report
+   * encrypting (and signing). Returns false on error.
+   */
+  bool Finish(int ret, GpgRetEncryptInfo *retobj) const;
+
+ protected:
+  virtual void Take(const GpgStatusLine &line);
+
+ private:
+  enum State {
+    kWAITING,     /* for BEGIN_ENCRYPTION */
+    kENCRYPTING,  /* waiting for END_ENCRYPTION */
+    kDONE
+  };
+
+  State state_;
+  bool signing_;
+  bool signed_;
+  bool invalid_;
+  GpgInvRecp inv_recp_;
+};
+
+#endif  // _GPGPLUGIN_STATUSMACHINE_H_
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "errors.h"
+#include "status.h"
+#include "statusmachine.h"
+#include "types.h"
+
+namespace {
+
+/* What gpg 2.2 writes verifying a good signature. */
+const char kVERIFY_OUTPUT[] =
+    "[GNUPG:] NEWSIG rsa@example.com\n"
+    "[GNUPG:] KEY_CONSIDERED 7C29E768810FD42874A3075FADA6BD7EAFE07B0A 0\n"
+    "[GNUPG:] SIG_ID +WCBfx6ivngvs2JeOW/0IoqS8T8 2026-10-17 1792240078\n"
+    "[GNUPG:] KEY_CONSIDERED 7C29E768810FD42874A3075FADA6BD7EAFE07B0A 0\n"
+    "[GNUPG:] GOODSIG ADA6BD7EAFE07B0A Rsa <rsa@example.com>\n"
+    "[GNUPG:] VALIDSIG 7C29E768810FD42874A3075FADA6BD7EAFE07B0A 2026-10-17"
+    " 1792240078 0 4 0 1 10 00 7C29E768810FD42874A3075FADA6BD7EAFE07B0A\n"
+    "[GNUPG:] KEY_CONSIDERED 7C29E768810FD42874A3075FADA6BD7EAFE07B0A 0\n"
+    "[GNUPG:] TRUST_ULTIMATE 0 pgp\n";
+
+/* What gpg 2.2 writes decrypting a signed message. */
+const char kDECRYPT_SIGNED_OUTPUT[] =
+    "[GNUPG:] ENC_TO 3781F2BD7AE05C73 1 0\n"
+    "[GNUPG:] KEY_CONSIDERED 7C29E768810FD42874A3075FADA6BD7EAFE07B0A 0\n"
+    "[GNUPG:] DECRYPTION_KEY A83D9D1F3AC55209DE5402763781F2BD7AE05C73"
+    " 7C29E768810FD42874A3075FADA6BD7EAFE07B0A u\n"
+    "[GNUPG:] BEGIN_DECRYPTION\n"
+    "[GNUPG:] DECRYPTION_INFO 2 9 0\n"
+    "[GNUPG:] PLAINTEXT 62 1792243443 sm.txt\n"
+    "[GNUPG:] PLAINTEXT_LENGTH 6\n"
+    "[GNUPG:] NEWSIG ed@example.com\n"
+    "[GNUPG:] SIG_ID ehSHE1epgWW+44ASjp+TIGB04eY 2026-10-17 1792243443\n"
+    "[GNUPG:] GOODSIG 52F8D67E0DD41C8F Ed <ed@example.com>\n"
+    "[GNUPG:] VALIDSIG 012C0768C2B6E018DF98874752F8D67E0DD41C8F 2026-10-17"
+    " 1792243443 0 4 0 22 10 00 012C0768C2B6E018DF98874752F8D67E0DD41C8F\n"
+    "[GNUPG:] TRUST_ULTIMATE 0 pgp\n"
+    "[GNUPG:] DECRYPTION_OKAY\n"
+    "[GNUPG:] GOODMDC\n"
+    "[GNUPG:] END_DECRYPTION\n";
+
+TEST(StatusEventTest, ParsesArguments) {
+  GpgStatusLine line;
+  ASSERT_TRUE(ParseStatusLine("[GNUPG:] GOODSIG 0123 Some One <one@x>",
+                              &line));
+  GpgGoodSig good;
+  ASSERT_TRUE(ParseStatusEvent(line, &good));
+  EXPECT_EQ("0123", good.keyid.as_string());
+  EXPECT_EQ("Some One <one@x>", good.uid.as_string());
+  GpgValidSig valid;
+  EXPECT_FALSE(ParseStatusEvent(line, &valid));
+
+  ASSERT_TRUE(ParseStatusLine("[GNUPG:] VALIDSIG ABCD 2009-07-16 1247743312 0",
+                              &line));
+  ASSERT_TRUE(ParseStatusEvent(line, &valid));
+  EXPECT_EQ("ABCD", valid.fingerprint.as_string());
+  EXPECT_EQ("1247743312", valid.timestamp.as_string());
+  ASSERT_TRUE(ParseStatusLine("[GNUPG:] VALIDSIG ABCD", &line));
+  EXPECT_FALSE(ParseStatusEvent(line, &valid));
+
+  ASSERT_TRUE(ParseStatusLine("[GNUPG:] INV_RECP 10 someone@example.com",
+                              &line));
+  GpgInvRecp inv_recp;
+  ASSERT_TRUE(ParseStatusEvent(line, &inv_recp));
+  EXPECT_EQ("10", inv_recp.code.as_string());
+  EXPECT_EQ("someone@example.com", inv_recp.key.as_string());
+
+  ASSERT_TRUE(ParseStatusLine("[GNUPG:] ENC_TO 3781F2BD7AE05C73 1 0", &line));
+  GpgEncTo enc_to;
+  ASSERT_TRUE(ParseStatusEvent(line, &enc_to));
+  EXPECT_EQ("3781F2BD7AE05C73", enc_to.keyid.as_string());
+
+  ASSERT_TRUE(ParseStatusLine("[GNUPG:] TRUST_FULLY 0 pgp", &line));
+  GpgTrustLevel trust;
+  ASSERT_TRUE(ParseStatusEvent(line, &trust));
+  EXPECT_EQ(kSTATUS_TRUST_FULLY, trust.status);
+  EXPECT_EQ("TRUST_FULLY", trust.name.as_string());
+}
+
+TEST(GpgVerifyMachineTest, PassesOverExtraLines) {
+  GpgVerifyMachine status;
+  status.FeedOutput(kVERIFY_OUTPUT);
+  EXPECT_EQ(8U, status.lines());
+  EXPECT_TRUE(status.is_signed());
+
+  GpgRetSignerInfo retobj;
+  EXPECT_TRUE(status.Finish(0, &retobj));
+  EXPECT_FALSE(retobj.is_error());
+  EXPECT_EQ("Rsa <rsa@example.com>", retobj.signer());
+  EXPECT_EQ("TRUST_ULTIMATE", retobj.trust_level());
+}
+
+TEST(GpgVerifyMachineTest, NeedsValidSigAfterGoodSig) {
+  GpgVerifyMachine status;
+  status.FeedOutput("[GNUPG:] VALIDSIG ABCD 2009-07-16 1247743312 0\n"
+                    "[GNUPG:] GOODSIG 0123 Some One\n"
+                    "[GNUPG:] TRUST_ULTIMATE\n");
+  GpgRetSignerInfo retobj;
+  EXPECT_FALSE(status.Finish(0, &retobj));
+  EXPECT_EQ(kERR_UNEXPECTED_GPG_OUTPUT, retobj.error_str());
+}
+
+TEST(GpgVerifyMachineTest, ReportsBadSignatures) {
+  GpgVerifyMachine status;
+  status.FeedOutput("[GNUPG:] NEWSIG\n"
+                    "[GNUPG:] KEY_CONSIDERED ABCD 0\n"
+                    "[GNUPG:] BADSIG 0123 Some One\n");
+  GpgRetSignerInfo retobj;
+  EXPECT_FALSE(status.Finish(1, &retobj));
+  EXPECT_EQ(kERR_BAD_SIGNATURE, retobj.error_str());
+
+  GpgVerifyMachine nodata;
+  nodata.FeedOutput("[GNUPG:] NODATA 1\n");
+  GpgRetSignerInfo nodata_retobj;
+  EXPECT_FALSE(nodata.Finish(2, &nodata_retobj));
+  EXPECT_EQ(kERR_SIGNATURE_ERR, nodata_retobj.error_str());
+
+  GpgVerifyMachine none;
+  GpgRetSignerInfo none_retobj;
+  EXPECT_FALSE(none.Finish(2, &none_retobj));
+  EXPECT_EQ(kERR_UNKNOWN_GPG_ERR, none_retobj.error_str());
+}
+
+TEST(GpgDecryptMachineTest, ReportsSigner) {
+  GpgDecryptMachine status;
+  status.FeedOutput(kDECRYPT_SIGNED_OUTPUT);
+  GpgRetDecryptInfo retobj;
+  EXPECT_TRUE(status.Finish(0, &retobj));
+  EXPECT_EQ("Ed <ed@example.com>", retobj.signer());
+  EXPECT_EQ("TRUST_ULTIMATE", retobj.trust_level());
+}
+
+TEST(GpgDecryptMachineTest, NeedsDecryptionOkay) {
+  GpgDecryptMachine status;
+  status.FeedOutput("[GNUPG:] ENC_TO 0123456789ABCDEF 1 0\n"
+                    "[GNUPG:] PLAINTEXT 62 1251728234 \n"
+                    "[GNUPG:] END_DECRYPTION\n");
+  GpgRetDecryptInfo retobj;
+  EXPECT_FALSE(status.Finish(0, &retobj));
+  EXPECT_EQ(kERR_UNEXPECTED_GPG_OUTPUT, retobj.error_str());
+}
+
+TEST(GpgDecryptMachineTest, NeedsEncTo) {
+  /* What gpg 2.2 writes decrypting a symmetrically encrypted message. */
+  GpgDecryptMachine status;
+  status.FeedOutput("[GNUPG:] NEED_PASSPHRASE_SYM 9 3 2\n"
+                    "[GNUPG:] BEGIN_DECRYPTION\n"
+                    "[GNUPG:] DECRYPTION_INFO 2 9 0\n"
+                    "[GNUPG:] PLAINTEXT 62 1792243443 \n"
+                    "[GNUPG:] PLAINTEXT_LENGTH 6\n"
+                    "[GNUPG:] DECRYPTION_OKAY\n"
+                    "[GNUPG:] GOODMDC\n"
+                    "[GNUPG:] END_DECRYPTION\n");
+  GpgRetDecryptInfo retobj;
+  EXPECT_FALSE(status.Finish(0, &retobj));
+  EXPECT_EQ(kERR_UNEXPECTED_GPG_OUTPUT, retobj.error_str());
+}
+
+TEST(GpgDecryptMachineTest, ReportsFailures) {
+  GpgDecryptMachine status;
+  status.FeedOutput("[GNUPG:] ENC_TO D7974AEBC4DC6340 16 0\n"
+                    "[GNUPG:] KEY_CONSIDERED ABCD 0\n"
+                    "[GNUPG:] DECRYPTION_FAILED\n"
+                    "[GNUPG:] END_DECRYPTION\n");
+  GpgRetDecryptInfo retobj;
+  EXPECT_FALSE(status.Finish(2, &retobj));
+  EXPECT_EQ(kERR_NO_SECRET_KEY, retobj.error_str());
+
+  GpgDecryptMachine bad;
+  bad.FeedOutput("[GNUPG:] PLAINTEXT 62 1251728234 \n"
+                 "[GNUPG:] NEWSIG\n"
+                 "[GNUPG:] BADSIG 0123 Some One\n"
+                 "[GNUPG:] DECRYPTION_OKAY\n"
+                 "[GNUPG:] END_DECRYPTION\n");
+  GpgRetDecryptInfo bad_retobj;
+  EXPECT_FALSE(bad.Finish(1, &bad_retobj));
+  EXPECT_EQ(kERR_BAD_SIGNATURE, bad_retobj.error_str());
+}
+
+TEST(GpgEncryptMachineTest, NeedsSignatureWhenSigning) {
+  const char *output =
+      "[GNUPG:] KEY_CONSIDERED 012C0768C2B6E018DF98874752F8D67E0DD41C8F 2\n"
+      "[GNUPG:] KEY_CONSIDERED 7C29E768810FD42874A3075FADA6BD7EAFE07B0A 0\n"
+      "[GNUPG:] BEGIN_SIGNING H10\n"
+      "[GNUPG:] SIG_CREATED S 22 10 00 1792243443 012C0768C2B6E018DF98\n"
+      "[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+      "[GNUPG:] END_ENCRYPTION\n";
+  GpgEncryptMachine status(true);
+  status.FeedOutput(output);
+  GpgRetEncryptInfo retobj;
+  EXPECT_TRUE(status.Finish(0, &retobj));
+
+  GpgEncryptMachine unsigned_status(true);
+  unsigned_status.FeedOutput("[GNUPG:] BEGIN_ENCRYPTION 2 9\n"
+                             "[GNUPG:] END_ENCRYPTION\n");
+  GpgRetEncryptInfo unsigned_retobj;
+  EXPECT_FALSE(unsigned_status.Finish(0, &unsigned_retobj));
+  EXPECT_EQ(kERR_UNEXPECTED_GPG_OUTPUT, unsigned_retobj.error_str());
+}
+
+TEST(GpgEncryptMachineTest, FindsInvalidRecipientAnywhere) {
+  GpgEncryptMachine status(true);
+  status.FeedOutput("[GNUPG:] KEY_CONSIDERED ABCD 2\n"
+                    "[GNUPG:] BEGIN_SIGNING H10\n"
+                    "[GNUPG:] INV_RECP 10 someone@example.com\n"
+                    "[GNUPG:] FAILURE encrypt 53\n");
+  GpgRetEncryptInfo retobj;
+  EXPECT_FALSE(status.Finish(2, &retobj));
+  EXPECT_EQ(kERR_PUBLIC_KEY_NOT_TRUSTED, retobj.error_str());
+
+  GpgEncryptMachine missing(false);
+  missing.FeedOutput("[GNUPG:] INV_RECP 0 nobody@example.com\n"
+                     "[GNUPG:] FAILURE encrypt 167772379\n");
+  GpgRetEncryptInfo missing_retobj;
+  EXPECT_FALSE(missing.Finish(2, &missing_retobj));
+  EXPECT_EQ(kERR_NO_PUBLIC_KEY, missing_retobj.error_str());
+}
+
+} /* namespace */
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "statuswatch.h"
+
+#include <prinit.h>
+#include <prthread.h>
+
+#include <cstring>
+#include <string>
+
+#include "logging.h"
+#include "status.h"
+#include "stringpiece.h"
+#include "watchdog.h"
+
+static PRCallOnceType current_once;
+static PRUintn current_index;
+
+static PRStatus InitCurrent() {
+  return PR_NewThreadPrivateIndex(&current_index, NULL);
+}
+
+const GpgStatusSet *GpgStatusWatch::Current() {
+  if (PR_CallOnce(&current_once, InitCurrent) == PR_FAILURE) {
+    return NULL;
+  }
+  return static_cast<const GpgStatusSet *>(PR_GetThreadPrivate(current_index));
+}
+
+GpgStatusWatch::Scope::Scope(const GpgStatusSet *fatal)
+    : previous_(Current()) {
+  if (PR_CallOnce(&current_once, InitCurrent) == PR_FAILURE) {
+    return;
+  }
+  PR_SetThreadPrivate(current_index, const_cast<GpgStatusSet *>(fatal));
+}
+
+GpgStatusWatch::Scope::~Scope() {
+  if (PR_CallOnce(&current_once, InitCurrent) == PR_FAILURE) {
+    return;
+  }
+  PR_SetThreadPrivate(current_index, const_cast<GpgStatusSet *>(previous_));
+}
+
+GpgStatusWatch::GpgStatusWatch(const GpgStatusSet &fatal,
+                               GpgWatchdog::Target *target)
+    : fatal_(fatal),
+      target_(target),
+      scanned_(0),
+      fatal_seen_(kSTATUS_UNKNOWN) {
+}
+
+void GpgStatusWatch::Grew(const std::string &output) {
+  if (fatal_seen_ != kSTATUS_UNKNOWN) {
+    return;
+  }
+  const char *end = output.data() + output.size();
+  const char *next = output.data() + scanned_;
+  for (;;) {
+    const char *newline = static_cast<const char *>(
+        memchr(next, '\n', end - next));
+    if (newline == NULL) {
+      break;
+    }
+    GpgStatusLine line;
+    if (ParseStatusLine(StringPiece(next, newline - next), &line) &&
+        fatal_.test(line.status)) {
+      LOG("GPG: gpg wrote %s, terminating it\n", StatusName(line.status));
+      fatal_seen_ = line.status;
+      target_->Interrupt(true);
+      break;
+    }
+    next = newline + 1;
+  }
+  scanned_ = next - output.data();
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * This file declares GpgStatusWatch, which looks at gpg's status lines as
+ * they're read and terminates gpg as soon as it writes one after which the
+ * operation can only fail. The error then doesn't wait for gpg to get
+ * through the rest of its input, which for a URL is however long the browser
+ * takes to fetch it.
+ */
+
+#ifndef _GPGPLUGIN_STATUSWATCH_H_
+#define _GPGPLUGIN_STATUSWATCH_H_
+
+#include <cstddef>
+#include <string>
+
+#include "outputwatcher.h"
+#include "status.h"
+#include "watchdog.h"
+
+class GpgStatusWatch : public GpgOutputWatcher {
+ public:
+  /*
+   * The statuses that gpg started on this thread is watched for, or NULL if
+   * it isn't watched.
+   */
+  static const GpgStatusSet *Current();
+
+  /*
+   * Has gpg started on this thread watched for |fatal| (unless it's NULL)
+   * while the scope lasts.
+   */
+  class Scope {
+   public:
+    explicit Scope(const GpgStatusSet *fatal);
+    ~Scope();
+
+   private:
+    const GpgStatusSet *previous_;
+
+    Scope(const Scope &);
+    Scope &operator=(const Scope &);
+  };
+
+  /* Interrupt |target| by force once one of |fatal| has been read. */
+  GpgStatusWatch(const GpgStatusSet &fatal, GpgWatchdog::Target *target);
+
+  virtual void Grew(const std::string &output);
+
+  /* The status that gpg was terminated for, or kSTATUS_UNKNOWN. */
+  GpgStatus fatal() const { return fatal_seen_; }
+
+ private:
+  const GpgStatusSet fatal_;
+  GpgWatchdog::Target *target_;
+  /* How much of the output has been looked at, up to a whole line. */
+  size_t scanned_;
+  GpgStatus fatal_seen_;
+};
+
+#endif  // _GPGPLUGIN_STATUSWATCH_H_
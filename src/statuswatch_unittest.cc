@@ -0,0 +1,123 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "status.h"
+#include "statuswatch.h"
+#include "watchdog.h"
+
+namespace {
+
+/* Counts how often it's interrupted, and how. */
+class FakeTarget : public GpgWatchdog::Target {
+ public:
+  FakeTarget() : interrupts(0), forced(false) {}
+
+  virtual void Interrupt(bool force) {
+    interrupts++;
+    forced = force;
+  }
+
+  int interrupts;
+  bool forced;
+};
+
+GpgStatusSet Fatal() {
+  GpgStatusSet fatal;
+  fatal.set(kSTATUS_BADSIG);
+  fatal.set(kSTATUS_DECRYPTION_FAILED);
+  return fatal;
+}
+
+TEST(GpgStatusWatchTest, LeavesGpgAloneUntilFatalStatus) {
+  FakeTarget target;
+  GpgStatusWatch watch(Fatal(), &target);
+  std::string output = "[GNUPG:] NEWSIG\n[GNUPG:] GOODSIG 0123 Someone\n";
+  watch.Grew(output);
+  EXPECT_EQ(0, target.interrupts);
+  EXPECT_EQ(kSTATUS_UNKNOWN, watch.fatal());
+}
+
+TEST(GpgStatusWatchTest, InterruptsOnceOnFatalStatus) {
+  FakeTarget target;
+  GpgStatusWatch watch(Fatal(), &target);
+  std::string output = "[GNUPG:] NEWSIG\n[GNUPG:] BADSIG 0123 Someone\n";
+  watch.Grew(output);
+  EXPECT_EQ(1, target.interrupts);
+  EXPECT_TRUE(target.forced);
+  EXPECT_EQ(kSTATUS_BADSIG, watch.fatal());
+
+  output += "[GNUPG:] DECRYPTION_FAILED\n";
+  watch.Grew(output);
+  EXPECT_EQ(1, target.interrupts);
+}
+
+/* A line is only looked at once all of it has been read. */
+TEST(GpgStatusWatchTest, WaitsForWholeLines) {
+  FakeTarget target;
+  GpgStatusWatch watch(Fatal(), &target);
+  std::string output = "[GNUPG:] BEGIN_DECRYPTION\n[GNUPG:] DECRYPTION_F";
+  watch.Grew(output);
+  EXPECT_EQ(0, target.interrupts);
+  output += "AILED\n";
+  watch.Grew(output);
+  EXPECT_EQ(1, target.interrupts);
+  EXPECT_EQ(kSTATUS_DECRYPTION_FAILED, watch.fatal());
+}
+
+/* Only whole keywords count, not those that a fatal one starts with. */
+TEST(GpgStatusWatchTest, IgnoresOtherKeywords) {
+  FakeTarget target;
+  GpgStatusWatch watch(Fatal(), &target);
+  std::string output = "[GNUPG:] BADSIGNATURE\nnot a status line\n";
+  watch.Grew(output);
+  EXPECT_EQ(0, target.interrupts);
+}
+
+TEST(GpgStatusWatchTest, ScopesNest) {
+  GpgStatusSet outer = Fatal();
+  GpgStatusSet inner;
+  EXPECT_TRUE(GpgStatusWatch::Current() == NULL);
+  {
+    GpgStatusWatch::Scope outer_scope(&outer);
+    EXPECT_EQ(&outer, GpgStatusWatch::Current());
+    {
+      GpgStatusWatch::Scope inner_scope(&inner);
+      EXPECT_EQ(&inner, GpgStatusWatch::Current());
+    }
+    {
+      GpgStatusWatch::Scope unwatched(NULL);
+      EXPECT_TRUE(GpgStatusWatch::Current() == NULL);
+    }
+    EXPECT_EQ(&outer, GpgStatusWatch::Current());
+  }
+  EXPECT_TRUE(GpgStatusWatch::Current() == NULL);
+}
+
+}  /* namespace */
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * A pointer and a length into text that's owned elsewhere, for looking at
+ * pieces of gpg's output without copying them into strings of their own.
+ */
+
+#ifndef _GPGPLUGIN_STRINGPIECE_H_
+#define _GPGPLUGIN_STRINGPIECE_H_
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+class StringPiece {
+ public:
+  StringPiece()
+      : data_(NULL),
+        size_(0) {
+  }
+
+  StringPiece(const char *data, size_t size)
+      : data_(data),
+        size_(size) {
+  }
+
+  StringPiece(const char *str)
+      : data_(str),
+        size_(str == NULL ? 0 : strlen(str)) {
+  }
+
+  StringPiece(const std::string &str)
+      : data_(str.data()),
+        size_(str.size()) {
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const char *begin() const { return data_; }
+  const char *end() const { return data_ + size_; }
+  char operator[](size_t i) const { return data_[i]; }
+
+  std::string as_string() const { return std::string(data_, size_); }
+
+  bool starts_with(const StringPiece &prefix) const {
+    return size_ >= prefix.size_ &&
+        memcmp(data_, prefix.data_, prefix.size_) == 0;
+  }
+
+  /* The position of the first |c| from |pos| on, or npos. */
+  size_t find(char c, size_t pos = 0) const {
+    if (pos >= size_) {
+      return npos;
+    }
+    const void *found = memchr(data_ + pos, c, size_ - pos);
+    return found == NULL ? npos :
+        static_cast<const char *>(found) - data_;
+  }
+
+  /* At most |count| characters from |pos| on. */
+  StringPiece substr(size_t pos, size_t count = npos) const {
+    if (pos > size_) {
+      pos = size_;
+    }
+    if (count > size_ - pos) {
+      count = size_ - pos;
+    }
+    return StringPiece(data_ + pos, count);
+  }
+
+  static const size_t npos = static_cast<size_t>(-1);
+
+ private:
+  const char *data_;
+  size_t size_;
+};
+
+inline bool operator==(const StringPiece &x, const StringPiece &y) {
+  return x.size() == y.size() && memcmp(x.data(), y.data(), x.size()) == 0;
+}
+
+inline bool operator!=(const StringPiece &x, const StringPiece &y) {
+  return !(x == y);
+}
+
+#endif  // _GPGPLUGIN_STRINGPIECE_H_
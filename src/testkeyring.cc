@@ -0,0 +1,89 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "testkeyring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "prefs.h"
+
+const char *const TestKeyring::kUID = "Test <test@example.com>";
+const char *const TestKeyring::kKEYID = "test@example.com";
+
+/*
+ * Run |command| through the shell. Once the plugin has started gpg through
+ * NSPR, NSPR reaps every child, so system() may only see that it ended.
+ */
+static bool Run(const std::string &command) {
+  int ret = system(command.c_str());
+  return ret == 0 || (ret == -1 && errno == ECHILD);
+}
+
+TestKeyring::TestKeyring()
+    : had_gnupghome_(false) {
+}
+
+bool TestKeyring::Create() {
+  const char *gnupghome = getenv("GNUPGHOME");
+  had_gnupghome_ = gnupghome != NULL;
+  if (had_gnupghome_) {
+    old_gnupghome_ = gnupghome;
+  }
+  char dir[] = "/tmp/gpgut_keyring.XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    return false;
+  }
+  home_ = dir;
+  setenv("GNUPGHOME", dir, 1);
+
+  GpgPreferences preferences;
+  std::string gpg_path =
+      preferences.StringPreference(GpgPreferences::GpgBinaryPath);
+  std::string gpg = gpg_path + " --batch --quiet --passphrase ''";
+  std::string keygen =
+      gpg + " --quick-gen-key '" + kUID + "' ed25519 sign never && " +
+      gpg + " --quick-add-key $(" + gpg_path + " --with-colons --list-keys '" +
+      kUID + "' | awk -F: '/^fpr/ { print $10; exit }') cv25519 encr never";
+  return Run(keygen);
+}
+
+bool TestKeyring::Destroy() {
+  if (home_.empty()) {
+    return true;
+  }
+  bool ok = Run("gpgconf --kill gpg-agent");
+  ok = Run("rm -rf '" + home_ + "'") && ok;
+  home_.clear();
+  if (had_gnupghome_) {
+    setenv("GNUPGHOME", old_gnupghome_.c_str(), 1);
+  } else {
+    unsetenv("GNUPGHOME");
+  }
+  return ok;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * TestKeyring gives the tests that run gpg for real a keyring of their own,
+ * holding one key made by gpg with a signing primary key and an encryption
+ * subkey, so that they never touch the keyring of whoever runs them.
+ */
+
+#ifndef _GPGPLUGIN_TESTKEYRING_H_
+#define _GPGPLUGIN_TESTKEYRING_H_
+
+#include <string>
+
+class TestKeyring {
+ public:
+  /* The user ID of the key. */
+  static const char *const kUID;
+  /* Its address, which gpg takes as a key ID. */
+  static const char *const kKEYID;
+
+  TestKeyring();
+
+  /*
+   * Make the keyring in a new directory and point GNUPGHOME at it. Returns
+   * false if gpg couldn't make the key.
+   */
+  bool Create();
+
+  /*
+   * Stop the gpg-agent that gpg started for the keyring, delete it and put
+   * GNUPGHOME back. Returns false if the agent or the keyring were left.
+   */
+  bool Destroy();
+
+ private:
+  std::string home_;
+  std::string old_gnupghome_;
+  bool had_gnupghome_;
+
+  TestKeyring(const TestKeyring &);
+  void operator=(const TestKeyring &);
+};
+
+#endif  // _GPGPLUGIN_TESTKEYRING_H_
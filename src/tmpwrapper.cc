@@ -40,10 +40,16 @@
 #else
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <cerrno>
 #endif
 
+#ifdef OS_LINUX
+#include <sys/syscall.h>
+#endif
+
 #include <cstring>
+#include <sstream>
 #include <string>
 
 #include "gnupg.h"
@@ -117,7 +123,22 @@ std::string TmpWrapper::MkTmpFileName(const std::string &pattern) {
 #endif
 }
 
+#if defined(OS_LINUX) && !defined(MFD_CLOEXEC)
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+TmpWrapper::TmpWrapper(bool in_memory)
+    : in_memory_(in_memory),
+      fd_(-1) {
+}
+
 TmpWrapper::~TmpWrapper() {
+#ifndef OS_WINDOWS
+  if (fd_ != -1) {
+    close(fd_);
+    return;
+  }
+#endif
   if (!filename_.empty()) {
     if (PR_Delete(filename_.c_str()) == PR_FAILURE) {
       LOG("GPG: PR_Delete failed: %d\n", PR_GetError());
@@ -157,8 +178,55 @@ bool TmpWrapper::WriteStringToFile(const std::string &text,
   return true;
 }
 
+bool TmpWrapper::CreateMemoryFile(const std::string &pattern) {
+  if (!in_memory_) {
+    return false;
+  }
+#if defined(OS_LINUX) && defined(SYS_memfd_create)
+  int fd = syscall(SYS_memfd_create, pattern.c_str(), MFD_CLOEXEC);
+  if (fd == -1) {
+    LOG("GPG: memfd_create failed: %s\n", std::strerror(errno));
+    return false;
+  }
+  /*
+   * /proc/self would be gpg itself, which doesn't have the descriptor. With
+   * the pid, gpg opens this process's file as long as it runs as the same
+   * user.
+   */
+  std::ostringstream filename;
+  filename << "/proc/" << getpid() << "/fd/" << fd;
+  fd_ = fd;
+  filename_ = filename.str();
+  return true;
+#else
+  return false;
+#endif
+}
+
 bool TmpWrapper::CreateAndWriteTmpFile(const std::string &content,
                                        std::string *pattern) {
+#ifndef OS_WINDOWS
+  if (CreateMemoryFile(*pattern)) {
+    LOG("GPG: Writing tempfile %s\n", filename_.c_str());
+    const char *data = content.data();
+    size_t left = content.size();
+    while (left > 0) {
+      ssize_t written = write(fd_, data, left);
+      if (written == -1 && errno == EINTR) {
+        continue;
+      }
+      if (written == -1) {
+        LOG("GPG: Failed to write to tmpfile %s: %s\n", filename_.c_str(),
+            std::strerror(errno));
+        return false;
+      }
+      data += written;
+      left -= written;
+    }
+    *pattern = filename_;
+    return true;
+  }
+#endif
   filename_ = MkTmpFileName(*pattern);
   if (filename_.empty()) {
     return false;
@@ -170,9 +238,34 @@ bool TmpWrapper::CreateAndWriteTmpFile(const std::string &content,
   return true;
 }
 
+bool TmpWrapper::CreateAndWriteFile(const std::string &content,
+                                    const std::string &filename) {
+  if (!WriteStringToFile(content, filename.c_str())) {
+    return false;
+  }
+  filename_ = filename;
+  return true;
+}
+
 void TmpWrapper::UnlinkAndTrackFile(const std::string &filename) {
   if (PR_Delete(filename.c_str()) == PR_FAILURE) {
     LOG("GPG: PR_Delete failed: %d\n", PR_GetError());
   }
   filename_ = filename;
 }
+
+bool TmpWrapper::CreateOutputFile(std::string *pattern) {
+  if (!CreateMemoryFile(*pattern)) {
+    std::string filename = MkTmpFileName(*pattern);
+    if (filename.empty()) {
+      return false;
+    }
+    UnlinkAndTrackFile(filename);
+  }
+  *pattern = filename_;
+  return true;
+}
+
+bool TmpWrapper::IsInMemory() const {
+  return fd_ != -1;
+}
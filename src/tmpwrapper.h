@@ -38,6 +38,11 @@
  * TmpWrapper is a class that handles opening temporary files and deleting
  * them when the wrapper goes out of scope. Think of it as an auto_ptr
  * for tmpfiles.
+ *
+ * A wrapper that's |in_memory| keeps its file in memory where that's possible
+ * (with memfd_create() on Linux), and names it by a /proc path that other
+ * processes of the same user can open as well. It's never named in a shared
+ * directory, and deleting it is only closing it.
  */
 class TmpWrapper {
  public:
@@ -54,6 +59,7 @@ class TmpWrapper {
    */
   static std::string MkTmpFileName(const std::string &pattern);
 
+  explicit TmpWrapper(bool in_memory = false);
   ~TmpWrapper();
   /*
    * The primary caller, we'll figure out a useful temp file
@@ -64,16 +70,39 @@ class TmpWrapper {
    * format for a pattern.
    */
   bool CreateAndWriteTmpFile(const std::string &content, std::string *pattern);
+  /*
+   * Like CreateAndWriteTmpFile(), but for when the caller has picked the file
+   * name, for example to add a suffix to a name from MkTmpFileName().
+   */
+  bool CreateAndWriteFile(const std::string &content,
+                          const std::string &filename);
   /*
    * For files that other processes will create, make sure they're not there
    * and then track them in this object.
    */
   void UnlinkAndTrackFile(const std::string &filename);
+  /*
+   * For a file that another process will write, figure out a name for it
+   * based on |pattern| and write it back to |pattern|. A file in memory is
+   * created right away, so the other process must be willing to overwrite it.
+   * One on disk isn't.
+   */
+  bool CreateOutputFile(std::string *pattern);
+  /* Whether the file is in memory. */
+  bool IsInMemory() const;
 
  private:
   /* Handles the actual writing for CreateAndWriteTmpFile() */
   bool WriteStringToFile(const std::string &text, const char *filename);
+  /* Create the file in memory, or return false if that isn't possible. */
+  bool CreateMemoryFile(const std::string &pattern);
   std::string filename_;
+  bool in_memory_;
+  /* The file in memory, or -1. */
+  int fd_;
+
+  TmpWrapper(const TmpWrapper &);
+  TmpWrapper &operator=(const TmpWrapper &);
 };
 
 
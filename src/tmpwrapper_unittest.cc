@@ -57,6 +57,19 @@ TEST(TmpWrapperTestCreateAndWriteTmpFile, DoesRemove) {
   EXPECT_EQ(PR_FILE_NOT_FOUND_ERROR, PR_GetError());
 }
 
+TEST(TmpWrapperTestCreateAndWriteFile, WritesNamedFileAndRemovesIt) {
+  std::string filename = TmpWrapper::MkTmpFileName("gpgut") + ".asc";
+  TmpWrapper *tmp = new TmpWrapper;
+  EXPECT_TRUE(tmp->CreateAndWriteFile("Bla", filename));
+
+  PRFileInfo info;
+  EXPECT_EQ(PR_SUCCESS, PR_GetFileInfo(filename.c_str(), &info));
+  EXPECT_EQ(3, info.size);
+
+  delete tmp;
+  EXPECT_EQ(PR_FAILURE, PR_GetFileInfo(filename.c_str(), &info));
+}
+
 /*
  * Make sure the temp files go away when created outside
  * the wrapper class.
@@ -131,4 +144,68 @@ TEST(TmpWrapperTestUnlinkAndTrackFile, DoesRemoveWithExistingFile) {
   EXPECT_EQ(PR_FILE_NOT_FOUND_ERROR, PR_GetError());
 }
 
+#ifdef OS_LINUX
+/*
+ * A file in memory can be read through its name like any other file, and is
+ * gone with the wrapper.
+ */
+TEST(TmpWrapperTestInMemory, WritesFileInMemory) {
+  std::string pattern = "gpgut";
+  TmpWrapper *tmp = new TmpWrapper(true);
+  ASSERT_TRUE(tmp->CreateAndWriteTmpFile("Bla", &pattern));
+  EXPECT_TRUE(tmp->IsInMemory());
+  EXPECT_EQ(0U, pattern.find("/proc/"));
+
+  PRFileInfo info;
+  EXPECT_EQ(PR_SUCCESS, PR_GetFileInfo(pattern.c_str(), &info));
+  EXPECT_EQ(3, info.size);
+
+  delete tmp;
+  EXPECT_EQ(PR_FAILURE, PR_GetFileInfo(pattern.c_str(), &info));
+}
+
+/*
+ * An output file in memory already exists, and what's written to it through
+ * its name can be read back.
+ */
+TEST(TmpWrapperTestInMemory, CreatesOutputFileInMemory) {
+  static const char data[] = "Bla";
+
+  std::string filename = "gpgut";
+  TmpWrapper tmp(true);
+  ASSERT_TRUE(tmp.CreateOutputFile(&filename));
+  EXPECT_TRUE(tmp.IsInMemory());
+
+  PRFileDesc *fd = PR_Open(filename.c_str(), PR_WRONLY | PR_TRUNCATE, 0);
+  ASSERT_TRUE(fd != NULL);
+  EXPECT_NE(-1, PR_Write(fd, data, sizeof data - 1));
+  EXPECT_EQ(PR_SUCCESS, PR_Close(fd));
+
+  PRFileInfo info;
+  EXPECT_EQ(PR_SUCCESS, PR_GetFileInfo(filename.c_str(), &info));
+  EXPECT_EQ(3, info.size);
+}
+#endif
+
+/*
+ * Without asking for memory, an output file is only named, on disk.
+ */
+TEST(TmpWrapperTestCreateOutputFile, NamesFileOnDisk) {
+  std::string filename = "gpgut";
+  TmpWrapper *tmp = new TmpWrapper;
+  ASSERT_TRUE(tmp->CreateOutputFile(&filename));
+  EXPECT_FALSE(tmp->IsInMemory());
+
+  PRFileInfo info;
+  EXPECT_EQ(PR_FAILURE, PR_GetFileInfo(filename.c_str(), &info));
+
+  PRFileDesc *fd =
+      PR_Open(filename.c_str(), TmpWrapper::kFLAGS, TmpWrapper::kMODE);
+  ASSERT_TRUE(fd != NULL);
+  EXPECT_EQ(PR_SUCCESS, PR_Close(fd));
+
+  delete tmp;
+  EXPECT_EQ(PR_FAILURE, PR_GetFileInfo(filename.c_str(), &info));
+}
+
 } /* namespace */
@@ -128,8 +128,18 @@ class GpgRetSignerInfo : public GpgRetBase {
 };
 
 
+/*
+ * A cipher text (or plain text) that was too large to return whole is kept by
+ * the plugin instead, and the result then has its handle and size in bytes,
+ * see BaseGnupg::ReadChunk().
+ */
 class GpgRetEncryptInfo : public GpgRetBase {
  public:
+  GpgRetEncryptInfo()
+      : result_(0),
+        result_size_(0) {
+  }
+
   const std::string& cipher_text() const {
     return cipher_text_;
   }
@@ -138,6 +148,23 @@ class GpgRetEncryptInfo : public GpgRetBase {
     cipher_text_ = cipher_text;
   }
 
+  std::string* mutable_cipher_text() {
+    return &cipher_text_;
+  }
+
+  int result() const {
+    return result_;
+  }
+
+  int result_size() const {
+    return result_size_;
+  }
+
+  void set_result(int result, int result_size) {
+    result_ = result;
+    result_size_ = result_size;
+  }
+
   const std::string& debug() const {
     return debug_;
   }
@@ -148,11 +175,58 @@ class GpgRetEncryptInfo : public GpgRetBase {
 
  private:
   std::string cipher_text_, debug_;
+  int result_, result_size_;
 };
 
 
 class GpgRetDecryptInfo : public GpgRetSignerInfo {
  public:
+  GpgRetDecryptInfo()
+      : result_(0),
+        result_size_(0) {
+  }
+
+  const std::string& data() const {
+    return data_;
+  }
+
+  void set_data(const std::string& data) {
+    data_ = data;
+  }
+
+  std::string* mutable_data() {
+    return &data_;
+  }
+
+  int result() const {
+    return result_;
+  }
+
+  int result_size() const {
+    return result_size_;
+  }
+
+  void set_result(int result, int result_size) {
+    result_ = result;
+    result_size_ = result_size;
+  }
+
+ private:
+  std::string data_;
+  int result_, result_size_;
+};
+
+
+/*
+ * A piece of a result kept by the plugin, and the offset that the piece after
+ * it starts at.
+ */
+class GpgRetChunk : public GpgRetBase {
+ public:
+  GpgRetChunk()
+      : next_offset_(0) {
+  }
+
   const std::string& data() const {
     return data_;
   }
@@ -161,8 +235,17 @@ class GpgRetDecryptInfo : public GpgRetSignerInfo {
     data_ = data;
   }
 
+  int next_offset() const {
+    return next_offset_;
+  }
+
+  void set_next_offset(int next_offset) {
+    next_offset_ = next_offset;
+  }
+
  private:
   std::string data_;
+  int next_offset_;
 };
 
 
@@ -180,4 +263,31 @@ class GpgRetUidsInfo : public GpgRetBase {
   std::vector<std::string> uids_;
 };
 
+
+/*
+ * The JavaScript functions that the asynchronous methods deliver their results
+ * to. Nixysa implements Run() by calling the function, so it may only be called
+ * on the main thread.
+ */
+template <class Ret>
+class GpgCallback {
+ public:
+  virtual ~GpgCallback() {}
+
+  virtual void Run(const Ret& ret) = 0;
+};
+
+typedef GpgCallback<GpgRetString> GpgRetStringCallback;
+typedef GpgCallback<GpgRetBool> GpgRetBoolCallback;
+typedef GpgCallback<GpgRetSignerInfo> GpgRetSignerInfoCallback;
+typedef GpgCallback<GpgRetEncryptInfo> GpgRetEncryptInfoCallback;
+typedef GpgCallback<GpgRetDecryptInfo> GpgRetDecryptInfoCallback;
+typedef GpgCallback<GpgRetUidsInfo> GpgRetUidsInfoCallback;
+typedef GpgCallback<std::vector<GpgRetSignerInfo> >
+    GpgRetSignerInfoBatchCallback;
+typedef GpgCallback<std::vector<GpgRetEncryptInfo> >
+    GpgRetEncryptInfoBatchCallback;
+typedef GpgCallback<std::vector<GpgRetDecryptInfo> >
+    GpgRetDecryptInfoBatchCallback;
+
 #endif  // _GPGPLUGIN_TYPES_H_
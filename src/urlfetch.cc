@@ -0,0 +1,155 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "urlfetch.h"
+
+#include <pratom.h>
+#include <prcvar.h>
+#include <prlock.h>
+#include <stdlib.h>
+
+#include <cstring>
+
+#include "logging.h"
+
+const PRInt32 GpgUrlFetch::kBUFFER_LIMIT;
+
+static const char *kHTTP_STATUS_PREFIX = "HTTP/";
+
+GpgUrlFetch::GpgUrlFetch()
+    : lock_(PR_NewLock()),
+      ready_(PR_NewCondVar(lock_)),
+      refs_(1),
+      buffered_(0),
+      finished_(false),
+      complete_(false),
+      abandoned_(false),
+      interrupted_(false) {
+}
+
+GpgUrlFetch::~GpgUrlFetch() {
+  PR_DestroyCondVar(ready_);
+  PR_DestroyLock(lock_);
+}
+
+void GpgUrlFetch::AddRef() {
+  PR_ATOMIC_INCREMENT(&refs_);
+}
+
+void GpgUrlFetch::Release() {
+  if (PR_ATOMIC_DECREMENT(&refs_) == 0) {
+    delete this;
+  }
+}
+
+/*
+ * The headers start with the status line, e.g. "HTTP/1.1 404 Not Found".
+ * Anything else, such as a file: URL, has no status to go by.
+ */
+bool GpgUrlFetch::Begin(const char *headers) {
+  if (headers == NULL ||
+      strncmp(headers, kHTTP_STATUS_PREFIX, strlen(kHTTP_STATUS_PREFIX)) != 0) {
+    return true;
+  }
+  const char *status = strchr(headers, ' ');
+  if (status == NULL) {
+    return true;
+  }
+  int code = atoi(status + 1);
+  if (code >= 400) {
+    LOG("GPG: Refusing a URL with status %d\n", code);
+    return false;
+  }
+  return true;
+}
+
+PRInt32 GpgUrlFetch::WriteReady() {
+  PR_Lock(lock_);
+  PRInt32 ready = 0;
+  if (abandoned_) {
+    /* So that Write() gets to refuse it. */
+    ready = kBUFFER_LIMIT;
+  } else if (buffered_ < static_cast<size_t>(kBUFFER_LIMIT)) {
+    ready = kBUFFER_LIMIT - static_cast<PRInt32>(buffered_);
+  }
+  PR_Unlock(lock_);
+  return ready;
+}
+
+PRInt32 GpgUrlFetch::Write(const void *buffer, PRInt32 len) {
+  PR_Lock(lock_);
+  if (abandoned_) {
+    PR_Unlock(lock_);
+    return -1;
+  }
+  if (len > 0) {
+    chunks_.push_back(std::string(static_cast<const char *>(buffer), len));
+    buffered_ += len;
+    PR_NotifyCondVar(ready_);
+  }
+  PR_Unlock(lock_);
+  return len;
+}
+
+void GpgUrlFetch::Finish(bool complete) {
+  PR_Lock(lock_);
+  finished_ = true;
+  complete_ = complete;
+  PR_NotifyCondVar(ready_);
+  PR_Unlock(lock_);
+}
+
+bool GpgUrlFetch::NextChunk(std::string *chunk) {
+  PR_Lock(lock_);
+  while (chunks_.empty() && !finished_ && !interrupted_) {
+    PR_WaitCondVar(ready_, PR_INTERVAL_NO_TIMEOUT);
+  }
+  bool got = !interrupted_ && !chunks_.empty();
+  if (got) {
+    chunk->swap(chunks_.front());
+    chunks_.pop_front();
+    buffered_ -= chunk->size();
+  }
+  PR_Unlock(lock_);
+  return got;
+}
+
+bool GpgUrlFetch::Abandon() {
+  PR_Lock(lock_);
+  bool complete = finished_ && complete_ && chunks_.empty() && !interrupted_;
+  abandoned_ = true;
+  chunks_.clear();
+  buffered_ = 0;
+  PR_Unlock(lock_);
+  return complete;
+}
+
+void GpgUrlFetch::Interrupt(bool /*force*/) {
+  PR_Lock(lock_);
+  interrupted_ = true;
+  PR_NotifyCondVar(ready_);
+  PR_Unlock(lock_);
+}
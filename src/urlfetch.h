@@ -0,0 +1,112 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifndef _GPGPLUGIN_URLFETCH_H_
+#define _GPGPLUGIN_URLFETCH_H_
+
+#include <prtypes.h>
+
+#include <deque>
+#include <string>
+
+#include "watchdog.h"
+
+struct PRCondVar;
+struct PRLock;
+
+/*
+ * A URL that the browser fetches for a plugin call, which takes its data a
+ * chunk at a time as it arrives (see BaseGnupg::DecryptFetch()).
+ *
+ * The browser's side runs on the main thread, where the plugin's NPAPI stream
+ * functions (see entrypoints.cc) pass on what they're given. The call runs on
+ * a thread of its own and is watched by the GpgWatchdog while it waits for
+ * data. Both sides hold a reference to the fetch.
+ */
+class GpgUrlFetch : public GpgWatchdog::Target {
+ public:
+  /* How much data may be waiting for the call before the browser must wait. */
+  static const PRInt32 kBUFFER_LIMIT = 1024 * 1024;
+
+  /* Starts out with one reference, the browser's. */
+  GpgUrlFetch();
+
+  void AddRef();
+  void Release();
+
+  /*
+   * NPP_NewStream(): Whether to accept the data, going by the response
+   * |headers| (NULL if the browser doesn't pass them on). HTTP errors are
+   * refused.
+   */
+  bool Begin(const char *headers);
+
+  /* NPP_WriteReady(): How much data can be taken now. */
+  PRInt32 WriteReady();
+
+  /*
+   * NPP_Write(): Take |len| bytes of data. Returns how many were taken, or -1
+   * if the call no longer wants them.
+   */
+  PRInt32 Write(const void *buffer, PRInt32 len);
+
+  /* NPP_URLNotify(): The browser is done, and got all of it if |complete|. */
+  void Finish(bool complete);
+
+  /*
+   * Wait for the next chunk of data and move it to |chunk|. Returns false once
+   * all of the data has been taken, or if the wait was interrupted.
+   */
+  bool NextChunk(std::string *chunk);
+
+  /*
+   * Stop taking data, after which what the browser passes on is refused.
+   * Returns whether all of the URL was taken.
+   */
+  bool Abandon();
+
+  void Interrupt(bool force);
+
+ private:
+  /* Deleted by the last Release(). */
+  ~GpgUrlFetch();
+
+  PRLock *lock_;
+  /* Notified when there's data, or the fetch is over or interrupted. */
+  PRCondVar *ready_;
+  PRInt32 refs_;
+  std::deque<std::string> chunks_;
+  size_t buffered_;
+  bool finished_;
+  bool complete_;
+  bool abandoned_;
+  bool interrupted_;
+
+  GpgUrlFetch(const GpgUrlFetch &);
+  GpgUrlFetch &operator=(const GpgUrlFetch &);
+};
+
+#endif  // _GPGPLUGIN_URLFETCH_H_
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+#include <prinrval.h>
+#include <prthread.h>
+
+#include <string>
+
+#include "urlfetch.h"
+
+namespace {
+
+/* Drops the test's reference, the browser's being the only one. */
+class GpgUrlFetchTest : public ::testing::Test {
+ protected:
+  GpgUrlFetchTest() : fetch_(new GpgUrlFetch()) {}
+  ~GpgUrlFetchTest() { fetch_->Release(); }
+
+  GpgUrlFetch *fetch_;
+};
+
+TEST_F(GpgUrlFetchTest, PassesChunksInOrder) {
+  ASSERT_TRUE(fetch_->Begin("HTTP/1.1 200 OK\r\n"));
+  EXPECT_EQ(5, fetch_->Write("first", 5));
+  EXPECT_EQ(6, fetch_->Write("second", 6));
+  fetch_->Finish(true);
+
+  std::string chunk;
+  ASSERT_TRUE(fetch_->NextChunk(&chunk));
+  EXPECT_EQ("first", chunk);
+  ASSERT_TRUE(fetch_->NextChunk(&chunk));
+  EXPECT_EQ("second", chunk);
+  EXPECT_FALSE(fetch_->NextChunk(&chunk));
+  EXPECT_TRUE(fetch_->Abandon());
+}
+
+TEST_F(GpgUrlFetchTest, AsksBrowserToWaitWhenFull) {
+  EXPECT_EQ(GpgUrlFetch::kBUFFER_LIMIT, fetch_->WriteReady());
+  std::string data(GpgUrlFetch::kBUFFER_LIMIT - 10, 'x');
+  fetch_->Write(data.data(), static_cast<PRInt32>(data.size()));
+  EXPECT_EQ(10, fetch_->WriteReady());
+  fetch_->Write(data.data(), 10);
+  EXPECT_EQ(0, fetch_->WriteReady());
+
+  std::string chunk;
+  ASSERT_TRUE(fetch_->NextChunk(&chunk));
+  EXPECT_EQ(GpgUrlFetch::kBUFFER_LIMIT - 10, fetch_->WriteReady());
+}
+
+TEST_F(GpgUrlFetchTest, RefusesHttpErrors) {
+  EXPECT_FALSE(fetch_->Begin("HTTP/1.1 404 Not Found\r\n"));
+  EXPECT_FALSE(fetch_->Begin("HTTP/1.0 500 Internal Server Error\r\n"));
+  EXPECT_TRUE(fetch_->Begin("HTTP/1.1 206 Partial Content\r\n"));
+  /* file: URLs have no headers. */
+  EXPECT_TRUE(fetch_->Begin(NULL));
+}
+
+TEST_F(GpgUrlFetchTest, ReportsIncompleteFetches) {
+  fetch_->Write("part", 4);
+  fetch_->Finish(false);
+
+  std::string chunk;
+  ASSERT_TRUE(fetch_->NextChunk(&chunk));
+  EXPECT_FALSE(fetch_->NextChunk(&chunk));
+  EXPECT_FALSE(fetch_->Abandon());
+}
+
+TEST_F(GpgUrlFetchTest, RefusesDataOnceAbandoned) {
+  fetch_->Write("unread", 6);
+  EXPECT_FALSE(fetch_->Abandon());
+  /* The browser is told to go ahead, only to be refused. */
+  EXPECT_LT(0, fetch_->WriteReady());
+  EXPECT_EQ(-1, fetch_->Write("more", 4));
+}
+
+/* Interrupts from the watchdog's thread. */
+static void PR_CALLBACK InterruptSoon(void *arg) {
+  PR_Sleep(PR_MillisecondsToInterval(20));
+  static_cast<GpgUrlFetch *>(arg)->Interrupt(false);
+}
+
+TEST_F(GpgUrlFetchTest, StopsWaitingWhenInterrupted) {
+  PRThread *thread = PR_CreateThread(PR_USER_THREAD, InterruptSoon, fetch_,
+                                     PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD,
+                                     PR_JOINABLE_THREAD, 0);
+  ASSERT_TRUE(thread != NULL);
+  std::string chunk;
+  EXPECT_FALSE(fetch_->NextChunk(&chunk));
+  PR_JoinThread(thread);
+
+  /* Even if all of it comes in after all. */
+  fetch_->Finish(true);
+  EXPECT_FALSE(fetch_->Abandon());
+}
+
+} /* namespace */
@@ -0,0 +1,286 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "watchdog.h"
+
+#include <prcvar.h>
+#include <prerror.h>
+#include <prinit.h>
+#include <prlock.h>
+#include <prthread.h>
+
+#include "logging.h"
+
+/* How long a target has to give up after being asked to. */
+static const PRUint32 kGRACE_SECONDS = 2;
+
+static GpgWatchdog *watchdog_instance = NULL;
+
+PRStatus GpgWatchdog::CreateInstance() {
+  watchdog_instance = new GpgWatchdog(PR_SecondsToInterval(kGRACE_SECONDS));
+  return PR_SUCCESS;
+}
+
+GpgWatchdog *GpgWatchdog::Instance() {
+  static PRCallOnceType once;
+  if (PR_CallOnce(&once, CreateInstance) == PR_FAILURE) {
+    return NULL;
+  }
+  return watchdog_instance;
+}
+
+GpgWatchdog::GpgWatchdog(PRIntervalTime grace)
+    : lock_(PR_NewLock()),
+      changed_(PR_NewCondVar(lock_)),
+      thread_(NULL),
+      stopping_(false),
+      grace_(grace),
+      last_operation_(0) {
+}
+
+GpgWatchdog::~GpgWatchdog() {
+  Stop();
+  PR_DestroyCondVar(changed_);
+  PR_DestroyLock(lock_);
+}
+
+PRInt32 GpgWatchdog::NewOperation(const void *owner) {
+  PR_Lock(lock_);
+  do {
+    last_operation_ = (last_operation_ + 1) & 0x7fffffff;
+  } while (last_operation_ == 0 ||
+           operations_.find(last_operation_) != operations_.end());
+  PRInt32 operation = last_operation_;
+  operations_[operation].owner = owner;
+  operations_[operation].canceled = false;
+  PR_Unlock(lock_);
+  return operation;
+}
+
+bool GpgWatchdog::Cancel(PRInt32 operation, const void *owner) {
+  PR_Lock(lock_);
+  std::map<PRInt32, Operation>::iterator it = operations_.find(operation);
+  if (it == operations_.end() || it->second.owner != owner) {
+    PR_Unlock(lock_);
+    return false;
+  }
+  it->second.canceled = true;
+  for (std::map<Target *, Watched>::iterator w = watched_.begin();
+       w != watched_.end(); ++w) {
+    if (w->second.operation == operation &&
+        w->second.interruption == kNOT_INTERRUPTED) {
+      Interrupt(w->first, &w->second, kCANCELED);
+    }
+  }
+  PR_Unlock(lock_);
+  return true;
+}
+
+void GpgWatchdog::CancelAll(const void *owner) {
+  PR_Lock(lock_);
+  for (std::map<PRInt32, Operation>::iterator it = operations_.begin();
+       it != operations_.end(); ++it) {
+    if (it->second.owner != owner || it->second.canceled) {
+      continue;
+    }
+    it->second.canceled = true;
+    for (std::map<Target *, Watched>::iterator w = watched_.begin();
+         w != watched_.end(); ++w) {
+      if (w->second.operation == it->first &&
+          w->second.interruption == kNOT_INTERRUPTED) {
+        Interrupt(w->first, &w->second, kCANCELED);
+      }
+    }
+  }
+  PR_Unlock(lock_);
+}
+
+bool GpgWatchdog::IsCanceled(PRInt32 operation) {
+  PR_Lock(lock_);
+  std::map<PRInt32, Operation>::const_iterator it =
+      operations_.find(operation);
+  bool canceled = it != operations_.end() && it->second.canceled;
+  PR_Unlock(lock_);
+  return canceled;
+}
+
+void GpgWatchdog::EndOperation(PRInt32 operation) {
+  PR_Lock(lock_);
+  operations_.erase(operation);
+  PR_Unlock(lock_);
+}
+
+static PRCallOnceType current_once;
+static PRUintn current_index;
+
+static PRStatus InitCurrentOperation() {
+  return PR_NewThreadPrivateIndex(&current_index, NULL);
+}
+
+PRInt32 GpgWatchdog::CurrentOperation() {
+  if (PR_CallOnce(&current_once, InitCurrentOperation) == PR_FAILURE) {
+    return 0;
+  }
+  return static_cast<PRInt32>(
+      reinterpret_cast<PRUptrdiff>(PR_GetThreadPrivate(current_index)));
+}
+
+void GpgWatchdog::SetCurrentOperation(PRInt32 operation) {
+  if (PR_CallOnce(&current_once, InitCurrentOperation) == PR_FAILURE) {
+    return;
+  }
+  PR_SetThreadPrivate(current_index,
+                      reinterpret_cast<void *>(
+                          static_cast<PRUptrdiff>(operation)));
+}
+
+void GpgWatchdog::Watch(Target *target, PRInt32 operation,
+                        PRIntervalTime timeout) {
+  Watched watched;
+  watched.operation = operation;
+  watched.start = PR_IntervalNow();
+  watched.timeout = timeout;
+  watched.interruption = kNOT_INTERRUPTED;
+  watched.interrupted_at = 0;
+  watched.forced = false;
+
+  PR_Lock(lock_);
+  Watched &added = watched_[target] = watched;
+  std::map<PRInt32, Operation>::const_iterator it =
+      operations_.find(operation);
+  if (it != operations_.end() && it->second.canceled) {
+    Interrupt(target, &added, kCANCELED);
+  }
+  if (timeout != PR_INTERVAL_NO_TIMEOUT) {
+    StartThread();
+  }
+  PR_NotifyCondVar(changed_);
+  PR_Unlock(lock_);
+}
+
+GpgWatchdog::Interruption GpgWatchdog::Unwatch(Target *target) {
+  Interruption interruption = kNOT_INTERRUPTED;
+  PR_Lock(lock_);
+  std::map<Target *, Watched>::iterator it = watched_.find(target);
+  if (it != watched_.end()) {
+    interruption = it->second.interruption;
+    watched_.erase(it);
+  }
+  PR_Unlock(lock_);
+  return interruption;
+}
+
+void GpgWatchdog::Stop() {
+  PR_Lock(lock_);
+  PRThread *thread = thread_;
+  stopping_ = true;
+  PR_NotifyCondVar(changed_);
+  PR_Unlock(lock_);
+  if (thread != NULL) {
+    PR_JoinThread(thread);
+  }
+  PR_Lock(lock_);
+  thread_ = NULL;
+  stopping_ = false;
+  PR_Unlock(lock_);
+}
+
+/* Called with |lock_| held. */
+void GpgWatchdog::Interrupt(Target *target, Watched *watched,
+                            Interruption why) {
+  LOG("GPG: Interrupting %s operation %d\n",
+      why == kTIMED_OUT ? "timed out" : "canceled",
+      static_cast<int>(watched->operation));
+  watched->interruption = why;
+  watched->interrupted_at = PR_IntervalNow();
+  target->Interrupt(false);
+  /* Have the thread see to the forced interruption. */
+  StartThread();
+  PR_NotifyCondVar(changed_);
+}
+
+/* Called with |lock_| held. */
+void GpgWatchdog::StartThread() {
+  if (thread_ != NULL || stopping_) {
+    return;
+  }
+  thread_ = PR_CreateThread(PR_SYSTEM_THREAD, Run, this, PR_PRIORITY_NORMAL,
+                            PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+  if (thread_ == NULL) {
+    LOG("GPG: PR_CreateThread failed: %d\n", PR_GetError());
+  }
+}
+
+void GpgWatchdog::Run(void *watchdog) {
+  static_cast<GpgWatchdog *>(watchdog)->RunLoop();
+}
+
+/*
+ * Sleeps until the next deadline, which is either a timeout running out or
+ * the grace period after an interruption. Interval times wrap around, so only
+ * differences between them are compared.
+ */
+void GpgWatchdog::RunLoop() {
+  PR_Lock(lock_);
+  while (!stopping_) {
+    PRIntervalTime now = PR_IntervalNow();
+    PRIntervalTime wait = PR_INTERVAL_NO_TIMEOUT;
+    for (std::map<Target *, Watched>::iterator it = watched_.begin();
+         it != watched_.end(); ++it) {
+      Watched &watched = it->second;
+      PRIntervalTime left;
+      if (watched.interruption == kNOT_INTERRUPTED) {
+        if (watched.timeout == PR_INTERVAL_NO_TIMEOUT) {
+          continue;
+        }
+        PRIntervalTime elapsed = now - watched.start;
+        if (elapsed >= watched.timeout) {
+          Interrupt(it->first, &watched, kTIMED_OUT);
+          left = grace_;
+        } else {
+          left = watched.timeout - elapsed;
+        }
+      } else if (!watched.forced) {
+        PRIntervalTime elapsed = now - watched.interrupted_at;
+        if (elapsed >= grace_) {
+          LOG("GPG: Forcibly interrupting operation %d\n",
+              static_cast<int>(watched.operation));
+          watched.forced = true;
+          it->first->Interrupt(true);
+          continue;
+        }
+        left = grace_ - elapsed;
+      } else {
+        continue;
+      }
+      if (left < wait) {
+        wait = left;
+      }
+    }
+    PR_WaitCondVar(changed_, wait);
+  }
+  PR_Unlock(lock_);
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+/*
+ * Deadlines and cancellation for the things the plugin waits on: gpg
+ * processes and gpg-agent connections.
+ *
+ * Every plugin call is an operation with a handle, which JavaScript can use
+ * to cancel it. While a call waits on something, that something is watched
+ * as a Target on behalf of the call's operation. If it takes longer than its
+ * timeout, or the operation is canceled, the target is interrupted, and if
+ * that doesn't end the wait it's interrupted again, forcibly, a little later.
+ */
+
+#ifndef _GPGPLUGIN_WATCHDOG_H_
+#define _GPGPLUGIN_WATCHDOG_H_
+
+#include <prinrval.h>
+#include <prtypes.h>
+
+#include <map>
+
+struct PRCondVar;
+struct PRLock;
+struct PRThread;
+
+class GpgWatchdog {
+ public:
+  enum Interruption {
+    kNOT_INTERRUPTED,
+    kTIMED_OUT,
+    kCANCELED
+  };
+
+  class Target {
+   public:
+    virtual ~Target() {}
+
+    /*
+     * Make whoever is waiting on the target stop waiting: ask gently first
+     * and with |force| the second time. Called with the watchdog's lock held,
+     * so it must neither block nor call back into the watchdog.
+     */
+    virtual void Interrupt(bool force) = 0;
+  };
+
+  /*
+   * Returns the watchdog shared by all plugin instances. Its thread is
+   * started the first time something is watched with a timeout.
+   */
+  static GpgWatchdog *Instance();
+
+  /* |grace| is how long a target has after the first interruption. */
+  explicit GpgWatchdog(PRIntervalTime grace);
+  ~GpgWatchdog();
+
+  /*
+   * Start an operation on behalf of |owner|. The handle returned is never 0,
+   * which stands for no operation.
+   */
+  PRInt32 NewOperation(const void *owner);
+
+  /*
+   * Cancel |operation| if it was started by |owner| and hasn't ended yet, and
+   * interrupt what it's waiting on. Returns whether there was such an
+   * operation.
+   */
+  bool Cancel(PRInt32 operation, const void *owner);
+
+  /* Cancel every operation of |owner| that hasn't ended yet. */
+  void CancelAll(const void *owner);
+
+  bool IsCanceled(PRInt32 operation);
+
+  void EndOperation(PRInt32 operation);
+
+  /* The operation the calling thread works on, or 0. */
+  static PRInt32 CurrentOperation();
+  static void SetCurrentOperation(PRInt32 operation);
+
+  /*
+   * Interrupt |target| if it's still watched after |timeout| (which may be
+   * PR_INTERVAL_NO_TIMEOUT) or when |operation| is canceled. A target watched
+   * for an operation that has already been canceled is interrupted right
+   * away.
+   */
+  void Watch(Target *target, PRInt32 operation, PRIntervalTime timeout);
+
+  /*
+   * Stop watching |target|, after which it's no longer touched. Returns why
+   * it was interrupted, if it was.
+   */
+  Interruption Unwatch(Target *target);
+
+  /*
+   * Stop the thread if it's running, and wait for it to exit. It's started
+   * again by the next Watch() with a timeout. Targets still watched are no
+   * longer interrupted when they time out until then.
+   */
+  void Stop();
+
+ private:
+  struct Operation {
+    const void *owner;
+    bool canceled;
+  };
+
+  struct Watched {
+    PRInt32 operation;
+    PRIntervalTime start;
+    PRIntervalTime timeout;
+    Interruption interruption;
+    PRIntervalTime interrupted_at;
+    bool forced;
+  };
+
+  static PRStatus CreateInstance();
+  static void PR_CALLBACK Run(void *watchdog);
+  void RunLoop();
+  void Interrupt(Target *target, Watched *watched, Interruption why);
+  void StartThread();
+
+  PRLock *lock_;
+  PRCondVar *changed_;
+  PRThread *thread_;
+  bool stopping_;
+  PRIntervalTime grace_;
+  PRInt32 last_operation_;
+  std::map<PRInt32, Operation> operations_;
+  std::map<Target *, Watched> watched_;
+
+  GpgWatchdog(const GpgWatchdog &);
+  GpgWatchdog &operator=(const GpgWatchdog &);
+};
+
+#endif  // _GPGPLUGIN_WATCHDOG_H_
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2010, Google Inc.
+ *
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is the GPG Browser Bridge.
+ *
+ * The Initial Developer of the Original Code is Google Inc.
+ *
+ * Portions created by the Initial Developer are Copyright (C) 2010
+ * the Initial Developer. All Rights Reserved.
+ *
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <gtest/gtest.h>
+#include <prcvar.h>
+#include <prinrval.h>
+#include <prlock.h>
+#include <prthread.h>
+
+#include "watchdog.h"
+
+namespace {
+
+/* Records how it has been interrupted. */
+class FakeTarget : public GpgWatchdog::Target {
+ public:
+  FakeTarget()
+      : lock_(PR_NewLock()),
+        interrupted_(PR_NewCondVar(lock_)),
+        gentle_(0),
+        forced_(0) {
+  }
+
+  ~FakeTarget() {
+    PR_DestroyCondVar(interrupted_);
+    PR_DestroyLock(lock_);
+  }
+
+  virtual void Interrupt(bool force) {
+    PR_Lock(lock_);
+    if (force) {
+      forced_++;
+    } else {
+      gentle_++;
+    }
+    PR_NotifyAllCondVar(interrupted_);
+    PR_Unlock(lock_);
+  }
+
+  /* Wait up to 10 seconds for |forced| forced interruptions. */
+  bool WaitForForced(int forced) {
+    PRIntervalTime timeout = PR_SecondsToInterval(10);
+    PRIntervalTime start = PR_IntervalNow();
+    PR_Lock(lock_);
+    while (forced_ < forced &&
+           static_cast<PRIntervalTime>(PR_IntervalNow() - start) < timeout) {
+      PR_WaitCondVar(interrupted_, timeout);
+    }
+    bool ok = forced_ >= forced;
+    PR_Unlock(lock_);
+    return ok;
+  }
+
+  int gentle() {
+    PR_Lock(lock_);
+    int gentle = gentle_;
+    PR_Unlock(lock_);
+    return gentle;
+  }
+
+  int forced() {
+    PR_Lock(lock_);
+    int forced = forced_;
+    PR_Unlock(lock_);
+    return forced;
+  }
+
+ private:
+  PRLock *lock_;
+  PRCondVar *interrupted_;
+  int gentle_;
+  int forced_;
+};
+
+TEST(GpgWatchdogTest, LeavesTargetAloneUntilTimeout) {
+  GpgWatchdog watchdog(PR_MillisecondsToInterval(10));
+  FakeTarget target;
+  watchdog.Watch(&target, 0, PR_SecondsToInterval(60));
+  PR_Sleep(PR_MillisecondsToInterval(50));
+  EXPECT_EQ(GpgWatchdog::kNOT_INTERRUPTED, watchdog.Unwatch(&target));
+  EXPECT_EQ(0, target.gentle());
+  EXPECT_EQ(0, target.forced());
+}
+
+/*
+ * A target that's still there after the grace period is interrupted again,
+ * forcibly.
+ */
+TEST(GpgWatchdogTest, InterruptsTimedOutTargetThenForcesIt) {
+  GpgWatchdog watchdog(PR_MillisecondsToInterval(20));
+  FakeTarget target;
+  watchdog.Watch(&target, 0, PR_MillisecondsToInterval(20));
+  ASSERT_TRUE(target.WaitForForced(1));
+  EXPECT_EQ(GpgWatchdog::kTIMED_OUT, watchdog.Unwatch(&target));
+  EXPECT_EQ(1, target.gentle());
+  EXPECT_EQ(1, target.forced());
+}
+
+TEST(GpgWatchdogTest, StartsAgainAfterStop) {
+  GpgWatchdog watchdog(PR_MillisecondsToInterval(20));
+  watchdog.Stop();
+  FakeTarget target;
+  watchdog.Watch(&target, 0, PR_SecondsToInterval(60));
+  watchdog.Stop();
+  EXPECT_EQ(GpgWatchdog::kNOT_INTERRUPTED, watchdog.Unwatch(&target));
+
+  FakeTarget later;
+  watchdog.Watch(&later, 0, PR_MillisecondsToInterval(20));
+  ASSERT_TRUE(later.WaitForForced(1));
+  EXPECT_EQ(GpgWatchdog::kTIMED_OUT, watchdog.Unwatch(&later));
+}
+
+TEST(GpgWatchdogTest, CancelInterruptsTargetsOfOperation) {
+  GpgWatchdog watchdog(PR_SecondsToInterval(60));
+  FakeTarget target, other;
+  int owner;
+  PRInt32 operation = watchdog.NewOperation(&owner);
+  PRInt32 other_operation = watchdog.NewOperation(&owner);
+  EXPECT_NE(0, operation);
+  EXPECT_NE(operation, other_operation);
+  watchdog.Watch(&target, operation, PR_INTERVAL_NO_TIMEOUT);
+  watchdog.Watch(&other, other_operation, PR_INTERVAL_NO_TIMEOUT);
+
+  EXPECT_TRUE(watchdog.Cancel(operation, &owner));
+  EXPECT_EQ(1, target.gentle());
+  EXPECT_TRUE(watchdog.IsCanceled(operation));
+  EXPECT_EQ(GpgWatchdog::kCANCELED, watchdog.Unwatch(&target));
+  EXPECT_EQ(0, other.gentle());
+  EXPECT_FALSE(watchdog.IsCanceled(other_operation));
+  EXPECT_EQ(GpgWatchdog::kNOT_INTERRUPTED, watchdog.Unwatch(&other));
+}
+
+TEST(GpgWatchdogTest, CancelAllCancelsOnlyOwnersOperations) {
+  GpgWatchdog watchdog(PR_SecondsToInterval(60));
+  FakeTarget target, other;
+  int owner, stranger;
+  PRInt32 first = watchdog.NewOperation(&owner);
+  PRInt32 second = watchdog.NewOperation(&owner);
+  PRInt32 strangers = watchdog.NewOperation(&stranger);
+  watchdog.Watch(&target, first, PR_INTERVAL_NO_TIMEOUT);
+  watchdog.Watch(&other, strangers, PR_INTERVAL_NO_TIMEOUT);
+
+  watchdog.CancelAll(&owner);
+  EXPECT_TRUE(watchdog.IsCanceled(first));
+  EXPECT_TRUE(watchdog.IsCanceled(second));
+  EXPECT_FALSE(watchdog.IsCanceled(strangers));
+  EXPECT_EQ(GpgWatchdog::kCANCELED, watchdog.Unwatch(&target));
+  EXPECT_EQ(GpgWatchdog::kNOT_INTERRUPTED, watchdog.Unwatch(&other));
+}
+
+TEST(GpgWatchdogTest, InterruptsTargetOfCanceledOperationRightAway) {
+  GpgWatchdog watchdog(PR_SecondsToInterval(60));
+  FakeTarget target;
+  int owner;
+  PRInt32 operation = watchdog.NewOperation(&owner);
+  EXPECT_TRUE(watchdog.Cancel(operation, &owner));
+  watchdog.Watch(&target, operation, PR_INTERVAL_NO_TIMEOUT);
+  EXPECT_EQ(1, target.gentle());
+  EXPECT_EQ(GpgWatchdog::kCANCELED, watchdog.Unwatch(&target));
+}
+
+/*
+ * Handles are small numbers, so web pages mustn't be able to cancel the
+ * operations of others by guessing them.
+ */
+TEST(GpgWatchdogTest, CancelsOnlyOwnOperationsThatHaventEnded) {
+  GpgWatchdog watchdog(PR_SecondsToInterval(60));
+  int owner, stranger;
+  PRInt32 operation = watchdog.NewOperation(&owner);
+  EXPECT_FALSE(watchdog.Cancel(operation, &stranger));
+  EXPECT_FALSE(watchdog.IsCanceled(operation));
+  watchdog.EndOperation(operation);
+  EXPECT_FALSE(watchdog.Cancel(operation, &owner));
+  EXPECT_FALSE(watchdog.Cancel(0, &owner));
+}
+
+}  /* namespace */
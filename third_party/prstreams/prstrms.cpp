@@ -48,6 +48,12 @@
 #include <ios>
 #include <new>
 
+#ifdef XP_UNIX
+#include <sys/uio.h>
+
+#include "private/pprio.h"
+#endif
+
 using std::ios_base;
 using std::iostream;
 using std::istream;
@@ -56,11 +62,14 @@ using std::ostream;
 using std::streambuf;
 using std::streamsize;
 
+// The largest amount handed to a single PR_Read() or PR_Write().
+static const streamsize kMaxIO = 1 << 30;
+
 
 PRfilebuf::PRfilebuf():
     _fd(NULL),
     _opened(false),
-    _allocated(false),
+    _buf_size(BUFSIZ),
     _unbuffered(false),
     _user_buf(false),
     _buf_base(NULL),
@@ -70,7 +79,7 @@ PRfilebuf::PRfilebuf():
 PRfilebuf::PRfilebuf(PRFileDesc *fd):
     _fd(fd),
     _opened(false),
-    _allocated(false),
+    _buf_size(BUFSIZ),
     _unbuffered(false),
     _user_buf(false),
     _buf_base(NULL),
@@ -80,7 +89,7 @@ PRfilebuf::PRfilebuf(PRFileDesc *fd):
 PRfilebuf::PRfilebuf(PRFileDesc *fd, char_type *ptr, streamsize len):
     _fd(fd),
     _opened(false),
-    _allocated(false),
+    _buf_size(BUFSIZ),
     _unbuffered(false),
     _user_buf(false),
     _buf_base(NULL),
@@ -97,9 +106,7 @@ PRfilebuf::~PRfilebuf()
     } else {
         sync();
     }
-    if (_allocated) {
-        delete _buf_base;
-    }
+    setb(NULL, NULL, false);
 }
 
 
@@ -194,9 +201,20 @@ streambuf *PRfilebuf::setbuf(char_type *ptr, streamsize len)
     if (!ptr || len <= 0) {
         _unbuffered = true;
     } else {
-        setb(ptr, ptr + len, false);
+        setb(ptr, ptr + len, true);
+    }
+
+    return this;
+}
+
+
+PRfilebuf *PRfilebuf::set_buffer_size(streamsize len)
+{
+    if (_buf_base != NULL || len <= 0) {
+        return NULL;
     }
 
+    _buf_size = len;
     return this;
 }
 
@@ -257,7 +275,7 @@ int PRfilebuf::sync()
             // Sockets can't seek; don't need this.
             PROffset64 avail;
             if ((avail = in_avail()) > 0) {
-                if (PR_Seek64(_fd, -avail, PR_SEEK_CUR) != -1) {
+                if (PR_Seek64(_fd, -avail, PR_SEEK_CUR) == -1) {
                     return traits_type::eof();
                 }
             }
@@ -338,18 +356,144 @@ streambuf::int_type PRfilebuf::overflow(int_type c)
 }
 
 
+streamsize PRfilebuf::xsgetn(char_type *ptr, streamsize len)
+{
+    streamsize done = 0;
+
+    while (done < len) {
+        streamsize avail = egptr() - gptr();
+        if (avail > 0) {
+            // Hand out what has been read ahead first.
+            streamsize count = len - done < avail ? len - done : avail;
+            memcpy(ptr + done, gptr(), count);
+            gbump(static_cast<int>(count));
+            done += count;
+        } else if (!_unbuffered && len - done < buffer_size()) {
+            // Read small amounts through the buffer, so that what is read
+            // beyond them is kept for the next call.
+            if (traits_type::eq_int_type(underflow(), traits_type::eof())) {
+                break;
+            }
+        } else {
+            if (_fd == NULL ||
+                    traits_type::eq_int_type(sync(), traits_type::eof())) {
+                break;
+            }
+            PRInt32 count = PR_Read(
+                _fd, ptr + done, len - done < kMaxIO ? len - done : kMaxIO);
+            if (count <= 0) {
+                break;
+            }
+            done += count;
+        }
+    }
+
+    return done;
+}
+
+
+streamsize PRfilebuf::xsputn(const char_type *ptr, streamsize len)
+{
+    if (!_unbuffered && len < buffer_size()) {
+        return streambuf::xsputn(ptr, len);
+    }
+
+    if (_fd == NULL) {
+        return 0;
+    }
+
+    // Anything read ahead has to be given back before writing.
+    if (gptr() != egptr() &&
+            traits_type::eq_int_type(sync(), traits_type::eof())) {
+        return 0;
+    }
+
+    // Write what is waiting in the put area together with ptr.
+    streamsize waiting = pptr() - pbase();
+    streamsize nout = write2(pbase(), waiting, ptr, len);
+    if (nout < waiting) {
+        if (nout > 0) {
+            pbump(static_cast<int>(-nout));
+            memmove(pbase(), pbase() + nout, waiting - nout);
+        }
+        return 0;
+    }
+
+    setp(pbase(), epptr());  // Empty put area.
+    return nout - waiting;
+}
+
+
+// Write len1 bytes at ptr1 followed by len2 bytes at ptr2, with a single
+// writev() where one can be done on _fd. Returns the number of bytes written,
+// which is less than len1 + len2 only on error.
+streamsize PRfilebuf::write2(
+    const char_type *ptr1, streamsize len1,
+    const char_type *ptr2, streamsize len2)
+{
+    streamsize done = 0;
+
+    if (len1 > 0 && len2 > 0 && len1 < kMaxIO && len2 < kMaxIO) {
+        PRDescType type = PR_GetDescType(_fd);
+        if (type == PR_DESC_SOCKET_TCP) {
+            PRIOVec iov[2] = {
+                { const_cast<char *>(ptr1), static_cast<int>(len1) },
+                { const_cast<char *>(ptr2), static_cast<int>(len2) },
+            };
+            PRInt32 count = PR_Writev(_fd, iov, 2, PR_INTERVAL_NO_TIMEOUT);
+            if (count > 0) {
+                done = count;
+            }
+#ifdef XP_UNIX
+        } else if ((type == PR_DESC_PIPE || type == PR_DESC_FILE) &&
+                   PR_GetLayersIdentity(_fd) == PR_NSPR_IO_LAYER) {
+            // NSPR only implements PR_Writev() for sockets. The descriptor
+            // may be non-blocking, in which case PR_Write() below waits for
+            // whatever writev() couldn't take.
+            struct iovec iov[2] = {
+                { const_cast<char *>(ptr1), static_cast<size_t>(len1) },
+                { const_cast<char *>(ptr2), static_cast<size_t>(len2) },
+            };
+            ssize_t count = writev(PR_FileDesc2NativeHandle(_fd), iov, 2);
+            if (count > 0) {
+                done = count;
+            }
+#endif
+        }
+    }
+
+    while (done < len1 + len2) {
+        const char_type *ptr = done < len1 ? ptr1 + done : ptr2 + (done - len1);
+        streamsize left = done < len1 ? len1 - done : len1 + len2 - done;
+        PRInt32 count = PR_Write(_fd, ptr, left < kMaxIO ? left : kMaxIO);
+        if (count <= 0) {
+            break;
+        }
+        done += count;
+    }
+
+    return done;
+}
+
+
 bool PRfilebuf::allocate()
 {
-    char_type *buf = new(nothrow) char_type[BUFSIZ];
+    char_type *buf = new(nothrow) char_type[_buf_size];
     if (buf == NULL) {
         return false;
     }
 
-    setb(buf, buf + BUFSIZ, true);
+    setb(buf, buf + _buf_size, false);
     return true;
 }
 
 
+streamsize PRfilebuf::buffer_size() const
+{
+    return _buf_base != NULL ? _buf_end - _buf_base : _buf_size;
+}
+
+
 void PRfilebuf::setb(char_type *buf_base, char_type *buf_end, bool user_buf)
 {
     if (_buf_base && !_user_buf) {
@@ -79,6 +79,10 @@ public:
     PRfilebuf *attach(PRFileDesc *fd);
     PRfilebuf *close();
 
+    // Use an internal buffer of len bytes instead of BUFSIZ. Like setbuf(),
+    // this must be done before the first read or write.
+    PRfilebuf *set_buffer_size(std::streamsize len);
+
 protected:
     virtual std::streambuf *setbuf(char_type *ptr, std::streamsize len);
     virtual pos_type seekoff(
@@ -94,15 +98,24 @@ protected:
     virtual int_type underflow();
     virtual int_type overflow(int_type c = traits_type::eof());
 
-    // TODO: Override pbackfail(), showmanyc(), uflow(), xsgetn(), and xsputn().
+    // Reads and writes that are at least as large as the buffer bypass it and
+    // go straight between the caller's memory and the file descriptor.
+    virtual std::streamsize xsgetn(char_type *ptr, std::streamsize len);
+    virtual std::streamsize xsputn(const char_type *ptr, std::streamsize len);
+
+    // TODO: Override pbackfail(), showmanyc() and uflow().
 
 private:
     bool allocate();
     void setb(char_type *buf_base, char_type *buf_end, bool user_buf);
+    std::streamsize buffer_size() const;
+    std::streamsize write2(
+                        const char_type *ptr1, std::streamsize len1,
+                        const char_type *ptr2, std::streamsize len2);
 
     PRFileDesc *_fd;
     bool _opened;
-    bool _allocated;
+    std::streamsize _buf_size;
     bool _unbuffered;
     bool _user_buf;
     char_type *_buf_base;